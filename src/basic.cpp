@@ -1,6 +1,10 @@
 #include <cmath>
+#include <cstring>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "basic.hpp"
 
@@ -28,9 +32,6 @@ ErrorCode LocationNetworkError::code() const
 // NetworkEndpoint::NetworkEndpoint() :
 //     _address(), _port() {}
 
-NetworkEndpoint::NetworkEndpoint(const NetworkEndpoint& other) :
-    _address(other._address), _port(other._port) {}
-
 NetworkEndpoint::NetworkEndpoint(const Address& address, TcpPort port) :
     _address(address), _port(port) {}
 
@@ -53,27 +54,197 @@ ostream& operator<<(ostream &out, const NetworkEndpoint &value)
 
 
 
+const size_t NodeId::Size;
+
+
+// Spread arbitrary id bytes to the full id size: independent FNV-1a lanes, each finished by a splitmix64 step
+static void HashIdBytes(const uint8_t *bytes, size_t size, uint8_t *target)
+{
+    for (size_t lane = 0; lane < NodeId::Size / sizeof(uint64_t); ++lane)
+    {
+        uint64_t hash = 14695981039346656037ULL ^ (lane + 1);
+        for (size_t idx = 0; idx < size; ++idx)
+            { hash = (hash ^ bytes[idx]) * 1099511628211ULL; }
+        hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+        hash ^= hash >> 31;
+        memcpy( target + lane * sizeof(uint64_t), &hash, sizeof(uint64_t) );
+    }
+}
+
+
+static int HexDigitValue(char digit)
+{
+    if (digit >= '0' && digit <= '9') { return digit - '0'; }
+    if (digit >= 'a' && digit <= 'f') { return digit - 'a' + 10; }
+    if (digit >= 'A' && digit <= 'F') { return digit - 'A' + 10; }
+    return -1;
+}
+
+
+NodeId::NodeId() :
+    _bytes() {}
+
+NodeId::NodeId(const char *text) :
+    NodeId( string(text) ) {}
+
+// Decode text of exactly 2 * NodeId::Size hex digits, returns false without a complete id otherwise
+static bool DecodeHexId(const char *text, size_t size, uint8_t *target)
+{
+    if ( size != 2 * NodeId::Size )
+        { return false; }
+    for (size_t idx = 0; idx < NodeId::Size; ++idx)
+    {
+        int high = HexDigitValue( text[2 * idx] );
+        int low  = HexDigitValue( text[2 * idx + 1] );
+        if (high < 0 || low < 0)
+            { return false; }
+        target[idx] = static_cast<uint8_t>( (high << 4) | low );
+    }
+    return true;
+}
+
+
+NodeId::NodeId(const string &text) :
+    _bytes()
+{
+    if ( ! DecodeHexId( text.data(), text.size(), _bytes.data() ) )
+        { HashIdBytes( reinterpret_cast<const uint8_t*>( text.data() ), text.size(), _bytes.data() ); }
+}
+
+
+NodeId NodeId::FromHex(const string &text)
+{
+    NodeId result;
+    if ( ! DecodeHexId( text.data(), text.size(), result._bytes.data() ) )
+        { throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Invalid node id of " + to_string( text.size() ) + " characters"); }
+    return result;
+}
+
+
+NodeId NodeId::FromBytes(const void *bytes, size_t size)
+{
+    if (size != Size)
+        { throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Invalid node id of " + to_string(size) + " bytes"); }
+    NodeId result;
+    memcpy( result._bytes.data(), bytes, Size );
+    return result;
+}
+
+
+const uint8_t* NodeId::data() const { return _bytes.data(); }
+size_t NodeId::size() const { return Size; }
+
+size_t NodeId::hash() const
+{
+    size_t result;
+    memcpy( &result, _bytes.data(), sizeof(result) );
+    return result;
+}
+
+
+string NodeId::ToHex() const
+{
+    static const char HexDigits[] = "0123456789abcdef";
+    string result;
+    result.reserve(2 * Size);
+    for (uint8_t byte : _bytes)
+    {
+        result.push_back( HexDigits[byte >> 4] );
+        result.push_back( HexDigits[byte & 0x0F] );
+    }
+    return result;
+}
+
+
+bool NodeId::operator==(const NodeId& other) const
+    { return memcmp( _bytes.data(), other._bytes.data(), Size ) == 0; }
+
+bool NodeId::operator!=(const NodeId& other) const
+    { return ! operator==(other); }
+
+bool NodeId::operator<(const NodeId& other) const
+    { return memcmp( _bytes.data(), other._bytes.data(), Size ) < 0; }
+
+
+ostream& operator<<(ostream &out, const NodeId &value)
+    { return out << value.ToHex(); }
+
+
+
+const size_t IpAddress::MaxSize;
+
+IpAddress::IpAddress() :
+    _bytes(), _family(Family::Unspecified) {}
+
+
+IpAddress IpAddress::FromBytes(const void *bytes, size_t size)
+{
+    IpAddress result;
+    if (size == 4)
+        { result._family = Family::V4; }
+    else if (size == MaxSize)
+        { result._family = Family::V6; }
+    else if (size != 0)
+        { throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Invalid bytearray length of IP address: " + to_string(size) ); }
+    
+    if (size != 0)
+        { memcpy( result._bytes.data(), bytes, size ); }
+    return result;
+}
+
+
+IpAddress::Family IpAddress::family() const { return _family; }
+bool IpAddress::empty() const { return _family == Family::Unspecified; }
+const uint8_t* IpAddress::data() const { return _bytes.data(); }
+
+size_t IpAddress::size() const
+{
+    switch (_family)
+    {
+        case Family::V4: return 4;
+        case Family::V6: return MaxSize;
+        default:         return 0;
+    }
+}
+
+
+bool IpAddress::operator==(const IpAddress& other) const
+{
+    return _family == other._family &&
+           memcmp( _bytes.data(), other._bytes.data(), size() ) == 0;
+}
+
+bool IpAddress::operator!=(const IpAddress& other) const
+    { return ! operator==(other); }
+
+
+ostream& operator<<(ostream &out, const IpAddress &value)
+    { return out << value.ToString(); }
+
+
+
 // NodeContact::NodeContact() {}
     
-NodeContact::NodeContact(const NodeContact& other) :
-    _address(other._address), _nodePort(other._nodePort), _clientPort(other._clientPort) {}
+NodeContact::NodeContact(const IpAddress& address, TcpPort nodePort, TcpPort clientPort) :
+    _address(address), _nodePort(nodePort), _clientPort(clientPort) {}
 
 NodeContact::NodeContact(const Address& address, TcpPort nodePort, TcpPort clientPort) :
-    _address(address), _nodePort(nodePort), _clientPort(clientPort) {}
+    _address( IpAddress::FromString(address) ), _nodePort(nodePort), _clientPort(clientPort) {}
 
 
-const Address& NodeContact::address() const { return _address; }
+const IpAddress& NodeContact::address() const { return _address; }
 TcpPort NodeContact::nodePort() const { return _nodePort; }
 TcpPort NodeContact::clientPort() const { return _clientPort; }
 
 NetworkEndpoint NodeContact::nodeEndpoint() const
-    { return NetworkEndpoint(_address, _nodePort); }
+    { return NetworkEndpoint( _address.ToString(), _nodePort ); }
 
 NetworkEndpoint NodeContact::clientEndpoint() const
-    { return NetworkEndpoint(_address, _clientPort); }
+    { return NetworkEndpoint( _address.ToString(), _clientPort ); }
 
 
-void NodeContact::address(const Address& address)
+void NodeContact::address(const IpAddress& address)
     { _address = address; }
 
 bool NodeContact::operator==(const NodeContact& other) const
@@ -93,9 +264,6 @@ ostream& operator<<(ostream &out, const NodeContact &value)
 
 
 
-GpsLocation::GpsLocation(const GpsLocation &other) :
-    _latitude( other.latitude() ), _longitude( other.longitude() ) {}
-    
 GpsLocation::GpsLocation(GpsCoordinate latitude, GpsCoordinate longitude) :
     _latitude(latitude), _longitude(longitude)
     { Validate(); }
@@ -130,11 +298,8 @@ std::ostream& operator<<(std::ostream& out, const GpsLocation &value)
 
 ServiceInfo::ServiceInfo() : _type(), _port(0), _customData() {}
 
-ServiceInfo::ServiceInfo(const ServiceInfo& other) :
-    _type(other._type), _port(other._port), _customData(other._customData) {}
-
-ServiceInfo::ServiceInfo(std::string type, TcpPort port, const string& customData) :
-    _type(type), _port(port), _customData(customData) {}
+ServiceInfo::ServiceInfo(string type, TcpPort port, string customData) :
+    _type( move(type) ), _port(port), _customData( move(customData) ) {}
 
 const std::string& ServiceInfo::type() const { return _type; }
 TcpPort ServiceInfo::port() const { return _port; }
@@ -155,13 +320,17 @@ std::ostream& operator<<(std::ostream& out, const ServiceInfo &value)
 
 
 
-NodeInfo::NodeInfo(const NodeInfo& other) :
-    _id(other._id), _location(other._location), _contact(other._contact),
-    _services(other._services) {}
+shared_ptr<const string> NodeInfoEncoding::bytes() const
+    { return atomic_load(&_bytes); }
+
+void NodeInfoEncoding::bytes(shared_ptr<const string> value)
+    { atomic_store(&_bytes, value); }
+
+
 
 NodeInfo::NodeInfo( const NodeId &id, const GpsLocation &location,
-                    const NodeContact &contact, const Services &services ) :
-    _id(id), _location(location), _contact(contact), _services(services) {}
+                    const NodeContact &contact, Services services ) :
+    _id(id), _location(location), _contact(contact), _services( move(services) ) {}
 
 
 const NodeId&       NodeInfo::id()       const { return _id; }
@@ -169,8 +338,20 @@ const GpsLocation&  NodeInfo::location() const { return _location; }
 const NodeContact&  NodeInfo::contact()  const { return _contact; }
 const NodeInfo::Services& NodeInfo::services() const { return _services; }
 
-NodeContact& NodeInfo::contact() { return _contact; }
-NodeInfo::Services& NodeInfo::services() { return _services; }
+NodeContact& NodeInfo::contact()
+{
+    _encoding.reset();
+    return _contact;
+}
+
+NodeInfo::Services& NodeInfo::services()
+{
+    _encoding.reset();
+    return _services;
+}
+
+const shared_ptr<NodeInfoEncoding>& NodeInfo::encoding() const { return _encoding; }
+void NodeInfo::encoding(shared_ptr<NodeInfoEncoding> value) { _encoding = value; }
 
 bool NodeInfo::operator==(const NodeInfo& other) const
 {
@@ -192,4 +373,65 @@ std::ostream& operator<<(std::ostream& out, const NodeInfo &value)
 
 
 
+const size_t Diagnostics::SubsystemCount;
+const DiagnosticLevel Diagnostics::DefaultLevel;
+
+atomic<uint8_t> Diagnostics::_levels[SubsystemCount] = {
+    { static_cast<uint8_t>(DefaultLevel) }, { static_cast<uint8_t>(DefaultLevel) },
+    { static_cast<uint8_t>(DefaultLevel) }, { static_cast<uint8_t>(DefaultLevel) } };
+
+
+DiagnosticLevel Diagnostics::level(LogSubsystem subsystem)
+{
+    return static_cast<DiagnosticLevel>(
+        _levels[ static_cast<size_t>(subsystem) ].load(memory_order_relaxed) );
+}
+
+void Diagnostics::level(LogSubsystem subsystem, DiagnosticLevel level)
+{
+    _levels[ static_cast<size_t>(subsystem) ].store(
+        static_cast<uint8_t>(level), memory_order_relaxed );
+}
+
+
+void Diagnostics::Configure(const string &settings)
+{
+    static const unordered_map<string, vector<LogSubsystem>> subsystemNames {
+        { "network",    { LogSubsystem::Network } },
+        { "messaging",  { LogSubsystem::Messaging } },
+        { "node",       { LogSubsystem::Node } },
+        { "database",   { LogSubsystem::Database } },
+        { "all",        { LogSubsystem::Network, LogSubsystem::Messaging, LogSubsystem::Node, LogSubsystem::Database } },
+    };
+    static const unordered_map<string, DiagnosticLevel> levelNames {
+        { "trace",  DiagnosticLevel::Trace },
+        { "debug",  DiagnosticLevel::Debug },
+        { "off",    DiagnosticLevel::Off },
+    };
+    
+    vector< pair<LogSubsystem, DiagnosticLevel> > newLevels;
+    istringstream settingStream(settings);
+    string setting;
+    while ( getline(settingStream, setting, ',') )
+    {
+        if ( setting.empty() )
+            { continue; }
+        
+        size_t separatorPos = setting.find(':');
+        auto subsystemIt = subsystemNames.find( setting.substr(0, separatorPos) );
+        auto levelIt = separatorPos == string::npos ? levelNames.end() :
+            levelNames.find( setting.substr(separatorPos + 1) );
+        if ( subsystemIt == subsystemNames.end() || levelIt == levelNames.end() )
+            { throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Invalid diagnostic setting: " + setting); }
+        
+        for (LogSubsystem subsystem : subsystemIt->second)
+            { newLevels.emplace_back(subsystem, levelIt->second); }
+    }
+    
+    for (auto const &newLevel : newLevels)
+        { level(newLevel.first, newLevel.second); }
+}
+
+
+
 } // namespace LocNet
@@ -1,9 +1,13 @@
 #ifndef __LOCNET_BASIC_TYPES_H__
 #define __LOCNET_BASIC_TYPES_H__
 
+#include <array>
+#include <atomic>
 #include <exception>
 #include <functional>
 #include <iostream>
+#include <memory>
+#include <string>
 #include <unordered_map>
 
 
@@ -16,7 +20,6 @@ namespace LocNet
 typedef float       GpsCoordinate;
 typedef float       Distance;
 
-typedef std::string NodeId;
 typedef std::string Address;
 typedef uint16_t    TcpPort;
 
@@ -36,6 +39,7 @@ enum class ErrorCode : uint16_t
     // Problems with outgoing messages
     ERROR_CONNECTION = 96,          // Failed to connect to another peer
     ERROR_BAD_RESPONSE = 97,        // Consumed service (i.e. remote network node) returned unexpected response message
+    ERROR_TIMEOUT = 98,             // Consumed service did not respond until the deadline of the request
     
     // Problems inside the server 
     ERROR_INTERNAL = 128,           // Implementation problem: this shouldn't happen, we are not well propared for this error.
@@ -57,6 +61,93 @@ public:
 
 
 
+// Identifier of a node, i.e. the SHA256 hash of its public key, kept as 32 raw bytes in memory
+// and in the database, but sent to other nodes as text of 64 hex digits.
+// Text ids are adapted explicitly: 64 hex digits are decoded, anything else
+// (e.g. readable ids of tests) is mapped to 32 bytes by hashing it.
+class NodeId
+{
+public:
+    
+    static const size_t Size = 32;
+    
+private:
+    
+    std::array<uint8_t, Size> _bytes;
+    
+public:
+    
+    NodeId();
+    explicit NodeId(const std::string &text);
+    explicit NodeId(const char *text);
+    
+    // For ids received from other nodes: takes exactly 64 hex digits, throws for anything else
+    static NodeId FromHex(const std::string &text);
+    // For ids loaded from the database: takes exactly 32 raw bytes, throws for anything else
+    static NodeId FromBytes(const void *bytes, size_t size);
+    
+    const uint8_t* data() const;
+    size_t size() const;
+    
+    // Bytes of a hash are uniformly distributed already, no need to hash them again
+    size_t hash() const;
+    std::string ToHex() const;
+    
+    bool operator==(const NodeId &other) const;
+    bool operator!=(const NodeId &other) const;
+    bool operator< (const NodeId &other) const;
+};
+
+std::ostream& operator<<(std::ostream& out, const NodeId &value);
+
+
+
+// Binary form of an IP address as stored in node contacts and sent in messages.
+// Text form is produced only for logging and connecting, i.e. to resolve an endpoint.
+class IpAddress
+{
+public:
+    
+    enum class Family : uint8_t
+    {
+        Unspecified = 0,    // Not known yet, e.g. before detecting the external address
+        V4          = 4,
+        V6          = 6,
+    };
+    
+    static const size_t MaxSize = 16;
+    
+private:
+    
+    std::array<uint8_t, MaxSize> _bytes;
+    Family                        _family;
+    
+public:
+    
+    IpAddress();
+    
+    // Throws if size matches no address family
+    static IpAddress FromBytes(const void *bytes, size_t size);
+    
+    Family family() const;
+    bool empty() const;
+    
+    // Raw bytes in network order, 4 for V4, 16 for V6 and none for unspecified addresses
+    const uint8_t* data() const;
+    size_t size() const;
+    
+    bool operator==(const IpAddress &other) const;
+    bool operator!=(const IpAddress &other) const;
+    
+    // NOTE Following functions are implemented in network.cpp as being library-specific (currently with asio)
+    static IpAddress FromString(const Address &address);
+    Address ToString() const;
+};
+
+std::ostream& operator<<(std::ostream& out, const IpAddress &value);
+
+
+
 // Data holder class for a network endpoint to connect to.
 class NetworkEndpoint
 {
@@ -65,7 +156,10 @@ class NetworkEndpoint
     
 public:
     
-    NetworkEndpoint(const NetworkEndpoint &other);
+    NetworkEndpoint(const NetworkEndpoint &other) = default;
+    NetworkEndpoint(NetworkEndpoint &&other) = default;
+    NetworkEndpoint& operator=(const NetworkEndpoint &other) = default;
+    NetworkEndpoint& operator=(NetworkEndpoint &&other) = default;
     NetworkEndpoint(const Address &address, TcpPort port);
     
     Address address() const;
@@ -85,33 +179,31 @@ std::ostream& operator<<(std::ostream& out, const NetworkEndpoint &value);
 // Data holder class for contact data of a single (remote) node of the network to be advertised.
 class NodeContact
 {
-    Address     _address;
+    IpAddress   _address;
     TcpPort     _nodePort;
     TcpPort     _clientPort;
 
 public:
     
-    NodeContact(const NodeContact &other);
+    NodeContact(const NodeContact &other) = default;
+    NodeContact(NodeContact &&other) = default;
+    NodeContact& operator=(const NodeContact &other) = default;
+    NodeContact& operator=(NodeContact &&other) = default;
+    NodeContact(const IpAddress &address, TcpPort nodePort, TcpPort clientPort);
+    // Throws if the address is not a valid IP address in text form
     NodeContact(const Address &address, TcpPort nodePort, TcpPort clientPort);
     
-    const Address& address() const;
+    const IpAddress& address() const;
     TcpPort nodePort() const;
     TcpPort clientPort() const;
     
     NetworkEndpoint nodeEndpoint() const;
     NetworkEndpoint clientEndpoint() const;
     
-    void address(const Address &address);
+    void address(const IpAddress &address);
     
     bool operator==(const NodeContact &other) const;
     bool operator!=(const NodeContact &other) const;
-    
-    // NOTE Following functions are implemented in network.cpp as being library-specific (currently with asio)
-    // TODO consider splitting class into an interface here and an implementation in network
-    static Address AddressFromBytes(const std::string &bytes);
-    static std::string AddressToBytes(const Address &address);
-    
-    std::string AddressBytes() const;
 };
 
 std::ostream& operator<<(std::ostream& out, const NodeContact &value);
@@ -128,7 +220,10 @@ class GpsLocation
     
 public:
     
-    GpsLocation(const GpsLocation &other);
+    GpsLocation(const GpsLocation &other) = default;
+    GpsLocation(GpsLocation &&other) = default;
+    GpsLocation& operator=(const GpsLocation &other) = default;
+    GpsLocation& operator=(GpsLocation &&other) = default;
     GpsLocation(GpsCoordinate latitude, GpsCoordinate longitude);
     
     GpsCoordinate latitude() const;
@@ -179,8 +274,12 @@ class ServiceInfo
 public:
     
     ServiceInfo(); // Required to be a value in a map
-    ServiceInfo(const ServiceInfo &other);
-    ServiceInfo( std::string type, TcpPort port, const std::string &customData = std::string() );
+    ServiceInfo(const ServiceInfo &other) = default;
+    ServiceInfo(ServiceInfo &&other) = default;
+    ServiceInfo& operator=(const ServiceInfo &other) = default;
+    ServiceInfo& operator=(ServiceInfo &&other) = default;
+    // Strings are taken by value to be moved in from temporaries
+    ServiceInfo( std::string type, TcpPort port, std::string customData = std::string() );
     
     const std::string& type() const;
     TcpPort port() const;
@@ -194,6 +293,21 @@ std::ostream& operator<<(std::ostream& out, const ServiceInfo &value);
 
 
 
+// Encoded form of a node info to be sent, e.g. a serialized protobuf message. It is built on first use
+// and shared by all copies of the node info it is attached to. The database attaches the same instance
+// to the copies it hands out of a cached entry until the entry changes, so those are encoded only once.
+class NodeInfoEncoding
+{
+    std::shared_ptr<const std::string> _bytes;
+    
+public:
+    
+    std::shared_ptr<const std::string> bytes() const;
+    void bytes(std::shared_ptr<const std::string> value);
+};
+
+
+
 // Data holder class for complete node information exposed to the network,
 // including node identity, network contact and position.
 // TODO will we also need a public key here later as part of the identity?
@@ -210,20 +324,30 @@ private:
     NodeContact _contact;
     Services    _services;
     
+    std::shared_ptr<NodeInfoEncoding> _encoding; // Not part of the value, missing unless attached
+    
 public:
     
-    NodeInfo(const NodeInfo &other);
+    NodeInfo(const NodeInfo &other) = default;
+    NodeInfo(NodeInfo &&other) = default;
+    NodeInfo& operator=(const NodeInfo &other) = default;
+    NodeInfo& operator=(NodeInfo &&other) = default;
+    // Services are taken by value to be moved in from temporaries, e.g. when loaded from the database
     NodeInfo( const NodeId &id, const GpsLocation &location, const NodeContact &contact,
-              const Services &services );
+              Services services );
     
     const NodeId& id() const;
     const GpsLocation& location() const;
     const NodeContact& contact() const;
     const Services& services() const;
     
+    // NOTE the value may be changed through these, so they drop the attached encoding
     Services& services();
     NodeContact& contact();
     
+    const std::shared_ptr<NodeInfoEncoding>& encoding() const;
+    void encoding(std::shared_ptr<NodeInfoEncoding> value);
+    
     bool operator==(const NodeInfo &other) const;
     bool operator!=(const NodeInfo &other) const;
 };
@@ -265,7 +389,93 @@ struct scope_success : public scope_exit
 
 
 
+// Read-mostly value shared between threads. Readers get an immutable snapshot without
+// waiting for each other, writers publish a complete new copy replacing the old one atomically.
+template <typename T>
+class SharedSnapshot
+{
+    std::shared_ptr<const T> _current;
+    
+public:
+    
+    explicit SharedSnapshot(const T &value) :
+        _current( new T(value) ) {}
+    
+    std::shared_ptr<const T> Load() const
+        { return std::atomic_load(&_current); }
+    void Store(const T &value)
+        { std::atomic_store( &_current, std::shared_ptr<const T>( new T(value) ) ); }
+};
+
+
+
+// Parts of the server with separately switchable diagnostic logging
+enum class LogSubsystem : uint8_t
+{
+    Network     = 0,    // Connections, message channels and sessions
+    Messaging   = 1,    // Request dispatching and protobuf conversions
+    Node        = 2,    // Building and maintaining the network
+    Database    = 3,    // Spatial database of known nodes
+};
+
+// Most verbose diagnostic level still logged, more severe levels (e.g. INFO) are always logged
+enum class DiagnosticLevel : uint8_t
+{
+    Trace   = 0,
+    Debug   = 1,
+    Off     = 2,
+};
+
+
+// Runtime switches for trace and debug logging of subsystems. Use the LOG_TRACE and LOG_DEBUG macros
+// below instead of LOG(TRACE) and LOG(DEBUG): for disabled levels the whole statement is skipped,
+// so message arguments (e.g. text formatting of protobuf messages) are not even evaluated.
+class Diagnostics
+{
+    static const size_t SubsystemCount = 4;
+    static std::atomic<uint8_t> _levels[SubsystemCount];
+    
+public:
+    
+    static const DiagnosticLevel DefaultLevel = DiagnosticLevel::Debug;
+    
+    static bool IsEnabled(LogSubsystem subsystem, DiagnosticLevel level)
+    {
+        return static_cast<uint8_t>(level) >=
+            _levels[ static_cast<size_t>(subsystem) ].load(std::memory_order_relaxed);
+    }
+    
+    static DiagnosticLevel level(LogSubsystem subsystem);
+    static void level(LogSubsystem subsystem, DiagnosticLevel level);
+    
+    // Apply a comma separated list of subsystem:level settings, e.g. "network:trace,database:off".
+    // Subsystem "all" sets every subsystem. Nothing is changed if any of the settings is invalid.
+    static void Configure(const std::string &settings);
+};
+
+#define LOG_TRACE(subsystem) \
+    if ( ! ::LocNet::Diagnostics::IsEnabled( ::LocNet::LogSubsystem::subsystem, ::LocNet::DiagnosticLevel::Trace ) ) {} \
+    else LOG(TRACE)
+
+#define LOG_DEBUG(subsystem) \
+    if ( ! ::LocNet::Diagnostics::IsEnabled( ::LocNet::LogSubsystem::subsystem, ::LocNet::DiagnosticLevel::Debug ) ) {} \
+    else LOG(DEBUG)
+
+
+
 } // namespace LocNet
 
 
+
+namespace std
+{
+    template<>
+    struct hash<LocNet::NodeId>
+    {
+        size_t operator()(const LocNet::NodeId &id) const
+            { return id.hash(); }
+    };
+}
+
+
 #endif // __LOCNET_BASIC_TYPES_H__
@@ -105,11 +105,16 @@ static const string DEFAULT_NODE_PORT   = to_string(DefaultNodePort);
 static const string DEFAULT_CLIENT_PORT = to_string(DefaultClientPort);
 static const string DEFAULT_LOCAL_PORT  = to_string(DefaultLocalPort);
 static const string DEFAULT_LOCAL_DEVICE= "localhost";
+static const string DEFAULT_THREADS     = "4";
+static const string DEFAULT_CORES       = "0";
+static const string DEFAULT_WORKERS     = "8";
+static const string DEFAULT_PIPELINE    = "1";
 
 static const string DESC_OPTIONAL_DEFAULT = "Optional, default value: ";
 static const string DEFAULT_CONFIG_FILE = GetApplicationDataDirectory() + "iop-locnet.cfg";
 static const string DEFAULT_DBPATH      = GetApplicationDataDirectory() + "locnet.sqlite";
 static const string DEFAULT_LOGPATH     = GetApplicationDataDirectory() + "debug.log";
+static const string DEFAULT_DIAGNOSTICS = "";
 //const string DBFILE_PATH = ":memory:"; // NOTE in-memory storage without a db file
 //const string DBFILE_PATH = "file:locnet.sqlite"; // NOTE this may be any file URL
 
@@ -126,9 +131,14 @@ static const char *OPTNAME_LOCAL_PORT   = "--localport";
 static const char *OPTNAME_LATITUDE     = "--latitude";
 static const char *OPTNAME_LONGITUDE    = "--longitude";
 static const char *OPTNAME_SEEDNODE     = "--seednode";
+static const char *OPTNAME_THREADS      = "--threads";
+static const char *OPTNAME_CORES        = "--cores";
+static const char *OPTNAME_WORKERS      = "--workers";
+static const char *OPTNAME_PIPELINE     = "--pipeline";
 
 static const char *OPTNAME_DBPATH       = "--dbpath";
 static const char *OPTNAME_LOGPATH      = "--logpath";
+static const char *OPTNAME_DIAGNOSTICS  = "--diagnostics";
 static const char *OPTNAME_TESTMODE     = "--test";
 
 static const vector<NetworkEndpoint> DefaultSeedNodes {
@@ -181,9 +191,22 @@ bool EzParserConfig::Initialize(int argc, const char *argv[])
         "as real number from range (-180,180)", OPTNAME_LONGITUDE);
     _optParser.add("", false, 1, 0, "Host name of seed node to be used instead of default seeds. "
         "You can repeat this option to define multiple custom seed nodes.", OPTNAME_SEEDNODE);
+    _optParser.add(DEFAULT_THREADS.c_str(), false, 1, 0, ( "Number of threads serving network connections. " +
+        DESC_OPTIONAL_DEFAULT + DEFAULT_THREADS ).c_str(), OPTNAME_THREADS);
+    _optParser.add(DEFAULT_CORES.c_str(), false, 1, 0, ( "Number of cores serving node and client ports "
+        "in thread-per-core mode, each with its own acceptor and connections. Zero disables this mode. " +
+        DESC_OPTIONAL_DEFAULT + DEFAULT_CORES ).c_str(), OPTNAME_CORES);
+    _optParser.add(DEFAULT_WORKERS.c_str(), false, 1, 0, ( "Number of worker threads serving requests "
+        "separately for each interface. " + DESC_OPTIONAL_DEFAULT + DEFAULT_WORKERS ).c_str(), OPTNAME_WORKERS);
+    _optParser.add(DEFAULT_PIPELINE.c_str(), false, 1, 0, ( "Number of requests read ahead and served concurrently "
+        "on a single node or client connection. " + DESC_OPTIONAL_DEFAULT + DEFAULT_PIPELINE ).c_str(), OPTNAME_PIPELINE);
     
     _optParser.add(DEFAULT_LOGPATH.c_str(), false, 1, 0, ( "Path to log file. " +
         DESC_OPTIONAL_DEFAULT + DEFAULT_LOGPATH ).c_str(), OPTNAME_LOGPATH);
+    _optParser.add(DEFAULT_DIAGNOSTICS.c_str(), false, 1, 0, "Comma separated list of subsystem:level pairs "
+        "to change diagnostic logging, e.g. network:trace,database:off. Subsystems are network, messaging, "
+        "node, database or all, levels are trace, debug or off. Optional, by default debug level is logged.",
+        OPTNAME_DIAGNOSTICS);
     _optParser.add(DEFAULT_DBPATH.c_str(), false, 1, 0, ( "Path to db file. " +
         DESC_OPTIONAL_DEFAULT + DEFAULT_DBPATH ).c_str(), OPTNAME_DBPATH);
     
@@ -229,11 +252,14 @@ bool EzParserConfig::Initialize(int argc, const char *argv[])
     
     // Fetch extracted option values from parser
     _versionRequested = _optParser.isSet(OPTNAME_VERSION);
-    _optParser.get(OPTNAME_NODEID)->getString(_nodeId);
+    string nodeId;
+    _optParser.get(OPTNAME_NODEID)->getString(nodeId);
+    _nodeId = NodeId(nodeId);
     _optParser.get(OPTNAME_HOST)->getString(_ipAddr);
     _optParser.get(OPTNAME_LATITUDE)->getFloat(_latitude);
     _optParser.get(OPTNAME_LONGITUDE)->getFloat(_longitude);
     _optParser.get(OPTNAME_LOGPATH)->getString(_logPath);
+    _optParser.get(OPTNAME_DIAGNOSTICS)->getString(_diagnostics);
     _optParser.get(OPTNAME_DBPATH)->getString(_dbPath);
     
     unsigned long nodePort;
@@ -250,6 +276,37 @@ bool EzParserConfig::Initialize(int argc, const char *argv[])
     _optParser.get(OPTNAME_LOCAL_PORT)->getULong(localPort);
     _localEndpoint = NetworkEndpoint(localDevice,localPort);
     
+    unsigned long reactorThreadCount;
+    _optParser.get(OPTNAME_THREADS)->getULong(reactorThreadCount);
+    if (reactorThreadCount == 0)
+    {
+        cerr << "Option " << OPTNAME_THREADS << " must be a positive number" << endl;
+        return false;
+    }
+    _reactorThreadCount = reactorThreadCount;
+    
+    unsigned long reactorCoreCount;
+    _optParser.get(OPTNAME_CORES)->getULong(reactorCoreCount);
+    _reactorCoreCount = reactorCoreCount;
+    
+    unsigned long dispatchWorkerCount;
+    _optParser.get(OPTNAME_WORKERS)->getULong(dispatchWorkerCount);
+    if (dispatchWorkerCount == 0)
+    {
+        cerr << "Option " << OPTNAME_WORKERS << " must be a positive number" << endl;
+        return false;
+    }
+    _dispatchWorkerCount = dispatchWorkerCount;
+    
+    unsigned long pipelinedRequestCount;
+    _optParser.get(OPTNAME_PIPELINE)->getULong(pipelinedRequestCount);
+    if (pipelinedRequestCount == 0)
+    {
+        cerr << "Option " << OPTNAME_PIPELINE << " must be a positive number" << endl;
+        return false;
+    }
+    _pipelinedRequestCount = pipelinedRequestCount;
+    
     _myNodeInfo.reset( new NodeInfo( _nodeId, GpsLocation(_latitude, _longitude),
         NodeContact(_ipAddr, _nodePort, _clientPort), {} ) );
     
@@ -277,6 +334,9 @@ bool EzParserConfig::versionRequested() const
 const string& EzParserConfig::logPath() const
     { return _logPath; }    
 
+const string& EzParserConfig::diagnostics() const
+    { return _diagnostics; }
+
 const string& EzParserConfig::dbPath() const
     { return _dbPath; }
 
@@ -289,6 +349,18 @@ const vector<NetworkEndpoint>& EzParserConfig::seedNodes() const
 size_t EzParserConfig::neighbourhoodTargetSize() const
     { return isTestMode() ? 3 : NEIGHBOURHOOD_TARGET_SIZE; }
 
+size_t EzParserConfig::reactorThreadCount() const
+    { return _reactorThreadCount; }
+
+size_t EzParserConfig::reactorCoreCount() const
+    { return _reactorCoreCount; }
+
+size_t EzParserConfig::dispatchWorkerCount() const
+    { return _dispatchWorkerCount; }
+
+size_t EzParserConfig::pipelinedRequestCount() const
+    { return _pipelinedRequestCount; }
+
 const NetworkEndpoint& EzParserConfig::localServiceEndpoint() const
     { return _localEndpoint; }
 
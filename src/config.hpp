@@ -33,11 +33,16 @@ public:
     virtual const NetworkEndpoint& localServiceEndpoint() const = 0;
     
     virtual const std::string& logPath() const = 0;
+    virtual const std::string& diagnostics() const = 0; // Subsystem diagnostic levels, see Diagnostics::Configure()
     virtual const std::string& dbPath() const = 0;
     
     virtual bool isTestMode() const = 0;
     virtual const std::vector<NetworkEndpoint>& seedNodes() const = 0;
     virtual size_t neighbourhoodTargetSize() const = 0;
+    virtual size_t reactorThreadCount() const = 0;
+    virtual size_t reactorCoreCount() const = 0; // Zero if thread-per-core mode is disabled
+    virtual size_t dispatchWorkerCount() const = 0;
+    virtual size_t pipelinedRequestCount() const = 0; // Requests served concurrently on a connection
     
     virtual std::chrono::duration<uint32_t> requestExpirationPeriod() const = 0;
     virtual std::chrono::duration<uint32_t> dbMaintenancePeriod() const = 0;
@@ -62,10 +67,15 @@ class EzParserConfig : public Config
     Address         _ipAddr;
     TcpPort         _nodePort = 0;
     TcpPort         _clientPort = 0;
+    size_t          _reactorThreadCount = 0;
+    size_t          _reactorCoreCount = 0;
+    size_t          _dispatchWorkerCount = 0;
+    size_t          _pipelinedRequestCount = 0;
     NetworkEndpoint _localEndpoint = NetworkEndpoint("",0);
     GpsCoordinate   _latitude = 0;
     GpsCoordinate   _longitude = 0;
     std::string     _logPath;
+    std::string     _diagnostics;
     std::string     _dbPath;
     std::vector<NetworkEndpoint> _seedNodes;
     
@@ -80,11 +90,16 @@ public:
     const NetworkEndpoint& localServiceEndpoint() const override;
     
     const std::string& logPath() const override;
+    const std::string& diagnostics() const override;
     const std::string& dbPath() const override;
     
     bool isTestMode() const override;
     const std::vector<NetworkEndpoint>& seedNodes() const override;
     size_t neighbourhoodTargetSize() const override;
+    size_t reactorThreadCount() const override;
+    size_t reactorCoreCount() const override;
+    size_t dispatchWorkerCount() const override;
+    size_t pipelinedRequestCount() const override;
     
     std::chrono::duration<uint32_t> requestExpirationPeriod() const override;
     std::chrono::duration<uint32_t> dbMaintenancePeriod() const override;
@@ -22,6 +22,176 @@ namespace LocNet
 const float    INIT_WORLD_NODE_FILL_TARGET_RATE = 0.75;
 const size_t   PERIODIC_DISCOVERY_ATTEMPT_COUNT = 5;
 const size_t   MERGE_RANDOM_NODE_COuNT          = 10;
+const size_t   COVERAGE_MAX_MISS_STREAK_PENALTY = 10;
+
+// NOTE sessions enforce the deadline of each request, this only covers connecting and a stalled reactor
+const chrono::seconds REMOTE_RESULT_SAFETY_MARGIN = chrono::seconds(15);
+
+
+
+shared_ptr<IAsyncNodeMethods> INodeProxyFactory::ConnectToAsync(const NetworkEndpoint &endpoint)
+{
+    shared_ptr<INodeMethods> node = ConnectTo(endpoint);
+    return node ? shared_ptr<IAsyncNodeMethods>( new AsyncNodeMethodsAdapter(node) ) :
+        shared_ptr<IAsyncNodeMethods>();
+}
+
+
+
+// Run the operation right now and return its outcome as an already completed future
+template <typename Result>
+static future<Result> CompletedFuture( function<Result()> operation )
+{
+    promise<Result> result;
+    try { result.set_value( operation() ); }
+    catch (...)
+        { result.set_exception( current_exception() ); }
+    return result.get_future();
+}
+
+
+AsyncNodeMethodsAdapter::AsyncNodeMethodsAdapter(shared_ptr<INodeMethods> node) : _node(node)
+{
+    if (_node == nullptr) {
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No node instantiated");
+    }
+}
+
+future<NodeInfo> AsyncNodeMethodsAdapter::GetNodeInfo() const
+{
+    shared_ptr<INodeMethods> node = _node;
+    return CompletedFuture<NodeInfo>( [node] { return node->GetNodeInfo(); } );
+}
+
+future<size_t> AsyncNodeMethodsAdapter::GetNodeCount() const
+{
+    shared_ptr<INodeMethods> node = _node;
+    return CompletedFuture<size_t>( [node] { return node->GetNodeCount(); } );
+}
+
+future< vector<NodeInfo> > AsyncNodeMethodsAdapter::GetRandomNodes(size_t maxNodeCount, Neighbours filter) const
+{
+    shared_ptr<INodeMethods> node = _node;
+    return CompletedFuture< vector<NodeInfo> >( [node, maxNodeCount, filter]
+        { return node->GetRandomNodes(maxNodeCount, filter); } );
+}
+
+future< vector<NodeInfo> > AsyncNodeMethodsAdapter::GetClosestNodesByDistance(const GpsLocation &location,
+    Distance radiusKm, size_t maxNodeCount, Neighbours filter) const
+{
+    shared_ptr<INodeMethods> node = _node;
+    return CompletedFuture< vector<NodeInfo> >( [node, location, radiusKm, maxNodeCount, filter]
+        { return node->GetClosestNodesByDistance(location, radiusKm, maxNodeCount, filter); } );
+}
+
+future< shared_ptr<NodeInfo> > AsyncNodeMethodsAdapter::AcceptColleague(const NodeInfo &requestor)
+{
+    shared_ptr<INodeMethods> node = _node;
+    return CompletedFuture< shared_ptr<NodeInfo> >( [node, &requestor] { return node->AcceptColleague(requestor); } );
+}
+
+future< shared_ptr<NodeInfo> > AsyncNodeMethodsAdapter::RenewColleague(const NodeInfo &requestor)
+{
+    shared_ptr<INodeMethods> node = _node;
+    return CompletedFuture< shared_ptr<NodeInfo> >( [node, &requestor] { return node->RenewColleague(requestor); } );
+}
+
+future< shared_ptr<NodeInfo> > AsyncNodeMethodsAdapter::AcceptNeighbour(const NodeInfo &requestor)
+{
+    shared_ptr<INodeMethods> node = _node;
+    return CompletedFuture< shared_ptr<NodeInfo> >( [node, &requestor] { return node->AcceptNeighbour(requestor); } );
+}
+
+future< shared_ptr<NodeInfo> > AsyncNodeMethodsAdapter::RenewNeighbour(const NodeInfo &requestor)
+{
+    shared_ptr<INodeMethods> node = _node;
+    return CompletedFuture< shared_ptr<NodeInfo> >( [node, &requestor] { return node->RenewNeighbour(requestor); } );
+}
+
+
+
+const size_t CoverageGrid::CellSizeDegrees;
+const size_t CoverageGrid::LatitudeCellCount;
+const size_t CoverageGrid::LongitudeCellCount;
+
+
+CoverageGrid::CoverageGrid() : _cells(LatitudeCellCount * LongitudeCellCount) {}
+
+
+size_t CoverageGrid::CellIndex(const GpsLocation &location)
+{
+    size_t latitudeIndex  = static_cast<size_t>( (location.latitude()  +  90.) / CellSizeDegrees );
+    size_t longitudeIndex = static_cast<size_t>( (location.longitude() + 180.) / CellSizeDegrees );
+    // Locations on the north pole and the antimeridian belong to the last cells
+    latitudeIndex  = min(latitudeIndex,  LatitudeCellCount  - 1);
+    longitudeIndex = min(longitudeIndex, LongitudeCellCount - 1);
+    return latitudeIndex * LongitudeCellCount + longitudeIndex;
+}
+
+
+void CoverageGrid::UpdateKnownNodes(const vector<NodeDbEntry> &nodes)
+{
+    lock_guard<mutex> lock(_mutex);
+    for (auto &cell : _cells)
+        { cell.knownNodeCount = 0; }
+    for (auto const &node : nodes)
+        { ++_cells[ CellIndex( node.location() ) ].knownNodeCount; }
+}
+
+
+double CoverageGrid::CellWeight(size_t cellIndex) const
+{
+    const Cell &cell = _cells[cellIndex];
+    
+    // Estimate the chance of the cell being populated from earlier probes, known nodes also prove it.
+    // Repeatedly failing probes suggest an empty area, explore it exponentially less often.
+    double populatedRate = (cell.hitCount + 1. + (cell.knownNodeCount > 0 ? 1. : 0.)) / (cell.probeCount + 2.);
+    populatedRate *= pow( .5, min<size_t>(cell.missStreak, COVERAGE_MAX_MISS_STREAK_PENALTY) );
+    // Prefer areas where we know few nodes so far
+    double coverageFactor = 1. / (1. + cell.knownNodeCount);
+    // Cells are getting narrower towards the poles, weight them by area
+    double latitudeOfCenter = (cellIndex / LongitudeCellCount + .5) * CellSizeDegrees - 90.;
+    double areaFactor = cos(latitudeOfCenter * M_PI / 180.);
+    
+    return populatedRate * coverageFactor * areaFactor;
+}
+
+
+GpsLocation CoverageGrid::SelectProbeLocation(mt19937 &generator) const
+{
+    vector<double> weights( _cells.size() );
+    {
+        lock_guard<mutex> lock(_mutex);
+        for (size_t cellIndex = 0; cellIndex < _cells.size(); ++cellIndex)
+            { weights[cellIndex] = CellWeight(cellIndex); }
+    }
+    
+    discrete_distribution<size_t> cellRange( weights.begin(), weights.end() );
+    size_t cellIndex = cellRange(generator);
+    
+    // Select a uniform random point inside the cell, note that valid ranges are exclusive at the bottom
+    GpsCoordinate maxLatitude  = static_cast<GpsCoordinate>( (cellIndex / LongitudeCellCount + 1) * CellSizeDegrees ) - 90.;
+    GpsCoordinate maxLongitude = static_cast<GpsCoordinate>( (cellIndex % LongitudeCellCount + 1) * CellSizeDegrees ) - 180.;
+    uniform_real_distribution<GpsCoordinate> offsetRange(0., CellSizeDegrees);
+    return GpsLocation( maxLatitude - offsetRange(generator), maxLongitude - offsetRange(generator) );
+}
+
+
+void CoverageGrid::RecordProbe(const GpsLocation &probeLocation, const GpsLocation &closestNodeLocation)
+{
+    size_t cellIndex = CellIndex(probeLocation);
+    
+    lock_guard<mutex> lock(_mutex);
+    Cell &cell = _cells[cellIndex];
+    ++cell.probeCount;
+    // If the closest node is outside the cell, the area is probably empty, e.g. an ocean
+    if ( CellIndex(closestNodeLocation) == cellIndex )
+    {
+        ++cell.hitCount;
+        cell.missStreak = 0;
+    }
+    else { ++cell.missStreak; }
+}
 
 
 
@@ -111,10 +281,7 @@ GpsLocation Node::RegisterService(const ServiceInfo& serviceInfo)
     entry.services()[ serviceInfo.type() ] = serviceInfo;
     _spatialDb->Update(entry);
     
-    // NOTE running RenewNeighbours could block the reactor while connect(endpoint) has blocking implementation
-    shared_ptr<Node> self = shared_from_this();
-    thread updateNodeInfoAtNeighboursThread( [self] { self->RenewNeighbours(); } );
-    updateNodeInfoAtNeighboursThread.detach();
+    ScheduleSelfInfoUpdate();
     
     return GetNodeInfo().location();
 }
@@ -131,9 +298,38 @@ void Node::DeregisterService(std::string serviceType)
     entry.services().erase(serviceType);
     _spatialDb->Update(entry);
     
+    ScheduleSelfInfoUpdate();
+}
+
+
+void Node::selfInfoChangedCallback(function<void()> callback)
+{
+    lock_guard<mutex> lock(_selfInfoChangedMutex);
+    _selfInfoChangedCallback = callback;
+}
+
+
+void Node::ScheduleSelfInfoUpdate()
+{
+    function<void()> callback;
+    {
+        lock_guard<mutex> lock(_selfInfoChangedMutex);
+        callback = _selfInfoChangedCallback;
+    }
+    if (callback)
+    {
+        callback();
+        return;
+    }
+    
     // NOTE running RenewNeighbours could block the reactor while connect(endpoint) has blocking implementation
     shared_ptr<Node> self = shared_from_this();
-    thread updateNodeInfoAtNeighboursThread( [self] { self->RenewNeighbours(); } );
+    thread updateNodeInfoAtNeighboursThread( [self]
+    {
+        try { self->RenewNeighbours(); }
+        catch (exception &e)
+            { LOG(WARNING) << "Failed to propagate changed self info to neighbours: " << e.what(); }
+    } );
     updateNodeInfoAtNeighboursThread.detach();
 }
 
@@ -146,7 +342,7 @@ void Node::RemoveListener(const SessionId &sessionId)
 
 
 
-void Node::DetectedExternalAddress(const Address& address)
+void Node::DetectedExternalAddress(const IpAddress &address)
 {
     NodeDbEntry myEntry = _spatialDb->ThisNode();
     if ( myEntry.contact().address() != address && ! address.empty() )
@@ -155,9 +351,8 @@ void Node::DetectedExternalAddress(const Address& address)
         myEntry.contact().address(address);
         _spatialDb->Update(myEntry);
         
-        // TODO normally we should immediately start distributing updated node info,
-        //      but IP may change again during the process and may behave Unexpectedly. What to do here?
-        // RenewNeighbours();
+        // NOTE IP may change again soon, the scheduler waits for a quiet period before distributing it
+        ScheduleSelfInfoUpdate();
     }
 }
 
@@ -226,33 +421,44 @@ size_t Node::GetNodeCount() const
     { return _spatialDb->GetNodeCount(); }
 
 
-vector<NodeInfo> Node::GetRandomNodes(size_t maxNodeCount, Neighbours filter) const
+// Slice database entries to the node infos they contain, moving instead of copying ids and services
+static vector<NodeInfo> ToNodeInfos(vector<NodeDbEntry> &&entries)
 {
-    vector<NodeDbEntry> entries( _spatialDb->GetRandomNodes(maxNodeCount, filter) );
-    return vector<NodeInfo>( entries.begin(), entries.end() );
+    vector<NodeInfo> result;
+    result.reserve( entries.size() );
+    for (auto &entry : entries)
+        { result.emplace_back( move(entry) ); }
+    return result;
 }
+
+
+vector<NodeInfo> Node::GetRandomNodes(size_t maxNodeCount, Neighbours filter) const
+    { return ToNodeInfos( _spatialDb->GetRandomNodes(maxNodeCount, filter) ); }
     
 vector<NodeInfo> Node::GetNeighbourNodesByDistance() const
-{
-    vector<NodeDbEntry> entries( _spatialDb->GetNeighbourNodesByDistance() );
-    return vector<NodeInfo>( entries.begin(), entries.end() );
-}
+    { return ToNodeInfos( _spatialDb->GetNeighbourNodesByDistance() ); }
 
 
 
 vector<NodeInfo> Node::GetClosestNodesByDistance(const GpsLocation& location,
     Distance radiusKm, size_t maxNodeCount, Neighbours filter) const
+    { return ToNodeInfos( _spatialDb->GetClosestNodesByDistance(location, radiusKm, maxNodeCount, filter) ); }
+
+
+template <typename Result>
+Result Node::AwaitRemote(future<Result> &result) const
 {
-    vector<NodeDbEntry> entries( _spatialDb->GetClosestNodesByDistance(location, radiusKm, maxNodeCount, filter) );
-    return vector<NodeInfo>( entries.begin(), entries.end() );
+    if ( result.wait_for( _config->requestExpirationPeriod() + REMOTE_RESULT_SAFETY_MARGIN ) != future_status::ready )
+        { throw LocationNetworkError(ErrorCode::ERROR_TIMEOUT, "No result from remote node until the deadline"); }
+    return result.get();
 }
 
 
 vector<NodeInfo> Node::ExploreNetworkNodesByDistance(const GpsLocation &location,
     size_t targetNodeCount, size_t maxNodeHops) const
 {
-    // TODO This might last for a very long time. The current implementation
-    //      still uses a blocking network connect and a synchronous return value here.
+    // TODO This might last for a very long time. Each hop needs the answer of the previous one,
+    //      so they cannot overlap, and the result is still returned synchronously here.
     //      With a single reactor thread this might block all other clients
     //      until the result is done. Transforming this to an asynchronous
     //      operation is not trivial, but should be done in the future.
@@ -269,14 +475,15 @@ vector<NodeInfo> Node::ExploreNetworkNodesByDistance(const GpsLocation &location
         if (newClosestNode == oldClosestNode)
             { break; }
         
-        shared_ptr<INodeMethods> closestNodeProxy = SafeConnectTo( newClosestNode.contact().nodeEndpoint() );
+        shared_ptr<IAsyncNodeMethods> closestNodeProxy = SafeConnectToAsync( newClosestNode.contact().nodeEndpoint() );
         if (closestNodeProxy == nullptr) {
             // TODO consider what better to do if closest node is not reachable?
             break;
         }
         
-        closestNodesByDistance = closestNodeProxy->GetClosestNodesByDistance(
+        future< vector<NodeInfo> > closestNodesResponse = closestNodeProxy->GetClosestNodesByDistance(
             location, numeric_limits<Distance>::max(), targetNodeCount, Neighbours::Included);
+        closestNodesByDistance = AwaitRemote(closestNodesResponse);
         if ( closestNodesByDistance.empty() )
             { throw LocationNetworkError(ErrorCode::ERROR_BAD_RESPONSE, "Node returned empty node list result"); }
             
@@ -329,214 +536,282 @@ bool Node::BubbleOverlaps(const NodeInfo &newNode) const
 
 
 
-shared_ptr<INodeMethods> Node::SafeConnectTo(const NetworkEndpoint& endpoint) const
+shared_ptr<IAsyncNodeMethods> Node::SafeConnectToAsync(const NetworkEndpoint& endpoint) const
 {
     // There is no point in connecting to ourselves
     if ( endpoint == _spatialDb->ThisNode().contact().nodeEndpoint() ||
          ( ! _config->isTestMode() && endpoint.isLoopback() ) )
     {
-        LOG(TRACE) << "Address " << endpoint << " is self or local, refusing";
-        return shared_ptr<INodeMethods>();
+        LOG_TRACE(Node) << "Address " << endpoint << " is self or local, refusing";
+        return shared_ptr<IAsyncNodeMethods>();
     }
     
-    try { return _proxyFactory->ConnectTo(endpoint); }
+    try { return _proxyFactory->ConnectToAsync(endpoint); }
     catch (exception &e)
         { LOG(INFO) << "Failed to connect to " << endpoint << ": " << e.what(); }
-    return shared_ptr<INodeMethods>();
+    return shared_ptr<IAsyncNodeMethods>();
 }
 
 
 
-bool Node::SafeStoreNode(const NodeDbEntry& plannedEntry, shared_ptr<INodeMethods> nodeProxy)
+bool Node::IsStoreAllowed(const NodeDbEntry &plannedEntry, shared_ptr<NodeDbEntry> &storedInfo)
 {
-    try
+    const NodeInfo &myNode = _config->myNodeInfo();
+    
+    // We must not explicitly add or overwrite our own node info here.
+    // Whether or not our own nodeinfo is stored in the db is an implementation detail of the SpatialDatabase.
+    if ( plannedEntry.id() == myNode.id() ||
+         plannedEntry.relationType() == NodeRelationType::Self )
     {
-        const NodeInfo &myNode = _config->myNodeInfo();
-        
-        // We must not explicitly add or overwrite our own node info here.
-        // Whether or not our own nodeinfo is stored in the db is an implementation detail of the SpatialDatabase.
-        if ( plannedEntry.id() == myNode.id() ||
-             plannedEntry.relationType() == NodeRelationType::Self )
-        {
-            LOG(TRACE) << "Attempt to store self, refusing";
-            return false;
-        }
-     
-        // Validate if node is acceptable
-        shared_ptr<NodeDbEntry> storedInfo = _spatialDb->Load( plannedEntry.id() );
-        if ( storedInfo && storedInfo->relationType() == NodeRelationType::Self )
-        {
-            LOG(TRACE) << "Attempt to overwrite self, refusing";
-            throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Forbidden operation: must not overwrite self here");
-        }
-        
-        switch ( plannedEntry.relationType() )
+        LOG_TRACE(Node) << "Attempt to store self, refusing";
+        return false;
+    }
+    
+    // Validate if node is acceptable
+    storedInfo = _spatialDb->Load( plannedEntry.id() );
+    if ( storedInfo && storedInfo->relationType() == NodeRelationType::Self )
+    {
+        LOG_TRACE(Node) << "Attempt to overwrite self, refusing";
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Forbidden operation: must not overwrite self here");
+    }
+    
+    switch ( plannedEntry.relationType() )
+    {
+        case NodeRelationType::Colleague:
         {
-            case NodeRelationType::Colleague:
+            if (storedInfo != nullptr)
             {
-                if (storedInfo != nullptr)
+                // Existing colleague info may be upgraded to neighbour but not vica versa
+                if ( storedInfo->relationType() == NodeRelationType::Neighbour )
                 {
-                    // Existing colleague info may be upgraded to neighbour but not vica versa
-                    if ( storedInfo->relationType() == NodeRelationType::Neighbour )
-                    {
-                        LOG(TRACE) << "Attempt to downgrade neighbour as colleague, refusing colleague";
-                        return false;
-                    }
-                    if ( storedInfo->location() != plannedEntry.location() ) {
-                        // Node must not be moved away to a position that overlaps with anything other than itself
-                        if ( BubbleOverlaps(plannedEntry) )
-                        {
-                            LOG(TRACE) << "Bubble of changed node location would overlap, refusing colleague";
-                            return false;
-                        }
-                    }
+                    LOG_TRACE(Node) << "Attempt to downgrade neighbour as colleague, refusing colleague";
+                    return false;
                 }
-                else {
-                    // New node must not overlap with other colleagues
+                if ( storedInfo->location() != plannedEntry.location() ) {
+                    // Node must not be moved away to a position that overlaps with anything other than itself
                     if ( BubbleOverlaps(plannedEntry) )
                     {
-                        LOG(TRACE) << "Node bubble would overlap, refusing colleague";
+                        LOG_TRACE(Node) << "Bubble of changed node location would overlap, refusing colleague";
                         return false;
                     }
                 }
-                break;
             }
-            
-            case NodeRelationType::Neighbour:
+            else {
+                // New node must not overlap with other colleagues
+                if ( BubbleOverlaps(plannedEntry) )
+                {
+                    LOG_TRACE(Node) << "Node bubble would overlap, refusing colleague";
+                    return false;
+                }
+            }
+            break;
+        }
+        
+        case NodeRelationType::Neighbour:
+        {
+            size_t neighbourhoodTargetSize = _config->neighbourhoodTargetSize();
+            size_t neighbourhoodSize = _spatialDb->GetNodeCount(NodeRelationType::Neighbour);
+            if (storedInfo == nullptr || storedInfo->relationType() == NodeRelationType::Colleague)
             {
-                size_t neighbourhoodTargetSize = _config->neighbourhoodTargetSize();
-                size_t neighbourhoodSize = _spatialDb->GetNodeCount(NodeRelationType::Neighbour);
-                if (storedInfo == nullptr || storedInfo->relationType() == NodeRelationType::Colleague)
+                // Received a new neighbour request
+                if (neighbourhoodSize >= neighbourhoodTargetSize)
                 {
-                    // Received a new neighbour request
-                    if (neighbourhoodSize >= neighbourhoodTargetSize)
+                    // Neighbour limit is exceeded by adding a new neighbour, but if it is closer
+                    // than an old neighbour then we can temporarily break the neighbourhood count limit
+                    // and will later refuse renewal of exceeding old neighbours and let them expire
+                    vector<NodeInfo> neighboursByDistance( GetNeighbourNodesByDistance() );
+                    const NodeInfo &limitNeighbour = neighboursByDistance[neighbourhoodTargetSize - 1];
+                    LOG_TRACE(Node) << "We have reached the neighbour limit " << neighbourhoodTargetSize
+                               << ", farthest neighbour within limit is " << limitNeighbour;
+                    if ( _spatialDb->GetDistanceKm( myNode.location(), limitNeighbour.location() ) <=
+                         _spatialDb->GetDistanceKm( myNode.location(), plannedEntry.location() ) )
                     {
-                        // Neighbour limit is exceeded by adding a new neighbour, but if it is closer
-                        // than an old neighbour then we can temporarily break the neighbourhood count limit
-                        // and will later refuse renewal of exceeding old neighbours and let them expire
-                        vector<NodeInfo> neighboursByDistance( GetNeighbourNodesByDistance() );
-                        const NodeInfo &limitNeighbour = neighboursByDistance[neighbourhoodTargetSize - 1];
-                        LOG(TRACE) << "We have reached the neighbour limit " << neighbourhoodTargetSize
-                                   << ", farthest neighbour within limit is " << limitNeighbour;
-                        if ( _spatialDb->GetDistanceKm( myNode.location(), limitNeighbour.location() ) <=
-                             _spatialDb->GetDistanceKm( myNode.location(), plannedEntry.location() ) )
-                        {
-                            LOG(TRACE) << neighbourhoodTargetSize << " closer neighbours found, refusing to add new";
-                            return false;
-                        }
+                        LOG_TRACE(Node) << neighbourhoodTargetSize << " closer neighbours found, refusing to add new";
+                        return false;
                     }
                 }
-                else
+            }
+            else
+            {
+                // Renewal of an old neighbour
+                if (neighbourhoodSize > neighbourhoodTargetSize)
                 {
-                    // Renewal of an old neighbour
-                    if (neighbourhoodSize > neighbourhoodTargetSize)
+                    vector<NodeInfo> neighboursByDistance( GetNeighbourNodesByDistance() );
+                    auto neighbourIter = find_if( neighboursByDistance.begin(), neighboursByDistance.end(),
+                        [plannedEntry] (const NodeInfo &neighbour) { return neighbour.id() == plannedEntry.id(); } );
+                    if ( neighbourIter == neighboursByDistance.end() )
+                    {
+                        LOG(ERROR) << "Implementation problem: stored neighbour is not found in neighbour list";
+                        throw LocationNetworkError(ErrorCode::ERROR_CONCEPTUAL, "Please report this to the developers");
+                    }
+                    // Don't care about location change here. If moved too far away we expire it
+                    // at the next renewal request when it's at its new place in the neighbour list.
+                    size_t neighbourIndex = distance( neighboursByDistance.begin(), neighbourIter );
+                    if (neighbourIndex >= neighbourhoodTargetSize)
                     {
-                        vector<NodeInfo> neighboursByDistance( GetNeighbourNodesByDistance() );
-                        auto neighbourIter = find_if( neighboursByDistance.begin(), neighboursByDistance.end(),
-                            [plannedEntry] (const NodeInfo &neighbour) { return neighbour.id() == plannedEntry.id(); } );
-                        if ( neighbourIter == neighboursByDistance.end() )
-                        {
-                            LOG(ERROR) << "Implementation problem: stored neighbour is not found in neighbour list";
-                            throw LocationNetworkError(ErrorCode::ERROR_CONCEPTUAL, "Please report this to the developers");
-                        }
-                        // Don't care about location change here. If moved too far away we expire it
-                        // at the next renewal request when it's at its new place in the neighbour list.
-                        size_t neighbourIndex = distance( neighboursByDistance.begin(), neighbourIter );
-                        if (neighbourIndex >= neighbourhoodTargetSize)
-                        {
-                            LOG(TRACE) << neighbourhoodTargetSize << " neighbours limit reached, refusing to renew neighbour nr. " << neighbourIndex;
-                            return false;
-                        }
+                        LOG_TRACE(Node) << neighbourhoodTargetSize << " neighbours limit reached, refusing to renew neighbour nr. " << neighbourIndex;
+                        return false;
                     }
                 }
-                break;
             }
-            
-            case NodeRelationType::Self:
-                throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Forbidden operation: must not overwrite self here");
-            
-            default:
-                throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Unknown nodetype, missing implementation");
+            break;
         }
         
-        NodeDbEntry entryToWrite(plannedEntry);
+        case NodeRelationType::Self:
+            throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Forbidden operation: must not overwrite self here");
+        
+        default:
+            throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Unknown nodetype, missing implementation");
+    }
+    return true;
+}
+
+
+bool Node::StoreAcceptedNode( const NodeDbEntry &plannedEntry, shared_ptr<NodeDbEntry> storedInfo,
+                              shared_ptr<NodeInfo> freshInfo )
+{
+    NodeDbEntry entryToWrite(plannedEntry);
+    if ( plannedEntry.roleType() == NodeContactRoleType::Initiator )
+    {
+        // Request was denied
+        if (freshInfo == nullptr)
+        {
+            LOG_TRACE(Node) << "Accept/renew request was denied";
+            return false;
+        }
+        
+        // Node identity is questionable
+        if ( freshInfo->id() != plannedEntry.id() )
+        {
+            LOG(WARNING) << endl
+                << "Contacted node has different identity than expected." << endl
+                << "  Expected: " << plannedEntry << endl
+                << "  Reported: " << *freshInfo << endl;
+            return false;
+        }
+        
+        entryToWrite = NodeDbEntry( *freshInfo, plannedEntry.relationType(), plannedEntry.roleType() );
+    }
+    
+    // TODO consider if all important sanity checks are done above
+    if (storedInfo == nullptr)
+    {
+        LOG_DEBUG(Node) << "Storing node info " << entryToWrite;
+        _spatialDb->Store(entryToWrite);
+    }
+    else
+    {
+        LOG_DEBUG(Node) << "Updating node info " << entryToWrite;
+        _spatialDb->Update(entryToWrite);
+    }
+    return true;
+}
+
+
+bool Node::SafeStoreNode(const NodeDbEntry& plannedEntry)
+{
+    try
+    {
         if ( plannedEntry.roleType() == NodeContactRoleType::Initiator )
         {
-            // If no connection argument is specified, try connecting to candidate node
-            if (nodeProxy == nullptr)
-                { nodeProxy = SafeConnectTo( plannedEntry.contact().nodeEndpoint() ); }
-            if (nodeProxy == nullptr)
-            {
-                LOG(TRACE) << "Failed to connect to remote node to ask for permission, refusing";
-                return false;
-            }
-            
-            // Ask for its permission for mutual acceptance
-            shared_ptr<NodeInfo> freshInfo;
-            switch ( plannedEntry.relationType() )
-            {
-                case NodeRelationType::Colleague:
-                    freshInfo = storedInfo && storedInfo->relationType() == plannedEntry.relationType() ?
-                        nodeProxy->RenewColleague(myNode) : nodeProxy->AcceptColleague(myNode);
-                    break;
-                
-                case NodeRelationType::Neighbour:
-                    freshInfo = storedInfo && storedInfo->relationType() == plannedEntry.relationType() ?
-                        nodeProxy->RenewNeighbour(myNode) : nodeProxy->AcceptNeighbour(myNode);
-                    break;
-                
-                case NodeRelationType::Self:
-                    throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Forbidden operation: must not overwrite self here");
-                
-                default: throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Unknown relationtype, missing implementation");
-            }
-            
-            // Request was denied
-            if (freshInfo == nullptr)
-            {
-                LOG(TRACE) << "Accept/renew request was denied";
-                return false;
-            }
-            
-            // Node identity is questionable
-            if ( freshInfo->id() != plannedEntry.id() )
-            {
-                LOG(WARNING) << endl
-                    << "Contacted node has different identity than expected." << endl
-                    << "  Expected: " << plannedEntry << endl
-                    << "  Reported: " << *freshInfo << endl;
-                return false;
-            }
-            
-            entryToWrite = NodeDbEntry( *freshInfo, plannedEntry.relationType(), plannedEntry.roleType() );
+            // Ask the node for its permission for mutual acceptance
+            vector<PendingRelation> pendingRelations;
+            if (! RequestRelation(plannedEntry, shared_ptr<IAsyncNodeMethods>(), pendingRelations) )
+                { return false; }
+            return CompleteRelation( pendingRelations.front() );
         }
         
-        // TODO consider if all important sanity checks are done above
-        if (storedInfo == nullptr)
+        shared_ptr<NodeDbEntry> storedInfo;
+        if (! IsStoreAllowed(plannedEntry, storedInfo) )
+            { return false; }
+        return StoreAcceptedNode( plannedEntry, storedInfo, shared_ptr<NodeInfo>() );
+    }
+    catch (exception &e)
+    {
+        LOG(ERROR) << "Unexpected error validating and storing node: " << e.what();
+    }
+    
+    return false;
+}
+
+
+bool Node::RequestRelation( const NodeDbEntry &plannedEntry, shared_ptr<IAsyncNodeMethods> nodeProxy,
+                            vector<PendingRelation> &pendingRelations )
+{
+    try
+    {
+        if ( plannedEntry.roleType() != NodeContactRoleType::Initiator )
+            { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Only relations initiated by us need permission"); }
+        
+        shared_ptr<NodeDbEntry> storedInfo;
+        if (! IsStoreAllowed(plannedEntry, storedInfo) )
+            { return false; }
+        
+        // If no connection argument is specified, try connecting to candidate node
+        if (nodeProxy == nullptr)
+            { nodeProxy = SafeConnectToAsync( plannedEntry.contact().nodeEndpoint() ); }
+        if (nodeProxy == nullptr)
         {
-            LOG(DEBUG) << "Storing node info " << entryToWrite;
-            _spatialDb->Store(entryToWrite);
+            LOG_TRACE(Node) << "Failed to connect to remote node to ask for permission, refusing";
+            return false;
         }
-        else
+        
+        const NodeInfo &myNode = _config->myNodeInfo();
+        bool renewal = storedInfo && storedInfo->relationType() == plannedEntry.relationType();
+        future< shared_ptr<NodeInfo> > response;
+        switch ( plannedEntry.relationType() )
         {
-            LOG(DEBUG) << "Updating node info " << entryToWrite;
-            _spatialDb->Update(entryToWrite);
+            case NodeRelationType::Colleague:
+                response = renewal ? nodeProxy->RenewColleague(myNode) : nodeProxy->AcceptColleague(myNode);
+                break;
+            
+            case NodeRelationType::Neighbour:
+                response = renewal ? nodeProxy->RenewNeighbour(myNode) : nodeProxy->AcceptNeighbour(myNode);
+                break;
+            
+            case NodeRelationType::Self:
+                throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Forbidden operation: must not overwrite self here");
+            
+            default: throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Unknown relationtype, missing implementation");
         }
+        pendingRelations.push_back( PendingRelation{ plannedEntry, storedInfo, nodeProxy, move(response) } );
         return true;
     }
     catch (exception &e)
     {
-        LOG(ERROR) << "Unexpected error validating and storing node: " << e.what();
+        LOG(ERROR) << "Unexpected error asking node " << plannedEntry.id() << " for permission: " << e.what();
     }
     
     return false;
 }
 
 
+bool Node::CompleteRelation(PendingRelation &pending)
+{
+    try
+    {
+        shared_ptr<NodeInfo> freshInfo = AwaitRemote(pending.response);
+        
+        // Other requests may have completed while waiting, e.g. a colleague with an overlapping bubble
+        if (! IsStoreAllowed(pending.entry, pending.storedInfo) )
+        {
+            LOG_TRACE(Node) << "Node " << pending.entry.id() << " is no longer acceptable, not storing it";
+            return false;
+        }
+        return StoreAcceptedNode(pending.entry, pending.storedInfo, freshInfo);
+    }
+    catch (exception &e)
+    {
+        LOG(WARNING) << "Failed to get permission of node " << pending.entry.id() << ": " << e.what();
+    }
+    return false;
+}
+
+
 
 bool Node::InitializeWorld(const vector<NetworkEndpoint> &seedNodes)
 {
-    LOG(DEBUG) << "Discovering world map for colleagues";
+    LOG_DEBUG(Node) << "Discovering world map for colleagues";
     const size_t INIT_WORLD_RANDOM_NODE_COUNT = 2 * _config->neighbourhoodTargetSize();
     
     unordered_set<Address> triedNodes;
@@ -550,22 +825,28 @@ bool Node::InitializeWorld(const vector<NetworkEndpoint> &seedNodes)
             triedNodes.emplace( seedContact.address() );
             
             // Try connecting to selected seed node
-            shared_ptr<INodeMethods> seedNodeProxy = SafeConnectTo(seedContact);
+            shared_ptr<IAsyncNodeMethods> seedNodeProxy = SafeConnectToAsync(seedContact);
             if (seedNodeProxy == nullptr)
                 { continue; }
             
-            // Try to add seed node to our network (no matter if fails)
-            NodeInfo seedInfo = seedNodeProxy->GetNodeInfo();
-            SafeStoreNode( NodeDbEntry(seedInfo, NodeRelationType::Colleague, NodeContactRoleType::Initiator),
-                           seedNodeProxy );
-            
             // Query both total node count and an initial list of random nodes to start with
-            LOG(DEBUG) << "Getting node count from initial seed";
-            nodeCountAtSeed = seedNodeProxy->GetNodeCount();
-            LOG(DEBUG) << "Node count on seed is " << nodeCountAtSeed;
-            randomColleagueCandidates = seedNodeProxy->GetRandomNodes(
+            LOG_DEBUG(Node) << "Getting node count from initial seed";
+            future<NodeInfo> seedInfo = seedNodeProxy->GetNodeInfo();
+            future<size_t> seedNodeCount = seedNodeProxy->GetNodeCount();
+            future< vector<NodeInfo> > seedRandomNodes = seedNodeProxy->GetRandomNodes(
                 INIT_WORLD_RANDOM_NODE_COUNT, Neighbours::Included );
             
+            // Try to add seed node to our network (no matter if fails)
+            vector<PendingRelation> seedRelation;
+            RequestRelation( NodeDbEntry( AwaitRemote(seedInfo), NodeRelationType::Colleague,
+                NodeContactRoleType::Initiator ), seedNodeProxy, seedRelation );
+            
+            nodeCountAtSeed = AwaitRemote(seedNodeCount);
+            LOG_DEBUG(Node) << "Node count on seed is " << nodeCountAtSeed;
+            randomColleagueCandidates = AwaitRemote(seedRandomNodes);
+            for (auto &pending : seedRelation)
+                { CompleteRelation(pending); }
+            
             // If got a reasonable response from a seed server, stop contacting other seeds
             if ( nodeCountAtSeed > 0 && ! randomColleagueCandidates.empty() )
                 { break; }
@@ -587,47 +868,57 @@ bool Node::InitializeWorld(const vector<NetworkEndpoint> &seedNodes)
     
     // We received a reasonable random node list from a seed, try to fill in our world map
     size_t targetNodeCount = static_cast<size_t>( ceil(INIT_WORLD_NODE_FILL_TARGET_RATE * nodeCountAtSeed) );
-    LOG(DEBUG) << "Targeted node count is " << targetNodeCount;
+    LOG_DEBUG(Node) << "Targeted node count is " << targetNodeCount;
     
     // Keep trying until we either reached targeted node count or run out of all candidates
-    while ( GetNodeCount() < targetNodeCount )
+    while ( GetNodeCount() < targetNodeCount && ! randomColleagueCandidates.empty() )
     {
-        if ( randomColleagueCandidates.empty() )
-            { break; }
-        
-        // Pick a single node from the candidate list and try to make it a colleague node
-        NodeInfo nodeInfo( randomColleagueCandidates.back() );
-        auto const &nodeEndpoint = nodeInfo.contact().nodeEndpoint();
-        randomColleagueCandidates.pop_back();
-        
-        // Add it as a tried node, skip if we tried it already
-        if ( ! triedNodes.emplace( nodeEndpoint.address() ).second )
-            { continue; }
-        
-        try
+        // Contact as many candidates at once as nodes are still missing
+        size_t batchSize = targetNodeCount - GetNodeCount();
+        vector<PendingRelation> pendingRelations;
+        vector< future< vector<NodeInfo> > > pendingCandidates;
+        while ( pendingCandidates.size() < batchSize && ! randomColleagueCandidates.empty() )
         {
+            // Pick a single node from the candidate list and try to make it a colleague node
+            NodeInfo nodeInfo( randomColleagueCandidates.back() );
+            auto const &nodeEndpoint = nodeInfo.contact().nodeEndpoint();
+            randomColleagueCandidates.pop_back();
+            
+            // Add it as a tried node, skip if we tried it already
+            if ( ! triedNodes.emplace( nodeEndpoint.address() ).second )
+                { continue; }
+            
             // Connect to selected random node
-            shared_ptr<INodeMethods> nodeProxy = SafeConnectTo(nodeEndpoint);
+            shared_ptr<IAsyncNodeMethods> nodeProxy = SafeConnectToAsync(nodeEndpoint);
             if (nodeProxy == nullptr)
                 { continue; }
-                
-            SafeStoreNode( NodeDbEntry(nodeInfo, NodeRelationType::Colleague, NodeContactRoleType::Initiator),
-                           nodeProxy );
-        
-            // Ask it for random colleague candidates
-            vector<NodeInfo> candidates = nodeProxy->GetRandomNodes(
-                INIT_WORLD_RANDOM_NODE_COUNT, Neighbours::Excluded);
             
-            randomColleagueCandidates.insert( randomColleagueCandidates.begin(),
-                candidates.begin(), candidates.end() );
+            RequestRelation( NodeDbEntry(nodeInfo, NodeRelationType::Colleague, NodeContactRoleType::Initiator),
+                             nodeProxy, pendingRelations );
+            
+            // Ask it for random colleague candidates
+            pendingCandidates.push_back( nodeProxy->GetRandomNodes(
+                INIT_WORLD_RANDOM_NODE_COUNT, Neighbours::Excluded) );
         }
-        catch (exception &e)
+        
+        for (auto &pending : pendingRelations)
+            { CompleteRelation(pending); }
+        for (auto &pending : pendingCandidates)
         {
-            LOG(WARNING) << "Failed to fetch more random nodes: " << e.what();
+            try
+            {
+                vector<NodeInfo> candidates = AwaitRemote(pending);
+                randomColleagueCandidates.insert( randomColleagueCandidates.begin(),
+                    candidates.begin(), candidates.end() );
+            }
+            catch (exception &e)
+            {
+                LOG(WARNING) << "Failed to fetch more random nodes: " << e.what();
+            }
         }
     }
     
-    LOG(DEBUG) << "World discovery finished with total node count " << GetNodeCount();
+    LOG_DEBUG(Node) << "World discovery finished with total node count " << GetNodeCount();
     return true;
 }
 
@@ -635,7 +926,7 @@ bool Node::InitializeWorld(const vector<NetworkEndpoint> &seedNodes)
 
 bool Node::InitializeNeighbourhood(const vector<NetworkEndpoint> &seedNodes)
 {
-    LOG(DEBUG) << "Discovering neighbourhood";
+    LOG_DEBUG(Node) << "Discovering neighbourhood";
     
     NodeDbEntry myNode = _spatialDb->ThisNode();
     vector<NodeInfo> closestNodesByDistance = GetClosestNodesByDistance(
@@ -650,7 +941,7 @@ bool Node::InitializeNeighbourhood(const vector<NetworkEndpoint> &seedNodes)
     NodeInfo newClosestNode = GetNodeInfo();
     if ( closestNodesByDistance.size() >= 2 )
     {
-        LOG(DEBUG) << "Already know other nodes, start from the closest one";
+        LOG_DEBUG(Node) << "Already know other nodes, start from the closest one";
         for (const NodeInfo &node : closestNodesByDistance)
         {
             // make sure that we don't choose ourselves
@@ -662,45 +953,48 @@ bool Node::InitializeNeighbourhood(const vector<NetworkEndpoint> &seedNodes)
         }
     }
     else {
-        LOG(DEBUG) << "No other nodes are available beyond self. Trying to contact a seed to detect neighbours.";
+        LOG_DEBUG(Node) << "No other nodes are available beyond self. Trying to contact a seed to detect neighbours.";
+        // Ask all seeds at once, then take the answer of the last one responding
+        vector< pair< NetworkEndpoint, future<NodeInfo> > > seedInfos;
         for (const NetworkEndpoint &seedContact : seedNodes)
         {
-            try
-            {
-                // Try connecting to selected seed node
-                shared_ptr<INodeMethods> seedNodeProxy = SafeConnectTo(seedContact);
-                if (seedNodeProxy == nullptr)
-                    { continue; }
-                newClosestNode = seedNodeProxy->GetNodeInfo();
-            }
+            shared_ptr<IAsyncNodeMethods> seedNodeProxy = SafeConnectToAsync(seedContact);
+            if (seedNodeProxy != nullptr)
+                { seedInfos.emplace_back( seedContact, seedNodeProxy->GetNodeInfo() ); }
+        }
+        for (auto &seedInfo : seedInfos)
+        {
+            try { newClosestNode = AwaitRemote(seedInfo.second); }
             catch (exception &e)
             {
-                LOG(WARNING) << "Failed to bootstrap from seed node " << seedContact
+                LOG(WARNING) << "Failed to bootstrap from seed node " << seedInfo.first
                             << ": " << e.what() << ", trying other seeds";
             }
         }
     }
     if ( newClosestNode == GetNodeInfo() )
     {
-        LOG(DEBUG) << "Could not contact any other node, failed to discover neighbourhood";
+        LOG_DEBUG(Node) << "Could not contact any other node, failed to discover neighbourhood";
         return false;
     }
     
     // Repeat asking the currently closest node for an even closer node until no new node discovered
     NodeInfo oldClosestNode = newClosestNode;
     do {
-        LOG(TRACE) << "Closest node known so far: " << newClosestNode;
+        LOG_TRACE(Node) << "Closest node known so far: " << newClosestNode;
         oldClosestNode = newClosestNode;
         try
         {
-            shared_ptr<INodeMethods> closestNodeProxy = SafeConnectTo( newClosestNode.contact().nodeEndpoint() );
+            // NOTE each step needs the answer of the previous one, they cannot overlap
+            shared_ptr<IAsyncNodeMethods> closestNodeProxy = SafeConnectToAsync( newClosestNode.contact().nodeEndpoint() );
             if (closestNodeProxy == nullptr) {
                 // TODO consider what better to do if closest node is not reachable?
                 continue;
             }
             
-            closestNodesByDistance = closestNodeProxy->GetClosestNodesByDistance(
+            future< vector<NodeInfo> > closestNodesResponse = closestNodeProxy->GetClosestNodesByDistance(
                 myNode.location(), numeric_limits<Distance>::max(), 2, Neighbours::Included);
+            closestNodesByDistance = AwaitRemote(closestNodesResponse);
             if ( closestNodesByDistance.empty() )
                 { throw LocationNetworkError(ErrorCode::ERROR_BAD_RESPONSE, "Node returned empty node list result"); }
                 
@@ -718,48 +1012,60 @@ bool Node::InitializeNeighbourhood(const vector<NetworkEndpoint> &seedNodes)
             _spatialDb->GetDistanceKm( _config->myNodeInfo().location(), oldClosestNode.location() ) );
     
     // Try to fill neighbourhood map until limit reached or no new nodes left to ask
-    unordered_set<string> askedNodeIds;
+    unordered_set<NodeId> askedNodeIds;
     deque<NodeInfo> nodesToAskQueue{oldClosestNode};
-    while ( _spatialDb->GetNodeCount(NodeRelationType::Neighbour) < _config->neighbourhoodTargetSize() &&
-            ! nodesToAskQueue.empty() )
+    size_t neighbourhoodSize = _spatialDb->GetNodeCount(NodeRelationType::Neighbour);
+    while ( neighbourhoodSize < _config->neighbourhoodTargetSize() && ! nodesToAskQueue.empty() )
     {
-        // Get next candidate
-        NodeInfo neighbourCandidate = nodesToAskQueue.front();
-        nodesToAskQueue.pop_front();
-        
-        // Skip it if has been processed already
-        auto askedIt = askedNodeIds.find( neighbourCandidate.id() );
-        if ( askedIt != askedNodeIds.end() )
-            { continue; }
-        
-        try
+        // Ask as many candidates at once as neighbours are still missing
+        size_t batchSize = _config->neighbourhoodTargetSize() - neighbourhoodSize;
+        vector<PendingRelation> pendingRelations;
+        vector< future< vector<NodeInfo> > > pendingCandidates;
+        while ( pendingCandidates.size() < batchSize && ! nodesToAskQueue.empty() )
         {
+            // Get next candidate
+            NodeInfo neighbourCandidate = nodesToAskQueue.front();
+            nodesToAskQueue.pop_front();
+            
+            // Skip it if has been processed already, mark it otherwise
+            if ( ! askedNodeIds.insert( neighbourCandidate.id() ).second )
+                { continue; }
+            
             // Try connecting to the node
-            shared_ptr<INodeMethods> candidateProxy = SafeConnectTo( neighbourCandidate.contact().nodeEndpoint() );
+            shared_ptr<IAsyncNodeMethods> candidateProxy = SafeConnectToAsync( neighbourCandidate.contact().nodeEndpoint() );
             if (candidateProxy == nullptr)
                 { continue; }
             
             // Try to add node as neighbour, reusing connection
-            SafeStoreNode( NodeDbEntry(neighbourCandidate, NodeRelationType::Neighbour, NodeContactRoleType::Initiator),
-                           candidateProxy );
+            RequestRelation( NodeDbEntry(neighbourCandidate, NodeRelationType::Neighbour, NodeContactRoleType::Initiator),
+                             candidateProxy, pendingRelations );
             
             // Get its neighbours closest to us
-            vector<NodeInfo> newNeighbourCandidates = candidateProxy->GetClosestNodesByDistance(
+            pendingCandidates.push_back( candidateProxy->GetClosestNodesByDistance(
                 myNode.location(), numeric_limits<Distance>::max(),
-                _config->neighbourhoodTargetSize(), Neighbours::Included );
-            
-            // Mark current node as processed and append new neighbour candidates to our todo list
-            askedNodeIds.insert( neighbourCandidate.id() );
-            nodesToAskQueue.insert( nodesToAskQueue.end(),
-                newNeighbourCandidates.begin(), newNeighbourCandidates.end() );
+                _config->neighbourhoodTargetSize(), Neighbours::Included ) );
         }
-        catch (exception &e) {
-            LOG(WARNING) << "Failed to add neighbour node: " << e.what();
-            // TODO consider what else to do here?
+        
+        for (auto &pending : pendingRelations)
+            { CompleteRelation(pending); }
+        for (auto &pending : pendingCandidates)
+        {
+            // Append new neighbour candidates to our todo list
+            try
+            {
+                vector<NodeInfo> newNeighbourCandidates = AwaitRemote(pending);
+                nodesToAskQueue.insert( nodesToAskQueue.end(),
+                    newNeighbourCandidates.begin(), newNeighbourCandidates.end() );
+            }
+            catch (exception &e) {
+                LOG(WARNING) << "Failed to add neighbour node: " << e.what();
+                // TODO consider what else to do here?
+            }
         }
+        neighbourhoodSize = _spatialDb->GetNodeCount(NodeRelationType::Neighbour);
     }
     
-    LOG(DEBUG) << "Neighbourhood discovery finished with total node count " << GetNodeCount()
+    LOG_DEBUG(Node) << "Neighbourhood discovery finished with total node count " << GetNodeCount()
                << ", neighbourhood size is " << _spatialDb->GetNodeCount(NodeRelationType::Neighbour);
     return true;
 }
@@ -769,7 +1075,7 @@ bool Node::InitializeNeighbourhood(const vector<NetworkEndpoint> &seedNodes)
 void Node::ExpireOldNodes()
 {
 //     size_t sizeBefore = _spatialDb->GetNodeCount();
-    LOG(DEBUG) << "Deleting expired node connections";
+    LOG_DEBUG(Node) << "Deleting expired node connections";
     _spatialDb->ExpireOldNodes();
     if ( _spatialDb->GetNodeCount() <= 1 && ! _config->isTestMode() )
     {
@@ -784,19 +1090,21 @@ void Node::ExpireOldNodes()
 void Node::RenewNodeRelations()
 {
     vector<NodeDbEntry> nodesToContact( _spatialDb->GetNodes(NodeContactRoleType::Initiator) );
-    LOG(DEBUG) << "We have " << nodesToContact.size() << " relations to renew";
+    LOG_DEBUG(Node) << "We have " << nodesToContact.size() << " relations to renew";
+    
+    // Send all renewal requests before waiting for any response,
+    // so round-trips to remote nodes overlap instead of adding up
+    vector<PendingRelation> pendingRenewals;
     for (auto const &node : nodesToContact)
     {
-        try
-        {
-            bool renewed = SafeStoreNode(node);
-            LOG(DEBUG) << "Attempted renewing relation with node " << node.id() << ", result: " << renewed;
-        }
-        catch (exception &e)
-        {
-            LOG(WARNING) << "Unexpected error renewing relation with node "
-                         << node.id() << " : " << e.what();
-        }
+        if (! RequestRelation(node, shared_ptr<IAsyncNodeMethods>(), pendingRenewals) )
+            { LOG_DEBUG(Node) << "Relation with node " << node.id() << " is not to be renewed"; }
+    }
+    
+    for (auto &pending : pendingRenewals)
+    {
+        bool renewed = CompleteRelation(pending);
+        LOG_DEBUG(Node) << "Attempted renewing relation with node " << pending.entry.id() << ", result: " << renewed;
     }
 }
 
@@ -804,27 +1112,26 @@ void Node::RenewNodeRelations()
 void Node::RenewNeighbours()
 {
     vector<NodeDbEntry> neighbours( _spatialDb->GetNeighbourNodesByDistance() );
-    LOG(DEBUG) << "Updating changed node details on " << neighbours.size() << " neighbours";
+    LOG_DEBUG(Node) << "Updating changed node details on " << neighbours.size() << " neighbours";
+    
+    vector<PendingRelation> pendingUpdates;
     for (auto const &neighbour : neighbours)
     {
-        try
-        {
-            bool updated = SafeStoreNode( NodeDbEntry(neighbour,
-                NodeRelationType::Neighbour, NodeContactRoleType::Initiator) );
-            LOG(DEBUG) << "Attempted updating changed self info on neighbour " << neighbour.id() << ", result: " << updated;
-        }
-        catch (exception &e)
-        {
-            LOG(WARNING) << "Unexpected error updating changed self info on neighbour "
-                         << neighbour.id() << " : " << e.what();
-        }
+        RequestRelation( NodeDbEntry(neighbour, NodeRelationType::Neighbour, NodeContactRoleType::Initiator),
+                         shared_ptr<IAsyncNodeMethods>(), pendingUpdates );
+    }
+    
+    for (auto &pending : pendingUpdates)
+    {
+        bool updated = CompleteRelation(pending);
+        LOG_DEBUG(Node) << "Attempted updating changed self info on neighbour " << pending.entry.id() << ", result: " << updated;
     }
 }
 
 
 void Node::MergeSplits()
 {
-    LOG(DEBUG) << "Detect and merge a potentially splitted network";
+    LOG_DEBUG(Node) << "Detect and merge a potentially splitted network";
     auto seeds = _config->seedNodes();
     mt19937 generator( _randomDevice() );
     std::uniform_int_distribution<int> randomRange( 0, seeds.size() - 1 );
@@ -832,50 +1139,69 @@ void Node::MergeSplits()
     advance( selectedSeed, randomRange(generator) );
 
     // Connect to closest node
-    shared_ptr<INodeMethods> seedProxy = SafeConnectTo(*selectedSeed);
+    shared_ptr<IAsyncNodeMethods> seedProxy = SafeConnectToAsync(*selectedSeed);
     if (seedProxy == nullptr)
     {
-        LOG(DEBUG) << "Failed to contact seed node " << *selectedSeed;
+        LOG_DEBUG(Node) << "Failed to contact seed node " << *selectedSeed;
         return;
     }
     
-    vector<NodeInfo> randomNodes( seedProxy->GetRandomNodes(MERGE_RANDOM_NODE_COuNT, Neighbours::Included) );
-    for (auto node : randomNodes)
+    future< vector<NodeInfo> > randomNodesResponse = seedProxy->GetRandomNodes(MERGE_RANDOM_NODE_COuNT, Neighbours::Included);
+    vector<NodeInfo> randomNodes( AwaitRemote(randomNodesResponse) );
+    
+    // Ask all random nodes to be colleagues at once, then the accepting ones to be neighbours
+    vector<PendingRelation> colleagueRequests;
+    for (auto const &node : randomNodes)
     {
-        shared_ptr<INodeMethods> nodeProxy = SafeConnectTo( node.contact().nodeEndpoint() );
+        shared_ptr<IAsyncNodeMethods> nodeProxy = SafeConnectToAsync( node.contact().nodeEndpoint() );
         if (nodeProxy == nullptr)
         {
-            LOG(DEBUG) << "Failed to contact random node " << node;
-            return;
+            LOG_DEBUG(Node) << "Failed to contact random node " << node;
+            continue;
         }
         
-        bool colleague = SafeStoreNode( NodeDbEntry( node,
-            NodeRelationType::Colleague, NodeContactRoleType::Initiator), nodeProxy );
-        if (colleague)
+        RequestRelation( NodeDbEntry( node, NodeRelationType::Colleague, NodeContactRoleType::Initiator),
+                         nodeProxy, colleagueRequests );
+    }
+    
+    vector<PendingRelation> neighbourRequests;
+    for (auto &pending : colleagueRequests)
+    {
+        if ( CompleteRelation(pending) )
         {
-            SafeStoreNode( NodeDbEntry( node,
-                NodeRelationType::Neighbour, NodeContactRoleType::Initiator), nodeProxy );
+            RequestRelation( NodeDbEntry( pending.entry, NodeRelationType::Neighbour, NodeContactRoleType::Initiator),
+                             pending.nodeProxy, neighbourRequests );
         }
     }
+    for (auto &pending : neighbourRequests)
+        { CompleteRelation(pending); }
     
-    LOG(DEBUG) << "Merge finished";
+    LOG_DEBUG(Node) << "Merge finished";
 }
 
 
 void Node::DiscoverUnknownAreas()
 {
-    LOG(DEBUG) << "Exploring white spots of the map";
+    LOG_DEBUG(Node) << "Exploring white spots of the map";
+    mt19937 generator( _randomDevice() );
+    _coverageGrid.UpdateKnownNodes( _spatialDb->GetRandomNodes(
+        _spatialDb->GetNodeCount(), Neighbours::Included ) );
+    NodeInfo myNodeInfo = _spatialDb->ThisNode();
+    
+    // Send all probes at once, then contact the nodes discovered by them at once
+    struct Probe
+    {
+        GpsLocation                 location;
+        future< vector<NodeInfo> >  closestNodes;
+    };
+    vector<Probe> probes;
     for (size_t i = 0; i < PERIODIC_DISCOVERY_ATTEMPT_COUNT; ++i)
     {
-        // Generate a random GPS location
-        uniform_real_distribution<GpsCoordinate> latitudeRange(-90.0, 90.0);
-        uniform_real_distribution<GpsCoordinate> longitudeRange(-180.0, 180.0);
-        GpsLocation randomLocation( latitudeRange(_randomDevice), longitudeRange(_randomDevice) );
-            
+        // Generate a random GPS location, preferably in populated but not well covered areas
+        GpsLocation randomLocation = _coverageGrid.SelectProbeLocation(generator);
+        
         try
         {
-            NodeInfo myNodeInfo = _spatialDb->ThisNode();
-            
             // Get node closest to this position that is already present in our database
             vector<NodeInfo> myClosestNodes = GetClosestNodesByDistance(
                 randomLocation, numeric_limits<Distance>::max(), 2, Neighbours::Excluded );
@@ -886,52 +1212,83 @@ void Node::DiscoverUnknownAreas()
                 myClosestNodes[0] : myClosestNodes[1];
             
             // Connect to closest node
-            shared_ptr<INodeMethods> knownNodeProxy = SafeConnectTo( myClosestNode.contact().nodeEndpoint() );
+            shared_ptr<IAsyncNodeMethods> knownNodeProxy = SafeConnectToAsync( myClosestNode.contact().nodeEndpoint() );
             if (knownNodeProxy == nullptr)
             {
-                LOG(DEBUG) << "Failed to contact known node " << myClosestNode;
+                LOG_DEBUG(Node) << "Failed to contact known node " << myClosestNode;
                 continue;
             }
             
             // Ask closest node about its nodes closest to the random position
-            vector<NodeInfo> newClosestNodes = knownNodeProxy->GetClosestNodesByDistance(
-                randomLocation, numeric_limits<Distance>::max(), 1, Neighbours::Included );
-            if ( newClosestNodes.empty() || newClosestNodes[0].id() == myNodeInfo.id() )
+            probes.push_back( Probe{ randomLocation, knownNodeProxy->GetClosestNodesByDistance(
+                randomLocation, numeric_limits<Distance>::max(), 1, Neighbours::Included ) } );
+        }
+        catch (exception &ex)
+        {
+            LOG(INFO) << "Failed to discover location " << randomLocation << ": " << ex.what();
+        }
+    }
+    
+    unordered_set<NodeId> discoveredNodeIds;
+    vector<PendingRelation> neighbourRequests;
+    vector<PendingRelation> colleagueRequests;
+    for (auto &probe : probes)
+    {
+        try
+        {
+            vector<NodeInfo> newClosestNodes = AwaitRemote(probe.closestNodes);
+            if ( newClosestNodes.empty() )
+                { continue; }
+            _coverageGrid.RecordProbe( probe.location, newClosestNodes[0].location() );
+            if ( newClosestNodes[0].id() == myNodeInfo.id() )
                 { continue; }
             const auto &newClosestNode = newClosestNodes[0];
-            LOG(DEBUG) << "Closest node to random position is " << newClosestNode;
+            LOG_DEBUG(Node) << "Closest node to random position is " << newClosestNode;
             
             // If we already know this node, nothing to do here, renewals will keep it alive
             shared_ptr<NodeInfo> storedInfo = _spatialDb->Load( newClosestNode.id() );
             if (storedInfo != nullptr)
             {
-                LOG(DEBUG) << "Closest node is already present: " << *storedInfo;
+                LOG_DEBUG(Node) << "Closest node is already present: " << *storedInfo;
                 continue;
             }
+            // Several probes may have found the same node
+            if ( ! discoveredNodeIds.insert( newClosestNode.id() ).second )
+                { continue; }
             
             // Connect to closest node
-            shared_ptr<INodeMethods> discoveredNodeProxy = SafeConnectTo( newClosestNode.contact().nodeEndpoint() );
+            shared_ptr<IAsyncNodeMethods> discoveredNodeProxy = SafeConnectToAsync( newClosestNode.contact().nodeEndpoint() );
             if (discoveredNodeProxy == nullptr)
             {
-                LOG(DEBUG) << "Failed to contact discovered node " << newClosestNode;
+                LOG_DEBUG(Node) << "Failed to contact discovered node " << newClosestNode;
                 continue;
             }
             
             // Try to add node to our database
-            bool storedAsNeighbour = SafeStoreNode( NodeDbEntry( newClosestNode,
-                NodeRelationType::Neighbour, NodeContactRoleType::Initiator), discoveredNodeProxy );
-            if (! storedAsNeighbour) {
-                SafeStoreNode( NodeDbEntry( newClosestNode,
-                    NodeRelationType::Colleague, NodeContactRoleType::Initiator), discoveredNodeProxy );
+            bool askedAsNeighbour = RequestRelation( NodeDbEntry( newClosestNode,
+                NodeRelationType::Neighbour, NodeContactRoleType::Initiator), discoveredNodeProxy, neighbourRequests );
+            if (! askedAsNeighbour) {
+                RequestRelation( NodeDbEntry( newClosestNode,
+                    NodeRelationType::Colleague, NodeContactRoleType::Initiator), discoveredNodeProxy, colleagueRequests );
             }
         }
         catch (exception &ex)
         {
-            LOG(INFO) << "Failed to discover location " << randomLocation << ": " << ex.what();
+            LOG(INFO) << "Failed to discover location " << probe.location << ": " << ex.what();
+        }
+    }
+    
+    for (auto &pending : neighbourRequests)
+    {
+        if (! CompleteRelation(pending) ) {
+            RequestRelation( NodeDbEntry( pending.entry,
+                NodeRelationType::Colleague, NodeContactRoleType::Initiator), pending.nodeProxy, colleagueRequests );
         }
     }
+    for (auto &pending : colleagueRequests)
+        { CompleteRelation(pending); }
     
-    LOG(DEBUG) << "Exploration finished";
+    LOG_DEBUG(Node) << "Exploration finished";
 }
 
 
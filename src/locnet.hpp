@@ -1,6 +1,10 @@
 #ifndef __LOCNET_BUSINESS_LOGIC_H__
 #define __LOCNET_BUSINESS_LOGIC_H__
 
+#include <chrono>
+#include <functional>
+#include <future>
+#include <mutex>
 #include <random>
 #include <unordered_map>
 
@@ -55,6 +59,29 @@ public:
 };
 
 
+// Asynchronous variant of INodeMethods for potentially remote nodes. Calls return immediately,
+// so a few threads can keep many remote operations in flight.
+class IAsyncNodeMethods
+{
+public:
+    
+    virtual ~IAsyncNodeMethods() {}
+    
+    virtual std::future<NodeInfo> GetNodeInfo() const = 0;
+    virtual std::future<size_t> GetNodeCount() const = 0;
+    virtual std::future< std::vector<NodeInfo> > GetRandomNodes(
+        size_t maxNodeCount, Neighbours filter) const = 0;
+    
+    virtual std::future< std::vector<NodeInfo> > GetClosestNodesByDistance(const GpsLocation &location,
+        Distance radiusKm, size_t maxNodeCount, Neighbours filter) const = 0;
+    
+    virtual std::future< std::shared_ptr<NodeInfo> > AcceptColleague(const NodeInfo &node) = 0;
+    virtual std::future< std::shared_ptr<NodeInfo> > RenewColleague (const NodeInfo &node) = 0;
+    virtual std::future< std::shared_ptr<NodeInfo> > AcceptNeighbour(const NodeInfo &node) = 0;
+    virtual std::future< std::shared_ptr<NodeInfo> > RenewNeighbour (const NodeInfo &node) = 0;
+};
+
+
 // Interface provided to serve higher level services and clients
 class IClientMethods
 {
@@ -98,6 +125,73 @@ public:
     virtual ~INodeProxyFactory() {}
     
     virtual std::shared_ptr<INodeMethods> ConnectTo(const NetworkEndpoint &endpoint) = 0;
+    // Unless overridden, the blocking proxy returned by ConnectTo() is adapted
+    virtual std::shared_ptr<IAsyncNodeMethods> ConnectToAsync(const NetworkEndpoint &endpoint);
+};
+
+
+
+// Adapts blocking node methods to the asynchronous interface by completing calls immediately
+// on the calling thread. Suited for in-process nodes (e.g. in tests) where calls are fast.
+class AsyncNodeMethodsAdapter : public IAsyncNodeMethods
+{
+    std::shared_ptr<INodeMethods> _node;
+    
+public:
+    
+    AsyncNodeMethodsAdapter(std::shared_ptr<INodeMethods> node);
+    
+    std::future<NodeInfo> GetNodeInfo() const override;
+    std::future<size_t> GetNodeCount() const override;
+    std::future< std::vector<NodeInfo> > GetRandomNodes(
+        size_t maxNodeCount, Neighbours filter) const override;
+    
+    std::future< std::vector<NodeInfo> > GetClosestNodesByDistance(const GpsLocation &location,
+        Distance radiusKm, size_t maxNodeCount, Neighbours filter) const override;
+    
+    std::future< std::shared_ptr<NodeInfo> > AcceptColleague(const NodeInfo &node) override;
+    std::future< std::shared_ptr<NodeInfo> > RenewColleague (const NodeInfo &node) override;
+    std::future< std::shared_ptr<NodeInfo> > AcceptNeighbour(const NodeInfo &node) override;
+    std::future< std::shared_ptr<NodeInfo> > RenewNeighbour (const NodeInfo &node) override;
+};
+
+
+
+// Coarse grid over the map that keeps track of node density known by us and the outcome
+// of previous discovery attempts. Used to select discovery probe locations that are likely
+// populated but not covered well yet instead of uniform random ones.
+class CoverageGrid
+{
+public:
+    
+    static const size_t CellSizeDegrees = 10;
+    static const size_t LatitudeCellCount  = 180 / CellSizeDegrees;
+    static const size_t LongitudeCellCount = 360 / CellSizeDegrees;
+    
+private:
+    
+    struct Cell
+    {
+        size_t knownNodeCount = 0;
+        size_t probeCount     = 0;
+        size_t hitCount       = 0; // Probes that found a node inside the probed cell
+        size_t missStreak     = 0; // Consecutive probes that found no node inside the cell
+    };
+    
+    mutable std::mutex  _mutex;
+    std::vector<Cell>   _cells;
+    
+    double CellWeight(size_t cellIndex) const;
+    
+public:
+    
+    CoverageGrid();
+    
+    static size_t CellIndex(const GpsLocation &location);
+    
+    void UpdateKnownNodes(const std::vector<NodeDbEntry> &nodes);
+    GpsLocation SelectProbeLocation(std::mt19937 &generator) const;
+    void RecordProbe(const GpsLocation &probeLocation, const GpsLocation &closestNodeLocation);
 };
 
 
@@ -112,10 +206,38 @@ class Node : public ILocalServiceMethods, public IClientMethods, public INodeMet
     std::shared_ptr<ISpatialDatabase>          _spatialDb;
     mutable std::shared_ptr<INodeProxyFactory> _proxyFactory;
     
+    CoverageGrid _coverageGrid;
+    
+    std::mutex                 _selfInfoChangedMutex;
+    std::function<void()>      _selfInfoChangedCallback;
     
-    std::shared_ptr<INodeMethods> SafeConnectTo(const NetworkEndpoint &endpoint) const;
-    bool SafeStoreNode( const NodeDbEntry &entry,
-        std::shared_ptr<INodeMethods> nodeProxy = std::shared_ptr<INodeMethods>() );
+    
+    // Permission asked from a remote node to store it, the answer is collected later
+    struct PendingRelation
+    {
+        NodeDbEntry                                 entry;
+        std::shared_ptr<NodeDbEntry>                storedInfo;
+        std::shared_ptr<IAsyncNodeMethods>          nodeProxy;
+        std::future< std::shared_ptr<NodeInfo> >    response;
+    };
+    
+    std::shared_ptr<IAsyncNodeMethods> SafeConnectToAsync(const NetworkEndpoint &endpoint) const;
+    bool SafeStoreNode(const NodeDbEntry &entry);
+    
+    // Steps of SafeStoreNode() to be used separately when asking the node for permission asynchronously
+    bool IsStoreAllowed(const NodeDbEntry &plannedEntry, std::shared_ptr<NodeDbEntry> &storedInfo);
+    bool StoreAcceptedNode( const NodeDbEntry &plannedEntry, std::shared_ptr<NodeDbEntry> storedInfo,
+                            std::shared_ptr<NodeInfo> freshInfo );
+    // Send all requests first and complete them afterwards to keep many of them in flight.
+    // Returns false without a pending request if storing is not allowed or the node is unreachable.
+    bool RequestRelation( const NodeDbEntry &plannedEntry, std::shared_ptr<IAsyncNodeMethods> nodeProxy,
+                          std::vector<PendingRelation> &pendingRelations );
+    bool CompleteRelation(PendingRelation &pending);
+    // Wait for the result of a remote call, bounded even if the reactor completing it is stalled
+    template <typename Result>
+    Result AwaitRemote(std::future<Result> &result) const;
+    
+    void ScheduleSelfInfoUpdate();
     
     bool InitializeWorld(const std::vector<NetworkEndpoint> &seedNodes);
     bool InitializeNeighbourhood(const std::vector<NetworkEndpoint> &seedNodes);
@@ -135,7 +257,11 @@ public:
     
     void EnsureMapFilled();
     
-    void DetectedExternalAddress(const Address &address);
+    // Called on changes of self info instead of updating neighbours right away,
+    // e.g. to coalesce changes into a single RenewNeighbours() after a quiet period
+    void selfInfoChangedCallback(std::function<void()> callback);
+    
+    void DetectedExternalAddress(const IpAddress &address);
     
     void ExpireOldNodes();
     void RenewNodeRelations();
@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#include "logging.hpp"
+
+using namespace std;
+
+
+
+namespace LocNet
+{
+
+
+const size_t AsyncLogBackend::DefaultRingCapacity;
+const chrono::milliseconds AsyncLogBackend::FlushInterval = chrono::milliseconds(100);
+
+atomic<uint64_t> AsyncLogBackend::_nextBackendId(1);
+AsyncLogBackend AsyncLogBackend::_instance;
+
+AsyncLogBackend& AsyncLogBackend::Instance()
+    { return _instance; }
+
+
+
+AsyncLogBackend::Ring::Ring(size_t capacity) :
+    _records(capacity), _mask(capacity - 1), _head(0), _tail(0), abandoned(false) {}
+
+
+AsyncLogBackend::Record* AsyncLogBackend::Ring::BeginPush()
+{
+    size_t tail = _tail.load(memory_order_relaxed);
+    if ( tail - _head.load(memory_order_acquire) >= _records.size() )
+        { return nullptr; }
+    return &_records[tail & _mask];
+}
+
+
+void AsyncLogBackend::Ring::EndPush()
+    { _tail.store( _tail.load(memory_order_relaxed) + 1, memory_order_release ); }
+
+
+size_t AsyncLogBackend::Ring::Drain( function<void(const Record&)> consumer )
+{
+    size_t head = _head.load(memory_order_relaxed);
+    size_t tail = _tail.load(memory_order_acquire);
+    for (size_t idx = head; idx != tail; ++idx)
+        { consumer( _records[idx & _mask] ); }
+    // NOTE slots are released only after consuming them, the producer may reuse them from now on
+    _head.store(tail, memory_order_release);
+    return tail - head;
+}
+
+
+bool AsyncLogBackend::Ring::IsEmpty() const
+    { return _head.load(memory_order_acquire) == _tail.load(memory_order_acquire); }
+
+
+
+// Rings of the current thread for each backend, marked abandoned when the thread exits
+class AsyncLogBackend::ThreadRings
+{
+    vector< pair< uint64_t, shared_ptr<Ring> > > _rings;
+
+public:
+
+    ~ThreadRings()
+    {
+        for (auto &ring : _rings)
+            { ring.second->abandoned = true; }
+    }
+
+    Ring* Find(uint64_t backendId)
+    {
+        for (auto &ring : _rings)
+            { if (ring.first == backendId) { return ring.second.get(); } }
+        return nullptr;
+    }
+
+    void Add(uint64_t backendId, shared_ptr<Ring> ring)
+        { _rings.emplace_back(backendId, ring); }
+};
+
+
+
+AsyncLogBackend::AsyncLogBackend(size_t ringCapacity) :
+    _id( _nextBackendId++ ), _ringCapacity(1), _droppedCount(0), _writtenCount(0), _writerStopped(false)
+{
+    // Round capacity up to a power of two to find slots by masking the sequence numbers
+    while (_ringCapacity < ringCapacity)
+        { _ringCapacity <<= 1; }
+}
+
+
+AsyncLogBackend::~AsyncLogBackend()
+    { Shutdown(); }
+
+
+size_t AsyncLogBackend::droppedCount() const
+    { return _droppedCount; }
+
+size_t AsyncLogBackend::writtenCount() const
+    { return _writtenCount; }
+
+
+void AsyncLogBackend::Start(const string &logPath)
+{
+    lock_guard<mutex> writerGuard(_writerMutex);
+    if ( _writerThread.joinable() )
+        { return; }
+
+    if ( _file.is_open() )
+        { _file.close(); }
+    _file.open(logPath, ios::out | ios::app);
+    if (! _file)
+        { throw runtime_error("Failed to open log file " + logPath); }
+    _shutdown = false;
+    _writerStopped = false;
+    _writerThread = thread( [this] { WriterLoop(); } );
+}
+
+
+void AsyncLogBackend::Shutdown()
+{
+    {
+        lock_guard<mutex> writerGuard(_writerMutex);
+        if ( ! _writerThread.joinable() )
+            { return; }
+        _shutdown = true;
+    }
+    _flushRequested.notify_one();
+    _writerThread.join();
+    
+    // NOTE the file is kept open, records appended meanwhile or later are written by their own threads
+    lock_guard<mutex> writerGuard(_writerMutex);
+    _writerStopped = true;
+    WriteBatch();
+}
+
+
+void AsyncLogBackend::Flush()
+    { _flushRequested.notify_one(); }
+
+
+
+AsyncLogBackend::Ring& AsyncLogBackend::ThreadRing()
+{
+    static thread_local ThreadRings threadRings;
+    Ring *ring = threadRings.Find(_id);
+    if (ring == nullptr)
+    {
+        shared_ptr<Ring> newRing( new Ring(_ringCapacity) );
+        {
+            lock_guard<mutex> ringsGuard(_ringsMutex);
+            _rings.push_back(newRing);
+        }
+        threadRings.Add(_id, newRing);
+        ring = newRing.get();
+    }
+    return *ring;
+}
+
+
+bool AsyncLogBackend::Append( el::Level level, const string &file, unsigned long line, const string &message )
+{
+    Ring &ring = ThreadRing();
+    Record *record = ring.BeginPush();
+    if (record == nullptr)
+    {
+        ++_droppedCount;
+        return false;
+    }
+
+    // NOTE assigning reuses the storage of strings in the slot, no allocation after warming up
+    record->level = level;
+    record->time  = chrono::system_clock::now();
+    record->file.assign(file);
+    record->line  = line;
+    record->message.assign(message);
+    ring.EndPush();
+
+    // NOTE checked after pushing: if shutdown missed this record, the flag is already visible here
+    if (_writerStopped)
+    {
+        lock_guard<mutex> writerGuard(_writerMutex);
+        WriteBatch();
+        return true;
+    }
+    if (level == el::Level::Error || level == el::Level::Fatal)
+        { Flush(); }
+    return true;
+}
+
+
+
+static void FormatRecordTime(ostream &out, chrono::system_clock::time_point time)
+{
+    time_t seconds = chrono::system_clock::to_time_t(time);
+    tm localTime;
+#ifndef _WIN32
+    localtime_r(&seconds, &localTime);
+#else
+    localtime_s(&localTime, &seconds);
+#endif
+    char buffer[32];
+    strftime( buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &localTime );
+    auto millis = chrono::duration_cast<chrono::milliseconds>( time.time_since_epoch() ).count() % 1000;
+    out << buffer << ',' << setw(3) << setfill('0') << millis;
+}
+
+
+size_t AsyncLogBackend::WriteBatch()
+{
+    vector< shared_ptr<Ring> > rings;
+    {
+        lock_guard<mutex> ringsGuard(_ringsMutex);
+        rings = _rings;
+    }
+
+    ostringstream batch;
+    size_t recordCount = 0;
+    for (auto &ring : rings)
+    {
+        recordCount += ring->Drain( [&batch] (const Record &record)
+        {
+            // Same layout as configured for easylogging++: %datetime %level %msg (%fbase:%line)
+            FormatRecordTime(batch, record.time);
+            size_t baseNamePos = record.file.find_last_of("/\\");
+            batch << ' ' << el::LevelHelper::convertToString(record.level) << ' ' << record.message << " ("
+                  << ( baseNamePos == string::npos ? record.file : record.file.substr(baseNamePos + 1) )
+                  << ':' << record.line << ')' << '\n';
+        } );
+    }
+
+    size_t droppedCount = _droppedCount;
+    if (droppedCount != _reportedDroppedCount)
+    {
+        FormatRecordTime( batch, chrono::system_clock::now() );
+        batch << " WARNING " << droppedCount - _reportedDroppedCount
+              << " log records were dropped because logging threads were faster than the log file\n";
+        _reportedDroppedCount = droppedCount;
+    }
+
+    const string &batchContent = batch.str();
+    if ( ! batchContent.empty() )
+    {
+        _file.write( batchContent.data(), batchContent.size() );
+        _file.flush();
+    }
+    _writtenCount += recordCount;
+
+    // Remove rings of exited threads, nothing can be appended to them anymore
+    lock_guard<mutex> ringsGuard(_ringsMutex);
+    _rings.erase( remove_if( _rings.begin(), _rings.end(),
+        [] (const shared_ptr<Ring> &ring) { return ring->abandoned && ring->IsEmpty(); } ), _rings.end() );
+    return recordCount;
+}
+
+
+void AsyncLogBackend::WriterLoop()
+{
+    unique_lock<mutex> writerGuard(_writerMutex);
+    while (! _shutdown)
+    {
+        _flushRequested.wait_for(writerGuard, FlushInterval);
+        writerGuard.unlock();
+        WriteBatch();
+        writerGuard.lock();
+    }
+    writerGuard.unlock();
+    // Write records appended since the last batch before exiting
+    WriteBatch();
+}
+
+
+
+void AsyncLogDispatcher::handle(const el::LogDispatchData *data)
+{
+    if ( data->dispatchAction() != el::base::DispatchAction::NormalLog )
+        { return; }
+    const el::LogMessage *message = data->logMessage();
+    AsyncLogBackend::Instance().Append( message->level(), message->file(), message->line(), message->message() );
+}
+
+
+
+} // namespace LocNet
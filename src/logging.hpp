@@ -0,0 +1,126 @@
+#ifndef __LOCNET_ASYNC_LOGGING_H__
+#define __LOCNET_ASYNC_LOGGING_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <easylogging++.h>
+
+
+
+namespace LocNet
+{
+
+
+// Log file backend that takes formatting and file output off the logging threads.
+// Every thread appends compact records into its own lock-free single producer ring buffer,
+// a background thread formats and writes them to the log file in batches.
+// If a ring is full, new records of that thread are dropped and counted instead of waiting.
+class AsyncLogBackend
+{
+public:
+
+    static const size_t DefaultRingCapacity = 4096;
+    static const std::chrono::milliseconds FlushInterval;
+
+private:
+
+    struct Record
+    {
+        el::Level                               level = el::Level::Unknown;
+        std::chrono::system_clock::time_point   time;
+        std::string                             file;
+        unsigned long                           line = 0;
+        std::string                             message;
+    };
+
+    class Ring
+    {
+        std::vector<Record>     _records;
+        size_t                  _mask;
+        std::atomic<size_t>     _head;  // Next record to be consumed, written by consumer only
+        std::atomic<size_t>     _tail;  // Next free slot, written by producer only
+
+    public:
+
+        std::atomic<bool>       abandoned; // Producer thread exited, ring can be removed when drained
+
+        Ring(size_t capacity);
+
+        Record* BeginPush();
+        void EndPush();
+        size_t Drain( std::function<void(const Record&)> consumer );
+        bool IsEmpty() const;
+    };
+
+    class ThreadRings;
+
+    static std::atomic<uint64_t> _nextBackendId;
+    static AsyncLogBackend _instance;
+
+    uint64_t                            _id;
+    size_t                              _ringCapacity;
+    std::atomic<size_t>                 _droppedCount;
+    std::atomic<size_t>                 _writtenCount;
+    size_t                              _reportedDroppedCount = 0; // Used by writer thread only
+
+    std::mutex                          _ringsMutex;
+    std::vector< std::shared_ptr<Ring> > _rings;
+
+    std::mutex                          _writerMutex;
+    std::condition_variable             _flushRequested;
+    bool                                _shutdown = false;
+    std::atomic<bool>                   _writerStopped; // Records are written by their threads after shutdown
+    std::ofstream                       _file;
+    std::thread                         _writerThread;
+
+    Ring& ThreadRing();
+    void WriterLoop();
+    size_t WriteBatch();
+
+public:
+
+    static AsyncLogBackend& Instance();
+
+    AsyncLogBackend(size_t ringCapacity = DefaultRingCapacity);
+    ~AsyncLogBackend();
+
+    size_t droppedCount() const;
+    size_t writtenCount() const;
+
+    // Records may be appended before starting, they are kept until the rings are full
+    void Start(const std::string &logPath);
+    // Write all pending records and stop the writer thread, later records are written synchronously
+    void Shutdown();
+
+    // Never blocks until shut down, returns false if the record was dropped
+    bool Append( el::Level level, const std::string &file, unsigned long line, const std::string &message );
+    // Wake up the writer thread instead of waiting for the next flush interval
+    void Flush();
+};
+
+
+
+// Forwards easylogging++ messages to the shared asynchronous backend. Install with
+// el::Helpers::installLogDispatchCallback<AsyncLogDispatcher>() and disable file output of the loggers.
+class AsyncLogDispatcher : public el::LogDispatchCallback
+{
+protected:
+
+    void handle(const el::LogDispatchData *data) override;
+};
+
+
+
+} // namespace LocNet
+
+
+#endif // __LOCNET_ASYNC_LOGGING_H__
@@ -1,7 +1,10 @@
 #include <iostream>
 #include <csignal>
+#include <set>
+#include <vector>
 
 #include "config.hpp"
+#include "logging.hpp"
 #include "server.hpp"
 
 #include <easylogging++.h>
@@ -13,6 +16,39 @@ using namespace LocNet;
 
 
 
+// Random delay of periodic jobs is at most this fraction of their period
+const uint32_t PERIODIC_JOB_JITTER_DIVISOR = 10;
+
+// Changes of self info are sent to neighbours only after no more changes arrived for a while
+const chrono::seconds SELF_INFO_UPDATE_QUIET_PERIOD = chrono::seconds(3);
+
+// Sessions to other nodes are kept open for reuse, but only a limited number of them.
+// Idle links are not reused, but closed only by the next eviction, which must run much more often.
+const size_t PEER_LINK_MAX_COUNT = 64;
+const chrono::minutes PEER_LINK_IDLE_TIMEOUT    = chrono::minutes(10);
+const chrono::minutes PEER_LINK_EVICTION_PERIOD = chrono::minutes(1);
+
+// Unreachable nodes are not contacted again until an exponentially growing backoff period
+const chrono::seconds PEER_FAILURE_INITIAL_BACKOFF = chrono::seconds(30);
+const chrono::hours   PEER_FAILURE_MAX_BACKOFF     = chrono::hours(2);
+
+// Requests waiting for a worker thread over this limit are refused instead of piling up
+const size_t DISPATCH_QUEUE_MAX_DEPTH = 1024;
+const chrono::minutes DISPATCH_STATS_LOG_PERIOD = chrono::minutes(5);
+
+// Accepted connections are closed after being idle or not sending a whole message in time.
+// NOTE other nodes keep their links to us open for reuse, those must not expire earlier,
+//      i.e. before the idle timeout and eviction period of peer links elapse.
+const chrono::seconds CONNECTION_READ_TIMEOUT = chrono::seconds(30);
+const chrono::minutes NODE_CONNECTION_IDLE_TIMEOUT   = PEER_LINK_IDLE_TIMEOUT + chrono::minutes(5);
+const chrono::minutes CLIENT_CONNECTION_IDLE_TIMEOUT = chrono::minutes(2);
+const chrono::minutes LOCAL_CONNECTION_IDLE_TIMEOUT  = chrono::minutes(10);
+const size_t NODE_MAX_CONNECTIONS               = 1024;
+const size_t NODE_MAX_CONNECTIONS_PER_ADDRESS   = 16;
+const size_t CLIENT_MAX_CONNECTIONS             = 4096;
+const size_t CLIENT_MAX_CONNECTIONS_PER_ADDRESS = 32;
+
+
 function<void(int)> mySignalHandlerFunc;
 
 void signalHandler(int signal)
@@ -22,6 +58,7 @@ void signalHandler(int signal)
 void reactorLoop(const string &threadName)
 {
     LOG(DEBUG) << "Thread " << threadName << " started";
+    Reactor::MarkReactorThread();
     while ( ! Reactor::Instance().IsShutdown() )
     {
         try
@@ -41,6 +78,106 @@ void reactorLoop(const string &threadName)
 }
 
 
+ConnectionPolicy CreateConnectionPolicy( chrono::steady_clock::duration idleTimeout,
+    size_t maxConnections, size_t maxConnectionsPerAddress )
+{
+    ConnectionPolicy policy;
+    policy.idleTimeout = idleTimeout;
+    policy.readTimeout = CONNECTION_READ_TIMEOUT;
+    policy.maxConnections = maxConnections;
+    policy.maxConnectionsPerAddress = maxConnectionsPerAddress;
+    return policy;
+}
+
+
+// Thread-per-core mode accepts connections on every core using the same port,
+// otherwise a single acceptor serves the port on the shared reactor.
+// NOTE acceptors of all cores share a single connection manager, limits apply to the port as a whole.
+vector< shared_ptr<DispatchingTcpServer> > StartServers( shared_ptr<ReactorPool> corePool,
+    TcpPort portNumber, shared_ptr<IBlockingRequestDispatcherFactory> dispatcherFactory,
+    shared_ptr<DispatchWorkerPool> workerPool, size_t pipelinedRequestCount,
+    const ConnectionPolicy &connectionPolicy )
+{
+    vector< shared_ptr<DispatchingTcpServer> > servers;
+    if (! corePool)
+        { servers.push_back( DispatchingTcpServer::Create(portNumber, dispatcherFactory) ); }
+    else for (size_t coreIndex = 0; coreIndex < corePool->coreCount(); ++coreIndex)
+    {
+        servers.push_back( DispatchingTcpServer::Create(
+            corePool->AsioService(coreIndex), portNumber, dispatcherFactory ) );
+    }
+    
+    shared_ptr<ConnectionManager> connectionManager( new ConnectionManager(connectionPolicy) );
+    for (auto &server : servers)
+    {
+        server->workerPool(workerPool);
+        server->pipelinedRequestCount(pipelinedRequestCount);
+        server->connectionManager(connectionManager);
+        server->StartListening();
+    }
+    return servers;
+}
+
+
+void LogDispatchStats(const DispatchWorkerPool &workerPool)
+{
+    DispatchQueueStats stats = workerPool.stats();
+    chrono::steady_clock::duration averageWaitTime = chrono::steady_clock::duration::zero();
+    if (stats.executedCount > 0)
+        { averageWaitTime = stats.totalWaitTime / static_cast<chrono::steady_clock::rep>(stats.executedCount); }
+    LOG(INFO) << "Request queue " << workerPool.name() << ": depth " << stats.queueDepth
+              << " (max " << stats.maxQueueDepth << "), executed " << stats.executedCount
+              << ", rejected " << stats.rejectedCount << ", average wait "
+              << chrono::duration_cast<chrono::microseconds>(averageWaitTime).count() << "us (max "
+              << chrono::duration_cast<chrono::microseconds>(stats.maxWaitTime).count() << "us)";
+}
+
+
+void LogConnectionStats( const string &interfaceName,
+    const vector< shared_ptr<DispatchingTcpServer> > &servers )
+{
+    // NOTE servers may share a connection manager, count each one only once
+    set<const ConnectionManager*> countedManagers;
+    ConnectionStats total;
+    for (auto const &server : servers)
+    {
+        if ( ! countedManagers.insert( server->connectionManager().get() ).second )
+            { continue; }
+        ConnectionStats stats = server->connectionStats();
+        total.openCount               += stats.openCount;
+        total.rejectedCount           += stats.rejectedCount;
+        total.idleEvictedCount        += stats.idleEvictedCount;
+        total.readTimeoutEvictedCount += stats.readTimeoutEvictedCount;
+    }
+    LOG(INFO) << interfaceName << " connections: " << total.openCount << " open, "
+              << total.rejectedCount << " refused over limits, " << total.idleEvictedCount << " closed when idle, "
+              << total.readTimeoutEvictedCount << " closed for slow reads";
+}
+
+
+void LogRouteStats(const RequestRouteMetrics &metrics)
+{
+    for (auto const &route : metrics.stats())
+    {
+        const RequestRouteStats &stats = route.second;
+        size_t requestCount = stats.servedCount + stats.failedCount;
+        LOG(INFO) << "Route " << route.first << ": served " << stats.servedCount << ", failed " << stats.failedCount
+                  << ", average " << chrono::duration_cast<chrono::microseconds>(stats.totalDuration).count() /
+                        static_cast<long long>( max<size_t>(requestCount, 1) )
+                  << "us (max " << chrono::duration_cast<chrono::microseconds>(stats.maxDuration).count() << "us)";
+    }
+}
+
+
+void LogSendQueueStats()
+{
+    SendQueueStats stats = AsyncMessageWriter::stats();
+    LOG(INFO) << "Send queues: " << stats.queuedFrames << " messages queued (max " << stats.maxQueueDepth
+              << " on a connection), congested " << stats.congestedCount << " times, "
+              << stats.writtenFrameCount << " messages sent in " << stats.writeCount << " writes";
+}
+
+
 
 int main(int argc, const char *argv[])
 {
@@ -61,6 +198,11 @@ int main(int argc, const char *argv[])
         el::Loggers::reconfigureAllLoggers(el::ConfigurationType::Format, "%datetime %level %msg (%fbase:%line)");
         el::Loggers::reconfigureAllLoggers(el::ConfigurationType::Filename, config->logPath());
         el::Loggers::reconfigureAllLoggers(el::Level::Trace, el::ConfigurationType::ToStandardOutput, "false");
+        // Log file is written by a background thread, logging threads only queue messages for it
+        el::Loggers::reconfigureAllLoggers(el::ConfigurationType::ToFile, "false");
+        AsyncLogBackend::Instance().Start( config->logPath() );
+        el::Helpers::installLogDispatchCallback<AsyncLogDispatcher>("AsyncLogDispatcher");
+        Diagnostics::Configure( config->diagnostics() );
         
         // Initialize server components
         NodeInfo myNodeInfo( config->myNodeInfo() );
@@ -69,24 +211,66 @@ int main(int argc, const char *argv[])
         shared_ptr<ISpatialDatabase> geodb( new SpatiaLiteDatabase(
             myNodeInfo, config->dbPath(), config->dbExpirationPeriod() ) );
 
-        TcpNodeConnectionFactory *connFactPtr = new TcpNodeConnectionFactory(config);
-        shared_ptr<INodeProxyFactory> connectionFactory(connFactPtr);
-        shared_ptr<Node> node = Node::Create(config, geodb, connectionFactory);
+        shared_ptr<TcpNodeConnectionFactory> connectionFactory( new TcpNodeConnectionFactory(config) );
+        shared_ptr<PeerFailureCache> peerFailures( new PeerFailureCache(
+            PEER_FAILURE_INITIAL_BACKOFF, PEER_FAILURE_MAX_BACKOFF ) );
+        shared_ptr<PeerLinkManager> peerLinks( new PeerLinkManager(
+            connectionFactory, peerFailures, PEER_LINK_MAX_COUNT, PEER_LINK_IDLE_TIMEOUT ) );
+        shared_ptr<Node> node = Node::Create(config, geodb, peerLinks);
+        
+        // NOTE jobs run on separate threads, the neighbour update connects to other nodes
+        shared_ptr<PeriodicScheduler> scheduler = PeriodicScheduler::Create();
+        scheduler->AddTriggeredJob( "SelfInfoUpdate", SELF_INFO_UPDATE_QUIET_PERIOD, [node]
+            { node->RenewNeighbours(); } );
+        weak_ptr<PeriodicScheduler> schedulerWeakRef(scheduler);
+        node->selfInfoChangedCallback( [schedulerWeakRef]
+        {
+            shared_ptr<PeriodicScheduler> scheduler = schedulerWeakRef.lock();
+            if (scheduler)
+                { scheduler->Trigger("SelfInfoUpdate"); }
+        } );
+        
+        shared_ptr<ReactorPool> corePool;
+        if ( config->reactorCoreCount() > 0 )
+        {
+            LOG(INFO) << "Serving node and client ports in thread-per-core mode on "
+                      << config->reactorCoreCount() << " cores";
+            corePool.reset( new ReactorPool( config->reactorCoreCount() ) );
+        }
+        
+        // Separate request queues for all interfaces so a flood on one cannot starve the others
+        shared_ptr<DispatchWorkerPool> nodeWorkers( new DispatchWorkerPool(
+            "NodeRequests", config->dispatchWorkerCount(), DISPATCH_QUEUE_MAX_DEPTH ) );
+        shared_ptr<DispatchWorkerPool> clientWorkers( new DispatchWorkerPool(
+            "ClientRequests", config->dispatchWorkerCount(), DISPATCH_QUEUE_MAX_DEPTH ) );
+        shared_ptr<DispatchWorkerPool> localWorkers( new DispatchWorkerPool(
+            "LocalRequests", config->dispatchWorkerCount(), DISPATCH_QUEUE_MAX_DEPTH ) );
 
         LOG(INFO) << "Connecting node to the network";
         shared_ptr<IBlockingRequestDispatcherFactory> nodeDispatcherFactory(
             new StaticBlockingDispatcherFactory( shared_ptr<IBlockingRequestDispatcher>(
                 new IncomingNodeRequestDispatcher(node) ) ) );
-        shared_ptr<DispatchingTcpServer> nodeTcpServer = DispatchingTcpServer::Create(
-            myNodeInfo.contact().nodePort(), nodeDispatcherFactory );
-        nodeTcpServer->StartListening();
+        vector< shared_ptr<DispatchingTcpServer> > nodeTcpServers = StartServers(
+            corePool, myNodeInfo.contact().nodePort(), nodeDispatcherFactory, nodeWorkers,
+            config->pipelinedRequestCount(), CreateConnectionPolicy( NODE_CONNECTION_IDLE_TIMEOUT,
+                NODE_MAX_CONNECTIONS, NODE_MAX_CONNECTIONS_PER_ADDRESS ) );
         
-        connFactPtr->detectedIpCallback( [node](const Address &addr)
+        connectionFactory->detectedIpCallback( [node](const IpAddress &addr)
             { node->DetectedExternalAddress(addr); } );
         
-        thread mainReactorThread( [] { reactorLoop("ReactorMain"); } );
+        vector<thread> reactorThreads;
+        for (size_t threadIdx = 0; threadIdx < config->reactorThreadCount(); ++threadIdx)
+        {
+            string threadName = "Reactor" + to_string(threadIdx);
+            reactorThreads.emplace_back( [threadName] { reactorLoop(threadName); } );
+        }
+        if (corePool)
+            { corePool->Start(); }
         node->EnsureMapFilled();
 
+        shared_ptr<RequestRouteMetrics> routeMetrics( new RequestRouteMetrics() );
+        IRequestRouteHooks::Install(routeMetrics);
+        
         LOG(INFO) << "Serving local and client interfaces";
         shared_ptr<IBlockingRequestDispatcherFactory> localDispatcherFactory(
             new LocalServiceRequestDispatcherFactory(node) );
@@ -96,57 +280,77 @@ int main(int argc, const char *argv[])
         
         shared_ptr<DispatchingTcpServer> localTcpServer = DispatchingTcpServer::Create(
             config->localServiceEndpoint().address(), config->localServiceEndpoint().port(), localDispatcherFactory );
-        shared_ptr<DispatchingTcpServer> clientTcpServer = DispatchingTcpServer::Create(
-            myNodeInfo.contact().clientPort(), clientDispatcherFactory );
-
+        // NOTE local services rely on their requests being served in order, e.g. registration before listening
+        localTcpServer->workerPool(localWorkers);
+        // NOTE subscribers of neighbourhood notifications are exempt from idle expiry
+        localTcpServer->connectionPolicy( CreateConnectionPolicy( LOCAL_CONNECTION_IDLE_TIMEOUT, 0, 0 ) );
         localTcpServer->StartListening();
-        clientTcpServer->StartListening();
+        vector< shared_ptr<DispatchingTcpServer> > clientTcpServers = StartServers(
+            corePool, myNodeInfo.contact().clientPort(), clientDispatcherFactory, clientWorkers,
+            config->pipelinedRequestCount(), CreateConnectionPolicy( CLIENT_CONNECTION_IDLE_TIMEOUT,
+                CLIENT_MAX_CONNECTIONS, CLIENT_MAX_CONNECTIONS_PER_ADDRESS ) );
         
-        // Set up signal handlers to stop on Ctrl-C and further events
-        mySignalHandlerFunc = [] (int) { Reactor::Instance().Shutdown(); };
-        signal(SIGINT,  signalHandler);
-        signal(SIGTERM, signalHandler);
-        
-        // start threads for periodic db maintenance (relation renewal and expiration) and discovery
-        thread dbMaintenanceThread( [config, node]
+        // Schedule periodic db maintenance (relation renewal and expiration) and discovery on the reactor
+        scheduler->AddJob( "DbMaintenance", config->dbMaintenancePeriod(),
+            config->dbMaintenancePeriod() / PERIODIC_JOB_JITTER_DIVISOR, [node]
         {
-            while ( ! Reactor::Instance().IsShutdown() )
-            {
-                try
-                {
-                    this_thread::sleep_for( config->dbMaintenancePeriod() );
-                    node->RenewNodeRelations();
-                    node->ExpireOldNodes();
-                }
-                catch (exception &ex)
-                    { LOG(ERROR) << "Maintenance failed: " << ex.what(); }
-            }
+            node->RenewNodeRelations();
+            node->ExpireOldNodes();
         } );
-        dbMaintenanceThread.detach();
-        
-        thread discoveryThread( [config, node]
+        scheduler->AddJob( "Discovery", config->discoveryPeriod(),
+            config->discoveryPeriod() / PERIODIC_JOB_JITTER_DIVISOR, [node]
         {
-            while ( ! Reactor::Instance().IsShutdown() )
-            {
-                try
-                {
-                    this_thread::sleep_for( config->discoveryPeriod() );
-                    node->MergeSplits();
-                    node->DiscoverUnknownAreas();
-                }
-                catch (exception &ex)
-                    { LOG(ERROR) << "Periodic discovery failed: " << ex.what(); }
-            }
+            node->MergeSplits();
+            node->DiscoverUnknownAreas();
         } );
-        discoveryThread.detach();
-
-        mainReactorThread.join();
+        scheduler->AddJob( "PeerLinkEviction", PEER_LINK_EVICTION_PERIOD,
+            PEER_LINK_EVICTION_PERIOD / PERIODIC_JOB_JITTER_DIVISOR, [peerLinks]
+        {
+            size_t evictedCount = peerLinks->EvictIdleLinks();
+            LOG(DEBUG) << "Closed " << evictedCount << " idle peer links, "
+                       << peerLinks->linkCount() << " remain open";
+        } );
+        scheduler->AddJob( "DispatchStats", DISPATCH_STATS_LOG_PERIOD,
+            DISPATCH_STATS_LOG_PERIOD / PERIODIC_JOB_JITTER_DIVISOR,
+            [nodeWorkers, clientWorkers, localWorkers, nodeTcpServers, clientTcpServers, localTcpServer, routeMetrics]
+        {
+            LogDispatchStats(*nodeWorkers);
+            LogDispatchStats(*clientWorkers);
+            LogDispatchStats(*localWorkers);
+            LogSendQueueStats();
+            LogConnectionStats("Node", nodeTcpServers);
+            LogConnectionStats("Client", clientTcpServers);
+            LogConnectionStats("Local", { localTcpServer });
+            LogRouteStats(*routeMetrics);
+        } );
+        scheduler->Start( Reactor::Instance().AsioService() );
+        
+        // Set up signal handlers to stop on Ctrl-C and further events
+        mySignalHandlerFunc = [scheduler, corePool, nodeWorkers, clientWorkers, localWorkers] (int)
+        {
+            scheduler->Shutdown();
+            nodeWorkers->Shutdown();
+            clientWorkers->Shutdown();
+            localWorkers->Shutdown();
+            Reactor::Instance().Shutdown();
+            if (corePool)
+                { corePool->Shutdown(); }
+        };
+        signal(SIGINT,  signalHandler);
+        signal(SIGTERM, signalHandler);
+        
+        for (auto &reactorThread : reactorThreads)
+            { reactorThread.join(); }
+        if (corePool)
+            { corePool->Join(); }
         
         LOG(INFO) << "Shutting down location-based network";
+        AsyncLogBackend::Instance().Shutdown();
         return 0;
     }
     catch (exception &e)
     {
         LOG(ERROR) << "Failed with exception: " << e.what();
+        AsyncLogBackend::Instance().Shutdown();
     }
 }
@@ -1,8 +1,16 @@
+#include <algorithm>
+#include <cstring>
+
 #include <easylogging++.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
 
 #include "messaging.hpp"
 
 using namespace std;
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::io::CodedOutputStream;
+using google::protobuf::internal::WireFormatLite;
 
 
 
@@ -11,7 +19,6 @@ namespace LocNet
 
 
 const GpsCoordinate GPS_COORDINATE_PROTOBUF_INT_MULTIPLIER = 1000000.;
-//const chrono::duration<int> DELAYED_DISPATCHER_TIMEOUT = chrono::seconds(10);
 
 
 
@@ -40,6 +47,7 @@ iop::locnet::Status Converter::ToProtoBuf(ErrorCode value)
         case ErrorCode::ERROR_BAD_RESPONSE:         return iop::locnet::Status::ERROR_INTERNAL;
         case ErrorCode::ERROR_CONCEPTUAL:           return iop::locnet::Status::ERROR_INTERNAL;
         case ErrorCode::ERROR_CONNECTION:           return iop::locnet::Status::ERROR_INTERNAL;
+        case ErrorCode::ERROR_TIMEOUT:              return iop::locnet::Status::ERROR_INTERNAL;
         case ErrorCode::ERROR_INTERNAL:             return iop::locnet::Status::ERROR_INTERNAL;
         case ErrorCode::ERROR_INVALID_VALUE:        return iop::locnet::Status::ERROR_INVALID_VALUE;
         case ErrorCode::ERROR_BAD_STATE:            return iop::locnet::Status::ERROR_INTERNAL;
@@ -50,15 +58,6 @@ iop::locnet::Status Converter::ToProtoBuf(ErrorCode value)
 }
 
 
-iop::locnet::GpsLocation* Converter::ToProtoBuf(const GpsLocation &location)
-{
-    auto result = new iop::locnet::GpsLocation();
-    FillProtoBuf(result, location);
-    return result;
-}
-
-
-
 // ServiceType Converter::FromProtoBuf(iop::locnet::ServiceType value)
 // {
 //     switch(value)
@@ -116,13 +115,14 @@ NodeInfo Converter::FromProtoBuf(const iop::locnet::NodeInfo& value)
     for (int idx = 0; idx < value.services_size(); ++idx)
     {
         const iop::locnet::ServiceInfo &sourceService = value.services(idx);
-        ServiceInfo service = FromProtoBuf(sourceService);
-        services[ service.type() ] = service;
+        services[ sourceService.type() ] = FromProtoBuf(sourceService);
     }
     
-    return NodeInfo( value.node_id(), FromProtoBuf( value.location() ), NodeContact(
-        NodeContact::AddressFromBytes( contact.ip_address() ), contact.node_port(), contact.client_port() ),
-        services );
+    return NodeInfo( NodeId::FromHex( value.node_id() ),
+        FromProtoBuf( value.location() ), NodeContact(
+        IpAddress::FromBytes( contact.ip_address().data(), contact.ip_address().size() ),
+        contact.node_port(), contact.client_port() ),
+        move(services) );
 }
 
 
@@ -135,27 +135,20 @@ void Converter::FillProtoBuf(iop::locnet::ServiceInfo *target, const ServiceInfo
         { target->set_service_data( source.customData() ); }
 }
 
-iop::locnet::ServiceInfo* Converter::ToProtoBuf(const ServiceInfo &info)
-{
-    auto result = new iop::locnet::ServiceInfo();
-    FillProtoBuf(result, info);
-    return result;
-}
-
 
 
 void Converter::FillProtoBuf(
     iop::locnet::NodeInfo *target, const NodeInfo &source)
 {
-    target->set_node_id( source.id() );
-    target->set_allocated_location( ToProtoBuf( source.location() ) );
+    target->set_node_id( source.id().ToHex() );
+    FillProtoBuf( target->mutable_location(), source.location() );
     
     const NodeContact &sourceContact = source.contact();
     iop::locnet::NodeContact *targetContact = target->mutable_contact();
     
     targetContact->set_node_port( sourceContact.nodePort() );
     targetContact->set_client_port( sourceContact.clientPort() );
-    targetContact->set_ip_address( sourceContact.AddressBytes() );
+    targetContact->set_ip_address( sourceContact.address().data(), sourceContact.address().size() );
     
     for ( const auto &serviceEntry : source.services() )
     {
@@ -164,389 +157,302 @@ void Converter::FillProtoBuf(
     }
 }
 
-iop::locnet::NodeInfo* Converter::ToProtoBuf(const NodeInfo &info)
+
+
+shared_ptr<const string> Converter::Serialized(const NodeInfo &value)
 {
-    auto result = new iop::locnet::NodeInfo();
-    FillProtoBuf(result, info);
+    const shared_ptr<NodeInfoEncoding> &encoding = value.encoding();
+    if (encoding)
+    {
+        shared_ptr<const string> cached = encoding->bytes();
+        if (cached)
+            { return cached; }
+    }
+    
+    iop::locnet::NodeInfo message;
+    FillProtoBuf(&message, value);
+    shared_ptr<const string> result( new string( message.SerializeAsString() ) );
+    // NOTE threads encoding the same node concurrently store the same bytes, any of them may be kept
+    if (encoding)
+        { encoding->bytes(result); }
     return result;
 }
 
 
 
-IncomingLocalServiceRequestDispatcher::IncomingLocalServiceRequestDispatcher(
-        shared_ptr<ILocalServiceMethods> iLocalService, shared_ptr<IChangeListenerFactory> listenerFactory) :
-    _iLocalService(iLocalService), _listenerFactory(listenerFactory)
+SplicedResponseFields& SplicedResponseFields::ThreadInstance()
 {
-    if (_iLocalService == nullptr) {
-        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No local service logic instantiated");
-    }
-    if (_listenerFactory == nullptr) {
-        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No listener factory instantiated");
-    }
+    static thread_local SplicedResponseFields threadFields;
+    return threadFields;
+}
+
+
+SplicedResponseFields* SplicedResponseFields::Active()
+{
+    SplicedResponseFields &fields = ThreadInstance();
+    return fields._active ? &fields : nullptr;
 }
 
 
+SplicedResponseFields::SplicedResponseFields() :
+    _active(false) {}
+
+void SplicedResponseFields::Activate()
+    { _active = true; }
 
-// TODO Dispatchers simply translate between different data formats, ideally this should be generated.
-unique_ptr<iop::locnet::Response> IncomingLocalServiceRequestDispatcher::Dispatch(
-    unique_ptr<iop::locnet::Request> &&request)
+void SplicedResponseFields::Reset()
 {
-    // TODO this version check is shared between different interfaces, use a shared implementation here
-    if ( request->version().empty() || request->version()[0] != 1 )
-        { throw LocationNetworkError(ErrorCode::ERROR_UNSUPPORTED, "Missing or unknown request version"); }
-    
-    if ( ! request->has_local_service() )
-        { throw LocationNetworkError(ErrorCode::ERROR_BAD_REQUEST, "This interface serves only local service requests"); }
+    _active = false;
+    _bytes.clear();
+    _pending.clear();
+    _nesting.clear();
+}
+
+const string& SplicedResponseFields::bytes() const
+    { return _bytes; }
+
+
+static void AppendVarint32(string &target, uint32_t value)
+{
+    uint8_t buffer[5];  // Longest varint encoding of 32 bits
+    uint8_t *end = CodedOutputStream::WriteVarint32ToArray(value, buffer);
+    target.append( reinterpret_cast<const char*>(buffer), end - buffer );
+}
+
+
+void SplicedResponseFields::Add(int fieldNumber, const string &encodedMessage)
+{
+    AppendVarint32( _pending, WireFormatLite::MakeTag(fieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED) );
+    AppendVarint32( _pending, static_cast<uint32_t>( encodedMessage.size() ) );
+    _pending.append(encodedMessage);
+}
+
+
+void SplicedResponseFields::WrapPending()
+{
+    if ( _pending.empty() )
+        { return; }
     
-    const iop::locnet::LocalServiceRequest &localServiceRequest = request->local_service();
-    unique_ptr<iop::locnet::Response> result( new iop::locnet::Response() );
-    iop::locnet::LocalServiceResponse *localServiceResponse = result->mutable_local_service();
+    // Sizes of the enclosing fields are known only from the inside out, but written from the outside in
+    _wrapSizes.resize( _nesting.size() );
+    uint32_t size = static_cast<uint32_t>( _pending.size() );
+    for (size_t idx = _nesting.size(); idx-- > 0; )
+    {
+        _wrapSizes[idx] = size;
+        size += CodedOutputStream::VarintSize32( WireFormatLite::MakeTag(
+                    _nesting[idx], WireFormatLite::WIRETYPE_LENGTH_DELIMITED ) ) +
+                CodedOutputStream::VarintSize32(size);
+    }
     
-    switch ( localServiceRequest.LocalServiceRequestType_case() )
+    _bytes.reserve( _bytes.size() + size );
+    for (size_t idx = 0; idx < _nesting.size(); ++idx)
     {
-        case iop::locnet::LocalServiceRequest::kRegisterService:
-        {
-            auto const &registerRequest = localServiceRequest.register_service();
-            ServiceInfo service = Converter::FromProtoBuf( registerRequest.service() );
-            GpsLocation location = _iLocalService->RegisterService(service);
-            LOG(DEBUG) << "Served RegisterService()";
-            
-            localServiceResponse->mutable_register_service()->set_allocated_location(
-                Converter::ToProtoBuf(location) );
-            break;
-        }
-            
-        case iop::locnet::LocalServiceRequest::kDeregisterService:
-        {
-            auto const &deregisterRequest = localServiceRequest.deregister_service();
-            std::string serviceType =  deregisterRequest.service_type() ;
-            
-            _iLocalService->DeregisterService(serviceType);
-            LOG(DEBUG) << "Served DeregisterService()";
-            
-            localServiceResponse->mutable_deregister_service();
-            break;
-        }
-            
-        case iop::locnet::LocalServiceRequest::kGetNeighbourNodes:
-        {
-            auto const &getneighboursRequest = localServiceRequest.get_neighbour_nodes();
-            bool keepAlive = getneighboursRequest.keep_alive_and_send_updates();
-            
-            vector<NodeInfo> neighbours = _iLocalService->GetNeighbourNodesByDistance();
-            LOG(DEBUG) << "Served GetNeighbourNodes() with keepalive " << keepAlive
-                       << ", node count : " << neighbours.size();
-            
-            auto responseContent = localServiceResponse->mutable_get_neighbour_nodes();
-            for (auto const &neighbour : neighbours)
-            {
-                iop::locnet::NodeInfo *info = responseContent->add_nodes();
-                Converter::FillProtoBuf(info, neighbour);
-            }
-            
-            if (keepAlive)
-            {
-                shared_ptr<IChangeListener> listener = _listenerFactory->Create(_iLocalService);
-                _iLocalService->AddListener(listener);
-            }
-            break;
-        }
+        AppendVarint32( _bytes, WireFormatLite::MakeTag(_nesting[idx], WireFormatLite::WIRETYPE_LENGTH_DELIMITED) );
+        AppendVarint32( _bytes, _wrapSizes[idx] );
+    }
+    _bytes.append(_pending);
+    _pending.clear();
+}
 
-        case iop::locnet::LocalServiceRequest::kGetNodeInfo:
-        {
-            NodeInfo node = _iLocalService->GetNodeInfo();
-            LOG(DEBUG) << "Served GetNodeInfo(): " << node;
-            
-            auto responseContent = localServiceResponse->mutable_get_node_info();
-            responseContent->set_allocated_node_info( Converter::ToProtoBuf(node) );
-            break;
-        }
-        
-        case iop::locnet::LocalServiceRequest::kNeighbourhoodChanged:
-            throw LocationNetworkError(ErrorCode::ERROR_BAD_REQUEST,
-                "Invalid request type. This is a notification message: it's not supposed to be sent "
-                "as a request to this server but to be received as notification "
-                "after a GetNeighbourNodesRequest with flag keepAlive set.");
-        
-        default: throw LocationNetworkError(ErrorCode::ERROR_BAD_REQUEST, "Missing or unknown local service operation");
+
+SplicedResponseFields::Dispatching::Dispatching(int interfaceField, int caseField) :
+    _fields( Active() ), _suspended(false)
+{
+    if (! _fields)
+        { return; }
+    if ( ! _fields->_nesting.empty() )
+    {
+        _fields->_active = false;
+        _suspended = true;
+        return;
     }
-    
-    return result;
+    _fields->_nesting.push_back(interfaceField);
+    _fields->_nesting.push_back(caseField);
+}
+
+SplicedResponseFields::Dispatching::~Dispatching()
+{
+    if (! _fields)
+        { return; }
+    if (_suspended)
+    {
+        _fields->_active = true;
+        return;
+    }
+    _fields->WrapPending();
+    _fields->_nesting.clear();
 }
 
 
 
-IncomingNodeRequestDispatcher::IncomingNodeRequestDispatcher(shared_ptr<INodeMethods> iNode) :
-    _iNode(iNode)
+const size_t  MessageFraming::HeaderSize;
+const uint8_t MessageFraming::HeaderFieldTag;
+const uint8_t MessageFraming::BodyFieldTag;
+const size_t  MessageFraming::MaxFrameSize;
+
+
+uint32_t MessageFraming::ReadFrameSize(const char *header)
 {
-    if (_iNode == nullptr) {
-        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No remote node logic instantiated");
+    const uint8_t *data = reinterpret_cast<const uint8_t*>(header);
+    if (data[0] != HeaderFieldTag) {
+        throw LocationNetworkError(ErrorCode::ERROR_PROTOCOL_VIOLATION, "Invalid message header");
     }
+    // Adapt little endian value from network to local format
+    // NOTE bytes are promoted to int, shifting them into the sign bit would be undefined
+    return   static_cast<uint32_t>(data[1])
+          | (static_cast<uint32_t>(data[2]) << 8)
+          | (static_cast<uint32_t>(data[3]) << 16)
+          | (static_cast<uint32_t>(data[4]) << 24);
 }
 
 
+void MessageFraming::Serialize(const iop::locnet::Message &message, string &buffer)
+{
+    static const SplicedResponseFields noSplicedFields;
+    Serialize(message, noSplicedFields, buffer);
+}
 
-unique_ptr<iop::locnet::Response> IncomingNodeRequestDispatcher::Dispatch(unique_ptr<iop::locnet::Request> &&request)
+
+void MessageFraming::Serialize( const iop::locnet::Message &message,
+                                const SplicedResponseFields &splicedFields, string &buffer )
 {
-    if ( request->version().empty() || request->version()[0] != 1 )
-        { throw LocationNetworkError(ErrorCode::ERROR_UNSUPPORTED, "Missing or unknown request version"); }
+    static const uint8_t ResponseFieldTag = WireFormatLite::MakeTag(
+        iop::locnet::Message::kResponseFieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED );
     
-    if ( ! request->has_remote_node() )
-        { throw LocationNetworkError(ErrorCode::ERROR_BAD_REQUEST, "This interface serves only remote node requests"); }
+    // Spliced fields are wrapped into another occurrence of the response field, merged by the parser
+    const string &splicedBytes = splicedFields.bytes();
+    bool splicing = ! splicedBytes.empty() && message.has_response();
+    size_t splicedSize = splicing ? 1 + CodedOutputStream::VarintSize32( static_cast<uint32_t>( splicedBytes.size() ) ) + splicedBytes.size() : 0;
     
-    const iop::locnet::RemoteNodeRequest &nodeRequest = request->remote_node();
-    unique_ptr<iop::locnet::Response> result( new iop::locnet::Response() );
-    iop::locnet::RemoteNodeResponse *nodeResponse = result->mutable_remote_node();
-    
-    switch ( nodeRequest.RemoteNodeRequestType_case() )
+    // NOTE ByteSizeLong() caches the size of all submessages, serialization below reuses them
+    size_t bodySize = message.ByteSizeLong() + splicedSize;
+    if ( bodySize > MaxFrameSize )
+        { throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Message size is over limit: " + to_string(bodySize) ); }
+    uint32_t frameSize = 1 + CodedOutputStream::VarintSize32( static_cast<uint32_t>(bodySize) ) + static_cast<uint32_t>(bodySize);
+    if ( frameSize > MaxFrameSize )
+        { throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Message size is over limit: " + to_string(frameSize) ); }
+    buffer.resize(HeaderSize + frameSize);
+
+    uint8_t *target = reinterpret_cast<uint8_t*>( &buffer[0] );
+    *target++ = HeaderFieldTag;
+    target = CodedOutputStream::WriteLittleEndian32ToArray(frameSize, target);
+    *target++ = BodyFieldTag;
+    target = CodedOutputStream::WriteVarint32ToArray( static_cast<uint32_t>(bodySize), target );
+    target = message.SerializeWithCachedSizesToArray(target);
+    if (splicing)
     {
-        case iop::locnet::RemoteNodeRequest::kGetNodeInfo:
-        {
-            NodeInfo node = _iNode->GetNodeInfo();
-            LOG(DEBUG) << "Served GetNodeInfo(): " << node;
-            
-            auto responseContent = nodeResponse->mutable_get_node_info();
-            responseContent->set_allocated_node_info( Converter::ToProtoBuf(node) );
-            break;
-        }
-        
-        case iop::locnet::RemoteNodeRequest::kAcceptColleague:
-        {
-            auto acceptColleagueReq = nodeRequest.accept_colleague();
-            auto nodeInfo = Converter::FromProtoBuf( acceptColleagueReq.requestor_node_info() );
-            
-            shared_ptr<NodeInfo> result = _iNode->AcceptColleague(nodeInfo);
-            LOG(DEBUG) << "Served AcceptColleague(" << nodeInfo
-                       << "), accepted: " << static_cast<bool>(result);
-            
-            nodeResponse->mutable_accept_colleague()->set_accepted( static_cast<bool>(result) );
-            if (result) {
-                nodeResponse->mutable_accept_colleague()->set_allocated_acceptor_node_info(
-                    Converter::ToProtoBuf(*result) );
-            }
-            break;
-        }
-        
-        case iop::locnet::RemoteNodeRequest::kRenewColleague:
-        {
-            auto renewColleagueReq = nodeRequest.renew_colleague();
-            auto nodeInfo = Converter::FromProtoBuf( renewColleagueReq.requestor_node_info() );
-            
-            shared_ptr<NodeInfo> result = _iNode->RenewColleague(nodeInfo);
-            LOG(DEBUG) << "Served RenewColleague(" << nodeInfo
-                       << "), accepted: " << static_cast<bool>(result);
-                       
-            nodeResponse->mutable_renew_colleague()->set_accepted( static_cast<bool>(result) );
-            if (result) {
-                nodeResponse->mutable_renew_colleague()->set_allocated_acceptor_node_info(
-                    Converter::ToProtoBuf(*result) );
-            }
-            break;
-        }
-        
-        case iop::locnet::RemoteNodeRequest::kAcceptNeighbour:
-        {
-            auto acceptNeighbourReq = nodeRequest.accept_neighbour();
-            auto nodeInfo = Converter::FromProtoBuf( acceptNeighbourReq.requestor_node_info() );
-            
-            shared_ptr<NodeInfo> result = _iNode->AcceptNeighbour(nodeInfo);
-            LOG(DEBUG) << "Served AcceptNeighbour(" << nodeInfo
-                       << "), accepted: " << static_cast<bool>(result);
-                       
-            nodeResponse->mutable_accept_neighbour()->set_accepted( static_cast<bool>(result) );
-            if (result) {
-                nodeResponse->mutable_accept_neighbour()->set_allocated_acceptor_node_info(
-                    Converter::ToProtoBuf(*result) );
-            }
-            break;
-        }
-        
-        case iop::locnet::RemoteNodeRequest::kRenewNeighbour:
-        {
-            auto renewNeighbourReq = nodeRequest.renew_neighbour();
-            auto nodeInfo = Converter::FromProtoBuf( renewNeighbourReq.requestor_node_info() );
-            
-            shared_ptr<NodeInfo> result = _iNode->RenewNeighbour(nodeInfo);
-            LOG(DEBUG) << "Served RenewNeighbour(" << nodeInfo
-                       << "), accepted: " << static_cast<bool>(result);
-                       
-            nodeResponse->mutable_renew_neighbour()->set_accepted( static_cast<bool>(result) );
-            if (result) {
-                nodeResponse->mutable_renew_neighbour()->set_allocated_acceptor_node_info(
-                    Converter::ToProtoBuf(*result) );
-            }
-            break;
-        }
+        *target++ = ResponseFieldTag;
+        target = CodedOutputStream::WriteVarint32ToArray( static_cast<uint32_t>( splicedBytes.size() ), target );
+        memcpy( target, splicedBytes.data(), splicedBytes.size() );
+    }
+}
 
-        case iop::locnet::RemoteNodeRequest::kGetNodeCount:
-        {
-            size_t counter = _iNode->GetNodeCount();
-            LOG(DEBUG) << "Served GetNodeCount(), node count: " << counter;
-            
-            nodeResponse->mutable_get_node_count()->set_node_count(counter);
-            break;
-        }
-        
-        case iop::locnet::RemoteNodeRequest::kGetRandomNodes:
-        {
-            auto randomNodesReq = nodeRequest.get_random_nodes();
-            Neighbours neighbourFilter = randomNodesReq.include_neighbours() ?
-                Neighbours::Included : Neighbours::Excluded;
-                
-            vector<NodeInfo> randomNodes = _iNode->GetRandomNodes(
-                randomNodesReq.max_node_count(), neighbourFilter );
-            LOG(DEBUG) << "Served GetRandomNodes(), node count: " << randomNodes.size();
-            
-            auto responseContent = nodeResponse->mutable_get_random_nodes();
-            for (auto const &node : randomNodes)
-            {
-                iop::locnet::NodeInfo *info = responseContent->add_nodes();
-                Converter::FillProtoBuf(info, node);
-            }
-            break;
-        }
-        
-        case iop::locnet::RemoteNodeRequest::kGetClosestNodes:
+
+bool MessageFraming::Parse(const char *frame, size_t frameSize, iop::locnet::Message &message)
+{
+    CodedInputStream input( reinterpret_cast<const uint8_t*>(frame), static_cast<int>(frameSize) );
+    bool bodyFound = false;
+    for (uint32_t tag = input.ReadTag(); tag != 0; tag = input.ReadTag())
+    {
+        // Skip anything unknown like the wrapper message would do
+        if (tag != BodyFieldTag)
         {
-            auto const &closestRequest = nodeRequest.get_closest_nodes();
-            GpsLocation location = Converter::FromProtoBuf( closestRequest.location() );
-            Neighbours neighbourFilter = closestRequest.include_neighbours() ?
-                Neighbours::Included : Neighbours::Excluded;
-            
-            vector<NodeInfo> closeNodes( _iNode->GetClosestNodesByDistance( location,
-                closestRequest.max_radius_km(), closestRequest.max_node_count(), neighbourFilter) );
-            LOG(DEBUG) << "Served GetClosestNodes(), node count: " << closeNodes.size();
-            
-            auto responseContent = nodeResponse->mutable_get_closest_nodes();
-            for (auto const &node : closeNodes)
-            {
-                iop::locnet::NodeInfo *info = responseContent->add_nodes();
-                Converter::FillProtoBuf(info, node);
-            }
-            break;
+            if ( ! WireFormatLite::SkipField(&input, tag) )
+                { return false; }
+            continue;
         }
-        
-        default: throw LocationNetworkError(ErrorCode::ERROR_BAD_REQUEST, "Missing or unknown remote node operation");
+
+        uint32_t bodySize;
+        if ( ! input.ReadVarint32(&bodySize) )
+            { return false; }
+        CodedInputStream::Limit bodyLimit = input.PushLimit(bodySize);
+        if ( ! message.ParseFromCodedStream(&input) || input.BytesUntilLimit() != 0 )
+            { return false; }
+        input.PopLimit(bodyLimit);
+        bodyFound = true;
     }
-    
-    return result;
+    return bodyFound && input.ConsumedEntireMessage();
 }
 
 
 
-IncomingClientRequestDispatcher::IncomingClientRequestDispatcher(shared_ptr<IClientMethods> iClient) :
-    _iClient(iClient)
+const size_t MessageArena::InitialBlockSize;
+
+static google::protobuf::ArenaOptions MessageArenaOptions()
 {
-    if (_iClient == nullptr) {
-        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No client logic instantiated");
-    }
+    google::protobuf::ArenaOptions options;
+    options.start_block_size = MessageArena::InitialBlockSize;
+    return options;
 }
 
 
+MessageArena::MessageArena() :
+    _arena( MessageArenaOptions() ) {}
+
 
-unique_ptr<iop::locnet::Response> IncomingClientRequestDispatcher::Dispatch(unique_ptr<iop::locnet::Request> &&request)
+MessageArena& MessageArena::ThreadInstance()
+{
+    static thread_local MessageArena threadArena;
+    return threadArena;
+}
+
+
+size_t MessageArena::spaceUsed() const
+    { return _arena.SpaceUsed(); }
+
+void MessageArena::Reset()
+    { _arena.Reset(); }
+
+
+
+void IBlockingRequestDispatcher::DispatchInto(const iop::locnet::Request &request, iop::locnet::Response &response)
+{
+    unique_ptr<iop::locnet::Response> result( Dispatch(
+        unique_ptr<iop::locnet::Request>( new iop::locnet::Request(request) ) ) );
+    response.Swap( result.get() );
+}
+
+
+unique_ptr<iop::locnet::Response> ArenaRequestDispatcher::Dispatch(unique_ptr<iop::locnet::Request> &&request)
 {
-    if ( request->version().empty() || request->version()[0] != 1 )
-        { throw LocationNetworkError(ErrorCode::ERROR_UNSUPPORTED, "Missing or unknown request version"); }
-    
-    if ( ! request->has_client() )
-        { throw LocationNetworkError(ErrorCode::ERROR_BAD_REQUEST, "This interface serves only client requests"); }
-    
-    const iop::locnet::ClientRequest &clientRequest = request->client();
     unique_ptr<iop::locnet::Response> result( new iop::locnet::Response() );
-    iop::locnet::ClientResponse *clientResponse = result->mutable_client();
-    
-    switch ( clientRequest.ClientRequestType_case() )
-    {
-        case iop::locnet::ClientRequest::kGetNodeInfo:
-        {
-            NodeInfo node = _iClient->GetNodeInfo();
-            LOG(DEBUG) << "Served GetNodeInfo(): " << node;
-            
-            auto responseContent = clientResponse->mutable_get_node_info();
-            responseContent->set_allocated_node_info( Converter::ToProtoBuf(node) );
-            break;
-        }
-        
-        case iop::locnet::ClientRequest::kGetNeighbourNodes:
-        {
-            vector<NodeInfo> neighbours = _iClient->GetNeighbourNodesByDistance();
-            LOG(DEBUG) << "Served GetNeighbourNodes(), node count: " << neighbours.size();
-            
-            auto responseContent = clientResponse->mutable_get_neighbour_nodes();
-            for (auto const &neighbour : neighbours)
-            {
-                iop::locnet::NodeInfo *info = responseContent->add_nodes();
-                Converter::FillProtoBuf(info, neighbour);
-            }
-            break;
-        }
-        
-        case iop::locnet::ClientRequest::kGetClosestNodes:
-        {
-            auto const &closestRequest = clientRequest.get_closest_nodes();
-            GpsLocation location = Converter::FromProtoBuf( closestRequest.location() );
-            Neighbours neighbourFilter = closestRequest.include_neighbours() ?
-                Neighbours::Included : Neighbours::Excluded;
-            
-            vector<NodeInfo> closeNodes( _iClient->GetClosestNodesByDistance( location,
-                closestRequest.max_radius_km(), closestRequest.max_node_count(), neighbourFilter) );
-            LOG(DEBUG) << "Served GetClosestNodes(), node count: " << closeNodes.size();
-            
-            auto responseContent = clientResponse->mutable_get_closest_nodes();
-            for (auto const &node : closeNodes)
-            {
-                iop::locnet::NodeInfo *info = responseContent->add_nodes();
-                Converter::FillProtoBuf(info, node);
-            }
-            break;
-        }
-        
-        case iop::locnet::ClientRequest::kExploreNodes:
-        {
-            auto const &exploreRequest = clientRequest.explore_nodes();
-            GpsLocation location = Converter::FromProtoBuf( exploreRequest.location() );
-            
-            vector<NodeInfo> exploredNodes( _iClient->ExploreNetworkNodesByDistance( location,
-                exploreRequest.target_node_count(), exploreRequest.max_node_hops() ) );
-            LOG(DEBUG) << "Served GetClosestNodes(), node count: " << exploredNodes.size();
-            
-            auto responseContent = clientResponse->mutable_explore_nodes();
-            for (auto const &node : exploredNodes)
-            {
-                iop::locnet::NodeInfo *info = responseContent->add_closest_nodes();
-                Converter::FillProtoBuf(info, node);
-            }
-            break;
-        }
-        
-        case iop::locnet::ClientRequest::kGetRandomNodes:
-        {
-            auto randomNodesReq = clientRequest.get_random_nodes();
-            Neighbours neighbourFilter = randomNodesReq.include_neighbours() ?
-                Neighbours::Included : Neighbours::Excluded;
-                
-            vector<NodeInfo> randomNodes = _iClient->GetRandomNodes(
-                randomNodesReq.max_node_count(), neighbourFilter );
-            LOG(DEBUG) << "Served GetRandomNodes(), node count: " << randomNodes.size();
-            
-            auto responseContent = clientResponse->mutable_get_random_nodes();
-            for (auto const &node : randomNodes)
-            {
-                iop::locnet::NodeInfo *info = responseContent->add_nodes();
-                Converter::FillProtoBuf(info, node);
-            }
-            break;
-        }
-        
-        default: throw LocationNetworkError(ErrorCode::ERROR_BAD_REQUEST, "Missing or unknown client operation");
-    }
-    
+    DispatchInto(*request, *result);
     return result;
 }
 
 
 
+IncomingLocalServiceRequestDispatcher::IncomingLocalServiceRequestDispatcher(
+        shared_ptr<ILocalServiceMethods> iLocalService, shared_ptr<IChangeListenerFactory> listenerFactory) :
+    _iLocalService(iLocalService), _listenerFactory(listenerFactory)
+{
+    if (_iLocalService == nullptr) {
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No local service logic instantiated");
+    }
+    if (_listenerFactory == nullptr) {
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No listener factory instantiated");
+    }
+}
+
+
+IncomingNodeRequestDispatcher::IncomingNodeRequestDispatcher(shared_ptr<INodeMethods> iNode) :
+    _iNode(iNode)
+{
+    if (_iNode == nullptr) {
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No remote node logic instantiated");
+    }
+}
+
+
+IncomingClientRequestDispatcher::IncomingClientRequestDispatcher(shared_ptr<IClientMethods> iClient) :
+    _iClient(iClient)
+{
+    if (_iClient == nullptr) {
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No client logic instantiated");
+    }
+}
+
+
 IncomingRequestDispatcher::IncomingRequestDispatcher(
         shared_ptr<LocNet::Node> node, shared_ptr<IChangeListenerFactory> listenerFactory ) :
     _iLocalService( new IncomingLocalServiceRequestDispatcher(node, listenerFactory) ),
@@ -574,226 +480,898 @@ IncomingRequestDispatcher::IncomingRequestDispatcher(
         throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No client request dispatcher instantiated");
     }
 }
-    
 
 
-unique_ptr<iop::locnet::Response> IncomingRequestDispatcher::Dispatch(unique_ptr<iop::locnet::Request> &&request)
-{
-    switch ( request->RequestType_case() )
-    {
-        case iop::locnet::Request::kLocalService:
-            return _iLocalService->Dispatch( move(request) );
-            
-        case iop::locnet::Request::kRemoteNode:
-            return _iRemoteNode->Dispatch( move(request) );
-            
-        case iop::locnet::Request::kClient:
-            return _iClient->Dispatch( move(request) );
-            
-        default: throw LocationNetworkError(ErrorCode::ERROR_BAD_REQUEST, "Missing or unknown request type");
-    }
-}
 
+shared_ptr<IRequestRouteHooks> IRequestRouteHooks::_installed;
 
+void IRequestRouteHooks::Install(shared_ptr<IRequestRouteHooks> hooks)
+    { atomic_store(&_installed, hooks); }
 
-NodeMethodsProtoBufClient::NodeMethodsProtoBufClient(
-    //std::shared_ptr<IDelayedRequestDispatcher> dispatcher, std::function<void(const Address&)> detectedIpCallback) :
-    std::shared_ptr<IBlockingRequestDispatcher> dispatcher, std::function<void(const Address&)> detectedIpCallback) :
-    _dispatcher(dispatcher), _detectedIpCallback(detectedIpCallback)
+shared_ptr<IRequestRouteHooks> IRequestRouteHooks::Installed()
+    { return atomic_load(&_installed); }
+
+
+
+bool RequestRouteMetrics::Admit(const char*)
+    { return true; }
+
+
+void RequestRouteMetrics::Served(const char *route, Duration duration, bool succeeded)
 {
-    if (! _dispatcher)
-        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No dispatcher instantiated"); }
+    lock_guard<mutex> lock(_mutex);
+    RequestRouteStats &stats = _stats[route];
+    if (succeeded)
+        { ++stats.servedCount; }
+    else { ++stats.failedCount; }
+    stats.maxDuration = max(stats.maxDuration, duration);
+    stats.totalDuration += duration;
 }
 
 
-
-// TODO All methods simply translate between different data formats, ideally this should be generated.
-NodeInfo NodeMethodsProtoBufClient::GetNodeInfo() const
+map<string, RequestRouteStats> RequestRouteMetrics::stats() const
 {
-    unique_ptr<iop::locnet::Request> request( new iop::locnet::Request() );
-    request->mutable_remote_node()->mutable_get_node_info();
-    
-    unique_ptr<iop::locnet::Response> response = _dispatcher->Dispatch( move(request) );
-    if (! response || ! response->has_remote_node() || ! response->remote_node().has_get_node_info() )
-        { throw LocationNetworkError(ErrorCode::ERROR_BAD_RESPONSE, "Failed to get expected response"); }
-    
-    auto result = Converter::FromProtoBuf( response->remote_node().get_node_info().node_info() );
-    LOG(DEBUG) << "Request GetNodeInfo() returned " << result;
-    return result;
+    lock_guard<mutex> lock(_mutex);
+    return _stats;
 }
 
 
 
-size_t NodeMethodsProtoBufClient::GetNodeCount() const
+// Requests are routed by indexing a table of handlers with the oneof case number of the request.
+// Tables are filled at compile time by instantiating a RequestRoute for each case number,
+// cases without a specialized route are refused. Interfaces are described by the traits below.
+template <class Interface, int RequestCase>
+struct RequestRoute
 {
-    unique_ptr<iop::locnet::Request> request( new iop::locnet::Request() );
-    request->mutable_remote_node()->mutable_get_node_count();
+    static constexpr const char* Name() { return nullptr; }
     
-    unique_ptr<iop::locnet::Response> response = _dispatcher->Dispatch( move(request) );
-    if (! response || ! response->has_remote_node() || ! response->remote_node().has_get_node_count() )
-        { throw LocationNetworkError(ErrorCode::ERROR_BAD_RESPONSE, "Failed to get expected response"); }
-    
-    auto result = response->remote_node().get_node_count().node_count();
-    LOG(DEBUG) << "Request GetNodeCount() returned " << result;
-    return result;
-}
+    static void Serve( typename Interface::Dispatcher&,
+        const typename Interface::Request&, typename Interface::Response& )
+        { throw LocationNetworkError(ErrorCode::ERROR_BAD_REQUEST, Interface::UnknownOperationError()); }
+};
 
 
+template <int... Cases>
+struct CaseList {};
 
-shared_ptr<NodeInfo> NodeMethodsProtoBufClient::AcceptColleague(const NodeInfo& node)
+template <int Count, int... Cases>
+struct MakeCaseList : MakeCaseList<Count - 1, Count - 1, Cases...> {};
+
+template <int... Cases>
+struct MakeCaseList<0, Cases...> : CaseList<Cases...> {};
+
+
+template <class Interface>
+struct DispatchTable
 {
-    unique_ptr<iop::locnet::Request> request( new iop::locnet::Request() );
-    request->mutable_remote_node()->mutable_accept_colleague()->set_allocated_requestor_node_info(
-        Converter::ToProtoBuf(node) );
+    typedef void Handler( typename Interface::Dispatcher &dispatcher,
+        const typename Interface::Request &request, typename Interface::Response &response );
     
-    unique_ptr<iop::locnet::Response> response = _dispatcher->Dispatch( move(request) );
-    if (! response || ! response->has_remote_node() || ! response->remote_node().has_accept_colleague() )
-        { throw LocationNetworkError(ErrorCode::ERROR_BAD_RESPONSE, "Failed to get expected response"); }
+    struct Route
+    {
+        const char *name;
+        Handler    *serve;
+    };
     
-    auto result = response->remote_node().accept_colleague().accepted() ?
-        shared_ptr<NodeInfo>( new NodeInfo( Converter::FromProtoBuf(
-            response->remote_node().accept_colleague().acceptor_node_info() ) ) ) :
-        shared_ptr<NodeInfo>();
-    LOG(DEBUG) << "Request AcceptColleague() returned " << static_cast<bool>(result);
+    template <int... Cases>
+    static const Route* Build(CaseList<Cases...>)
+    {
+        static const Route routes[] = {
+            { RequestRoute<Interface, Cases>::Name(), &RequestRoute<Interface, Cases>::Serve }... };
+        return routes;
+    }
     
-    if (_detectedIpCallback)
+    static const Route& Find(int requestCase)
     {
-        const string &address = response->remote_node().accept_colleague().remote_ip_address();
-        if ( ! address.empty() )
-            { _detectedIpCallback( NodeContact::AddressFromBytes(address) ); }
+        static const Route *routes = Build( MakeCaseList<Interface::CaseCount>() );
+        // Case 0 is the unset oneof, its route is never specialized
+        if (requestCase < 0 || requestCase >= Interface::CaseCount)
+            { requestCase = 0; }
+        return routes[requestCase];
     }
-    return result;
-}
+};
 
 
 
-shared_ptr<NodeInfo> NodeMethodsProtoBufClient::RenewColleague(const NodeInfo& node)
+struct LocalServiceInterface
 {
-    unique_ptr<iop::locnet::Request> request( new iop::locnet::Request() );
-    request->mutable_remote_node()->mutable_renew_colleague()->set_allocated_requestor_node_info(
-        Converter::ToProtoBuf(node) );
+    typedef IncomingLocalServiceRequestDispatcher   Dispatcher;
+    typedef iop::locnet::LocalServiceRequest        Request;
+    typedef iop::locnet::LocalServiceResponse       Response;
     
-    unique_ptr<iop::locnet::Response> response = _dispatcher->Dispatch( move(request) );
-    if (! response || ! response->has_remote_node() || ! response->remote_node().has_renew_colleague() )
-        { throw LocationNetworkError(ErrorCode::ERROR_BAD_RESPONSE, "Failed to get expected response"); }
+    static const int CaseCount = iop::locnet::LocalServiceRequest::kGetNodeInfo + 1;
+    // Field of the interface part in Response, numbers of request and response cases match
+    static const int ResponseField = iop::locnet::Response::kLocalServiceFieldNumber;
     
-    auto result = response->remote_node().renew_colleague().accepted() ?
-        shared_ptr<NodeInfo>( new NodeInfo( Converter::FromProtoBuf(
-            response->remote_node().renew_colleague().acceptor_node_info() ) ) ) :
-        shared_ptr<NodeInfo>();
-    LOG(DEBUG) << "Request RenewColleague() returned " << static_cast<bool>(result);
+    static bool Serves(const iop::locnet::Request &request)
+        { return request.has_local_service(); }
+    static const Request& Part(const iop::locnet::Request &request)
+        { return request.local_service(); }
+    static Response* MutablePart(iop::locnet::Response &response)
+        { return response.mutable_local_service(); }
+    static int Case(const Request &request)
+        { return request.LocalServiceRequestType_case(); }
     
-    if (_detectedIpCallback)
-    {
-        const string &address = response->remote_node().renew_colleague().remote_ip_address();
-        if ( ! address.empty() )
-            { _detectedIpCallback( NodeContact::AddressFromBytes(address) ); }
-    }
-    return result;
-}
+    static const char* WrongInterfaceError()   { return "This interface serves only local service requests"; }
+    static const char* UnknownOperationError() { return "Missing or unknown local service operation"; }
+};
 
 
-
-shared_ptr<NodeInfo> NodeMethodsProtoBufClient::AcceptNeighbour(const NodeInfo& node)
+struct NodeInterface
 {
-    unique_ptr<iop::locnet::Request> request( new iop::locnet::Request() );
-    request->mutable_remote_node()->mutable_accept_neighbour()->set_allocated_requestor_node_info(
-        Converter::ToProtoBuf(node) );
+    typedef IncomingNodeRequestDispatcher   Dispatcher;
+    typedef iop::locnet::RemoteNodeRequest  Request;
+    typedef iop::locnet::RemoteNodeResponse Response;
     
-    unique_ptr<iop::locnet::Response> response = _dispatcher->Dispatch( move(request) );
-    if (! response || ! response->has_remote_node() || ! response->remote_node().has_accept_neighbour() )
-        { throw LocationNetworkError(ErrorCode::ERROR_BAD_RESPONSE, "Failed to get expected response"); }
+    static const int CaseCount = iop::locnet::RemoteNodeRequest::kGetNodeInfo + 1;
+    // Field of the interface part in Response, numbers of request and response cases match
+    static const int ResponseField = iop::locnet::Response::kRemoteNodeFieldNumber;
     
-    auto result = response->remote_node().accept_neighbour().accepted() ?
-        shared_ptr<NodeInfo>( new NodeInfo( Converter::FromProtoBuf(
-            response->remote_node().accept_neighbour().acceptor_node_info() ) ) ) :
-        shared_ptr<NodeInfo>();
-    LOG(DEBUG) << "Request AcceptNeighbour() returned " << static_cast<bool>(result);
+    static bool Serves(const iop::locnet::Request &request)
+        { return request.has_remote_node(); }
+    static const Request& Part(const iop::locnet::Request &request)
+        { return request.remote_node(); }
+    static Response* MutablePart(iop::locnet::Response &response)
+        { return response.mutable_remote_node(); }
+    static int Case(const Request &request)
+        { return request.RemoteNodeRequestType_case(); }
     
-    if (_detectedIpCallback)
-    {
-        const string &address = response->remote_node().accept_neighbour().remote_ip_address();
-        if ( ! address.empty() )
-            { _detectedIpCallback( NodeContact::AddressFromBytes(address) ); }
-    }
-    return result;
-}
+    static const char* WrongInterfaceError()   { return "This interface serves only remote node requests"; }
+    static const char* UnknownOperationError() { return "Missing or unknown remote node operation"; }
+};
 
 
-
-shared_ptr<NodeInfo> NodeMethodsProtoBufClient::RenewNeighbour(const NodeInfo& node)
+struct ClientInterface
 {
-    unique_ptr<iop::locnet::Request> request( new iop::locnet::Request() );
-    request->mutable_remote_node()->mutable_renew_neighbour()->set_allocated_requestor_node_info(
-        Converter::ToProtoBuf(node) );
+    typedef IncomingClientRequestDispatcher Dispatcher;
+    typedef iop::locnet::ClientRequest      Request;
+    typedef iop::locnet::ClientResponse     Response;
     
-    unique_ptr<iop::locnet::Response> response = _dispatcher->Dispatch( move(request) );
-    if (! response || ! response->has_remote_node() || ! response->remote_node().has_renew_neighbour() )
-        { throw LocationNetworkError(ErrorCode::ERROR_BAD_RESPONSE, "Failed to get expected response"); }
+    static const int CaseCount = iop::locnet::ClientRequest::kGetRandomNodes + 1;
+    // Field of the interface part in Response, numbers of request and response cases match
+    static const int ResponseField = iop::locnet::Response::kClientFieldNumber;
     
-    auto result = response->remote_node().renew_neighbour().accepted() ?
-        shared_ptr<NodeInfo>( new NodeInfo( Converter::FromProtoBuf(
-            response->remote_node().renew_neighbour().acceptor_node_info() ) ) ) :
-        shared_ptr<NodeInfo>();
-    LOG(DEBUG) << "Request RenewNeighbour() returned " << static_cast<bool>(result);
+    static bool Serves(const iop::locnet::Request &request)
+        { return request.has_client(); }
+    static const Request& Part(const iop::locnet::Request &request)
+        { return request.client(); }
+    static Response* MutablePart(iop::locnet::Response &response)
+        { return response.mutable_client(); }
+    static int Case(const Request &request)
+        { return request.ClientRequestType_case(); }
     
-    if (_detectedIpCallback)
-    {
-        const string &address = response->remote_node().renew_neighbour().remote_ip_address();
-        if ( ! address.empty() )
-            { _detectedIpCallback( NodeContact::AddressFromBytes(address) ); }
-    }
-    return result;
-}
+    static const char* WrongInterfaceError()   { return "This interface serves only client requests"; }
+    static const char* UnknownOperationError() { return "Missing or unknown client operation"; }
+};
 
 
-
-vector<NodeInfo> NodeMethodsProtoBufClient::GetRandomNodes(
-    size_t maxNodeCount, Neighbours filter) const
+// Selects the interface of a request for the unified dispatcher
+struct AnyInterface
+{
+    typedef IncomingRequestDispatcher   Dispatcher;
+    typedef iop::locnet::Request        Request;
+    typedef iop::locnet::Response       Response;
+    
+    static const int CaseCount = iop::locnet::Request::kClient + 1;
+    
+    static const char* UnknownOperationError() { return "Missing or unknown request type"; }
+};
+
+
+
+static void CheckRequestVersion(const iop::locnet::Request &request)
+{
+    if ( request.version().empty() || request.version()[0] != 1 )
+        { throw LocationNetworkError(ErrorCode::ERROR_UNSUPPORTED, "Missing or unknown request version"); }
+}
+
+
+template <class Interface>
+static void DispatchRoute( typename Interface::Dispatcher &dispatcher,
+    const iop::locnet::Request &request, iop::locnet::Response &response )
+{
+    CheckRequestVersion(request);
+    if ( ! Interface::Serves(request) )
+        { throw LocationNetworkError( ErrorCode::ERROR_BAD_REQUEST, Interface::WrongInterfaceError() ); }
+    
+    const typename Interface::Request &interfaceRequest = Interface::Part(request);
+    const typename DispatchTable<Interface>::Route &route =
+        DispatchTable<Interface>::Find( Interface::Case(interfaceRequest) );
+    SplicedResponseFields::Dispatching splicedFields( Interface::ResponseField, Interface::Case(interfaceRequest) );
+    
+    shared_ptr<IRequestRouteHooks> hooks = IRequestRouteHooks::Installed();
+    if ( ! hooks || route.name == nullptr )
+    {
+        route.serve( dispatcher, interfaceRequest, *Interface::MutablePart(response) );
+        return;
+    }
+    
+    if ( ! hooks->Admit(route.name) )
+        { throw LocationNetworkError( ErrorCode::ERROR_BAD_STATE, string("Requests of ") + route.name + " are refused now" ); }
+    auto startTime = chrono::steady_clock::now();
+    try { route.serve( dispatcher, interfaceRequest, *Interface::MutablePart(response) ); }
+    catch (...)
+    {
+        hooks->Served( route.name, chrono::steady_clock::now() - startTime, false );
+        throw;
+    }
+    hooks->Served( route.name, chrono::steady_clock::now() - startTime, true );
+}
+
+
+
+// Handlers shared by routes of different interfaces with the same message types
+// Nodes handed out by the database are spliced from their cached encodings while serving a request,
+// but only if all of them have one: spliced nodes are listed after the filled ones, which would change the order.
+static void FillNodes( google::protobuf::RepeatedPtrField<iop::locnet::NodeInfo> *target,
+                       int fieldNumber, const vector<NodeInfo> &nodes )
+{
+    SplicedResponseFields *splicedFields = SplicedResponseFields::Active();
+    if ( splicedFields && all_of( nodes.begin(), nodes.end(),
+            [] (const NodeInfo &node) { return static_cast<bool>( node.encoding() ); } ) )
+    {
+        for (auto const &node : nodes)
+            { splicedFields->Add( fieldNumber, *Converter::Serialized(node) ); }
+        return;
+    }
+    
+    target->Reserve( static_cast<int>( nodes.size() ) );
+    for (auto const &node : nodes)
+        { Converter::FillProtoBuf( target->Add(), node ); }
+}
+
+
+template <class Methods>
+static void ServeGetNodeInfo(Methods &methods, iop::locnet::GetNodeInfoResponse &response)
+{
+    NodeInfo node = methods.GetNodeInfo();
+    LOG_DEBUG(Messaging) << "Served GetNodeInfo(): " << node;
+    SplicedResponseFields *splicedFields = SplicedResponseFields::Active();
+    if (splicedFields)
+        { splicedFields->Add( iop::locnet::GetNodeInfoResponse::kNodeInfoFieldNumber, *Converter::Serialized(node) ); }
+    else { Converter::FillProtoBuf( response.mutable_node_info(), node ); }
+}
+
+
+template <class Methods>
+static void ServeGetRandomNodes( Methods &methods,
+    const iop::locnet::GetRandomNodesRequest &request, iop::locnet::GetRandomNodesResponse &response )
+{
+    Neighbours neighbourFilter = request.include_neighbours() ? Neighbours::Included : Neighbours::Excluded;
+    vector<NodeInfo> randomNodes = methods.GetRandomNodes( request.max_node_count(), neighbourFilter );
+    LOG_DEBUG(Messaging) << "Served GetRandomNodes(), node count: " << randomNodes.size();
+    FillNodes( response.mutable_nodes(), iop::locnet::GetRandomNodesResponse::kNodesFieldNumber, randomNodes );
+}
+
+
+template <class Methods>
+static void ServeGetClosestNodes( Methods &methods, const iop::locnet::GetClosestNodesByDistanceRequest &request,
+    iop::locnet::GetClosestNodesByDistanceResponse &response )
+{
+    GpsLocation location = Converter::FromProtoBuf( request.location() );
+    Neighbours neighbourFilter = request.include_neighbours() ? Neighbours::Included : Neighbours::Excluded;
+    vector<NodeInfo> closeNodes = methods.GetClosestNodesByDistance( location,
+        request.max_radius_km(), request.max_node_count(), neighbourFilter );
+    LOG_DEBUG(Messaging) << "Served GetClosestNodes(), node count: " << closeNodes.size();
+    FillNodes( response.mutable_nodes(),
+        iop::locnet::GetClosestNodesByDistanceResponse::kNodesFieldNumber, closeNodes );
+}
+
+
+// Relation requests have the same messages, only the method of the node differs
+static void ServeBuildNetwork( const char *operation, INodeMethods &iNode,
+    shared_ptr<NodeInfo> (INodeMethods::*method)(const NodeInfo&),
+    const iop::locnet::BuildNetworkRequest &request, iop::locnet::BuildNetworkResponse &response )
+{
+    NodeInfo nodeInfo = Converter::FromProtoBuf( request.requestor_node_info() );
+    shared_ptr<NodeInfo> result = (iNode.*method)(nodeInfo);
+    LOG_DEBUG(Messaging) << "Served " << operation << "(" << nodeInfo << "), accepted: " << static_cast<bool>(result);
+    
+    response.set_accepted( static_cast<bool>(result) );
+    if ( ! result )
+        { return; }
+    SplicedResponseFields *splicedFields = SplicedResponseFields::Active();
+    if (splicedFields)
+        { splicedFields->Add( iop::locnet::BuildNetworkResponse::kAcceptorNodeInfoFieldNumber, *Converter::Serialized(*result) ); }
+    else { Converter::FillProtoBuf( response.mutable_acceptor_node_info(), *result ); }
+}
+
+
+
+template <>
+struct RequestRoute<LocalServiceInterface, iop::locnet::LocalServiceRequest::kRegisterService>
+{
+    static constexpr const char* Name() { return "LocalService.RegisterService"; }
+    
+    static void Serve( IncomingLocalServiceRequestDispatcher &dispatcher,
+        const iop::locnet::LocalServiceRequest &request, iop::locnet::LocalServiceResponse &response )
+    {
+        ServiceInfo service = Converter::FromProtoBuf( request.register_service().service() );
+        GpsLocation location = dispatcher._iLocalService->RegisterService(service);
+        LOG_DEBUG(Messaging) << "Served RegisterService()";
+        Converter::FillProtoBuf( response.mutable_register_service()->mutable_location(), location );
+    }
+};
+
+
+template <>
+struct RequestRoute<LocalServiceInterface, iop::locnet::LocalServiceRequest::kDeregisterService>
+{
+    static constexpr const char* Name() { return "LocalService.DeregisterService"; }
+    
+    static void Serve( IncomingLocalServiceRequestDispatcher &dispatcher,
+        const iop::locnet::LocalServiceRequest &request, iop::locnet::LocalServiceResponse &response )
+    {
+        dispatcher._iLocalService->DeregisterService( request.deregister_service().service_type() );
+        LOG_DEBUG(Messaging) << "Served DeregisterService()";
+        response.mutable_deregister_service();
+    }
+};
+
+
+template <>
+struct RequestRoute<LocalServiceInterface, iop::locnet::LocalServiceRequest::kGetNeighbourNodes>
+{
+    static constexpr const char* Name() { return "LocalService.GetNeighbourNodes"; }
+    
+    static void Serve( IncomingLocalServiceRequestDispatcher &dispatcher,
+        const iop::locnet::LocalServiceRequest &request, iop::locnet::LocalServiceResponse &response )
+    {
+        bool keepAlive = request.get_neighbour_nodes().keep_alive_and_send_updates();
+        vector<NodeInfo> neighbours = dispatcher._iLocalService->GetNeighbourNodesByDistance();
+        LOG_DEBUG(Messaging) << "Served GetNeighbourNodes() with keepalive " << keepAlive
+                   << ", node count : " << neighbours.size();
+        FillNodes( response.mutable_get_neighbour_nodes()->mutable_nodes(),
+            iop::locnet::GetNeighbourNodesByDistanceResponse::kNodesFieldNumber, neighbours );
+        
+        if (keepAlive)
+        {
+            shared_ptr<IChangeListener> listener = dispatcher._listenerFactory->Create(dispatcher._iLocalService);
+            dispatcher._iLocalService->AddListener(listener);
+        }
+    }
+};
+
+
+template <>
+struct RequestRoute<LocalServiceInterface, iop::locnet::LocalServiceRequest::kNeighbourhoodChanged>
+{
+    static constexpr const char* Name() { return "LocalService.NeighbourhoodChanged"; }
+    
+    static void Serve( IncomingLocalServiceRequestDispatcher&,
+        const iop::locnet::LocalServiceRequest&, iop::locnet::LocalServiceResponse& )
+    {
+        throw LocationNetworkError(ErrorCode::ERROR_BAD_REQUEST,
+            "Invalid request type. This is a notification message: it's not supposed to be sent "
+            "as a request to this server but to be received as notification "
+            "after a GetNeighbourNodesRequest with flag keepAlive set.");
+    }
+};
+
+
+template <>
+struct RequestRoute<LocalServiceInterface, iop::locnet::LocalServiceRequest::kGetNodeInfo>
+{
+    static constexpr const char* Name() { return "LocalService.GetNodeInfo"; }
+    
+    static void Serve( IncomingLocalServiceRequestDispatcher &dispatcher,
+        const iop::locnet::LocalServiceRequest&, iop::locnet::LocalServiceResponse &response )
+        { ServeGetNodeInfo( *dispatcher._iLocalService, *response.mutable_get_node_info() ); }
+};
+
+
+
+template <>
+struct RequestRoute<NodeInterface, iop::locnet::RemoteNodeRequest::kAcceptColleague>
+{
+    static constexpr const char* Name() { return "RemoteNode.AcceptColleague"; }
+    
+    static void Serve( IncomingNodeRequestDispatcher &dispatcher,
+        const iop::locnet::RemoteNodeRequest &request, iop::locnet::RemoteNodeResponse &response )
+    {
+        ServeBuildNetwork( "AcceptColleague", *dispatcher._iNode, &INodeMethods::AcceptColleague,
+            request.accept_colleague(), *response.mutable_accept_colleague() );
+    }
+};
+
+
+template <>
+struct RequestRoute<NodeInterface, iop::locnet::RemoteNodeRequest::kRenewColleague>
+{
+    static constexpr const char* Name() { return "RemoteNode.RenewColleague"; }
+    
+    static void Serve( IncomingNodeRequestDispatcher &dispatcher,
+        const iop::locnet::RemoteNodeRequest &request, iop::locnet::RemoteNodeResponse &response )
+    {
+        ServeBuildNetwork( "RenewColleague", *dispatcher._iNode, &INodeMethods::RenewColleague,
+            request.renew_colleague(), *response.mutable_renew_colleague() );
+    }
+};
+
+
+template <>
+struct RequestRoute<NodeInterface, iop::locnet::RemoteNodeRequest::kAcceptNeighbour>
+{
+    static constexpr const char* Name() { return "RemoteNode.AcceptNeighbour"; }
+    
+    static void Serve( IncomingNodeRequestDispatcher &dispatcher,
+        const iop::locnet::RemoteNodeRequest &request, iop::locnet::RemoteNodeResponse &response )
+    {
+        ServeBuildNetwork( "AcceptNeighbour", *dispatcher._iNode, &INodeMethods::AcceptNeighbour,
+            request.accept_neighbour(), *response.mutable_accept_neighbour() );
+    }
+};
+
+
+template <>
+struct RequestRoute<NodeInterface, iop::locnet::RemoteNodeRequest::kRenewNeighbour>
+{
+    static constexpr const char* Name() { return "RemoteNode.RenewNeighbour"; }
+    
+    static void Serve( IncomingNodeRequestDispatcher &dispatcher,
+        const iop::locnet::RemoteNodeRequest &request, iop::locnet::RemoteNodeResponse &response )
+    {
+        ServeBuildNetwork( "RenewNeighbour", *dispatcher._iNode, &INodeMethods::RenewNeighbour,
+            request.renew_neighbour(), *response.mutable_renew_neighbour() );
+    }
+};
+
+
+template <>
+struct RequestRoute<NodeInterface, iop::locnet::RemoteNodeRequest::kGetNodeCount>
+{
+    static constexpr const char* Name() { return "RemoteNode.GetNodeCount"; }
+    
+    static void Serve( IncomingNodeRequestDispatcher &dispatcher,
+        const iop::locnet::RemoteNodeRequest&, iop::locnet::RemoteNodeResponse &response )
+    {
+        size_t counter = dispatcher._iNode->GetNodeCount();
+        LOG_DEBUG(Messaging) << "Served GetNodeCount(), node count: " << counter;
+        response.mutable_get_node_count()->set_node_count(counter);
+    }
+};
+
+
+template <>
+struct RequestRoute<NodeInterface, iop::locnet::RemoteNodeRequest::kGetRandomNodes>
+{
+    static constexpr const char* Name() { return "RemoteNode.GetRandomNodes"; }
+    
+    static void Serve( IncomingNodeRequestDispatcher &dispatcher,
+        const iop::locnet::RemoteNodeRequest &request, iop::locnet::RemoteNodeResponse &response )
+        { ServeGetRandomNodes( *dispatcher._iNode, request.get_random_nodes(), *response.mutable_get_random_nodes() ); }
+};
+
+
+template <>
+struct RequestRoute<NodeInterface, iop::locnet::RemoteNodeRequest::kGetClosestNodes>
+{
+    static constexpr const char* Name() { return "RemoteNode.GetClosestNodes"; }
+    
+    static void Serve( IncomingNodeRequestDispatcher &dispatcher,
+        const iop::locnet::RemoteNodeRequest &request, iop::locnet::RemoteNodeResponse &response )
+        { ServeGetClosestNodes( *dispatcher._iNode, request.get_closest_nodes(), *response.mutable_get_closest_nodes() ); }
+};
+
+
+template <>
+struct RequestRoute<NodeInterface, iop::locnet::RemoteNodeRequest::kGetNodeInfo>
+{
+    static constexpr const char* Name() { return "RemoteNode.GetNodeInfo"; }
+    
+    static void Serve( IncomingNodeRequestDispatcher &dispatcher,
+        const iop::locnet::RemoteNodeRequest&, iop::locnet::RemoteNodeResponse &response )
+        { ServeGetNodeInfo( *dispatcher._iNode, *response.mutable_get_node_info() ); }
+};
+
+
+
+template <>
+struct RequestRoute<ClientInterface, iop::locnet::ClientRequest::kGetNodeInfo>
+{
+    static constexpr const char* Name() { return "Client.GetNodeInfo"; }
+    
+    static void Serve( IncomingClientRequestDispatcher &dispatcher,
+        const iop::locnet::ClientRequest&, iop::locnet::ClientResponse &response )
+        { ServeGetNodeInfo( *dispatcher._iClient, *response.mutable_get_node_info() ); }
+};
+
+
+template <>
+struct RequestRoute<ClientInterface, iop::locnet::ClientRequest::kGetNeighbourNodes>
+{
+    static constexpr const char* Name() { return "Client.GetNeighbourNodes"; }
+    
+    static void Serve( IncomingClientRequestDispatcher &dispatcher,
+        const iop::locnet::ClientRequest&, iop::locnet::ClientResponse &response )
+    {
+        vector<NodeInfo> neighbours = dispatcher._iClient->GetNeighbourNodesByDistance();
+        LOG_DEBUG(Messaging) << "Served GetNeighbourNodes(), node count: " << neighbours.size();
+        FillNodes( response.mutable_get_neighbour_nodes()->mutable_nodes(),
+            iop::locnet::GetNeighbourNodesByDistanceResponse::kNodesFieldNumber, neighbours );
+    }
+};
+
+
+template <>
+struct RequestRoute<ClientInterface, iop::locnet::ClientRequest::kGetClosestNodes>
+{
+    static constexpr const char* Name() { return "Client.GetClosestNodes"; }
+    
+    static void Serve( IncomingClientRequestDispatcher &dispatcher,
+        const iop::locnet::ClientRequest &request, iop::locnet::ClientResponse &response )
+        { ServeGetClosestNodes( *dispatcher._iClient, request.get_closest_nodes(), *response.mutable_get_closest_nodes() ); }
+};
+
+
+template <>
+struct RequestRoute<ClientInterface, iop::locnet::ClientRequest::kExploreNodes>
+{
+    static constexpr const char* Name() { return "Client.ExploreNodes"; }
+    
+    static void Serve( IncomingClientRequestDispatcher &dispatcher,
+        const iop::locnet::ClientRequest &request, iop::locnet::ClientResponse &response )
+    {
+        auto const &exploreRequest = request.explore_nodes();
+        GpsLocation location = Converter::FromProtoBuf( exploreRequest.location() );
+        vector<NodeInfo> exploredNodes = dispatcher._iClient->ExploreNetworkNodesByDistance( location,
+            exploreRequest.target_node_count(), exploreRequest.max_node_hops() );
+        LOG_DEBUG(Messaging) << "Served ExploreNodes(), node count: " << exploredNodes.size();
+        FillNodes( response.mutable_explore_nodes()->mutable_closest_nodes(),
+            iop::locnet::ExploreNetworkNodesByDistanceResponse::kClosestNodesFieldNumber, exploredNodes );
+    }
+};
+
+
+template <>
+struct RequestRoute<ClientInterface, iop::locnet::ClientRequest::kGetRandomNodes>
+{
+    static constexpr const char* Name() { return "Client.GetRandomNodes"; }
+    
+    static void Serve( IncomingClientRequestDispatcher &dispatcher,
+        const iop::locnet::ClientRequest &request, iop::locnet::ClientResponse &response )
+        { ServeGetRandomNodes( *dispatcher._iClient, request.get_random_nodes(), *response.mutable_get_random_nodes() ); }
+};
+
+
+
+template <>
+struct RequestRoute<AnyInterface, iop::locnet::Request::kLocalService>
+{
+    static constexpr const char* Name() { return "LocalService"; }
+    
+    static void Serve( IncomingRequestDispatcher &dispatcher,
+        const iop::locnet::Request &request, iop::locnet::Response &response )
+        { dispatcher._iLocalService->DispatchInto(request, response); }
+};
+
+
+template <>
+struct RequestRoute<AnyInterface, iop::locnet::Request::kRemoteNode>
+{
+    static constexpr const char* Name() { return "RemoteNode"; }
+    
+    static void Serve( IncomingRequestDispatcher &dispatcher,
+        const iop::locnet::Request &request, iop::locnet::Response &response )
+        { dispatcher._iRemoteNode->DispatchInto(request, response); }
+};
+
+
+template <>
+struct RequestRoute<AnyInterface, iop::locnet::Request::kClient>
+{
+    static constexpr const char* Name() { return "Client"; }
+    
+    static void Serve( IncomingRequestDispatcher &dispatcher,
+        const iop::locnet::Request &request, iop::locnet::Response &response )
+        { dispatcher._iClient->DispatchInto(request, response); }
+};
+
+
+
+void IncomingLocalServiceRequestDispatcher::DispatchInto(
+    const iop::locnet::Request &request, iop::locnet::Response &response)
+    { DispatchRoute<LocalServiceInterface>(*this, request, response); }
+
+void IncomingNodeRequestDispatcher::DispatchInto(const iop::locnet::Request &request, iop::locnet::Response &response)
+    { DispatchRoute<NodeInterface>(*this, request, response); }
+
+void IncomingClientRequestDispatcher::DispatchInto(const iop::locnet::Request &request, iop::locnet::Response &response)
+    { DispatchRoute<ClientInterface>(*this, request, response); }
+
+// NOTE the version and interface of the request are validated by the dispatcher of the interface
+void IncomingRequestDispatcher::DispatchInto(const iop::locnet::Request &request, iop::locnet::Response &response)
+    { DispatchTable<AnyInterface>::Find( request.RequestType_case() ).serve(*this, request, response); }
+
+
+
+// TODO All functions simply translate between different data formats, ideally this should be generated.
+// Requests and responses of the remote node interface, shared by blocking and asynchronous proxies.
+static unique_ptr<iop::locnet::Request> GetNodeInfoRequest()
+{
+    unique_ptr<iop::locnet::Request> request( new iop::locnet::Request() );
+    request->mutable_remote_node()->mutable_get_node_info();
+    return request;
+}
+
+
+static unique_ptr<iop::locnet::Request> GetNodeCountRequest()
+{
+    unique_ptr<iop::locnet::Request> request( new iop::locnet::Request() );
+    request->mutable_remote_node()->mutable_get_node_count();
+    return request;
+}
+
+
+static unique_ptr<iop::locnet::Request> GetRandomNodesRequest(size_t maxNodeCount, Neighbours filter)
 {
     unique_ptr<iop::locnet::Request> request( new iop::locnet::Request() );
     iop::locnet::GetRandomNodesRequest *getRandReq = request->mutable_remote_node()->mutable_get_random_nodes();
     getRandReq->set_max_node_count(maxNodeCount);
     getRandReq->set_include_neighbours( filter == Neighbours::Included );
-    
-    unique_ptr<iop::locnet::Response> response = _dispatcher->Dispatch( move(request) );
-    if (! response || ! response->has_remote_node() || ! response->remote_node().has_get_random_nodes() )
-        { throw LocationNetworkError(ErrorCode::ERROR_BAD_RESPONSE, "Failed to get expected response"); }
-    
-    const iop::locnet::GetRandomNodesResponse &getRandResp = response->remote_node().get_random_nodes();
-    vector<NodeInfo> result;
-    for (int32_t idx = 0; idx < getRandResp.nodes_size(); ++idx)
-        { result.push_back( Converter::FromProtoBuf( getRandResp.nodes(idx) ) ); }
-    LOG(DEBUG) << "Request GetRandomNodes() returned " << result.size() << " nodes";
-    return result;
+    return request;
 }
 
 
-
-vector<NodeInfo> NodeMethodsProtoBufClient::GetClosestNodesByDistance(
-    const GpsLocation& location, Distance radiusKm, size_t maxNodeCount, Neighbours filter) const
+static unique_ptr<iop::locnet::Request> GetClosestNodesRequest( const GpsLocation& location,
+    Distance radiusKm, size_t maxNodeCount, Neighbours filter )
 {
     unique_ptr<iop::locnet::Request> request( new iop::locnet::Request() );
     iop::locnet::GetClosestNodesByDistanceRequest *getNodeReq =
         request->mutable_remote_node()->mutable_get_closest_nodes();
-    getNodeReq->set_allocated_location( Converter::ToProtoBuf(location) );
+    Converter::FillProtoBuf( getNodeReq->mutable_location(), location );
     getNodeReq->set_max_radius_km(radiusKm);
     getNodeReq->set_max_node_count(maxNodeCount);
     getNodeReq->set_include_neighbours( filter == Neighbours::Included );
-    
-    unique_ptr<iop::locnet::Response> response = _dispatcher->Dispatch( move(request) );
-    if (! response || ! response->has_remote_node() || ! response->remote_node().has_get_closest_nodes() )
+    return request;
+}
+
+
+static unique_ptr<iop::locnet::Request> BuildNetworkRequest(
+    iop::locnet::RemoteNodeRequest::RemoteNodeRequestTypeCase requestType, const NodeInfo &node )
+{
+    unique_ptr<iop::locnet::Request> request( new iop::locnet::Request() );
+    iop::locnet::RemoteNodeRequest *remoteReq = request->mutable_remote_node();
+    iop::locnet::BuildNetworkRequest *buildReq = nullptr;
+    switch (requestType)
+    {
+        case iop::locnet::RemoteNodeRequest::kAcceptColleague: buildReq = remoteReq->mutable_accept_colleague(); break;
+        case iop::locnet::RemoteNodeRequest::kRenewColleague:  buildReq = remoteReq->mutable_renew_colleague();  break;
+        case iop::locnet::RemoteNodeRequest::kAcceptNeighbour: buildReq = remoteReq->mutable_accept_neighbour(); break;
+        case iop::locnet::RemoteNodeRequest::kRenewNeighbour:  buildReq = remoteReq->mutable_renew_neighbour();  break;
+        default: throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Unknown relation request type");
+    }
+    Converter::FillProtoBuf( buildReq->mutable_requestor_node_info(), node );
+    return request;
+}
+
+
+
+static const iop::locnet::RemoteNodeResponse& ExpectRemoteNodeResponse(
+    const iop::locnet::Response *response, iop::locnet::RemoteNodeResponse::RemoteNodeResponseTypeCase responseType )
+{
+    if (! response || ! response->has_remote_node() ||
+        response->remote_node().RemoteNodeResponseType_case() != responseType )
         { throw LocationNetworkError(ErrorCode::ERROR_BAD_RESPONSE, "Failed to get expected response"); }
-    
-    const iop::locnet::GetClosestNodesByDistanceResponse &getNodeResp = response->remote_node().get_closest_nodes();
+    return response->remote_node();
+}
+
+
+static NodeInfo GetNodeInfoResult(const iop::locnet::Response *response)
+{
+    auto result = Converter::FromProtoBuf( ExpectRemoteNodeResponse(
+        response, iop::locnet::RemoteNodeResponse::kGetNodeInfo ).get_node_info().node_info() );
+    LOG_DEBUG(Messaging) << "Request GetNodeInfo() returned " << result;
+    return result;
+}
+
+
+static size_t GetNodeCountResult(const iop::locnet::Response *response)
+{
+    size_t result = ExpectRemoteNodeResponse(
+        response, iop::locnet::RemoteNodeResponse::kGetNodeCount ).get_node_count().node_count();
+    LOG_DEBUG(Messaging) << "Request GetNodeCount() returned " << result;
+    return result;
+}
+
+
+static vector<NodeInfo> GetRandomNodesResult(const iop::locnet::Response *response)
+{
+    const iop::locnet::GetRandomNodesResponse &getRandResp = ExpectRemoteNodeResponse(
+        response, iop::locnet::RemoteNodeResponse::kGetRandomNodes ).get_random_nodes();
+    vector<NodeInfo> result;
+    result.reserve( getRandResp.nodes_size() );
+    for (int32_t idx = 0; idx < getRandResp.nodes_size(); ++idx)
+        { result.push_back( Converter::FromProtoBuf( getRandResp.nodes(idx) ) ); }
+    LOG_DEBUG(Messaging) << "Request GetRandomNodes() returned " << result.size() << " nodes";
+    return result;
+}
+
+
+static vector<NodeInfo> GetClosestNodesResult(const iop::locnet::Response *response)
+{
+    const iop::locnet::GetClosestNodesByDistanceResponse &getNodeResp = ExpectRemoteNodeResponse(
+        response, iop::locnet::RemoteNodeResponse::kGetClosestNodes ).get_closest_nodes();
     vector<NodeInfo> result;
+    result.reserve( getNodeResp.nodes_size() );
     for (int32_t idx = 0; idx < getNodeResp.nodes_size(); ++idx)
         { result.push_back( Converter::FromProtoBuf( getNodeResp.nodes(idx) ) ); }
-    LOG(DEBUG) << "Request GetClosestNodesByDistance() returned " << result.size() << " nodes";
+    LOG_DEBUG(Messaging) << "Request GetClosestNodesByDistance() returned " << result.size() << " nodes";
+    return result;
+}
+
+
+static shared_ptr<NodeInfo> BuildNetworkResult( const iop::locnet::Response *response,
+    iop::locnet::RemoteNodeResponse::RemoteNodeResponseTypeCase responseType,
+    const function<void(const IpAddress&)> &detectedIpCallback )
+{
+    const iop::locnet::RemoteNodeResponse &remoteResp = ExpectRemoteNodeResponse(response, responseType);
+    const iop::locnet::BuildNetworkResponse *buildResp = nullptr;
+    switch (responseType)
+    {
+        case iop::locnet::RemoteNodeResponse::kAcceptColleague: buildResp = &remoteResp.accept_colleague(); break;
+        case iop::locnet::RemoteNodeResponse::kRenewColleague:  buildResp = &remoteResp.renew_colleague();  break;
+        case iop::locnet::RemoteNodeResponse::kAcceptNeighbour: buildResp = &remoteResp.accept_neighbour(); break;
+        case iop::locnet::RemoteNodeResponse::kRenewNeighbour:  buildResp = &remoteResp.renew_neighbour();  break;
+        default: throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Unknown relation response type");
+    }
+    
+    auto result = buildResp->accepted() ?
+        shared_ptr<NodeInfo>( new NodeInfo( Converter::FromProtoBuf( buildResp->acceptor_node_info() ) ) ) :
+        shared_ptr<NodeInfo>();
+    LOG_DEBUG(Messaging) << "Request for relation type " << responseType << " returned " << static_cast<bool>(result);
+    
+    if (detectedIpCallback)
+    {
+        const string &address = buildResp->remote_ip_address();
+        if ( ! address.empty() )
+            { detectedIpCallback( IpAddress::FromBytes( address.data(), address.size() ) ); }
+    }
     return result;
 }
 
 
 
+NodeMethodsProtoBufClient::NodeMethodsProtoBufClient(
+    std::shared_ptr<IBlockingRequestDispatcher> dispatcher, std::function<void(const IpAddress&)> detectedIpCallback) :
+    _dispatcher(dispatcher), _detectedIpCallback(detectedIpCallback)
+{
+    if (! _dispatcher)
+        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No dispatcher instantiated"); }
+}
+
+
+NodeInfo NodeMethodsProtoBufClient::GetNodeInfo() const
+    { return GetNodeInfoResult( _dispatcher->Dispatch( GetNodeInfoRequest() ).get() ); }
+
+size_t NodeMethodsProtoBufClient::GetNodeCount() const
+    { return GetNodeCountResult( _dispatcher->Dispatch( GetNodeCountRequest() ).get() ); }
+
+vector<NodeInfo> NodeMethodsProtoBufClient::GetRandomNodes(
+    size_t maxNodeCount, Neighbours filter) const
+{
+    return GetRandomNodesResult( _dispatcher->Dispatch(
+        GetRandomNodesRequest(maxNodeCount, filter) ).get() );
+}
+
+vector<NodeInfo> NodeMethodsProtoBufClient::GetClosestNodesByDistance(
+    const GpsLocation& location, Distance radiusKm, size_t maxNodeCount, Neighbours filter) const
+{
+    return GetClosestNodesResult( _dispatcher->Dispatch(
+        GetClosestNodesRequest(location, radiusKm, maxNodeCount, filter) ).get() );
+}
+
+shared_ptr<NodeInfo> NodeMethodsProtoBufClient::AcceptColleague(const NodeInfo& node)
+{
+    return BuildNetworkResult( _dispatcher->Dispatch( BuildNetworkRequest(
+            iop::locnet::RemoteNodeRequest::kAcceptColleague, node ) ).get(),
+        iop::locnet::RemoteNodeResponse::kAcceptColleague, _detectedIpCallback );
+}
+
+shared_ptr<NodeInfo> NodeMethodsProtoBufClient::RenewColleague(const NodeInfo& node)
+{
+    return BuildNetworkResult( _dispatcher->Dispatch( BuildNetworkRequest(
+            iop::locnet::RemoteNodeRequest::kRenewColleague, node ) ).get(),
+        iop::locnet::RemoteNodeResponse::kRenewColleague, _detectedIpCallback );
+}
+
+shared_ptr<NodeInfo> NodeMethodsProtoBufClient::AcceptNeighbour(const NodeInfo& node)
+{
+    return BuildNetworkResult( _dispatcher->Dispatch( BuildNetworkRequest(
+            iop::locnet::RemoteNodeRequest::kAcceptNeighbour, node ) ).get(),
+        iop::locnet::RemoteNodeResponse::kAcceptNeighbour, _detectedIpCallback );
+}
+
+shared_ptr<NodeInfo> NodeMethodsProtoBufClient::RenewNeighbour(const NodeInfo& node)
+{
+    return BuildNetworkResult( _dispatcher->Dispatch( BuildNetworkRequest(
+            iop::locnet::RemoteNodeRequest::kRenewNeighbour, node ) ).get(),
+        iop::locnet::RemoteNodeResponse::kRenewNeighbour, _detectedIpCallback );
+}
+
+
+
+// Dispatch the request and complete the returned future with the interpreted response
+template <typename Result>
+static future<Result> DispatchAsync( IDelayedRequestDispatcher &dispatcher,
+    unique_ptr<iop::locnet::Request> &&request, function<Result(const iop::locnet::Response*)> interpretResponse )
+{
+    shared_ptr< promise<Result> > result( new promise<Result>() );
+    dispatcher.Dispatch( move(request),
+        [result, interpretResponse] (unique_ptr<iop::locnet::Response> &&response, exception_ptr error)
+    {
+        try
+        {
+            if (error)
+                { rethrow_exception(error); }
+            result->set_value( interpretResponse( response.get() ) );
+        }
+        catch (...)
+            { result->set_exception( current_exception() ); }
+    } );
+    return result->get_future();
+}
+
+
+
+AsyncNodeMethodsProtoBufClient::AsyncNodeMethodsProtoBufClient(
+    shared_ptr<IDelayedRequestDispatcher> dispatcher, function<void(const IpAddress&)> detectedIpCallback ) :
+    _dispatcher(dispatcher), _detectedIpCallback(detectedIpCallback)
+{
+    if (! _dispatcher)
+        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No dispatcher instantiated"); }
+}
+
+
+future<NodeInfo> AsyncNodeMethodsProtoBufClient::GetNodeInfo() const
+{
+    return DispatchAsync<NodeInfo>( *_dispatcher, GetNodeInfoRequest(), GetNodeInfoResult );
+}
+
+future<size_t> AsyncNodeMethodsProtoBufClient::GetNodeCount() const
+{
+    return DispatchAsync<size_t>( *_dispatcher, GetNodeCountRequest(), GetNodeCountResult );
+}
+
+future< vector<NodeInfo> > AsyncNodeMethodsProtoBufClient::GetRandomNodes(
+    size_t maxNodeCount, Neighbours filter) const
+{
+    return DispatchAsync< vector<NodeInfo> >( *_dispatcher,
+        GetRandomNodesRequest(maxNodeCount, filter), GetRandomNodesResult );
+}
+
+future< vector<NodeInfo> > AsyncNodeMethodsProtoBufClient::GetClosestNodesByDistance(
+    const GpsLocation& location, Distance radiusKm, size_t maxNodeCount, Neighbours filter) const
+{
+    return DispatchAsync< vector<NodeInfo> >( *_dispatcher,
+        GetClosestNodesRequest(location, radiusKm, maxNodeCount, filter), GetClosestNodesResult );
+}
+
+
+future< shared_ptr<NodeInfo> > AsyncNodeMethodsProtoBufClient::BuildNetwork(
+    iop::locnet::RemoteNodeRequest::RemoteNodeRequestTypeCase requestType, const NodeInfo &node )
+{
+    // NOTE request and response cases of the same operation have the same numeric value
+    auto responseType = static_cast<iop::locnet::RemoteNodeResponse::RemoteNodeResponseTypeCase>(requestType);
+    function<void(const IpAddress&)> detectedIpCallback = _detectedIpCallback;
+    return DispatchAsync< shared_ptr<NodeInfo> >( *_dispatcher, BuildNetworkRequest(requestType, node),
+        [responseType, detectedIpCallback] (const iop::locnet::Response *response)
+            { return BuildNetworkResult(response, responseType, detectedIpCallback); } );
+}
+
+future< shared_ptr<NodeInfo> > AsyncNodeMethodsProtoBufClient::AcceptColleague(const NodeInfo& node)
+    { return BuildNetwork(iop::locnet::RemoteNodeRequest::kAcceptColleague, node); }
+
+future< shared_ptr<NodeInfo> > AsyncNodeMethodsProtoBufClient::RenewColleague(const NodeInfo& node)
+    { return BuildNetwork(iop::locnet::RemoteNodeRequest::kRenewColleague, node); }
+
+future< shared_ptr<NodeInfo> > AsyncNodeMethodsProtoBufClient::AcceptNeighbour(const NodeInfo& node)
+    { return BuildNetwork(iop::locnet::RemoteNodeRequest::kAcceptNeighbour, node); }
+
+future< shared_ptr<NodeInfo> > AsyncNodeMethodsProtoBufClient::RenewNeighbour(const NodeInfo& node)
+    { return BuildNetwork(iop::locnet::RemoteNodeRequest::kRenewNeighbour, node); }
+
+
+
 } // namespace LocNet
 
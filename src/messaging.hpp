@@ -1,9 +1,15 @@
 #ifndef __LOCNET_PROTOBUF_MESSAGING_H__
 #define __LOCNET_PROTOBUF_MESSAGING_H__
 
+#include <chrono>
 #include <future>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
+#include <google/protobuf/arena.h>
 #include <google/protobuf/text_format.h>
 
 #include "IopLocNet.pb.h"
@@ -25,17 +31,131 @@ struct Converter
     static GpsLocation FromProtoBuf(const iop::locnet::GpsLocation &value);
     static NodeInfo FromProtoBuf(const iop::locnet::NodeInfo &value);
     
-    // Functions that fill up an existing protobuf object from the internal representation
+    // Functions that fill up an existing protobuf object from the internal representation.
+    // Nested messages are created on the arena of the target if any.
     static void FillProtoBuf(iop::locnet::ServiceInfo *target, const ServiceInfo &source);
     static void FillProtoBuf(iop::locnet::GpsLocation *target, const GpsLocation &source);
     static void FillProtoBuf(iop::locnet::NodeInfo *target, const NodeInfo &source);
     
-    // Functions that convert from the internal representation to protobuf, creating a new object
+    // Functions that convert simple values from the internal representation to protobuf
     static iop::locnet::Status ToProtoBuf(ErrorCode value);
     static std::string ToProtoBuf(std::string value);
-    static iop::locnet::ServiceInfo* ToProtoBuf(const ServiceInfo &value);
-    static iop::locnet::GpsLocation* ToProtoBuf(const GpsLocation &location);
-    static iop::locnet::NodeInfo* ToProtoBuf(const NodeInfo &info);
+    
+    // Serialized protobuf message of the node info. It is stored in the encoding attached to the
+    // node info if any, and taken from there instead of converting again.
+    static std::shared_ptr<const std::string> Serialized(const NodeInfo &value);
+};
+
+
+
+// Protobuf messages of serving a request are allocated from an arena instead of a separate heap
+// allocation for every nested message. The arena is reset after each request, so its memory blocks
+// are reused by later requests served on the same thread.
+// NOTE messages generated without arena support (no cc_enable_arenas before protobuf 3.14) are still
+//      placed on the arena and destroyed by Reset(), but their nested messages are heap allocated.
+class MessageArena
+{
+    google::protobuf::Arena _arena;
+    
+public:
+    
+    static const size_t InitialBlockSize = 16 * 1024;
+    
+    // Arena of the calling thread, i.e. of the reactor or worker thread serving the request
+    static MessageArena& ThreadInstance();
+    
+    MessageArena();
+    MessageArena(const MessageArena &other) = delete;
+    MessageArena& operator=(const MessageArena &other) = delete;
+    
+    template <class MessageType>
+    MessageType* Create()
+        { return google::protobuf::Arena::Create<MessageType>(&_arena); }
+    
+    size_t spaceUsed() const;
+    
+    // Destroy all messages created on the arena, keeping its memory for reuse
+    void Reset();
+};
+
+
+
+// Pre-encoded fields of a response that are appended to its serialized form by MessageFraming
+// instead of being built as protobuf objects, e.g. node infos encoded once and listed by many responses.
+// Protobuf parsers merge repeated occurrences of embedded messages and append repeated fields,
+// so fields wrapped into their enclosing fields parse as if they were set in the response.
+// Request handlers add fields only while the instance of their thread is activated by the server,
+// otherwise they fill the response objects as usual.
+class SplicedResponseFields
+{
+    std::string             _bytes;     // Completed fields, encoded relative to the Response message
+    std::string             _pending;   // Fields added at the current nesting, not wrapped yet
+    std::vector<int>        _nesting;   // Field numbers enclosing the pending fields, outermost first
+    std::vector<uint32_t>   _wrapSizes;
+    bool                    _active;
+    
+    void WrapPending();
+    
+public:
+    
+    // Fields of the response served by the calling thread
+    static SplicedResponseFields& ThreadInstance();
+    // Instance of the calling thread if it is activated, null otherwise
+    static SplicedResponseFields* Active();
+    
+    SplicedResponseFields();
+    SplicedResponseFields(const SplicedResponseFields &other) = delete;
+    SplicedResponseFields& operator=(const SplicedResponseFields &other) = delete;
+    
+    void Activate();
+    // Drop all fields and stop collecting them
+    void Reset();
+    
+    // Fields added while serving a request are enclosed by the interface and case fields of the response.
+    // Requests dispatched in process by the handler of another request build their responses as usual.
+    class Dispatching
+    {
+        SplicedResponseFields  *_fields;
+        bool                    _suspended;
+        
+    public:
+        
+        Dispatching(int interfaceField, int caseField);
+        Dispatching(const Dispatching &other) = delete;
+        Dispatching& operator=(const Dispatching &other) = delete;
+        ~Dispatching();
+    };
+    
+    // Add an embedded message field, encoded already
+    void Add(int fieldNumber, const std::string &encodedMessage);
+    
+    // Fields of the response to be appended, complete when no Dispatching instance is alive
+    const std::string& bytes() const;
+};
+
+
+
+// Wire format of messages, compatible with serializing a MessageWithHeader object,
+// but without building the wrapper and intermediate strings. A frame consists of
+//   - a 5 byte header: the tag of the fixed32 header field and the little-endian size of the rest
+//   - the tag and varint length of the body field, followed by the serialized Message.
+struct MessageFraming
+{
+    static const size_t  HeaderSize     = 5;
+    static const uint8_t HeaderFieldTag = 0x0D; // Field 1, wire type fixed32
+    static const uint8_t BodyFieldTag   = 0x12; // Field 2, wire type length delimited
+    static const size_t  MaxFrameSize   = 1024 * 1024; // Limit of the frame following the header
+
+    // Size of the frame following the header, throws if the header is malformed
+    static uint32_t ReadFrameSize(const char *header);
+    // Replace the contents of the buffer with the whole frame of the message including the header,
+    // throws if the frame would exceed the size limit
+    static void Serialize(const iop::locnet::Message &message, std::string &buffer);
+    // Serialize a response message with pre-encoded fields appended to its response
+    static void Serialize( const iop::locnet::Message &message,
+                           const SplicedResponseFields &splicedFields, std::string &buffer );
+    // Parse a message from the frame following the header, returns false for malformed content
+    static bool Parse(const char *frame, size_t frameSize, iop::locnet::Message &message);
 };
 
 
@@ -50,60 +170,144 @@ public:
     virtual ~IBlockingRequestDispatcher() {}
     
     virtual std::unique_ptr<iop::locnet::Response> Dispatch(std::unique_ptr<iop::locnet::Request> &&request) = 0;
+    
+    // Fill a response provided by the caller, e.g. allocated on an arena.
+    // By default the request is copied to the heap and served with Dispatch().
+    virtual void DispatchInto(const iop::locnet::Request &request, iop::locnet::Response &response);
+};
+
+
+
+// Hooks called around serving each route of the incoming dispatchers, e.g. to collect metrics
+// or to refuse requests of some routes under load. Routes are named like "Client.GetClosestNodes".
+class IRequestRouteHooks
+{
+    static std::shared_ptr<IRequestRouteHooks> _installed;
+    
+public:
+    
+    typedef std::chrono::steady_clock::duration Duration;
+    
+    // Hooks used by all dispatchers, none are installed by default
+    static void Install(std::shared_ptr<IRequestRouteHooks> hooks);
+    static std::shared_ptr<IRequestRouteHooks> Installed();
+    
+    virtual ~IRequestRouteHooks() {}
+    
+    // Called before serving a request, return false to refuse it with ERROR_BAD_STATE.
+    // Exceptions thrown here are not caught either, those fail the request with their own error.
+    virtual bool Admit(const char *route) = 0;
+    virtual void Served(const char *route, Duration duration, bool succeeded) = 0;
+};
+
+
+
+// Statistics collected about requests served on a route, mostly for logging and monitoring.
+struct RequestRouteStats
+{
+    size_t servedCount = 0;
+    size_t failedCount = 0;
+    
+    std::chrono::steady_clock::duration maxDuration   = std::chrono::steady_clock::duration::zero();
+    std::chrono::steady_clock::duration totalDuration = std::chrono::steady_clock::duration::zero();
+};
+
+
+// Route hooks that admit every request and collect statistics for each route.
+class RequestRouteMetrics : public IRequestRouteHooks
+{
+    mutable std::mutex                          _mutex;
+    std::map<std::string, RequestRouteStats>    _stats;
+    
+public:
+    
+    bool Admit(const char *route) override;
+    void Served(const char *route, Duration duration, bool succeeded) override;
+    
+    std::map<std::string, RequestRouteStats> stats() const;
+};
+
+
+
+// Routes of the dispatch tables, specialized for each request type in the implementation.
+template <class Interface, int RequestCase>
+struct RequestRoute;
+
+
+
+// Base of the incoming dispatchers, they serve requests by filling the response of the caller.
+class ArenaRequestDispatcher : public IBlockingRequestDispatcher
+{
+public:
+    
+    std::unique_ptr<iop::locnet::Response> Dispatch(std::unique_ptr<iop::locnet::Request> &&request) override;
+    void DispatchInto(const iop::locnet::Request &request, iop::locnet::Response &response) override = 0;
 };
 
 
 
 // Dispatch messages to serve requests on the local service interface.
-class IncomingLocalServiceRequestDispatcher : public IBlockingRequestDispatcher
+class IncomingLocalServiceRequestDispatcher : public ArenaRequestDispatcher
 {
     std::shared_ptr<ILocalServiceMethods>   _iLocalService;
     std::shared_ptr<IChangeListenerFactory> _listenerFactory;
     
+    template <class Interface, int RequestCase>
+    friend struct RequestRoute;
+    
 public:
     
     IncomingLocalServiceRequestDispatcher( std::shared_ptr<ILocalServiceMethods> iLocalService,
         std::shared_ptr<IChangeListenerFactory> listenerFactory );
     
-    std::unique_ptr<iop::locnet::Response> Dispatch(std::unique_ptr<iop::locnet::Request> &&request) override;
+    void DispatchInto(const iop::locnet::Request &request, iop::locnet::Response &response) override;
 };
 
 
 
 // Dispatch messages to serve requests on the node interface.
-class IncomingNodeRequestDispatcher : public IBlockingRequestDispatcher
+class IncomingNodeRequestDispatcher : public ArenaRequestDispatcher
 {
     std::shared_ptr<INodeMethods> _iNode;
     
+    template <class Interface, int RequestCase>
+    friend struct RequestRoute;
+    
 public:
     
     IncomingNodeRequestDispatcher(std::shared_ptr<INodeMethods> iNode);
     
-    std::unique_ptr<iop::locnet::Response> Dispatch(std::unique_ptr<iop::locnet::Request> &&request) override;
+    void DispatchInto(const iop::locnet::Request &request, iop::locnet::Response &response) override;
 };
 
 
 
 // Dispatch messages to serve requests on the client interface.
-class IncomingClientRequestDispatcher : public IBlockingRequestDispatcher
+class IncomingClientRequestDispatcher : public ArenaRequestDispatcher
 {
     std::shared_ptr<IClientMethods> _iClient;
     
+    template <class Interface, int RequestCase>
+    friend struct RequestRoute;
+    
 public:
     
     IncomingClientRequestDispatcher(std::shared_ptr<IClientMethods> iClient);
     
-    std::unique_ptr<iop::locnet::Response> Dispatch(std::unique_ptr<iop::locnet::Request> &&request) override;
+    void DispatchInto(const iop::locnet::Request &request, iop::locnet::Response &response) override;
 };
 
 
 // Unified server functionality, useful to serve requests of all interfaces on a single port.
-class IncomingRequestDispatcher : public IBlockingRequestDispatcher
+class IncomingRequestDispatcher : public ArenaRequestDispatcher
 {
     std::shared_ptr<IncomingLocalServiceRequestDispatcher> _iLocalService;
     std::shared_ptr<IncomingNodeRequestDispatcher>         _iRemoteNode;
     std::shared_ptr<IncomingClientRequestDispatcher>       _iClient;
     
+    template <class Interface, int RequestCase>
+    friend struct RequestRoute;
+    
 public:
     
     IncomingRequestDispatcher( std::shared_ptr<Node> node,
@@ -114,21 +318,25 @@ public:
         std::shared_ptr<IncomingNodeRequestDispatcher> iRemoteNode,
         std::shared_ptr<IncomingClientRequestDispatcher> iClient );
     
-    std::unique_ptr<iop::locnet::Response> Dispatch(std::unique_ptr<iop::locnet::Request> &&request) override;
+    void DispatchInto(const iop::locnet::Request &request, iop::locnet::Response &response) override;
 };
 
 
 
-// // Serve requests that are probably slow, e.g. has to be sent over a network.
-// class IDelayedRequestDispatcher
-// {
-// public:
-//     
-//     virtual ~IDelayedRequestDispatcher() {}
-//     
-//     virtual std::future<std::unique_ptr<iop::locnet::Response>>
-//         Dispatch(std::unique_ptr<iop::locnet::Request> &&request) = 0;
-// };
+// Serve requests that are probably slow, e.g. has to be sent over a network.
+// Dispatch returns immediately, the handler is called exactly once later,
+// either with the response or with an error.
+class IDelayedRequestDispatcher
+{
+public:
+    
+    typedef void ResponseHandler( std::unique_ptr<iop::locnet::Response> &&response, std::exception_ptr error );
+    
+    virtual ~IDelayedRequestDispatcher() {}
+    
+    virtual void Dispatch( std::unique_ptr<iop::locnet::Request> &&request,
+                           std::function<ResponseHandler> responseHandler ) = 0;
+};
 
 
 
@@ -137,17 +345,13 @@ public:
 // then translate its response into our internal representation.
 class NodeMethodsProtoBufClient : public INodeMethods
 {
-    // TODO use a IDelayedRequestDispatcher instance instead
     std::shared_ptr<IBlockingRequestDispatcher> _dispatcher;
-    std::function<void(const Address&)> _detectedIpCallback;
-    
-    std::unique_ptr<iop::locnet::Response> WaitForDispatch(
-        std::unique_ptr<iop::locnet::Request> request);
+    std::function<void(const IpAddress&)> _detectedIpCallback;
     
 public:
     
     NodeMethodsProtoBufClient( std::shared_ptr<IBlockingRequestDispatcher> dispatcher,
-                               std::function<void(const Address&)> detectedIpCallback );
+                               std::function<void(const IpAddress&)> detectedIpCallback );
     
     NodeInfo GetNodeInfo() const override;
     size_t GetNodeCount() const override;
@@ -165,6 +369,36 @@ public:
 
 
 
+// Asynchronous variant of the protobuf proxy, no thread is held while waiting for the other node.
+class AsyncNodeMethodsProtoBufClient : public IAsyncNodeMethods
+{
+    std::shared_ptr<IDelayedRequestDispatcher> _dispatcher;
+    std::function<void(const IpAddress&)> _detectedIpCallback;
+    
+    std::future< std::shared_ptr<NodeInfo> > BuildNetwork(
+        iop::locnet::RemoteNodeRequest::RemoteNodeRequestTypeCase requestType, const NodeInfo &node );
+    
+public:
+    
+    AsyncNodeMethodsProtoBufClient( std::shared_ptr<IDelayedRequestDispatcher> dispatcher,
+                                    std::function<void(const IpAddress&)> detectedIpCallback );
+    
+    std::future<NodeInfo> GetNodeInfo() const override;
+    std::future<size_t> GetNodeCount() const override;
+    std::future< std::vector<NodeInfo> > GetRandomNodes(
+        size_t maxNodeCount, Neighbours filter) const override;
+    
+    std::future< std::vector<NodeInfo> > GetClosestNodesByDistance(const GpsLocation &location,
+        Distance radiusKm, size_t maxNodeCount, Neighbours filter) const override;
+    
+    std::future< std::shared_ptr<NodeInfo> > AcceptColleague(const NodeInfo &node) override;
+    std::future< std::shared_ptr<NodeInfo> > RenewColleague (const NodeInfo &node) override;
+    std::future< std::shared_ptr<NodeInfo> > AcceptNeighbour(const NodeInfo &node) override;
+    std::future< std::shared_ptr<NodeInfo> > RenewNeighbour (const NodeInfo &node) override;
+};
+
+
+
 } // namespace LocNet
 
 
@@ -1,3 +1,9 @@
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
 #include "network.hpp"
 
 // NOTE on Windows this includes <winsock(2).h> so must be after asio includes in "network.hpp"
@@ -19,54 +25,51 @@ bool NetworkEndpoint::isLoopback() const
     catch (...) { return false; }
 }
 
-Address NodeContact::AddressFromBytes(const std::string &bytes)
+IpAddress IpAddress::FromString(const Address &addr)
 {
-    if ( bytes.empty() )
-        { return Address(); }
-    else if ( bytes.size() == sizeof(address_v4::bytes_type) )
-    {
-        address_v4::bytes_type v4AddrBytes;
-        copy( &bytes.front(), &bytes.front() + v4AddrBytes.size(), v4AddrBytes.data() );
-        address_v4 ipv4(v4AddrBytes);
-        return ipv4.to_string();
-    }
-    else if ( bytes.size() == sizeof(address_v6::bytes_type) )
-    {
-        address_v6::bytes_type v6AddrBytes;
-        copy( &bytes.front(), &bytes.front() + v6AddrBytes.size(), v6AddrBytes.data() );
-        address_v6 ipv6(v6AddrBytes);
-        return ipv6.to_string();
-    }
-    else { throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Invalid bytearray length of IP address: " + to_string( bytes.size() ) ); }
+    if ( addr.empty() )
+        { return IpAddress(); }
+    
+    asio::error_code error;
+    auto ipAddress( address::from_string(addr, error) );
+    if (error)
+        { throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Invalid IP address: " + addr); }
+    return ToIpAddress(ipAddress);
 }
 
 
-string NodeContact::AddressToBytes(const Address &addr)
+IpAddress ToIpAddress(const address &ipAddress)
 {
-    string result;
-    if ( addr.empty() )
-        { return result; }
-    
-    auto ipAddress( address::from_string(addr) );
     if ( ipAddress.is_v4() )
     {
         auto bytes = ipAddress.to_v4().to_bytes();
-        for (uint8_t byte : bytes)
-            { result.push_back(byte); }
+        return IpAddress::FromBytes( bytes.data(), bytes.size() );
     }
-    else if ( ipAddress.is_v6() )
+    auto bytes = ipAddress.to_v6().to_bytes();
+    return IpAddress::FromBytes( bytes.data(), bytes.size() );
+}
+
+
+Address IpAddress::ToString() const
+{
+    switch (_family)
     {
-        auto bytes = ipAddress.to_v6().to_bytes();
-        for (uint8_t byte : bytes)
-            { result.push_back(byte); }
+        case Family::V4:
+        {
+            address_v4::bytes_type v4AddrBytes;
+            copy( _bytes.begin(), _bytes.begin() + v4AddrBytes.size(), v4AddrBytes.begin() );
+            return address_v4(v4AddrBytes).to_string();
+        }
+        case Family::V6:
+        {
+            address_v6::bytes_type v6AddrBytes;
+            copy( _bytes.begin(), _bytes.begin() + v6AddrBytes.size(), v6AddrBytes.begin() );
+            return address_v6(v6AddrBytes).to_string();
+        }
+        default: return Address();
     }
-    else { throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Unknown type of address: " + addr); }
-    return result;
 }
 
-string  NodeContact::AddressBytes() const
-    { return AddressToBytes(_address); }
-
 
 
 Reactor Reactor::_instance;
@@ -79,18 +82,460 @@ bool Reactor::IsShutdown() const { return _asioService.stopped(); }
 Reactor& Reactor::Instance() { return _instance; }
 asio::io_service& Reactor::AsioService() { return _asioService; }
 
+// NOTE asio has no public query for this, reactor loops mark their threads themselves instead
+static thread_local bool ThreadRunsReactor = false;
+
+bool Reactor::IsReactorThread()
+    { return ThreadRunsReactor; }
+
+void Reactor::MarkReactorThread()
+    { ThreadRunsReactor = true; }
+
+
+
+ReactorPool::ReactorPool(size_t coreCount)
+{
+    if (coreCount == 0) {
+        throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Reactor pool needs at least one core");
+    }
+    for (size_t coreIndex = 0; coreIndex < coreCount; ++coreIndex)
+    {
+        // NOTE concurrency hint 1 tells asio that the service is run by a single thread only
+        _services.emplace_back( new asio::io_service(1) );
+        _keepRunning.emplace_back( new asio::io_service::work( *_services.back() ) );
+    }
+}
+
+ReactorPool::~ReactorPool()
+{
+    Shutdown();
+    Join();
+}
+
+
+size_t ReactorPool::coreCount() const
+    { return _services.size(); }
+
+asio::io_service& ReactorPool::AsioService(size_t coreIndex)
+    { return *_services.at(coreIndex); }
+
+
+void ReactorPool::Post(size_t coreIndex, function<void()> task)
+    { AsioService(coreIndex).post(task); }
 
 
-shared_ptr<AsyncConnection> AsyncConnection::Create(
-    weak_ptr<asio::ip::tcp::socket> socket, unique_ptr<string> &&buffer, size_t offset )
+void ReactorPool::Start()
 {
-    return shared_ptr<AsyncConnection>( new AsyncConnection( socket, move(buffer), offset ) );
+    if ( ! _threads.empty() )
+        { throw LocationNetworkError(ErrorCode::ERROR_BAD_STATE, "Reactor pool is already started"); }
+    
+    for (size_t coreIndex = 0; coreIndex < _services.size(); ++coreIndex)
+        { _threads.emplace_back( [this, coreIndex] { CoreLoop(coreIndex); } ); }
+}
+
+
+void ReactorPool::CoreLoop(size_t coreIndex)
+{
+#ifdef __linux__
+    size_t hardwareCoreCount = max( thread::hardware_concurrency(), 1u );
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET( coreIndex % hardwareCoreCount, &cpuSet );
+    if ( pthread_setaffinity_np( pthread_self(), sizeof(cpuSet), &cpuSet ) != 0 )
+        { LOG(WARNING) << "Failed to pin reactor thread to core " << coreIndex; }
+#endif
+    
+    Reactor::MarkReactorThread();
+    LOG_DEBUG(Network) << "Reactor thread of core " << coreIndex << " started";
+    asio::io_service &service = *_services[coreIndex];
+    while ( ! service.stopped() )
+    {
+        try { service.run(); }
+        catch (exception &ex)
+            { LOG(WARNING) << "Async operation failed on core " << coreIndex << ": " << ex.what(); }
+    }
+    LOG_DEBUG(Network) << "Reactor thread of core " << coreIndex << " shut down";
+}
+
+
+void ReactorPool::Shutdown()
+{
+    _keepRunning.clear();
+    for (auto &service : _services)
+        { service->stop(); }
+}
+
+
+void ReactorPool::Join()
+{
+    for (auto &thread : _threads)
+    {
+        if ( thread.joinable() )
+            { thread.join(); }
+    }
+    _threads.clear();
+}
+
+
+
+shared_ptr<PeriodicScheduler> PeriodicScheduler::Create(ClockFunc clock, Executor executor)
+    { return shared_ptr<PeriodicScheduler>( new PeriodicScheduler(clock, executor) ); }
+
+PeriodicScheduler::PeriodicScheduler(ClockFunc clock, Executor executor) :
+    _clock(clock), _executor(executor), _randomGenerator( random_device()() )
+{
+    if (! _clock) {
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No clock instantiated");
+    }
+}
+
+PeriodicScheduler::~PeriodicScheduler()
+{
+    // NOTE job threads keep the scheduler alive while running, only their exit may still be in progress
+    for (auto &job : _jobs)
+    {
+        if ( ! job->thread.joinable() )
+            { continue; }
+        if ( job->thread.get_id() == this_thread::get_id() )
+            { job->thread.detach(); }
+        else { job->thread.join(); }
+    }
+}
+
+
+PeriodicScheduler::TimePoint PeriodicScheduler::NextRunTime(const Job &job, TimePoint from)
+{
+    uniform_int_distribution<Duration::rep> jitterRange( 0, job.jitter.count() );
+    return from + job.period + Duration( jitterRange(_randomGenerator) );
+}
+
+
+void PeriodicScheduler::AddJob(const string &name, Duration period, Duration jitter, Task task)
+{
+    if ( period <= Duration::zero() || jitter < Duration::zero() ) {
+        throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Invalid period for job " + name);
+    }
+    if (! task) {
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No task specified for job " + name);
+    }
+    
+    shared_ptr<Job> job( new Job() );
+    job->name   = name;
+    job->period = period;
+    job->jitter = jitter;
+    job->task   = task;
+    
+    {
+        lock_guard<mutex> lock(_mutex);
+        job->nextRun = NextRunTime( *job, _clock() );
+        _jobs.push_back(job);
+    }
+    
+    // Rearm timer if already running as the new job might be due sooner than others
+    ArmTimer();
+}
+
+
+void PeriodicScheduler::AddTriggeredJob(const string &name, Duration quietPeriod, Task task)
+{
+    if ( quietPeriod <= Duration::zero() ) {
+        throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Invalid quiet period for job " + name);
+    }
+    if (! task) {
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No task specified for job " + name);
+    }
+    
+    shared_ptr<Job> job( new Job() );
+    job->name      = name;
+    job->period    = quietPeriod;
+    job->jitter    = Duration::zero();
+    job->task      = task;
+    job->nextRun   = TimePoint::max();
+    job->triggered = true;
+    
+    lock_guard<mutex> lock(_mutex);
+    _jobs.push_back(job);
+}
+
+
+void PeriodicScheduler::Trigger(const string &jobName)
+{
+    {
+        lock_guard<mutex> lock(_mutex);
+        shared_ptr<Job> job = FindJob(jobName);
+        if (! job->triggered) {
+            throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Job " + jobName + " is not triggered");
+        }
+        job->nextRun = _clock() + job->period;
+    }
+    ArmTimer();
+}
+
+
+PeriodicScheduler::TimePoint PeriodicScheduler::NextDueTime() const
+{
+    lock_guard<mutex> lock(_mutex);
+    return EarliestRunTime();
+}
+
+
+PeriodicScheduler::TimePoint PeriodicScheduler::EarliestRunTime() const
+{
+    // NOTE caller must hold the lock
+    TimePoint result = TimePoint::max();
+    for (auto const &job : _jobs)
+        { result = min(result, job->nextRun); }
+    return result;
+}
+
+
+size_t PeriodicScheduler::RunDueJobs()
+{
+    vector<shared_ptr<Job>> dueJobs;
+    {
+        lock_guard<mutex> lock(_mutex);
+        if (_shutdown)
+            { return 0; }
+        
+        TimePoint now = _clock();
+        for (auto &job : _jobs)
+        {
+            if (job->nextRun > now)
+                { continue; }
+            
+            job->nextRun = job->triggered ? TimePoint::max() : NextRunTime(*job, now);
+            if (job->running && job->triggered)
+            {
+                job->triggeredAgain = true;
+                continue;
+            }
+            if (job->running)
+            {
+                LOG_DEBUG(Network) << "Previous run of job " << job->name << " is still in progress, skipping";
+                ++job->stats.skippedCount;
+                continue;
+            }
+            
+            job->running = true;
+            dueJobs.push_back(job);
+        }
+    }
+    
+    for (auto &job : dueJobs)
+        { ExecuteJob(job); }
+    return dueJobs.size();
+}
+
+
+void PeriodicScheduler::ExecuteJob(shared_ptr<Job> job)
+{
+    shared_ptr<PeriodicScheduler> self = shared_from_this();
+    Task run = [self, job]
+    {
+        LOG_DEBUG(Network) << "Running periodic job " << job->name;
+        bool failed = false;
+        auto startedAt = chrono::steady_clock::now();
+        try { job->task(); }
+        catch (exception &ex)
+        {
+            LOG(ERROR) << "Periodic job " << job->name << " failed: " << ex.what();
+            failed = true;
+        }
+        Duration runDuration = chrono::steady_clock::now() - startedAt;
+        LOG_DEBUG(Network) << "Periodic job " << job->name << " finished in "
+                   << chrono::duration_cast<chrono::milliseconds>(runDuration).count() << " ms";
+        
+        bool runAgain = false;
+        {
+            lock_guard<mutex> lock(self->_mutex);
+            job->running = false;
+            ++job->stats.runCount;
+            if (failed)
+                { ++job->stats.failureCount; }
+            job->stats.lastRunDuration   = runDuration;
+            job->stats.maxRunDuration    = max(job->stats.maxRunDuration, runDuration);
+            job->stats.totalRunDuration += runDuration;
+            
+            // Triggers arrived during this run, they need a single run after another quiet period
+            if (job->triggeredAgain)
+            {
+                job->triggeredAgain = false;
+                job->nextRun = self->_clock() + job->period;
+                runAgain = true;
+            }
+        }
+        if (runAgain)
+            { self->ArmTimer(); }
+    };
+    
+    if (_executor)
+    {
+        _executor(run);
+        return;
+    }
+    
+    thread previousRun;
+    {
+        lock_guard<mutex> lock(_mutex);
+        if (_shutdown)
+        {
+            job->running = false;
+            return;
+        }
+        // NOTE the previous run has already finished its task, joining only waits for its thread to exit
+        previousRun = move(job->thread);
+        job->thread = thread(run);
+    }
+    if ( previousRun.joinable() )
+        { previousRun.join(); }
+}
+
+
+void PeriodicScheduler::Start(asio::io_service &ioService)
+{
+    {
+        lock_guard<mutex> lock(_mutex);
+        if (_timer) {
+            throw LocationNetworkError(ErrorCode::ERROR_BAD_STATE, "Scheduler was already started");
+        }
+        _timer.reset( new asio::steady_timer(ioService) );
+    }
+    ArmTimer();
+}
+
+
+void PeriodicScheduler::ArmTimer()
+{
+    // NOTE due time must be read under the same lock, a concurrent Trigger() could be missed otherwise
+    lock_guard<mutex> lock(_mutex);
+    TimePoint nextDue = EarliestRunTime();
+    if (! _timer || _shutdown || nextDue == TimePoint::max() )
+        { return; }
+    
+    // NOTE setting expiration cancels any pending wait with asio::error::operation_aborted
+    _timer->expires_at(nextDue);
+    weak_ptr<PeriodicScheduler> weakSelf = shared_from_this();
+    _timer->async_wait( [weakSelf] (const asio::error_code &error)
+    {
+        shared_ptr<PeriodicScheduler> self = weakSelf.lock();
+        if (! self || error == asio::error::operation_aborted)
+            { return; }
+        
+        self->RunDueJobs();
+        self->ArmTimer();
+    } );
 }
 
-AsyncConnection::AsyncConnection( weak_ptr<tcp::socket> socket,
+
+void PeriodicScheduler::Shutdown()
+{
+    vector<thread> jobThreads;
+    {
+        lock_guard<mutex> lock(_mutex);
+        _shutdown = true;
+        if (_timer)
+            { _timer->cancel(); }
+        
+        for (auto &job : _jobs)
+        {
+            if ( ! job->thread.joinable() )
+                { continue; }
+            // A job shutting down the scheduler cannot wait for itself
+            if ( job->thread.get_id() == this_thread::get_id() )
+                { job->thread.detach(); }
+            else { jobThreads.push_back( move(job->thread) ); }
+        }
+    }
+    
+    for (auto &jobThread : jobThreads)
+        { jobThread.join(); }
+}
+
+
+shared_ptr<PeriodicScheduler::Job> PeriodicScheduler::FindJob(const string &jobName) const
+{
+    // NOTE caller must hold the lock
+    for (auto const &job : _jobs)
+    {
+        if (job->name == jobName)
+            { return job; }
+    }
+    throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Unknown job " + jobName);
+}
+
+
+PeriodicJobStats PeriodicScheduler::GetStats(const string &jobName) const
+{
+    lock_guard<mutex> lock(_mutex);
+    return FindJob(jobName)->stats;
+}
+
+
+
+const size_t MessageBufferPool::DefaultMaxBufferCount;
+const size_t MessageBufferPool::DefaultMaxBufferCapacity;
+
+MessageBufferPool MessageBufferPool::_instance;
+
+MessageBufferPool& MessageBufferPool::Instance() { return _instance; }
+
+
+MessageBufferPool::MessageBufferPool(size_t maxBufferCount, size_t maxBufferCapacity) :
+    _mutex(), _buffers(), _maxBufferCount(maxBufferCount), _maxBufferCapacity(maxBufferCapacity) {}
+
+
+size_t MessageBufferPool::pooledCount() const
+{
+    lock_guard<mutex> guard(_mutex);
+    return _buffers.size();
+}
+
+
+unique_ptr<string> MessageBufferPool::Acquire(size_t size)
+{
+    unique_ptr<string> buffer;
+    {
+        lock_guard<mutex> guard(_mutex);
+        if ( ! _buffers.empty() )
+        {
+            buffer = move( _buffers.back() );
+            _buffers.pop_back();
+        }
+    }
+    if (! buffer)
+        { buffer.reset( new string() ); }
+    buffer->resize(size);
+    return buffer;
+}
+
+
+void MessageBufferPool::Release(unique_ptr<string> &&buffer)
+{
+    // NOTE buffers of rare huge messages are freed instead of keeping their memory reserved
+    if ( ! buffer || buffer->capacity() > _maxBufferCapacity )
+        { return; }
+    buffer->clear();
+    
+    lock_guard<mutex> guard(_mutex);
+    if ( _buffers.size() < _maxBufferCount )
+        { _buffers.push_back( move(buffer) ); }
+}
+
+
+
+shared_ptr<AsyncConnection> AsyncConnection::Create( weak_ptr<asio::ip::tcp::socket> socket,
+    shared_ptr<asio::io_service::strand> strand, unique_ptr<string> &&buffer, size_t offset )
+{
+    return shared_ptr<AsyncConnection>( new AsyncConnection( socket, strand, move(buffer), offset ) );
+}
+
+AsyncConnection::AsyncConnection( weak_ptr<tcp::socket> socket, shared_ptr<asio::io_service::strand> strand,
                                   unique_ptr<string> &&buffer, size_t offset ) :
-    _socket(socket), _buffer( move(buffer) ), _offset(offset)
+    _socket(socket), _strand(strand), _buffer( move(buffer) ), _offset(offset)
 {
+    if (_strand == nullptr) {
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No strand instantiated");
+    }
     if (_buffer == nullptr) {
         throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No buffer instantiated");
     }
@@ -104,16 +549,19 @@ AsyncConnection::AsyncConnection( weak_ptr<tcp::socket> socket,
 void AsyncConnection::ReadBuffer( function< void ( unique_ptr<string>&& ) > completionCallback )
 {
     shared_ptr<AsyncConnection> self = shared_from_this();
-    shared_ptr<tcp::socket> socket = _socket.lock();
-    if (! socket) {
-        LOG(INFO) << "Socket was closed, stop reading";
-        completionCallback( unique_ptr<string>() );
-        return;
-    }
-    
-    asio::async_read( *socket, asio::buffer( &_buffer->operator[](_offset), _buffer->size() - _offset ),
-        [self, completionCallback] (const asio::error_code& error, std::size_t bytesRead)
-        { self->AsyncReadCallback(error, bytesRead, completionCallback); } );
+    _strand->dispatch( [self, completionCallback]
+    {
+        shared_ptr<tcp::socket> socket = self->_socket.lock();
+        if (! socket) {
+            LOG(INFO) << "Socket was closed, stop reading";
+            completionCallback( unique_ptr<string>() );
+            return;
+        }
+        
+        asio::async_read( *socket, asio::buffer( &self->_buffer->operator[](self->_offset), self->_buffer->size() - self->_offset ),
+            self->_strand->wrap( [self, completionCallback] (const asio::error_code& error, std::size_t bytesRead)
+                { self->AsyncReadCallback(error, bytesRead, completionCallback); } ) );
+    } );
 }
 
 
@@ -150,8 +598,8 @@ void AsyncConnection::AsyncReadCallback( const asio::error_code &error, size_t b
         }
         
         asio::async_read( *socket, asio::buffer( &_buffer->operator[](_offset), _buffer->size() - _offset ),
-            [self, completionCallback] (const asio::error_code& error, std::size_t bytesRead)
-            { self->AsyncReadCallback(error, bytesRead, completionCallback); } );
+            _strand->wrap( [self, completionCallback] (const asio::error_code& error, std::size_t bytesRead)
+                { self->AsyncReadCallback(error, bytesRead, completionCallback); } ) );
     }
     else { completionCallback( move(_buffer) ); }
 }
@@ -161,16 +609,17 @@ void AsyncConnection::AsyncReadCallback( const asio::error_code &error, size_t b
 void AsyncConnection::WriteBuffer( function< void ( unique_ptr<string>&& ) > completionCallback )
 {
     shared_ptr<AsyncConnection> self = shared_from_this();
-    shared_ptr<tcp::socket> socket = _socket.lock();
-    if (! socket) {
-        LOG(INFO) << "Socket was closed, stop writing";
-        completionCallback( unique_ptr<string>() );
-        return;
-    }
-    asio::async_write( *socket, asio::buffer( &_buffer->operator[](_offset), _buffer->size() - _offset ),
-        [self, completionCallback] (const asio::error_code& error, std::size_t bytesWritten)
+    _strand->dispatch( [self, completionCallback]
     {
-        self->AsyncWriteCallback(error, bytesWritten, completionCallback);
+        shared_ptr<tcp::socket> socket = self->_socket.lock();
+        if (! socket) {
+            LOG(INFO) << "Socket was closed, stop writing";
+            completionCallback( unique_ptr<string>() );
+            return;
+        }
+        asio::async_write( *socket, asio::buffer( &self->_buffer->operator[](self->_offset), self->_buffer->size() - self->_offset ),
+            self->_strand->wrap( [self, completionCallback] (const asio::error_code& error, std::size_t bytesWritten)
+                { self->AsyncWriteCallback(error, bytesWritten, completionCallback); } ) );
     } );
 }
 
@@ -208,18 +657,191 @@ void AsyncConnection::AsyncWriteCallback( const asio::error_code &error, size_t
         }
         
         asio::async_write( *socket, asio::buffer( &_buffer->operator[](_offset), _buffer->size() - _offset ),
-            [self, completionCallback] (const asio::error_code& error, std::size_t bytesWritten)
-            { self->AsyncWriteCallback(error, bytesWritten, completionCallback); } );
+            _strand->wrap( [self, completionCallback] (const asio::error_code& error, std::size_t bytesWritten)
+                { self->AsyncWriteCallback(error, bytesWritten, completionCallback); } ) );
     }
     else
     {
-        LOG(TRACE) << "Message was written, calling completion callback";
+        LOG_TRACE(Network) << "Message was written, calling completion callback";
         completionCallback( move(_buffer) );
     }
 }
 
 
 
+const AsyncTcpConnector::Duration AsyncTcpConnector::DefaultAttemptDelay = chrono::milliseconds(250);
+
+
+shared_ptr<AsyncTcpConnector> AsyncTcpConnector::Create( asio::io_service &ioService,
+        const NetworkEndpoint &endpoint, Duration timeout, Duration attemptDelay )
+    { return shared_ptr<AsyncTcpConnector>( new AsyncTcpConnector(ioService, endpoint, timeout, attemptDelay) ); }
+
+AsyncTcpConnector::AsyncTcpConnector( asio::io_service &ioService, const NetworkEndpoint &endpoint,
+                                      Duration timeout, Duration attemptDelay ) :
+    _endpoint(endpoint), _timeout(timeout), _attemptDelay(attemptDelay), _strand(ioService),
+    _resolver(ioService), _deadlineTimer(ioService), _nextAttemptTimer(ioService)
+{
+    if ( _timeout <= Duration::zero() ) {
+        throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Invalid connection timeout");
+    }
+}
+
+
+void AsyncTcpConnector::Connect( function<ConnectedCallback> callback )
+{
+    if (! callback)
+        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No connection callback instantiated"); }
+    
+    shared_ptr<AsyncTcpConnector> self = shared_from_this();
+    _strand.dispatch( [self, callback]
+    {
+        if (self->_callback)
+            { throw LocationNetworkError(ErrorCode::ERROR_BAD_STATE, "Connection is already in progress"); }
+        self->_callback = callback;
+        
+        self->_deadlineTimer.expires_from_now(self->_timeout);
+        self->_deadlineTimer.async_wait( self->_strand.wrap( [self] (const asio::error_code &error)
+        {
+            if (! error)
+                { self->Finish( shared_ptr<tcp::socket>(), asio::error::timed_out ); }
+        } ) );
+        
+        tcp::resolver::query query( self->_endpoint.address(), to_string( self->_endpoint.port() ) );
+        self->_resolver.async_resolve( query, self->_strand.wrap(
+            [self] (const asio::error_code &error, tcp::resolver::iterator addressIter)
+                { self->ResolveHandler(error, addressIter); } ) );
+    } );
+}
+
+
+future< shared_ptr<tcp::socket> > AsyncTcpConnector::Connect(asio::use_future_t<>)
+{
+    shared_ptr< promise< shared_ptr<tcp::socket> > > result( new promise< shared_ptr<tcp::socket> >() );
+    NetworkEndpoint endpoint = _endpoint;
+    Connect( [result, endpoint] (shared_ptr<tcp::socket> socket, const asio::error_code &error)
+    {
+        if (error)
+        {
+            result->set_exception( make_exception_ptr( LocationNetworkError( ErrorCode::ERROR_CONNECTION,
+                "Failed connecting to " + endpoint.address() + ":" + to_string( endpoint.port() ) +
+                " with error: " + error.message() ) ) );
+        }
+        else { result->set_value(socket); }
+    } );
+    return result->get_future();
+}
+
+
+void AsyncTcpConnector::ResolveHandler(const asio::error_code &error, tcp::resolver::iterator addressIter)
+{
+    if (_finished)
+        { return; }
+    if (error)
+    {
+        Finish( shared_ptr<tcp::socket>(), error );
+        return;
+    }
+    
+    // Interleave address families, preferring the family of the first resolved address
+    vector<tcp::endpoint> preferred, other;
+    for (tcp::resolver::iterator addressEnd; addressIter != addressEnd; ++addressIter)
+    {
+        tcp::endpoint address = addressIter->endpoint();
+        if ( preferred.empty() || preferred.front().protocol() == address.protocol() )
+            { preferred.push_back(address); }
+        else { other.push_back(address); }
+    }
+    for (size_t idx = 0; idx < max( preferred.size(), other.size() ); ++idx)
+    {
+        if ( idx < preferred.size() ) { _addresses.push_back( preferred[idx] ); }
+        if ( idx < other.size() )     { _addresses.push_back( other[idx] ); }
+    }
+    
+    StartNextAttempt();
+}
+
+
+void AsyncTcpConnector::StartNextAttempt()
+{
+    if (_finished)
+        { return; }
+    if ( _nextAddressIndex >= _addresses.size() )
+    {
+        // Nothing left to try, report failure when all running attempts failed
+        if (_pendingAttemptCount == 0)
+            { Finish( shared_ptr<tcp::socket>(), _lastError ? _lastError : asio::error::host_not_found ); }
+        return;
+    }
+    
+    const tcp::endpoint &address = _addresses[_nextAddressIndex++];
+    LOG_TRACE(Network) << "Trying to connect to " << _endpoint << " using address " << address;
+    shared_ptr<tcp::socket> socket( new tcp::socket( _strand.get_io_service() ) );
+    _attempts.push_back(socket);
+    ++_pendingAttemptCount;
+    
+    shared_ptr<AsyncTcpConnector> self = shared_from_this();
+    socket->async_connect( address, _strand.wrap( [self, socket] (const asio::error_code &error)
+        { self->AttemptHandler(socket, error); } ) );
+    
+    if ( _nextAddressIndex < _addresses.size() )
+    {
+        _nextAttemptTimer.expires_from_now(_attemptDelay);
+        _nextAttemptTimer.async_wait( _strand.wrap( [self] (const asio::error_code &error)
+        {
+            if (! error)
+                { self->StartNextAttempt(); }
+        } ) );
+    }
+}
+
+
+void AsyncTcpConnector::AttemptHandler(shared_ptr<tcp::socket> socket, const asio::error_code &error)
+{
+    --_pendingAttemptCount;
+    if (_finished)
+        { return; }
+    
+    if (error)
+    {
+        LOG_TRACE(Network) << "Connection attempt to " << _endpoint << " failed: " << error.message();
+        _lastError = error;
+        // Do not wait for the attempt delay, try next address immediately
+        _nextAttemptTimer.cancel();
+        StartNextAttempt();
+        return;
+    }
+    
+    Finish(socket, error);
+}
+
+
+void AsyncTcpConnector::Finish(shared_ptr<tcp::socket> socket, const asio::error_code &error)
+{
+    if (_finished)
+        { return; }
+    _finished = true;
+    
+    _deadlineTimer.cancel();
+    _nextAttemptTimer.cancel();
+    _resolver.cancel();
+    for (auto &attempt : _attempts)
+    {
+        if (attempt != socket)
+        {
+            asio::error_code ignored;
+            attempt->close(ignored);
+        }
+    }
+    _attempts.clear();
+    
+    if (error)
+        { LOG_DEBUG(Network) << "Failed to connect to " << _endpoint << ": " << error.message(); }
+    else { LOG_DEBUG(Network) << "Connected to " << _endpoint; }
+    _callback(socket, error);
+}
+
+
+
 TcpServer::TcpServer(TcpPort portNumber) :
     _acceptor( Reactor::Instance().AsioService(), tcp::endpoint( tcp::v4(), portNumber ) ) {}
 
@@ -235,6 +857,25 @@ _acceptor( Reactor::Instance().AsioService() )
 }
 
 
+#ifdef SO_REUSEPORT
+typedef asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> ReusePortOption;
+#endif
+
+TcpServer::TcpServer(asio::io_service &ioService, TcpPort portNumber) :
+    _acceptor(ioService)
+{
+#ifdef SO_REUSEPORT
+    tcp::endpoint endpoint( tcp::v4(), portNumber );
+    _acceptor.open( endpoint.protocol() );
+    _acceptor.set_option( tcp::acceptor::reuse_address(true) );
+    _acceptor.set_option( ReusePortOption(true) );
+    _acceptor.bind(endpoint);
+#else
+    throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Sharing ports between cores is not supported on this platform");
+#endif
+}
+
+
 TcpServer::~TcpServer() {}
 
 
@@ -1,10 +1,16 @@
 #ifndef __LOCNET_ASIO_NETWORK_H__
 #define __LOCNET_ASIO_NETWORK_H__
 
+#include <chrono>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
 
 #include "asio.hpp"
+#include "asio/steady_timer.hpp"
 #include "asio/use_future.hpp"
 #include "basic.hpp"
 
@@ -15,6 +21,11 @@ namespace LocNet
 
 
 
+// Binary form of an address from asio, e.g. the remote address of a connected socket
+IpAddress ToIpAddress(const asio::ip::address &address);
+
+
+
 class Reactor
 {
     static Reactor _instance;
@@ -33,20 +44,177 @@ public:
 
     void Shutdown();
     bool IsShutdown() const;
+    // True on threads running handlers of a reactor, i.e. this one or a core of a ReactorPool.
+    // These must never wait for operations completed by the reactor, e.g. connecting, that would stall them.
+    static bool IsReactorThread();
+    // Threads running a reactor loop must call this before running any handlers
+    static void MarkReactorThread();
     
     asio::io_service& AsioService();
 };
 
 
 
+// Alternative of the shared reactor: a separate io_service for each core, run by a single thread
+// pinned to that core. Connections accepted on a core do their network I/O there until closed.
+// NOTE this is not shared-nothing: requests of all cores are still served by the same worker pools
+//      on the same Node and database, synchronized by their locks. Post() runs a task on a given core.
+class ReactorPool
+{
+    std::vector<std::unique_ptr<asio::io_service>>          _services;
+    std::vector<std::unique_ptr<asio::io_service::work>>    _keepRunning;
+    std::vector<std::thread>                                _threads;
+    
+    void CoreLoop(size_t coreIndex);
+    
+public:
+    
+    ReactorPool(size_t coreCount);
+    ~ReactorPool();
+    
+    size_t coreCount() const;
+    asio::io_service& AsioService(size_t coreIndex);
+    
+    void Post(size_t coreIndex, std::function<void()> task);
+    
+    void Start();
+    void Shutdown();
+    void Join();
+};
+
+
+
+// Statistics collected about runs of a periodic job, mostly for logging and monitoring.
+struct PeriodicJobStats
+{
+    size_t runCount     = 0;
+    size_t failureCount = 0;
+    size_t skippedCount = 0; // Runs skipped because the previous run has not finished yet
+    
+    std::chrono::steady_clock::duration lastRunDuration  = std::chrono::steady_clock::duration::zero();
+    std::chrono::steady_clock::duration maxRunDuration   = std::chrono::steady_clock::duration::zero();
+    std::chrono::steady_clock::duration totalRunDuration = std::chrono::steady_clock::duration::zero();
+};
+
+
+// Runs maintenance jobs periodically, each with its own period and a random jitter added.
+// A job is never started again while its previous run is still in progress.
+// Triggered jobs run only once after a quiet period without further triggers instead,
+// triggers during a run result in a single follow-up run.
+// Normally driven by a steady timer on the reactor, but the clock is replaceable and
+// RunDueJobs() can be called explicitly to drive the scheduler with a virtual clock.
+class PeriodicScheduler : public std::enable_shared_from_this<PeriodicScheduler>
+{
+public:
+    
+    typedef std::chrono::steady_clock::duration    Duration;
+    typedef std::chrono::steady_clock::time_point  TimePoint;
+    typedef std::function<TimePoint()>             ClockFunc;
+    typedef std::function<void()>                  Task;
+    typedef std::function<void(const Task&)>       Executor;
+    
+private:
+    
+    struct Job
+    {
+        std::string         name;
+        Duration            period;
+        Duration            jitter;
+        Task                task;
+        TimePoint           nextRun;
+        bool                running = false;
+        bool                triggered = false;      // Runs only after Trigger(), period is the quiet period
+        bool                triggeredAgain = false; // Became due while running, a follow-up run is needed
+        std::thread         thread;                 // Runs the job if no executor is given, joined before the next run
+        PeriodicJobStats    stats;
+    };
+    
+    mutable std::mutex                  _mutex;
+    std::vector<std::shared_ptr<Job>>   _jobs;
+    ClockFunc                           _clock;
+    Executor                            _executor;
+    std::mt19937                        _randomGenerator;
+    bool                                _shutdown = false;
+    std::unique_ptr<asio::steady_timer> _timer;
+    
+    PeriodicScheduler(ClockFunc clock, Executor executor);
+    
+    TimePoint NextRunTime(const Job &job, TimePoint from);
+    TimePoint EarliestRunTime() const;
+    std::shared_ptr<Job> FindJob(const std::string &jobName) const;
+    void ExecuteJob(std::shared_ptr<Job> job);
+    void ArmTimer();
+    
+public:
+    
+    // Without an executor each job runs on a separate thread owned by the scheduler
+    // to avoid blocking the reactor with network operations
+    static std::shared_ptr<PeriodicScheduler> Create(
+        ClockFunc clock = [] { return std::chrono::steady_clock::now(); },
+        Executor executor = Executor() );
+    ~PeriodicScheduler();
+    
+    void AddJob(const std::string &name, Duration period, Duration jitter, Task task);
+    void AddTriggeredJob(const std::string &name, Duration quietPeriod, Task task);
+    // Each trigger restarts the quiet period of the job
+    void Trigger(const std::string &jobName);
+    
+    // Use steady timers on the given service to run due jobs until shut down
+    void Start(asio::io_service &ioService);
+    // Stop scheduling jobs and wait for runs in progress on threads of the scheduler.
+    // NOTE the reactor must still be running to let jobs complete their network operations
+    void Shutdown();
+    
+    TimePoint NextDueTime() const;
+    size_t RunDueJobs();
+    
+    PeriodicJobStats GetStats(const std::string &jobName) const;
+};
+
+
+
+// Keeps released message buffers to be reused for later messages instead of allocating
+// a new one for each message. Only a limited number of not too big buffers are kept.
+class MessageBufferPool
+{
+    static MessageBufferPool _instance;
+
+    mutable std::mutex                          _mutex;
+    std::vector<std::unique_ptr<std::string>>   _buffers;
+    size_t                                      _maxBufferCount;
+    size_t                                      _maxBufferCapacity;
+
+public:
+
+    static const size_t DefaultMaxBufferCount    = 256;
+    static const size_t DefaultMaxBufferCapacity = 64 * 1024;
+
+    static MessageBufferPool& Instance();
+
+    MessageBufferPool( size_t maxBufferCount = DefaultMaxBufferCount,
+                       size_t maxBufferCapacity = DefaultMaxBufferCapacity );
+
+    size_t pooledCount() const;
+
+    std::unique_ptr<std::string> Acquire(size_t size = 0);
+    void Release(std::unique_ptr<std::string> &&buffer);
+};
+
+
+
+// Reads or writes a whole buffer asynchronously. All socket operations and completion callbacks
+// are executed through the strand of the connection, so they are serialized even when the reactor
+// is run by multiple threads.
 class AsyncConnection : public std::enable_shared_from_this<AsyncConnection>
 {
     // TODO consider whether socket member should be weak_ptr or shared_ptr
-    std::weak_ptr<asio::ip::tcp::socket>    _socket;
-    std::unique_ptr<std::string>            _buffer;
-    size_t                                  _offset;
+    std::weak_ptr<asio::ip::tcp::socket>        _socket;
+    std::shared_ptr<asio::io_service::strand>   _strand;
+    std::unique_ptr<std::string>                _buffer;
+    size_t                                      _offset;
 
     AsyncConnection( std::weak_ptr<asio::ip::tcp::socket> socket,
+                     std::shared_ptr<asio::io_service::strand> strand,
                      std::unique_ptr<std::string> &&buffer, size_t offset );
     
     void AsyncReadCallback ( const asio::error_code &error, size_t bytesRead,
@@ -58,6 +226,7 @@ public:
     
     static std::shared_ptr<AsyncConnection> Create(
         std::weak_ptr<asio::ip::tcp::socket> socket,
+        std::shared_ptr<asio::io_service::strand> strand,
         std::unique_ptr<std::string> &&buffer, size_t offset = 0 );
     
     void ReadBuffer( std::function< void ( std::unique_ptr<std::string>&& ) > completionCallback );
@@ -69,6 +238,60 @@ public:
 
 
 
+// Resolves a host name and connects to it without blocking the calling thread.
+// Resolved addresses are tried in the style of Happy Eyeballs (RFC 8305): address families are
+// interleaved and a new attempt is started whenever the previous one failed or did not complete
+// within a short delay, so attempts run in parallel. The first established connection wins,
+// all other attempts are cancelled. The whole process is limited by a deadline.
+class AsyncTcpConnector : public std::enable_shared_from_this<AsyncTcpConnector>
+{
+public:
+    
+    typedef std::chrono::steady_clock::duration Duration;
+    typedef void ConnectedCallback( std::shared_ptr<asio::ip::tcp::socket> socket, const asio::error_code &error );
+    
+    // Delay before starting an attempt to the next address as recommended by RFC 8305
+    static const Duration DefaultAttemptDelay;
+    
+private:
+    
+    NetworkEndpoint                     _endpoint;
+    Duration                            _timeout;
+    Duration                            _attemptDelay;
+    
+    asio::io_service::strand            _strand;
+    asio::ip::tcp::resolver             _resolver;
+    asio::steady_timer                  _deadlineTimer;
+    asio::steady_timer                  _nextAttemptTimer;
+    
+    std::vector<asio::ip::tcp::endpoint>                _addresses;
+    size_t                                              _nextAddressIndex = 0;
+    std::vector< std::shared_ptr<asio::ip::tcp::socket> > _attempts;
+    size_t                                              _pendingAttemptCount = 0;
+    asio::error_code                                    _lastError;
+    bool                                                _finished = false;
+    std::function<ConnectedCallback>                    _callback;
+    
+    AsyncTcpConnector( asio::io_service &ioService, const NetworkEndpoint &endpoint,
+                       Duration timeout, Duration attemptDelay );
+    
+    void ResolveHandler(const asio::error_code &error, asio::ip::tcp::resolver::iterator addressIter);
+    void StartNextAttempt();
+    void AttemptHandler(std::shared_ptr<asio::ip::tcp::socket> socket, const asio::error_code &error);
+    void Finish(std::shared_ptr<asio::ip::tcp::socket> socket, const asio::error_code &error);
+    
+public:
+    
+    static std::shared_ptr<AsyncTcpConnector> Create( asio::io_service &ioService,
+        const NetworkEndpoint &endpoint, Duration timeout, Duration attemptDelay = DefaultAttemptDelay );
+    
+    // Callback is called exactly once, either with a connected socket or with an error
+    void Connect( std::function<ConnectedCallback> callback );
+    std::future< std::shared_ptr<asio::ip::tcp::socket> > Connect(asio::use_future_t<>);
+};
+
+
+
 // Abstract TCP server that accepts clients asynchronously on a specific port number
 // and has a customizable client accept callback to customize concrete provided service.
 class TcpServer: public std::enable_shared_from_this<TcpServer>
@@ -81,6 +304,8 @@ public:
 
     TcpServer(TcpPort portNumber);
     TcpServer(const std::string &device, TcpPort portNumber);
+    // Acceptor on the given service that shares its port with acceptors of other cores using SO_REUSEPORT
+    TcpServer(asio::io_service &ioService, TcpPort portNumber);
     virtual ~TcpServer();
     
     virtual void StartListening() = 0;
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <chrono>
 #include <easylogging++.h>
 
@@ -14,9 +15,7 @@ namespace LocNet
 
 
 
-static const size_t MaxMessageSize = 1024 * 1024;
-static const size_t MessageHeaderSize = 5;
-static const size_t MessageSizeOffset = 1;
+static const chrono::seconds ConnectTimeout = chrono::seconds(10);
 
 
 // static chrono::duration<uint32_t> GetNetworkExpirationPeriod()
@@ -26,6 +25,93 @@ static const size_t MessageSizeOffset = 1;
 
 
 
+DispatchWorkerPool::DispatchWorkerPool(const string &name, size_t threadCount, size_t maxQueueDepth) :
+    _name(name), _maxQueueDepth(maxQueueDepth)
+{
+    if (threadCount == 0 || maxQueueDepth == 0) {
+        throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Worker pool needs at least one thread and queue slot");
+    }
+    for (size_t threadIdx = 0; threadIdx < threadCount; ++threadIdx)
+        { _workers.emplace_back( [this] { WorkerLoop(); } ); }
+}
+
+DispatchWorkerPool::~DispatchWorkerPool()
+{
+    Shutdown();
+    for (auto &worker : _workers)
+        { worker.join(); }
+}
+
+
+const string& DispatchWorkerPool::name() const
+    { return _name; }
+
+DispatchQueueStats DispatchWorkerPool::stats() const
+{
+    lock_guard<mutex> lock(_mutex);
+    return _stats;
+}
+
+
+bool DispatchWorkerPool::TryPost(Task task)
+{
+    {
+        lock_guard<mutex> lock(_mutex);
+        if ( _shutdown || _queue.size() >= _maxQueueDepth )
+        {
+            ++_stats.rejectedCount;
+            return false;
+        }
+        
+        _queue.push_back( QueuedTask{ task, chrono::steady_clock::now() } );
+        _stats.queueDepth = _queue.size();
+        _stats.maxQueueDepth = max(_stats.maxQueueDepth, _stats.queueDepth);
+    }
+    _taskAvailable.notify_one();
+    return true;
+}
+
+
+void DispatchWorkerPool::Shutdown()
+{
+    {
+        lock_guard<mutex> lock(_mutex);
+        _shutdown = true;
+    }
+    _taskAvailable.notify_all();
+}
+
+
+void DispatchWorkerPool::WorkerLoop()
+{
+    while (true)
+    {
+        QueuedTask queuedTask;
+        {
+            unique_lock<mutex> lock(_mutex);
+            _taskAvailable.wait( lock, [this] { return _shutdown || ! _queue.empty(); } );
+            // NOTE tasks accepted before shutdown are still served to answer all pending requests
+            if ( _queue.empty() )
+                { return; }
+            
+            queuedTask = move( _queue.front() );
+            _queue.pop_front();
+            
+            auto waitTime = chrono::steady_clock::now() - queuedTask.enqueuedAt;
+            _stats.queueDepth = _queue.size();
+            _stats.maxWaitTime = max(_stats.maxWaitTime, waitTime);
+            _stats.totalWaitTime += waitTime;
+            ++_stats.executedCount;
+        }
+        
+        try { queuedTask.task(); }
+        catch (exception &ex)
+            { LOG(WARNING) << "Worker of " << _name << " failed to run task: " << ex.what(); }
+    }
+}
+
+
+
 shared_ptr<DispatchingTcpServer> DispatchingTcpServer::Create(
         TcpPort portNumber, shared_ptr<IBlockingRequestDispatcherFactory> dispatcherFactory )
     { return shared_ptr<DispatchingTcpServer>( new DispatchingTcpServer(portNumber, dispatcherFactory) ); }
@@ -34,6 +120,57 @@ shared_ptr<DispatchingTcpServer> DispatchingTcpServer::Create( const string &int
         TcpPort portNumber, shared_ptr<IBlockingRequestDispatcherFactory> dispatcherFactory )
     { return shared_ptr<DispatchingTcpServer>( new DispatchingTcpServer(interfaceName, portNumber, dispatcherFactory) ); }
 
+shared_ptr<DispatchingTcpServer> DispatchingTcpServer::Create( asio::io_service &ioService,
+        TcpPort portNumber, shared_ptr<IBlockingRequestDispatcherFactory> dispatcherFactory )
+    { return shared_ptr<DispatchingTcpServer>( new DispatchingTcpServer(ioService, portNumber, dispatcherFactory) ); }
+
+
+RequestPipeline::RequestPipeline(size_t maxInFlightCount) :
+    _maxInFlightCount(maxInFlightCount)
+{
+    if (_maxInFlightCount == 0) {
+        throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Pipeline must allow at least one request");
+    }
+}
+
+
+size_t RequestPipeline::inFlightCount() const
+{
+    lock_guard<mutex> guard(_mutex);
+    return _inFlightCount;
+}
+
+bool RequestPipeline::IsFailed() const
+{
+    lock_guard<mutex> guard(_mutex);
+    return _failed;
+}
+
+
+bool RequestPipeline::RequestStarted()
+{
+    lock_guard<mutex> guard(_mutex);
+    ++_inFlightCount;
+    if (_inFlightCount < _maxInFlightCount)
+        { return true; }
+    _readPaused = true;
+    return false;
+}
+
+
+bool RequestPipeline::RequestFinished(bool successful)
+{
+    lock_guard<mutex> guard(_mutex);
+    --_inFlightCount;
+    if (! successful)
+        { _failed = true; }
+    if ( ! _readPaused || _failed )
+        { return false; }
+    _readPaused = false;
+    return true;
+}
+
+
 
 DispatchingTcpServer::DispatchingTcpServer( TcpPort portNumber,
         shared_ptr<IBlockingRequestDispatcherFactory> dispatcherFactory ) :
@@ -53,15 +190,25 @@ DispatchingTcpServer::DispatchingTcpServer( const string &interfaceName, TcpPort
     }
 }
 
+DispatchingTcpServer::DispatchingTcpServer( asio::io_service &ioService, TcpPort portNumber,
+        shared_ptr<IBlockingRequestDispatcherFactory> dispatcherFactory ) :
+    TcpServer(ioService, portNumber), _dispatcherFactory(dispatcherFactory)
+{
+    if (_dispatcherFactory == nullptr) {
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No dispatcher factory instantiated");
+    }
+}
+
 
 
 void DispatchingTcpServer::StartListening()
 {
     // Switch the acceptor to listening state
-    LOG(DEBUG) << "Accepting connections on port " << _acceptor.local_endpoint().port();
+    LOG_DEBUG(Network) << "Accepting connections on port " << _acceptor.local_endpoint().port();
     _acceptor.listen();
     
-    shared_ptr<tcp::socket> socket( new tcp::socket( Reactor::Instance().AsioService() ) );
+    // NOTE accepted sockets must stay on the service of the acceptor to be served by the same core
+    shared_ptr<tcp::socket> socket( new tcp::socket( _acceptor.get_io_service() ) );
     weak_ptr<TcpServer> self = shared_from_this();
     _acceptor.async_accept( *socket,
         [self, socket] (const asio::error_code &ec)
@@ -80,12 +227,12 @@ void DispatchingTcpServer::AsyncAcceptHandler(
         LOG(ERROR) << "Failed to accept connection: " << ec;
         return;
     }
-    LOG(DEBUG) << "Connection accepted from "
+    LOG_DEBUG(Network) << "Connection accepted from "
         << socket->remote_endpoint().address().to_string() << ":" << socket->remote_endpoint().port() << " to "
         << socket->local_endpoint().address().to_string()  << ":" << socket->local_endpoint().port();
     
     // Keep accepting connections on the socket
-    shared_ptr<tcp::socket> nextSocket( new tcp::socket( Reactor::Instance().AsioService() ) );
+    shared_ptr<tcp::socket> nextSocket( new tcp::socket( _acceptor.get_io_service() ) );
     weak_ptr<DispatchingTcpServer> self = static_pointer_cast<DispatchingTcpServer>( shared_from_this() );
     _acceptor.async_accept( *nextSocket,
         [self, nextSocket] (const asio::error_code &ec)
@@ -94,25 +241,144 @@ void DispatchingTcpServer::AsyncAcceptHandler(
         if (server) { server->AsyncAcceptHandler(nextSocket, ec); }
     } );
     
-    shared_ptr<IProtoBufChannel> connection( new AsyncProtoBufTcpChannel(socket) );
+    shared_ptr<AsyncProtoBufTcpChannel> connection;
+    try { connection.reset( new AsyncProtoBufTcpChannel(socket) ); }
+    catch (exception &ex)
+    {
+        LOG_DEBUG(Network) << "Failed to set up accepted connection: " << ex.what();
+        return;
+    }
+    if (_connectionManager)
+    {
+        if ( ! _connectionManager->TryOpen( connection->remoteAddress() ) )
+        {
+            LOG(WARNING) << "Too many connections, refusing connection from " << connection->id();
+            return;
+        }
+        connection->Manage(_connectionManager);
+    }
+    
     shared_ptr<ProtoBufClientSession> session( ProtoBufClientSession::Create(connection) );
     shared_ptr<IBlockingRequestDispatcher> dispatcher( _dispatcherFactory->Create(session) );
 
     LOG(INFO) << "Starting server message loop for connection " << connection->id();
     
-    connection->ReceiveMessage( [session, dispatcher] ( unique_ptr<iop::locnet::Message> &&incomingMessage )
-        { AsyncServeMessageHandler( move(incomingMessage), session, dispatcher); } );
+    // NOTE the pool is owned by the server only, message loop closures must not keep it alive.
+    //      Otherwise a task finishing on a worker thread could release the last reference and join itself.
+    weak_ptr<DispatchWorkerPool> workerPool = _workerPool;
+    shared_ptr<RequestPipeline> pipeline( new RequestPipeline(_pipelinedRequestCount) );
+    connection->ReceiveMessage( [session, dispatcher, workerPool, pipeline] ( unique_ptr<iop::locnet::Message> &&incomingMessage )
+        { AsyncServeMessageHandler( move(incomingMessage), session, dispatcher, workerPool, pipeline ); } );
+}
+
+
+void DispatchingTcpServer::workerPool(shared_ptr<DispatchWorkerPool> workerPool)
+    { _workerPool = workerPool; }
+
+void DispatchingTcpServer::connectionPolicy(const ConnectionPolicy &policy)
+    { _connectionManager.reset( new ConnectionManager(policy) ); }
+
+void DispatchingTcpServer::connectionManager(shared_ptr<ConnectionManager> manager)
+    { _connectionManager = manager; }
+
+shared_ptr<ConnectionManager> DispatchingTcpServer::connectionManager() const
+    { return _connectionManager; }
+
+ConnectionStats DispatchingTcpServer::connectionStats() const
+    { return _connectionManager ? _connectionManager->stats() : ConnectionStats(); }
+
+void DispatchingTcpServer::pipelinedRequestCount(size_t requestCount)
+{
+    if (requestCount == 0) {
+        throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "At least one request must be served at a time");
+    }
+    _pipelinedRequestCount = requestCount;
 }
 
 
 void DispatchingTcpServer::AsyncServeMessageHandler( unique_ptr<iop::locnet::Message> &&receivedMessage,
+    shared_ptr<ProtoBufClientSession> session, shared_ptr<IBlockingRequestDispatcher> dispatcher,
+    weak_ptr<DispatchWorkerPool> workerPool, shared_ptr<RequestPipeline> pipeline )
+{
+    function<void()> continueMessageLoop = [session, dispatcher, workerPool, pipeline]
+    {
+        // Schedule next message loop iteration, but stop reading requests
+        // while the client does not consume our responses fast enough
+        shared_ptr<IProtoBufChannel> channel = session->messageChannel();
+        channel->WhenSendQueueReady( [channel, session, dispatcher, workerPool, pipeline]
+        {
+            channel->ReceiveMessage( [session, dispatcher, workerPool, pipeline]
+                ( unique_ptr<iop::locnet::Message> &&incomingMessage )
+                { AsyncServeMessageHandler( move(incomingMessage), session, dispatcher, workerPool, pipeline ); } );
+        } );
+    };
+    
+    // A request read ahead has failed meanwhile, do not serve further ones
+    if ( pipeline->IsFailed() )
+    {
+        LOG(INFO) << "Server message loop ended for session " << session->id();
+        return;
+    }
+    
+    // Responses and failures are cheap to handle, serve them right here on the reactor.
+    // NOTE this runs on the strand of the connection, the pool is never released here by a worker
+    shared_ptr<DispatchWorkerPool> workers = workerPool.lock();
+    if ( ! workers || ! receivedMessage || ! receivedMessage->has_request() )
+    {
+        if ( ServeMessage( move(receivedMessage), session, dispatcher ) )
+            { continueMessageLoop(); }
+        else { LOG(INFO) << "Server message loop ended for session " << session->id(); }
+        return;
+    }
+    
+    // Requests may block, run them on a worker thread. NOTE responses are written through the strand
+    // of the connection as soon as they are ready, possibly in a different order than the requests.
+    // The client matches them by message id. Further requests are read ahead up to the pipeline limit.
+    shared_ptr<iop::locnet::Message> request( receivedMessage.release() );
+    bool readNext = pipeline->RequestStarted();
+    bool queued = workers->TryPost( [request, session, dispatcher, pipeline, continueMessageLoop]
+    {
+        unique_ptr<iop::locnet::Message> requestMessage( new iop::locnet::Message() );
+        requestMessage->Swap( request.get() );
+        bool successful = ServeMessage( move(requestMessage), session, dispatcher );
+        if ( pipeline->RequestFinished(successful) )
+            { continueMessageLoop(); }
+        if (! successful)
+            { LOG(INFO) << "Server message loop ended for session " << session->id(); }
+    } );
+    
+    if (! queued)
+    {
+        LOG(WARNING) << "Request queue of " << workers->name() << " is full, refusing request";
+        unique_ptr<iop::locnet::Message> responseMsg( new iop::locnet::Message() );
+        responseMsg->set_id( request->id() );
+        responseMsg->mutable_response()->set_status( Converter::ToProtoBuf(ErrorCode::ERROR_BAD_STATE) );
+        responseMsg->mutable_response()->set_details("Server is overloaded, try again later");
+        session->messageChannel()->SendMessage( move(responseMsg), [] {} );
+        // NOTE if reading was paused, another request finished meanwhile may have resumed it already
+        readNext = pipeline->RequestFinished(true) || readNext;
+    }
+    
+    if (readNext)
+        { continueMessageLoop(); }
+}
+
+
+bool DispatchingTcpServer::ServeMessage( unique_ptr<iop::locnet::Message> &&receivedMessage,
     shared_ptr<ProtoBufClientSession> session, shared_ptr<IBlockingRequestDispatcher> dispatcher )
 {
     bool handlerSuccessful = false;
     bool sendResponse = true;
     
     uint32_t messageId = 0;
-    unique_ptr<iop::locnet::Response> response;
+    // Response is built on the arena of the serving thread and released at once after serialized for sending
+    MessageArena &arena = MessageArena::ThreadInstance();
+    scope_exit resetArena( [&arena] { arena.Reset(); } );
+    iop::locnet::Message *responseMsg = arena.Create<iop::locnet::Message>();
+    iop::locnet::Response *response = responseMsg->mutable_response();
+    // Handlers may add encoded fields to the response instead of building them, e.g. cached node infos
+    SplicedResponseFields &splicedFields = SplicedResponseFields::ThreadInstance();
+    scope_exit resetSplicedFields( [&splicedFields] { splicedFields.Reset(); } );
     try
     {
         if (! receivedMessage)
@@ -121,7 +387,7 @@ void DispatchingTcpServer::AsyncServeMessageHandler( unique_ptr<iop::locnet::Mes
         // If incoming response, connect it with the sent out request and skip further processing
         if ( receivedMessage->has_response() )
         {
-            LOG(TRACE) << "Received response message, delivering it to requestor";
+            LOG_TRACE(Network) << "Received response message, delivering it to requestor";
             session->ResponseArrived( move(receivedMessage) );
             sendResponse = false;
         }
@@ -130,53 +396,55 @@ void DispatchingTcpServer::AsyncServeMessageHandler( unique_ptr<iop::locnet::Mes
             if ( ! receivedMessage->has_request() )
                 { throw LocationNetworkError(ErrorCode::ERROR_BAD_REQUEST, "Missing request"); }
             
-            LOG(TRACE) << "Serving request";
+            LOG_TRACE(Network) << "Serving request";
             
             messageId = receivedMessage->id();
-            unique_ptr<iop::locnet::Request> request( receivedMessage->release_request() );
+            iop::locnet::Request *request = receivedMessage->mutable_request();
             
             // TODO the ip detection and keepalive features are violating the current abstraction layers.
             //      This is not a nice implementation, abstractions should be better prepared for these features
+            const IpAddress &remoteIp = session->messageChannel()->remoteIpAddress();
             if ( request->has_remote_node() )
             {
                 if ( request->remote_node().has_accept_colleague() ) {
                     request->mutable_remote_node()->mutable_accept_colleague()->mutable_requestor_node_info()->mutable_contact()->set_ip_address(
-                        NodeContact::AddressToBytes( session->messageChannel()->remoteAddress() ) );
+                        remoteIp.data(), remoteIp.size() );
                 }
                 else if ( request->remote_node().has_renew_colleague() ) {
                     request->mutable_remote_node()->mutable_renew_colleague()->mutable_requestor_node_info()->mutable_contact()->set_ip_address(
-                        NodeContact::AddressToBytes( session->messageChannel()->remoteAddress() ) );
+                        remoteIp.data(), remoteIp.size() );
                 }
                 else if ( request->remote_node().has_accept_neighbour() ) {
                     request->mutable_remote_node()->mutable_accept_neighbour()->mutable_requestor_node_info()->mutable_contact()->set_ip_address(
-                        NodeContact::AddressToBytes( session->messageChannel()->remoteAddress() ) );
+                        remoteIp.data(), remoteIp.size() );
                 }
                 else if ( request->remote_node().has_renew_neighbour() ) {
                     request->mutable_remote_node()->mutable_renew_neighbour()->mutable_requestor_node_info()->mutable_contact()->set_ip_address(
-                        NodeContact::AddressToBytes( session->messageChannel()->remoteAddress() ) );
+                        remoteIp.data(), remoteIp.size() );
                 }
             }
                 
-            response = dispatcher->Dispatch( move(request) );
+            splicedFields.Activate();
+            dispatcher->DispatchInto(*request, *response);
             response->set_status(iop::locnet::Status::STATUS_OK);
             
             if ( response->has_remote_node() )
             {
                 if ( response->remote_node().has_accept_colleague() ) {
                     response->mutable_remote_node()->mutable_accept_colleague()->set_remote_ip_address(
-                        NodeContact::AddressToBytes( session->messageChannel()->remoteAddress() ) );
+                        remoteIp.data(), remoteIp.size() );
                 }
                 else if ( response->remote_node().has_renew_colleague() ) {
                     response->mutable_remote_node()->mutable_renew_colleague()->set_remote_ip_address(
-                        NodeContact::AddressToBytes( session->messageChannel()->remoteAddress() ) );
+                        remoteIp.data(), remoteIp.size() );
                 }
                 else if ( response->remote_node().has_accept_neighbour() ) {
                     response->mutable_remote_node()->mutable_accept_neighbour()->set_remote_ip_address(
-                        NodeContact::AddressToBytes( session->messageChannel()->remoteAddress() ) );
+                        remoteIp.data(), remoteIp.size() );
                 }
                 else if ( response->remote_node().has_renew_neighbour() ) {
                     response->mutable_remote_node()->mutable_renew_neighbour()->set_remote_ip_address(
-                        NodeContact::AddressToBytes( session->messageChannel()->remoteAddress() ) );
+                        remoteIp.data(), remoteIp.size() );
                 }
             }
         }
@@ -189,239 +457,744 @@ void DispatchingTcpServer::AsyncServeMessageHandler( unique_ptr<iop::locnet::Mes
         //      thus no request can be read. This case should be distinguished and logged with a lower level.
         LOG(WARNING) << "Failed to serve request with code "
             << static_cast<uint32_t>( lnex.code() ) << ": " << lnex.what();
-        response.reset( new iop::locnet::Response() );
+        response->Clear();
+        splicedFields.Reset();
         response->set_status( Converter::ToProtoBuf( lnex.code() ) );
         response->set_details( lnex.what() );
     }
     catch (exception &ex)
     {
         LOG(WARNING) << "Failed to serve request: " << ex.what();
-        response.reset( new iop::locnet::Response() );
+        response->Clear();
+        splicedFields.Reset();
         response->set_status(iop::locnet::Status::ERROR_INTERNAL);
         response->set_details( ex.what() );
     }
     
     if (sendResponse)
     {
-        LOG(TRACE) << "Sending response";
-        unique_ptr<iop::locnet::Message> responseMsg( new iop::locnet::Message() );
-        responseMsg->set_allocated_response( response.release() );
+        LOG_TRACE(Network) << "Sending response";
         responseMsg->set_id(messageId);
-        
-        session->messageChannel()->SendMessage( move(responseMsg), [] {} );
+        session->messageChannel()->SendMessage( *responseMsg, splicedFields, [] {} );
     }
     
-    if (handlerSuccessful)
-    {
-        // Schedule next message loop iteration
-        session->messageChannel()->ReceiveMessage( [session, dispatcher]
-            ( unique_ptr<iop::locnet::Message> &&incomingMessage )
-            { AsyncServeMessageHandler( move(incomingMessage), session, dispatcher); } );
-    }
-    else { LOG(INFO) << "Server message loop ended for session " << session->id(); }
+    return handlerSuccessful;
 }
 
 
 
-AsyncProtoBufTcpChannel::AsyncProtoBufTcpChannel(shared_ptr<tcp::socket> socket) :
-    _socket(socket), _id(), _remoteAddress(), _nextRequestId(1) // , _socketWriteMutex(), _socketReadMutex()
-{
-    if (! _socket)
-        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No socket instantiated"); }
-    
-    _remoteAddress = socket->remote_endpoint().address().to_string();
-    _id = _remoteAddress + ":" + to_string( socket->remote_endpoint().port() );
-    // TODO handle session expiration for clients with no keepalive
-    //_stream.expires_after(NormalStreamExpirationPeriod);
-}
-
+const size_t AsyncMessageReader::InitialBufferSize;
 
-AsyncProtoBufTcpChannel::AsyncProtoBufTcpChannel(const NetworkEndpoint &endpoint) :
-    _socket( new tcp::socket( Reactor::Instance().AsioService() ) ),
-    _id( endpoint.address() + ":" + to_string( endpoint.port() ) ),
-    _remoteAddress( endpoint.address() ), _nextRequestId(1) // , _socketWriteMutex(), _socketReadMutex()
+shared_ptr<AsyncMessageReader> AsyncMessageReader::Create( weak_ptr<tcp::socket> socket,
+    shared_ptr<asio::io_service::strand> strand, const SessionId &channelId )
 {
-    tcp::resolver resolver( Reactor::Instance().AsioService() );
-    tcp::resolver::query query( endpoint.address(), to_string( endpoint.port() ) );
-    tcp::resolver::iterator addressIter = resolver.resolve(query);
-    // TODO transform this to async to make every I/O call async also for client connections
-    try { asio::connect(*_socket, addressIter); }
-    catch (exception &ex) { throw LocationNetworkError(ErrorCode::ERROR_CONNECTION, "Failed connecting to " +
-        endpoint.address() + ":" + to_string( endpoint.port() ) + " with error: " + ex.what() ); }
-    LOG(DEBUG) << "Connected to " << endpoint;
-    // TODO handle session expiration
-    //_stream.expires_after( GetNormalStreamExpirationPeriod() );
+    return shared_ptr<AsyncMessageReader>( new AsyncMessageReader(socket, strand, channelId) );
 }
 
-AsyncProtoBufTcpChannel::~AsyncProtoBufTcpChannel()
+AsyncMessageReader::AsyncMessageReader( weak_ptr<tcp::socket> socket,
+        shared_ptr<asio::io_service::strand> strand, const SessionId &channelId ) :
+    _socket(socket), _strand(strand), _channelId(channelId),
+    _buffer( MessageBufferPool::Instance().Acquire(InitialBufferSize) ),
+    _dataBegin(0), _dataEnd(0), _pendingFrameEnd(0), _failed(false), _receivedMessages(),
+    _lastActivity( chrono::steady_clock::now() ), _partialFrameSince()
 {
-    _socket->close();
-    LOG(DEBUG) << "Connection closed to " << id();
+    if (_strand == nullptr) {
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No strand instantiated");
+    }
 }
 
+AsyncMessageReader::~AsyncMessageReader()
+    { MessageBufferPool::Instance().Release( move(_buffer) ); }
 
-const SessionId& AsyncProtoBufTcpChannel::id() const
-    { return _id; }
 
-const Address& AsyncProtoBufTcpChannel::remoteAddress() const
-    { return _remoteAddress; }
+chrono::steady_clock::time_point AsyncMessageReader::lastActivity() const
+    { return _lastActivity; }
 
+chrono::steady_clock::time_point AsyncMessageReader::partialFrameSince() const
+    { return _partialFrameSince; }
 
-uint32_t GetMessageSizeFromHeader(const char *bytes)
+
+
+void AsyncMessageReader::ReceiveMessage( function<IProtoBufChannel::ReceivedMessageCallback> callback )
 {
-    // Adapt big endian value from network to local format
-    const uint8_t *data = reinterpret_cast<const uint8_t*>(bytes);
-    return data[0] + (data[1] << 8) + (data[2] << 16) + (data[3] << 24);
+    shared_ptr<AsyncMessageReader> self = shared_from_this();
+    _strand->dispatch( [self, callback] { self->NextMessage(callback); } );
 }
 
 
-void AsyncProtoBufTcpChannel::ReceiveMessage( function<ReceivedMessageCallback> callback )
+void AsyncMessageReader::NextMessage( function<IProtoBufChannel::ReceivedMessageCallback> callback )
 {
-    //lock_guard<mutex> readGuard(_socketReadMutex);
-    //LOG(TRACE) << "Receive message called for connection " << id();
+    if ( _receivedMessages.empty() && ! _failed )
+        { _failed = ! ExtractFrames(); }
     
-    if ( ! _socket->is_open() )
+    if ( ! _receivedMessages.empty() )
+    {
+        unique_ptr<iop::locnet::Message> message( move( _receivedMessages.front() ) );
+        _receivedMessages.pop_front();
+        callback( move(message) );
+        return;
+    }
+    if (_failed)
     {
-        LOG(DEBUG) << "Connection to " << id() << " is already closed, cannot read message";
         callback( unique_ptr<iop::locnet::Message>() );
+        return;
+    }
+    
+    shared_ptr<tcp::socket> socket = _socket.lock();
+    if (! socket)
+    {
+        LOG_DEBUG(Network) << "Connection " << _channelId << " was closed, stop reading";
+        callback( unique_ptr<iop::locnet::Message>() );
+        return;
     }
-
-    // Allocate a buffer for the message header and read it
-    unique_ptr<string> buffer( new string(MessageHeaderSize, 0) );
-    shared_ptr<AsyncConnection> bufferIO = AsyncConnection::Create( _socket, move(buffer) );
     
-    string connectionId = id();
-    shared_ptr<tcp::socket> socket = _socket;
-    bufferIO->ReadBuffer( [socket, callback, connectionId] ( unique_ptr<string> &&transferredBuffer )
+    // No complete frame is buffered, wait for more data
+    ReserveReadSpace();
+    shared_ptr<AsyncMessageReader> self = shared_from_this();
+    socket->async_read_some( asio::buffer( &_buffer->operator[](_dataEnd), _buffer->size() - _dataEnd ),
+        _strand->wrap( [self, callback] (const asio::error_code &error, size_t bytesRead)
     {
-        unique_ptr<string> buffer( move(transferredBuffer) );
-        if ( ! buffer || buffer->size() < MessageHeaderSize )
+        if (error)
         {
-            LOG(DEBUG) << "Failed to read message header";
+            LOG_DEBUG(Network) << "Failed to read from connection " << self->_channelId << ": " << error.message();
+            self->_failed = true;
             callback( unique_ptr<iop::locnet::Message>() );
             return;
         }
+        self->_dataEnd += bytesRead;
+        self->_lastActivity = chrono::steady_clock::now();
+        self->NextMessage(callback);
+    } ) );
+}
 
-        // Extract message size from the header to know how many bytes to read
-        uint32_t bodySize = GetMessageSizeFromHeader( &buffer->operator[](MessageSizeOffset) );
-        if (bodySize > MaxMessageSize)
+
+bool AsyncMessageReader::ExtractFrames()
+{
+    size_t extractedCount = _receivedMessages.size();
+    _pendingFrameEnd = 0;
+    while (_dataEnd - _dataBegin >= MessageFraming::HeaderSize)
+    {
+        // Extract message size from the header to know whether the whole frame has arrived
+        uint32_t frameSize = 0;
+        try { frameSize = MessageFraming::ReadFrameSize( _buffer->data() + _dataBegin ); }
+        catch (exception &ex)
         {
-            LOG(DEBUG) << "Message size is over limit: " << bodySize;
-            callback( unique_ptr<iop::locnet::Message>() );
-            return;
+            LOG_DEBUG(Network) << "Connection " << _channelId << ": " << ex.what();
+            return false;
+        }
+        if (frameSize == 0 || frameSize > MessageFraming::MaxFrameSize)
+        {
+            LOG_DEBUG(Network) << "Message size is invalid or over limit: " << frameSize;
+            return false;
+        }
+        if (_dataEnd - _dataBegin < MessageFraming::HeaderSize + frameSize)
+        {
+            _pendingFrameEnd = MessageFraming::HeaderSize + frameSize;
+            break;
         }
         
-        // Extend buffer to fit remaining message size and read it
-        buffer->resize(MessageHeaderSize + bodySize, 0);
-        
-        shared_ptr<AsyncConnection> bufferIO = AsyncConnection::Create( socket, move(buffer), MessageHeaderSize );
-        bufferIO->ReadBuffer( [callback, connectionId] ( unique_ptr<string> &&buffer )
+        // Deserialize message directly from the receive buffer, avoid leaks for failing cases with RAII-based unique_ptr
+        unique_ptr<iop::locnet::Message> message( new iop::locnet::Message() );
+        if ( ! MessageFraming::Parse( _buffer->data() + _dataBegin + MessageFraming::HeaderSize, frameSize, *message ) )
         {
-            if (! buffer)
-            {
-                LOG(DEBUG) << "Received empty buffer due to an error, ignore it";
-                return;
-            }
-            
-            // Deserialize message from receive buffer, avoid leaks for failing cases with RAII-based unique_ptr
-            unique_ptr<iop::locnet::MessageWithHeader> message( new iop::locnet::MessageWithHeader() );
-            message->ParseFromString(*buffer);
-            
-            string msgDebugStr;
-            google::protobuf::TextFormat::PrintToString(*message, &msgDebugStr);
-            LOG(TRACE) << "Connection " << connectionId << " received message " << msgDebugStr;
-            
-            callback( unique_ptr<iop::locnet::Message>( message->release_body() ) );
-        } );
-    } );
+            LOG_DEBUG(Network) << "Connection " << _channelId << " received malformed message";
+            return false;
+        }
+        _dataBegin += MessageFraming::HeaderSize + frameSize;
+        
+        LOG_TRACE(Network) << "Connection " << _channelId << " received message " << message->ShortDebugString();
+        
+        _receivedMessages.push_back( move(message) );
+    }
+    
+    // Time limit to receive a message runs from its first bytes, there is nothing to wait for if no data is buffered
+    if (_dataBegin == _dataEnd)
+        { _partialFrameSince = chrono::steady_clock::time_point(); }
+    else if ( _receivedMessages.size() > extractedCount || _partialFrameSince == chrono::steady_clock::time_point() )
+        { _partialFrameSince = chrono::steady_clock::now(); }
+    return true;
 }
 
 
-future< unique_ptr<iop::locnet::Message> > AsyncProtoBufTcpChannel::ReceiveMessage(asio::use_future_t<>)
+void AsyncMessageReader::ReserveReadSpace()
 {
-    //lock_guard<mutex> readGuard(_socketReadMutex);
-    //LOG(TRACE) << "Receive message called for connection " << id();
+    // Move the remaining partial frame to the front of the buffer
+    size_t pendingSize = _dataEnd - _dataBegin;
+    if (_dataBegin > 0)
+    {
+        copy( _buffer->begin() + _dataBegin, _buffer->begin() + _dataEnd, _buffer->begin() );
+        _dataBegin = 0;
+        _dataEnd = pendingSize;
+    }
     
-    shared_ptr< promise< unique_ptr<iop::locnet::Message> > > result(
-        new promise< unique_ptr<iop::locnet::Message> >() );
+    // Grow to fit the whole partial frame, shrink back after a huge message has been processed
+    size_t requiredSize = max( _pendingFrameEnd, _dataEnd + 1 );
+    if ( _buffer->size() < requiredSize )
+        { _buffer->resize( max( requiredSize, 2 * _buffer->size() ) ); }
+    else if ( pendingSize == 0 && _buffer->size() > MessageBufferPool::DefaultMaxBufferCapacity )
+        { _buffer.reset( new string(InitialBufferSize, 0) ); }
+}
 
-    ReceiveMessage( [result] ( unique_ptr<iop::locnet::Message> &&receivedMessage )
-        { result->set_value( move(receivedMessage) ); } );
-    
-    return result->get_future();
+
+
+atomic<size_t> AsyncMessageWriter::_totalQueuedFrames(0);
+atomic<size_t> AsyncMessageWriter::_maxQueueDepth(0);
+atomic<size_t> AsyncMessageWriter::_congestedCount(0);
+atomic<size_t> AsyncMessageWriter::_writeCount(0);
+atomic<size_t> AsyncMessageWriter::_writtenFrameCount(0);
+
+const size_t AsyncMessageWriter::DefaultHighWaterMark;
+const size_t AsyncMessageWriter::MaxGatherFrameCount;
+
+
+SendQueueStats AsyncMessageWriter::stats()
+{
+    SendQueueStats result;
+    result.queuedFrames      = _totalQueuedFrames;
+    result.maxQueueDepth     = _maxQueueDepth;
+    result.congestedCount    = _congestedCount;
+    result.writeCount        = _writeCount;
+    result.writtenFrameCount = _writtenFrameCount;
+    return result;
 }
 
 
+shared_ptr<AsyncMessageWriter> AsyncMessageWriter::Create( weak_ptr<tcp::socket> socket,
+    shared_ptr<asio::io_service::strand> strand, const SessionId &channelId, size_t highWaterMark )
+{
+    return shared_ptr<AsyncMessageWriter>( new AsyncMessageWriter(socket, strand, channelId, highWaterMark) );
+}
 
-void AsyncProtoBufTcpChannel::SendMessage( unique_ptr<iop::locnet::Message> &&messagePtr,
-                                           function<SentMessageCallback> callback )
+AsyncMessageWriter::AsyncMessageWriter( weak_ptr<tcp::socket> socket,
+        shared_ptr<asio::io_service::strand> strand, const SessionId &channelId, size_t highWaterMark ) :
+    _socket(socket), _strand(strand), _channelId(channelId), _highWaterMark(highWaterMark),
+    _queuedFrames(), _writtenFrames(), _queuedBytes(0), _queueDepth(0), _readyCallbacks(), _failed(false),
+    _lastActivity( chrono::steady_clock::now() )
 {
-    if ( ! _socket->is_open() )
-        { throw LocationNetworkError(ErrorCode::ERROR_BAD_STATE,
-            "Session " + id() + " socket is already closed, cannot write message"); }
-    
-    if (! messagePtr)
-        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Got empty message argument to send"); }
-    if ( messagePtr->has_request() )
-    {
-        messagePtr->set_id(_nextRequestId);
-        ++_nextRequestId;
+    if (_strand == nullptr) {
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No strand instantiated");
     }
-    
-    iop::locnet::MessageWithHeader message;
-    message.set_allocated_body( messagePtr.release() );
-    
-    message.set_header(1);
-    message.set_header( message.ByteSize() - MessageHeaderSize );
+}
 
-    string msgDebugStr;
-    google::protobuf::TextFormat::PrintToString(message, &msgDebugStr);
-    LOG(TRACE) << "Connection " << id() << " sending message " << msgDebugStr;
+AsyncMessageWriter::~AsyncMessageWriter()
+    { _totalQueuedFrames -= _queueDepth; }
 
-    unique_ptr<string> serializedMessage( new string( message.SerializeAsString() ) );
-    shared_ptr<AsyncConnection> bufferIO = AsyncConnection::Create( _socket, move(serializedMessage) );
-    bufferIO->WriteBuffer( [callback] ( unique_ptr<string> && ) { callback(); } );
-}
 
+size_t AsyncMessageWriter::queueDepth() const
+    { return _queueDepth; }
 
+chrono::steady_clock::time_point AsyncMessageWriter::lastActivity() const
+    { return _lastActivity; }
 
-future<void> AsyncProtoBufTcpChannel::SendMessage(unique_ptr<iop::locnet::Message> &&messagePtr, asio::use_future_t<>)
+bool AsyncMessageWriter::IsCongested() const
+    { return _queuedBytes >= _highWaterMark; }
+
+
+
+void AsyncMessageWriter::SendFrame( unique_ptr<string> &&frame,
+    function<IProtoBufChannel::SentMessageCallback> callback )
 {
-    shared_ptr< promise<void> > result( new promise<void>() );
-    SendMessage( move(messagePtr), [result] { result->set_value(); } );
-    return result->get_future();
+    shared_ptr<AsyncMessageWriter> self = shared_from_this();
+    // NOTE std::function needs a copyable lambda, the frame itself cannot be captured
+    shared_ptr< unique_ptr<string> > frameHolder( new unique_ptr<string>( move(frame) ) );
+    _strand->dispatch( [self, frameHolder, callback]
+    {
+        bool wasCongested = self->IsCongested();
+        self->_queuedBytes += (*frameHolder)->size();
+        self->_queuedFrames.push_back( QueuedFrame{ move(*frameHolder), callback } );
+        
+        size_t queueDepth = ++self->_queueDepth;
+        ++_totalQueuedFrames;
+        size_t maxQueueDepth = _maxQueueDepth;
+        while ( queueDepth > maxQueueDepth && ! _maxQueueDepth.compare_exchange_weak(maxQueueDepth, queueDepth) ) {}
+        if ( ! wasCongested && self->IsCongested() )
+        {
+            ++_congestedCount;
+            LOG_DEBUG(Network) << "Send queue of connection " << self->_channelId << " is congested with "
+                       << queueDepth << " messages";
+        }
+        
+        if ( self->_writtenFrames.empty() )
+            { self->StartWrite(); }
+    } );
 }
 
 
+void AsyncMessageWriter::WhenReady( function<void()> callback )
+{
+    shared_ptr<AsyncMessageWriter> self = shared_from_this();
+    _strand->dispatch( [self, callback]
+    {
+        if ( self->_failed || ! self->IsCongested() )
+            { callback(); }
+        else { self->_readyCallbacks.push_back(callback); }
+    } );
+}
 
-shared_ptr<ProtoBufClientSession> ProtoBufClientSession::Create(
-        std::shared_ptr<IProtoBufChannel> connection)
-    { return shared_ptr<ProtoBufClientSession>( new ProtoBufClientSession(connection) ); }
 
-ProtoBufClientSession::ProtoBufClientSession(shared_ptr<IProtoBufChannel> connection) :
-    _messageChannel(connection), _nextMessageId(1)
+void AsyncMessageWriter::StartWrite()
 {
-    if (_messageChannel == nullptr)
-        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No connection instantiated"); }
+    shared_ptr<tcp::socket> socket = _socket.lock();
+    if ( _failed || ! socket )
+    {
+        LOG_DEBUG(Network) << "Connection " << _channelId << " was closed, dropping queued messages";
+        WriteCompleted( asio::error::not_connected );
+        return;
+    }
+    
+    // Flush all frames queued so far with a single gather write
+    vector<asio::const_buffer> buffers;
+    while ( ! _queuedFrames.empty() && _writtenFrames.size() < MaxGatherFrameCount )
+    {
+        _writtenFrames.push_back( move( _queuedFrames.front() ) );
+        _queuedFrames.pop_front();
+        buffers.push_back( asio::buffer( *_writtenFrames.back().frame ) );
+    }
+    ++_writeCount;
+    
+    shared_ptr<AsyncMessageWriter> self = shared_from_this();
+    asio::async_write( *socket, buffers, _strand->wrap(
+        [self] (const asio::error_code &error, size_t)
+            { self->WriteCompleted(error); } ) );
 }
 
 
-void ProtoBufClientSession::AsyncMessageLoopHandler(
-    weak_ptr<ProtoBufClientSession> sessionWeakRef, const string &sessionId,
-    std::function<IncomingRequestHandler> requestHandler )
+void AsyncMessageWriter::WriteCompleted(const asio::error_code &error)
 {
-    shared_ptr<ProtoBufClientSession> sessionPtr = sessionWeakRef.lock();
-    if (! sessionPtr) // Session has been closed and destroyed, stop
+    if (error && ! _failed)
     {
-        LOG(DEBUG) << "Session " << sessionId << " was closed, stopping message loop";
-        return;
+        LOG(WARNING) << "Failed to write connection " << _channelId << ": " << error.message();
+        _failed = true;
     }
     
-    sessionPtr->_messageChannel->ReceiveMessage(
-        [sessionWeakRef, sessionId, requestHandler] ( unique_ptr<iop::locnet::Message> &&incomingMsg )
+    // Failing writes also complete all messages queued, senders must not wait forever
+    vector<QueuedFrame> completedFrames( move(_writtenFrames) );
+    _writtenFrames.clear();
+    if (_failed)
     {
-        try
-        {
+        for (auto &queuedFrame : _queuedFrames)
+            { completedFrames.push_back( move(queuedFrame) ); }
+        _queuedFrames.clear();
+    }
+    else
+    {
+        _writtenFrameCount += completedFrames.size();
+        _lastActivity = chrono::steady_clock::now();
+    }
+    
+    for (auto &completedFrame : completedFrames)
+    {
+        _queuedBytes -= completedFrame.frame->size();
+        --_queueDepth;
+        --_totalQueuedFrames;
+        MessageBufferPool::Instance().Release( move(completedFrame.frame) );
+    }
+    
+    if ( ! _queuedFrames.empty() )
+        { StartWrite(); }
+    
+    // NOTE callbacks may queue further messages, state must be consistent before running them
+    for (auto &completedFrame : completedFrames)
+        { completedFrame.callback(); }
+    if ( _failed || ! IsCongested() )
+    {
+        vector< function<void()> > readyCallbacks;
+        readyCallbacks.swap(_readyCallbacks);
+        for (auto &readyCallback : readyCallbacks)
+            { readyCallback(); }
+    }
+}
+
+
+
+ConnectionManager::ConnectionManager(const ConnectionPolicy &policy) :
+    _policy(policy), _mutex(), _addressConnectionCounts(), _stats() {}
+
+const ConnectionPolicy& ConnectionManager::policy() const
+    { return _policy; }
+
+ConnectionStats ConnectionManager::stats() const
+{
+    lock_guard<mutex> guard(_mutex);
+    return _stats;
+}
+
+
+bool ConnectionManager::TryOpen(const Address &remoteAddress)
+{
+    lock_guard<mutex> guard(_mutex);
+    size_t &addressCount = _addressConnectionCounts[remoteAddress];
+    if ( ( _policy.maxConnections > 0 && _stats.openCount >= _policy.maxConnections ) ||
+         ( _policy.maxConnectionsPerAddress > 0 && addressCount >= _policy.maxConnectionsPerAddress ) )
+    {
+        if (addressCount == 0)
+            { _addressConnectionCounts.erase(remoteAddress); }
+        ++_stats.rejectedCount;
+        return false;
+    }
+    ++addressCount;
+    ++_stats.openCount;
+    return true;
+}
+
+
+void ConnectionManager::Closed(const Address &remoteAddress)
+{
+    lock_guard<mutex> guard(_mutex);
+    auto it = _addressConnectionCounts.find(remoteAddress);
+    if ( it == _addressConnectionCounts.end() )
+        { return; }
+    if (--it->second == 0)
+        { _addressConnectionCounts.erase(it); }
+    --_stats.openCount;
+}
+
+
+void ConnectionManager::Evicted(bool idle)
+{
+    lock_guard<mutex> guard(_mutex);
+    if (idle)
+        { ++_stats.idleEvictedCount; }
+    else { ++_stats.readTimeoutEvictedCount; }
+}
+
+
+
+shared_ptr<ConnectionExpiryTimer> ConnectionExpiryTimer::Create( weak_ptr<tcp::socket> socket,
+    shared_ptr<asio::io_service::strand> strand, weak_ptr<AsyncMessageReader> reader,
+    weak_ptr<AsyncMessageWriter> writer, shared_ptr<ConnectionManager> manager, const SessionId &channelId )
+{
+    return shared_ptr<ConnectionExpiryTimer>( new ConnectionExpiryTimer(
+        socket, strand, reader, writer, manager, channelId ) );
+}
+
+ConnectionExpiryTimer::ConnectionExpiryTimer( weak_ptr<tcp::socket> socket,
+        shared_ptr<asio::io_service::strand> strand, weak_ptr<AsyncMessageReader> reader,
+        weak_ptr<AsyncMessageWriter> writer, shared_ptr<ConnectionManager> manager, const SessionId &channelId ) :
+    _socket(socket), _strand(strand), _reader(reader), _writer(writer), _manager(manager),
+    _channelId(channelId), _timer( strand->get_io_service() ), _keepAlive(false)
+{
+    if (_manager == nullptr) {
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No connection manager instantiated");
+    }
+}
+
+
+void ConnectionExpiryTimer::Start()
+{
+    const ConnectionPolicy &policy = _manager->policy();
+    chrono::steady_clock::duration firstCheck = policy.idleTimeout;
+    if ( firstCheck == chrono::steady_clock::duration::zero() ||
+         ( policy.readTimeout > chrono::steady_clock::duration::zero() && policy.readTimeout < firstCheck ) )
+        { firstCheck = policy.readTimeout; }
+    if ( firstCheck == chrono::steady_clock::duration::zero() )
+        { return; }
+    
+    shared_ptr<ConnectionExpiryTimer> self = shared_from_this();
+    _strand->dispatch( [self, firstCheck] { self->Schedule(firstCheck); } );
+}
+
+
+void ConnectionExpiryTimer::Cancel()
+{
+    shared_ptr<ConnectionExpiryTimer> self = shared_from_this();
+    _strand->dispatch( [self] { self->_timer.cancel(); } );
+}
+
+
+void ConnectionExpiryTimer::KeepAlive()
+    { _keepAlive = true; }
+
+
+void ConnectionExpiryTimer::Schedule(chrono::steady_clock::duration delay)
+{
+    shared_ptr<ConnectionExpiryTimer> self = shared_from_this();
+    _timer.expires_from_now(delay);
+    _timer.async_wait( _strand->wrap( [self] (const asio::error_code &error)
+    {
+        if (error != asio::error::operation_aborted)
+            { self->CheckDeadlines(); }
+    } ) );
+}
+
+
+void ConnectionExpiryTimer::CheckDeadlines()
+{
+    shared_ptr<tcp::socket> socket = _socket.lock();
+    shared_ptr<AsyncMessageReader> reader = _reader.lock();
+    shared_ptr<AsyncMessageWriter> writer = _writer.lock();
+    if ( ! socket || ! reader || ! writer || ! socket->is_open() )
+        { return; }
+    
+    const ConnectionPolicy &policy = _manager->policy();
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    chrono::steady_clock::time_point nextCheck = chrono::steady_clock::time_point::max();
+    
+    if ( policy.readTimeout > chrono::steady_clock::duration::zero() )
+    {
+        chrono::steady_clock::time_point readDeadline = chrono::steady_clock::time_point::max();
+        if ( reader->partialFrameSince() != chrono::steady_clock::time_point() )
+            { readDeadline = reader->partialFrameSince() + policy.readTimeout; }
+        if (readDeadline <= now)
+        {
+            LOG(INFO) << "Connection " << _channelId << " did not send a whole message in time, closing it";
+            _manager->Evicted(false);
+            socket->close();
+            return;
+        }
+        nextCheck = min( nextCheck, min( readDeadline, now + policy.readTimeout ) );
+    }
+    
+    if ( policy.idleTimeout > chrono::steady_clock::duration::zero() && ! _keepAlive )
+    {
+        chrono::steady_clock::time_point idleDeadline =
+            max( reader->lastActivity(), writer->lastActivity() ) + policy.idleTimeout;
+        if (idleDeadline <= now)
+        {
+            LOG(INFO) << "Connection " << _channelId << " was idle for too long, closing it";
+            _manager->Evicted(true);
+            socket->close();
+            return;
+        }
+        nextCheck = min(nextCheck, idleDeadline);
+    }
+    
+    if ( nextCheck != chrono::steady_clock::time_point::max() )
+        { Schedule(nextCheck - now); }
+}
+
+
+
+AsyncProtoBufTcpChannel::AsyncProtoBufTcpChannel(shared_ptr<tcp::socket> socket) :
+    _socket(socket), _strand(), _reader(), _writer(), _manager(), _expiryTimer(), _id(), _remoteAddress(), _remoteIpAddress(), _nextRequestId(1) // , _socketWriteMutex(), _socketReadMutex()
+{
+    if (! _socket)
+        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No socket instantiated"); }
+    _strand.reset( new asio::io_service::strand( _socket->get_io_service() ) );
+    
+    _remoteIpAddress = ToIpAddress( socket->remote_endpoint().address() );
+    _remoteAddress = _remoteIpAddress.ToString();
+    _id = _remoteAddress + ":" + to_string( socket->remote_endpoint().port() );
+    _reader = AsyncMessageReader::Create(_socket, _strand, _id);
+    _writer = AsyncMessageWriter::Create(_socket, _strand, _id);
+}
+
+
+AsyncProtoBufTcpChannel::AsyncProtoBufTcpChannel(const NetworkEndpoint &endpoint) :
+    _socket( new tcp::socket( Reactor::Instance().AsioService() ) ),
+    _strand( new asio::io_service::strand( Reactor::Instance().AsioService() ) ),
+    _reader(), _writer(), _manager(), _expiryTimer(),
+    _id( endpoint.address() + ":" + to_string( endpoint.port() ) ),
+    _remoteAddress( endpoint.address() ), _remoteIpAddress(), _nextRequestId(1) // , _socketWriteMutex(), _socketReadMutex()
+{
+    tcp::resolver resolver( Reactor::Instance().AsioService() );
+    tcp::resolver::query query( endpoint.address(), to_string( endpoint.port() ) );
+    tcp::resolver::iterator addressIter = resolver.resolve(query);
+    try { asio::connect(*_socket, addressIter); }
+    catch (exception &ex) { throw LocationNetworkError(ErrorCode::ERROR_CONNECTION, "Failed connecting to " +
+        endpoint.address() + ":" + to_string( endpoint.port() ) + " with error: " + ex.what() ); }
+    LOG_DEBUG(Network) << "Connected to " << endpoint;
+    _remoteIpAddress = ToIpAddress( _socket->remote_endpoint().address() );
+    _reader = AsyncMessageReader::Create(_socket, _strand, _id);
+    _writer = AsyncMessageWriter::Create(_socket, _strand, _id);
+}
+
+void AsyncProtoBufTcpChannel::Connect( const NetworkEndpoint &endpoint,
+    chrono::steady_clock::duration timeout, function<ConnectedCallback> callback )
+{
+    shared_ptr<AsyncTcpConnector> connector = AsyncTcpConnector::Create(
+        Reactor::Instance().AsioService(), endpoint, timeout );
+    connector->Connect( [callback] (shared_ptr<tcp::socket> socket, const asio::error_code &error)
+    {
+        shared_ptr<AsyncProtoBufTcpChannel> channel;
+        asio::error_code result = error;
+        if (! error)
+        {
+            // NOTE remote_endpoint() may still fail if the peer reset the connection meanwhile
+            try { channel.reset( new AsyncProtoBufTcpChannel(socket) ); }
+            catch (exception &ex)
+            {
+                LOG_DEBUG(Network) << "Failed to set up connected channel: " << ex.what();
+                result = asio::error::not_connected;
+            }
+        }
+        callback(channel, result);
+    } );
+}
+
+
+future< shared_ptr<AsyncProtoBufTcpChannel> > AsyncProtoBufTcpChannel::Connect(
+    const NetworkEndpoint &endpoint, chrono::steady_clock::duration timeout, asio::use_future_t<> )
+{
+    shared_ptr< promise< shared_ptr<AsyncProtoBufTcpChannel> > > result(
+        new promise< shared_ptr<AsyncProtoBufTcpChannel> >() );
+    Connect( endpoint, timeout, [result, endpoint]
+        (shared_ptr<AsyncProtoBufTcpChannel> channel, const asio::error_code &error)
+    {
+        if (error)
+        {
+            result->set_exception( make_exception_ptr( LocationNetworkError( ErrorCode::ERROR_CONNECTION,
+                "Failed connecting to " + endpoint.address() + ":" + to_string( endpoint.port() ) +
+                " with error: " + error.message() ) ) );
+        }
+        else { result->set_value(channel); }
+    } );
+    return result->get_future();
+}
+
+
+AsyncProtoBufTcpChannel::~AsyncProtoBufTcpChannel()
+{
+    if (_expiryTimer)
+        { _expiryTimer->Cancel(); }
+    if (_manager)
+        { _manager->Closed(_remoteAddress); }
+    _socket->close();
+    LOG_DEBUG(Network) << "Connection closed to " << id();
+}
+
+
+const SessionId& AsyncProtoBufTcpChannel::id() const
+    { return _id; }
+
+const Address& AsyncProtoBufTcpChannel::remoteAddress() const
+    { return _remoteAddress; }
+
+const IpAddress& AsyncProtoBufTcpChannel::remoteIpAddress() const
+    { return _remoteIpAddress; }
+
+
+void AsyncProtoBufTcpChannel::ReceiveMessage( function<ReceivedMessageCallback> callback )
+{
+    //lock_guard<mutex> readGuard(_socketReadMutex);
+    //LOG_TRACE(Network) << "Receive message called for connection " << id();
+    
+    if ( ! _socket->is_open() )
+    {
+        LOG_DEBUG(Network) << "Connection to " << id() << " is already closed, cannot read message";
+        callback( unique_ptr<iop::locnet::Message>() );
+        return;
+    }
+
+    _reader->ReceiveMessage(callback);
+}
+
+
+future< unique_ptr<iop::locnet::Message> > AsyncProtoBufTcpChannel::ReceiveMessage(asio::use_future_t<>)
+{
+    //lock_guard<mutex> readGuard(_socketReadMutex);
+    //LOG_TRACE(Network) << "Receive message called for connection " << id();
+    
+    shared_ptr< promise< unique_ptr<iop::locnet::Message> > > result(
+        new promise< unique_ptr<iop::locnet::Message> >() );
+
+    ReceiveMessage( [result] ( unique_ptr<iop::locnet::Message> &&receivedMessage )
+        { result->set_value( move(receivedMessage) ); } );
+    
+    return result->get_future();
+}
+
+
+
+void AsyncProtoBufTcpChannel::SendMessage( unique_ptr<iop::locnet::Message> &&messagePtr,
+                                           function<SentMessageCallback> callback )
+{
+    if ( ! _socket->is_open() )
+        { throw LocationNetworkError(ErrorCode::ERROR_BAD_STATE,
+            "Session " + id() + " socket is already closed, cannot write message"); }
+    
+    if (! messagePtr)
+        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Got empty message argument to send"); }
+    // NOTE sessions assign their own ids to match responses, those must not be overwritten
+    if ( messagePtr->has_request() && messagePtr->id() == 0 )
+        { messagePtr->set_id( _nextRequestId++ ); }
+    
+    static const SplicedResponseFields noSplicedFields;
+    SendMessage(*messagePtr, noSplicedFields, callback);
+}
+
+
+void AsyncProtoBufTcpChannel::SendMessage( const iop::locnet::Message &message,
+    const SplicedResponseFields &splicedFields, function<SentMessageCallback> callback )
+{
+    if ( ! _socket->is_open() )
+        { throw LocationNetworkError(ErrorCode::ERROR_BAD_STATE,
+            "Session " + id() + " socket is already closed, cannot write message"); }
+    
+    LOG_TRACE(Network) << "Connection " << id() << " sending message " << message.ShortDebugString();
+
+    unique_ptr<string> serializedMessage( MessageBufferPool::Instance().Acquire() );
+    MessageFraming::Serialize(message, splicedFields, *serializedMessage);
+    _writer->SendFrame( move(serializedMessage), callback );
+}
+
+
+
+future<void> AsyncProtoBufTcpChannel::SendMessage(unique_ptr<iop::locnet::Message> &&messagePtr, asio::use_future_t<>)
+{
+    shared_ptr< promise<void> > result( new promise<void>() );
+    SendMessage( move(messagePtr), [result] { result->set_value(); } );
+    return result->get_future();
+}
+
+
+
+size_t AsyncProtoBufTcpChannel::sendQueueDepth() const
+    { return _writer->queueDepth(); }
+
+void AsyncProtoBufTcpChannel::WhenSendQueueReady( function<void()> callback )
+    { _writer->WhenReady(callback); }
+
+
+void AsyncProtoBufTcpChannel::Manage(shared_ptr<ConnectionManager> manager)
+{
+    if (_manager) {
+        throw LocationNetworkError(ErrorCode::ERROR_BAD_STATE, "Connection is already managed");
+    }
+    _manager = manager;
+    _expiryTimer = ConnectionExpiryTimer::Create(_socket, _strand, _reader, _writer, _manager, _id);
+    _expiryTimer->Start();
+}
+
+void AsyncProtoBufTcpChannel::KeepAlive()
+{
+    if (_expiryTimer)
+        { _expiryTimer->KeepAlive(); }
+}
+
+
+
+shared_ptr<ProtoBufClientSession> ProtoBufClientSession::Create(
+        std::shared_ptr<IProtoBufChannel> connection)
+    { return shared_ptr<ProtoBufClientSession>( new ProtoBufClientSession(connection) ); }
+
+const ProtoBufClientSession::Duration ProtoBufClientSession::DefaultRequestTimeout = chrono::seconds(10);
+
+
+ProtoBufClientSession::ProtoBufClientSession(shared_ptr<IProtoBufChannel> connection) :
+    _messageChannel(connection), _messageLoopFailed(false), _nextMessageId(1)
+{
+    if (_messageChannel == nullptr)
+        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No connection instantiated"); }
+}
+
+
+void ProtoBufClientSession::AsyncMessageLoopHandler(
+    weak_ptr<ProtoBufClientSession> sessionWeakRef, const string &sessionId,
+    std::function<IncomingRequestHandler> requestHandler )
+{
+    shared_ptr<ProtoBufClientSession> sessionPtr = sessionWeakRef.lock();
+    if (! sessionPtr) // Session has been closed and destroyed, stop
+    {
+        LOG_DEBUG(Network) << "Session " << sessionId << " was closed, stopping message loop";
+        return;
+    }
+    
+    sessionPtr->_messageChannel->ReceiveMessage(
+        [sessionWeakRef, sessionId, requestHandler] ( unique_ptr<iop::locnet::Message> &&incomingMsg )
+    {
+        try
+        {
             if (! incomingMsg)
                 { throw runtime_error("No message received"); }
                 
@@ -439,149 +1212,837 @@ void ProtoBufClientSession::AsyncMessageLoopHandler(
                 if (! sessionPtr)
                     { throw runtime_error("Session is closed for " + sessionId); }
                 
-                LOG(TRACE) << "Dispatching incoming response to request sender";
+                LOG_TRACE(Network) << "Dispatching incoming response to request sender";
                 sessionPtr->ResponseArrived( move(incomingMsg) );
             }
             
             Reactor::Instance().AsioService().post( [sessionWeakRef, sessionId, requestHandler]
                 { AsyncMessageLoopHandler(sessionWeakRef, sessionId, requestHandler); } );
         }
-        catch (exception &ex)
-            { LOG(WARNING) << "Failed to dispatch response, stopping message loop: " << ex.what(); }
+        catch (exception &ex)
+        {
+            LOG(WARNING) << "Failed to dispatch response, stopping message loop: " << ex.what();
+            shared_ptr<ProtoBufClientSession> sessionPtr = sessionWeakRef.lock();
+            if (sessionPtr)
+            {
+                sessionPtr->_messageLoopFailed = true;
+                // No more responses can arrive, don't let senders wait for their deadlines
+                sessionPtr->FailPendingRequests( "Session " + sessionId + " was closed" );
+            }
+        }
+    } );
+}
+
+
+void ProtoBufClientSession::StartMessageLoop( std::function<IncomingRequestHandler> requestHandler )
+{
+    shared_ptr<ProtoBufClientSession> session = shared_from_this();
+    string sessionId = session->id();
+    weak_ptr<ProtoBufClientSession> sessionWeakRef(session);
+    Reactor::Instance().AsioService().post( [sessionWeakRef, sessionId, requestHandler]
+        { AsyncMessageLoopHandler(sessionWeakRef, sessionId, requestHandler); } );
+}
+
+
+ProtoBufClientSession::~ProtoBufClientSession()
+    { FailPendingRequests( "Session " + id() + " was destroyed" ); }
+
+
+const SessionId& ProtoBufClientSession::id() const
+    { return _messageChannel->id(); }
+
+shared_ptr<IProtoBufChannel> ProtoBufClientSession::messageChannel()
+    { return _messageChannel; }
+
+void ProtoBufClientSession::KeepAlive()
+    { _messageChannel->KeepAlive(); }
+
+bool ProtoBufClientSession::IsAlive() const
+    { return ! _messageLoopFailed; }
+
+size_t ProtoBufClientSession::pendingRequestCount()
+{
+    lock_guard<mutex> pendingRequestGuard(_pendingRequestsMutex);
+    return _pendingRequests.size();
+}
+
+
+
+ProtoBufClientSession::RequestId ProtoBufClientSession::SendRequest(
+    unique_ptr<iop::locnet::Message> &&requestMessage, Duration timeout,
+    function<ResponseHandler> responseHandler )
+{
+    if (! requestMessage->has_request() )
+        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Attempt to send non-request message"); }
+    if (! responseHandler)
+        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No response handler instantiated"); }
+    if ( _messageLoopFailed )
+        { throw LocationNetworkError(ErrorCode::ERROR_BAD_STATE, "Session " + id() + " is already closed"); }
+
+    PendingRequest pending;
+    pending.handler = responseHandler;
+    if ( timeout > Duration::zero() )
+        { pending.deadline = make_shared<asio::steady_timer>( Reactor::Instance().AsioService() ); }
+    
+    unique_lock<mutex> pendingRequestGuard(_pendingRequestsMutex);
+    RequestId messageId = _nextMessageId++;
+    auto emplaceResult = _pendingRequests.emplace( messageId, move(pending) );
+    if (! emplaceResult.second)
+        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Failed to store pending request"); }
+    
+    shared_ptr<asio::steady_timer> deadline = emplaceResult.first->second.deadline;
+    if (deadline)
+    {
+        weak_ptr<ProtoBufClientSession> sessionWeakRef( shared_from_this() );
+        deadline->expires_from_now(timeout);
+        deadline->async_wait( [sessionWeakRef, messageId] (const asio::error_code &error)
+        {
+            if (error) // Timer was cancelled because the request completed otherwise
+                { return; }
+            shared_ptr<ProtoBufClientSession> session = sessionWeakRef.lock();
+            if (! session)
+                { return; }
+            if ( session->CompleteRequest( messageId, unique_ptr<iop::locnet::Response>(),
+                    make_exception_ptr( LocationNetworkError( ErrorCode::ERROR_TIMEOUT,
+                        "Timeout waiting for response of request " + to_string(messageId) ) ) ) )
+                { LOG(WARNING) << "Session " << session->id() << " received no response for request "
+                               << messageId << ", timed out"; }
+        } );
+    }
+    pendingRequestGuard.unlock();
+    
+    requestMessage->set_id(messageId);
+    try { _messageChannel->SendMessage( move(requestMessage), [] {} ); }
+    catch (...)
+    {
+        // Request was never sent, forget it without calling the handler, the caller gets the exception
+        pendingRequestGuard.lock();
+        _pendingRequests.erase(messageId);
+        if (deadline)
+            { deadline->cancel(); }
+        throw;
+    }
+    
+    return messageId;
+}
+
+
+future< unique_ptr<iop::locnet::Response> > ProtoBufClientSession::SendRequest(
+    unique_ptr<iop::locnet::Message> &&requestMessage, Duration timeout)
+{
+    shared_ptr< promise< unique_ptr<iop::locnet::Response> > > result(
+        new promise< unique_ptr<iop::locnet::Response> >() );
+    SendRequest( move(requestMessage), timeout,
+        [result] (unique_ptr<iop::locnet::Response> &&response, exception_ptr error)
+        {
+            if (error)
+                { result->set_exception(error); }
+            else { result->set_value( move(response) ); }
+        } );
+    return result->get_future();
+}
+
+
+bool ProtoBufClientSession::CancelRequest(RequestId requestId)
+{
+    return CompleteRequest( requestId, unique_ptr<iop::locnet::Response>(),
+        make_exception_ptr( LocationNetworkError( ErrorCode::ERROR_BAD_STATE,
+            "Request " + to_string(requestId) + " was cancelled" ) ) );
+}
+
+
+bool ProtoBufClientSession::CompleteRequest( RequestId requestId,
+    unique_ptr<iop::locnet::Response> &&response, exception_ptr error )
+{
+    PendingRequest request;
+    {
+        lock_guard<mutex> pendingRequestGuard(_pendingRequestsMutex);
+        auto requestIter = _pendingRequests.find(requestId);
+        if ( requestIter == _pendingRequests.end() )
+            { return false; }
+        request = move(requestIter->second);
+        _pendingRequests.erase(requestIter);
+    }
+    
+    if (request.deadline)
+        { request.deadline->cancel(); }
+    // NOTE handler is called without holding the lock, it may send further requests
+    request.handler( move(response), error );
+    return true;
+}
+
+
+void ProtoBufClientSession::FailPendingRequests(const string &reason)
+{
+    unordered_map<RequestId, PendingRequest> failedRequests;
+    {
+        lock_guard<mutex> pendingRequestGuard(_pendingRequestsMutex);
+        failedRequests.swap(_pendingRequests);
+    }
+    
+    for (auto &entry : failedRequests)
+    {
+        if (entry.second.deadline)
+            { entry.second.deadline->cancel(); }
+        entry.second.handler( unique_ptr<iop::locnet::Response>(),
+            make_exception_ptr( LocationNetworkError(ErrorCode::ERROR_CONNECTION, reason) ) );
+    }
+}
+
+
+void ProtoBufClientSession::ResponseArrived(unique_ptr<iop::locnet::Message> &&responseMessage)
+{
+    if (! responseMessage)
+        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Implementation error: received null response"); }
+    if (! responseMessage->has_response() )
+        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Attempt to receive non-response message"); }
+    
+    RequestId requestId = responseMessage->id();
+    LOG_TRACE(Network) << "Looking up request for response message id " << requestId;
+    
+    unique_ptr<iop::locnet::Response> response( responseMessage->release_response() );
+    if ( CompleteRequest( requestId, move(response), exception_ptr() ) )
+    {
+        LOG_TRACE(Network) << "Response was dispatched for message id " << requestId;
+        return;
+    }
+    
+    {
+        lock_guard<mutex> pendingRequestGuard(_pendingRequestsMutex);
+        if ( requestId == 0 || requestId >= _nextMessageId )
+            { throw LocationNetworkError( ErrorCode::ERROR_PROTOCOL_VIOLATION, "No request found for message id " + to_string(requestId) ); }
+    }
+    // Request was sent by us but already expired or cancelled, the remote node was just too slow
+    LOG_DEBUG(Network) << "Session " << id() << " dropped late response for message id " << requestId;
+}
+
+
+
+
+NetworkDispatcher::NetworkDispatcher(shared_ptr<Config> config, shared_ptr<ProtoBufClientSession> session) :
+    _config(config), _session(session) {}
+
+
+
+unique_ptr<iop::locnet::Message> RequestToMessage(unique_ptr<iop::locnet::Request> &&request)
+{
+    request->set_version({1,0,0});
+    unique_ptr<iop::locnet::Message> message( new iop::locnet::Message() );
+    message->set_allocated_request( request.release() );
+    return message;
+}
+
+
+
+unique_ptr<iop::locnet::Response> NetworkDispatcher::Dispatch(unique_ptr<iop::locnet::Request> &&request)
+{
+    // NOTE the response is read by a reactor thread, waiting for it here would stall until the deadline
+    if ( Reactor::IsReactorThread() )
+        { throw LocationNetworkError( ErrorCode::ERROR_BAD_STATE, "Session " + _session->id() +
+            " refuses to wait for a response on a reactor thread" ); }
+    
+    unique_ptr<iop::locnet::Message> requestMessage( RequestToMessage( move(request) ) );
+    // NOTE the deadline is enforced by the session, the future completes with an error on expiry
+    future< unique_ptr<iop::locnet::Response> > futureResponse = _session->SendRequest(
+        move(requestMessage), _config->requestExpirationPeriod() );
+    unique_ptr<iop::locnet::Response> result( futureResponse.get() );
+    if ( result && result->status() != iop::locnet::Status::STATUS_OK )
+    {
+        LOG(WARNING) << "Session " << _session->id() << " received response code " << result->status()
+                     << ", error details: " << result->details();
+        throw LocationNetworkError( ErrorCode::ERROR_BAD_RESPONSE, result->details() );
+    }
+    return result;
+}
+
+
+
+SessionRequestDispatcher::SessionRequestDispatcher( shared_ptr<ProtoBufClientSession> session,
+        ProtoBufClientSession::Duration timeout, function<OutcomeCallback> outcomeCallback ) :
+    _session(session), _timeout(timeout), _outcomeCallback(outcomeCallback)
+{
+    if (_session == nullptr) {
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No session instantiated");
+    }
+}
+
+
+void SessionRequestDispatcher::Dispatch( unique_ptr<iop::locnet::Request> &&request,
+    function<ResponseHandler> responseHandler )
+{
+    unique_ptr<iop::locnet::Message> requestMessage( RequestToMessage( move(request) ) );
+    SessionId sessionId = _session->id();
+    function<OutcomeCallback> outcomeCallback = _outcomeCallback;
+    _session->SendRequest( move(requestMessage), _timeout,
+        [sessionId, outcomeCallback, responseHandler] (unique_ptr<iop::locnet::Response> &&response, exception_ptr error)
+    {
+        if ( ! error && response && response->status() != iop::locnet::Status::STATUS_OK )
+        {
+            LOG(WARNING) << "Session " << sessionId << " received response code " << response->status()
+                         << ", error details: " << response->details();
+            error = make_exception_ptr( LocationNetworkError( ErrorCode::ERROR_BAD_RESPONSE, response->details() ) );
+            response.reset();
+        }
+        if (outcomeCallback)
+            { outcomeCallback(error); }
+        responseHandler( move(response), error );
     } );
 }
 
 
-void ProtoBufClientSession::StartMessageLoop( std::function<IncomingRequestHandler> requestHandler )
+
+void PendingSessionRequestDispatcher::Opened(shared_ptr<IDelayedRequestDispatcher> dispatcher)
 {
-    shared_ptr<ProtoBufClientSession> session = shared_from_this();
-    string sessionId = session->id();
-    weak_ptr<ProtoBufClientSession> sessionWeakRef(session);
-    Reactor::Instance().AsioService().post( [sessionWeakRef, sessionId, requestHandler]
-        { AsyncMessageLoopHandler(sessionWeakRef, sessionId, requestHandler); } );
+    vector<QueuedRequest> queuedRequests;
+    {
+        lock_guard<mutex> lock(_mutex);
+        _dispatcher = dispatcher;
+        queuedRequests.swap(_queuedRequests);
+    }
+    for (auto &queued : queuedRequests)
+        { dispatcher->Dispatch( move(queued.request), queued.responseHandler ); }
 }
 
 
-ProtoBufClientSession::~ProtoBufClientSession()
+void PendingSessionRequestDispatcher::Failed(exception_ptr error)
 {
-    // NOTE destruction of the promise<> values of the map will trigger sending a broken_promise exception to related future<> objects, no need to do this manually
+    vector<QueuedRequest> queuedRequests;
+    {
+        lock_guard<mutex> lock(_mutex);
+        _error = error;
+        queuedRequests.swap(_queuedRequests);
+    }
+    for (auto &queued : queuedRequests)
+        { queued.responseHandler( unique_ptr<iop::locnet::Response>(), error ); }
 }
 
 
-const SessionId& ProtoBufClientSession::id() const
-    { return _messageChannel->id(); }
+void PendingSessionRequestDispatcher::Dispatch( unique_ptr<iop::locnet::Request> &&request,
+    function<ResponseHandler> responseHandler )
+{
+    shared_ptr<IDelayedRequestDispatcher> dispatcher;
+    exception_ptr error;
+    {
+        lock_guard<mutex> lock(_mutex);
+        if ( ! _dispatcher && ! _error )
+        {
+            _queuedRequests.push_back( QueuedRequest{ move(request), responseHandler } );
+            return;
+        }
+        dispatcher = _dispatcher;
+        error = _error;
+    }
+    
+    if (dispatcher)
+        { dispatcher->Dispatch( move(request), responseHandler ); }
+    else { responseHandler( unique_ptr<iop::locnet::Response>(), error ); }
+}
 
-shared_ptr<IProtoBufChannel> ProtoBufClientSession::messageChannel()
-    { return _messageChannel; }
 
-future< unique_ptr<iop::locnet::Response> > ProtoBufClientSession::SendRequest(
-    unique_ptr<iop::locnet::Message> &&requestMessage)
+
+TcpNodeConnectionFactory::TcpNodeConnectionFactory(shared_ptr<Config> config) :
+    _config(config) {}
+
+void TcpNodeConnectionFactory::detectedIpCallback(function<void(const IpAddress&)> detectedIpCallback)
 {
-    if (! requestMessage->has_request() )
-        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Attempt to send non-request message"); }
+    _detectedIpCallback = detectedIpCallback;
+    LOG_DEBUG(Network) << "Callback for detecting external IP address is set " << static_cast<bool>(_detectedIpCallback); 
+}
 
-    unique_lock<mutex> pendingRequestGuard(_pendingRequestsMutex);
-    uint32_t messageId = _nextMessageId++;
-    auto emplaceResult = _pendingRequests.emplace(messageId, promise< unique_ptr<iop::locnet::Response> >());
-    if (! emplaceResult.second)
-        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Failed to store pending request"); }
-    
-    auto result = emplaceResult.first->second.get_future();
-    pendingRequestGuard.unlock();
+
+shared_ptr<INodeMethods> TcpNodeConnectionFactory::ConnectTo(const NetworkEndpoint& endpoint)
+    { return CreateProxy( OpenSession(endpoint) ); }
+
+
+void TcpNodeConnectionFactory::OpenSessionAsync( const NetworkEndpoint &endpoint,
+    function<SessionOpenedCallback> callback )
+{
+    LOG_DEBUG(Network) << "Connecting to " << endpoint;
+    AsyncProtoBufTcpChannel::Connect( endpoint, ConnectTimeout, [endpoint, callback]
+        (shared_ptr<AsyncProtoBufTcpChannel> channel, const asio::error_code &error)
+    {
+        if (error)
+        {
+            callback( shared_ptr<ProtoBufClientSession>(), make_exception_ptr( LocationNetworkError(
+                ErrorCode::ERROR_CONNECTION, "Failed connecting to " + endpoint.address() + ":" +
+                to_string( endpoint.port() ) + " with error: " + error.message() ) ) );
+            return;
+        }
+        shared_ptr<ProtoBufClientSession> session( ProtoBufClientSession::Create(channel) );
+        session->StartMessageLoop();
+        callback( session, exception_ptr() );
+    } );
+}
+
+
+shared_ptr<ProtoBufClientSession> TcpNodeConnectionFactory::OpenSession(const NetworkEndpoint& endpoint)
+{
+    // NOTE the connection is completed by a reactor thread, waiting for it here would stall until the timeout
+    if ( Reactor::IsReactorThread() )
+        { throw LocationNetworkError( ErrorCode::ERROR_BAD_STATE, "Refusing to wait for connecting to " +
+            endpoint.address() + ":" + to_string( endpoint.port() ) + " on a reactor thread" ); }
     
-    requestMessage->set_id(messageId);
-    _messageChannel->SendMessage( move(requestMessage), [] {} );
+    shared_ptr< promise< shared_ptr<ProtoBufClientSession> > > result(
+        new promise< shared_ptr<ProtoBufClientSession> >() );
+    OpenSessionAsync( endpoint, [result] (shared_ptr<ProtoBufClientSession> session, exception_ptr error)
+    {
+        if (error)
+            { result->set_exception(error); }
+        else { result->set_value(session); }
+    } );
     
-    return result;
+    future< shared_ptr<ProtoBufClientSession> > futureSession = result->get_future();
+    // NOTE the connector enforces the timeout itself, this is only a safety net for an overloaded reactor
+    if ( futureSession.wait_for(ConnectTimeout + chrono::seconds(1)) != future_status::ready )
+        { throw LocationNetworkError( ErrorCode::ERROR_CONNECTION, "Timeout connecting to " +
+            endpoint.address() + ":" + to_string( endpoint.port() ) ); }
+    return futureSession.get();
 }
 
 
-void ProtoBufClientSession::ResponseArrived(unique_ptr<iop::locnet::Message> &&responseMessage)
+shared_ptr<INodeMethods> TcpNodeConnectionFactory::CreateProxy(shared_ptr<ProtoBufClientSession> session)
 {
-    if (! responseMessage)
-        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Implementation error: received null response"); }
-    if (! responseMessage->has_response() )
-        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Attempt to receive non-response message"); }
-    
-    LOG(TRACE) << "Looking up request for response message id " << responseMessage->id()
-               << " between " << _pendingRequests.size() << " pending requests";
+    shared_ptr<IBlockingRequestDispatcher> dispatcher( new NetworkDispatcher(_config, session) );
+    return shared_ptr<INodeMethods>( new NodeMethodsProtoBufClient(dispatcher, _detectedIpCallback) );
+}
 
-    lock_guard<mutex> pendingRequestGuard(_pendingRequestsMutex);
-    auto requestIter = _pendingRequests.find( responseMessage->id() );
-    if ( requestIter == _pendingRequests.end() )
-        { throw LocationNetworkError( ErrorCode::ERROR_PROTOCOL_VIOLATION, "No request found for message id " + to_string( responseMessage->id() ) ); }
-    
-    LOG(TRACE) << "Found request for message id " << responseMessage->id() << ", notifying sender";
+
+shared_ptr<IAsyncNodeMethods> TcpNodeConnectionFactory::ConnectToAsync(const NetworkEndpoint& endpoint)
+{
+    shared_ptr<PendingSessionRequestDispatcher> dispatcher( new PendingSessionRequestDispatcher() );
+    ProtoBufClientSession::Duration timeout = _config->requestExpirationPeriod();
+    OpenSessionAsync( endpoint, [dispatcher, timeout] (shared_ptr<ProtoBufClientSession> session, exception_ptr error)
+    {
+        if (error)
+            { dispatcher->Failed(error); }
+        else { dispatcher->Opened( shared_ptr<IDelayedRequestDispatcher>(
+            new SessionRequestDispatcher(session, timeout) ) ); }
+    } );
+    return CreateAsyncProxy(dispatcher);
+}
+
+
+shared_ptr<IDelayedRequestDispatcher> TcpNodeConnectionFactory::CreateAsyncDispatcher(
+    shared_ptr<ProtoBufClientSession> session, function<SessionRequestDispatcher::OutcomeCallback> outcomeCallback )
+{
+    return shared_ptr<IDelayedRequestDispatcher>( new SessionRequestDispatcher(
+        session, _config->requestExpirationPeriod(), outcomeCallback ) );
+}
+
+
+shared_ptr<IAsyncNodeMethods> TcpNodeConnectionFactory::CreateAsyncProxy(shared_ptr<IDelayedRequestDispatcher> dispatcher)
+    { return shared_ptr<IAsyncNodeMethods>( new AsyncNodeMethodsProtoBufClient(dispatcher, _detectedIpCallback) ); }
+
+
+
+PeerFailureCache::PeerFailureCache(Duration initialBackoff, Duration maxBackoff, ClockFunc clock) :
+    _initialBackoff(initialBackoff), _maxBackoff(maxBackoff), _clock(clock),
+    _randomGenerator( random_device()() )
+{
+    if ( _initialBackoff <= Duration::zero() || _maxBackoff < _initialBackoff ) {
+        throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Invalid backoff period");
+    }
+    if (! _clock) {
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No clock instantiated");
+    }
+}
+
+
+string PeerFailureCache::KeyOf(const NetworkEndpoint &endpoint)
+    { return endpoint.address() + ":" + to_string( endpoint.port() ); }
+
+
+PeerFailureCache::Duration PeerFailureCache::Randomize(Duration backoff)
+{
+    // Add up to 50% jitter to avoid retrying many peers (or many nodes retrying a peer) in lockstep
+    uniform_int_distribution<Duration::rep> jitterRange( 0, backoff.count() / 2 );
+    return backoff + Duration( jitterRange(_randomGenerator) );
+}
+
+
+bool PeerFailureCache::TryAttempt(const NetworkEndpoint &endpoint)
+{
+    lock_guard<mutex> lock(_mutex);
+    auto recordIt = _failures.find( KeyOf(endpoint) );
+    if ( recordIt == _failures.end() )
+        { return true; }
     
-    requestIter->second.set_value( unique_ptr<iop::locnet::Response>(
-        responseMessage->release_response() ) );
-    _pendingRequests.erase(requestIter);
+    FailureRecord &record = recordIt->second;
+    TimePoint now = _clock();
+    if (now < record.retryAfter)
+        { return false; }
     
-    LOG(TRACE) << "Response was dispatched, " << _pendingRequests.size() << " pending requests remain";
+    // Let a single trial through, others are still refused until the trial fails or succeeds.
+    // If no result is ever recorded for the trial, another one is allowed after the same backoff.
+    record.retryAfter = now + Randomize(record.backoff);
+    return true;
 }
 
 
+void PeerFailureCache::RecordFailure(const NetworkEndpoint &endpoint)
+{
+    lock_guard<mutex> lock(_mutex);
+    FailureRecord &record = _failures[ KeyOf(endpoint) ];
+    ++record.failureCount;
+    record.backoff = record.failureCount == 1 ? _initialBackoff : min(2 * record.backoff, _maxBackoff);
+    record.retryAfter = _clock() + Randomize(record.backoff);
+    LOG_DEBUG(Network) << "Peer " << endpoint << " failed " << record.failureCount << " times in a row, backing off for "
+               << chrono::duration_cast<chrono::seconds>(record.backoff).count() << " seconds";
+}
 
 
-NetworkDispatcher::NetworkDispatcher(shared_ptr<Config> config, shared_ptr<ProtoBufClientSession> session) :
-    _config(config), _session(session) {}
+void PeerFailureCache::RecordSuccess(const NetworkEndpoint &endpoint)
+{
+    lock_guard<mutex> lock(_mutex);
+    if ( ! _failures.empty() )
+        { _failures.erase( KeyOf(endpoint) ); }
+}
 
 
+size_t PeerFailureCache::failureCount(const NetworkEndpoint &endpoint) const
+{
+    lock_guard<mutex> lock(_mutex);
+    auto recordIt = _failures.find( KeyOf(endpoint) );
+    return recordIt == _failures.end() ? 0 : recordIt->second.failureCount;
+}
 
-unique_ptr<iop::locnet::Message> RequestToMessage(unique_ptr<iop::locnet::Request> &&request)
+
+
+PeerLink::PeerLink( const NetworkEndpoint &endpoint, shared_ptr<ProtoBufClientSession> session,
+                    shared_ptr<INodeMethods> proxy, shared_ptr<PeerFailureCache> failureCache ) :
+    _endpoint(endpoint), _session(session), _proxy(proxy),
+    _lastUsed( chrono::steady_clock::now() ), _failed(false), _failureCache(failureCache)
 {
-    request->set_version({1,0,0});
-    unique_ptr<iop::locnet::Message> message( new iop::locnet::Message() );
-    message->set_allocated_request( request.release() );
-    return message;
+    if (_session == nullptr) {
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No session instantiated");
+    }
+    if (_proxy == nullptr) {
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No proxy instantiated");
+    }
 }
 
+const NetworkEndpoint& PeerLink::endpoint() const
+    { return _endpoint; }
 
+shared_ptr<ProtoBufClientSession> PeerLink::session() const
+    { return _session; }
 
-unique_ptr<iop::locnet::Response> NetworkDispatcher::Dispatch(unique_ptr<iop::locnet::Request> &&request)
+chrono::steady_clock::time_point PeerLink::lastUsed() const
 {
-    unique_ptr<iop::locnet::Message> requestMessage( RequestToMessage( move(request) ) );
-    future< unique_ptr<iop::locnet::Response> > futureResponse = _session->SendRequest( move(requestMessage) );
-    if ( futureResponse.wait_for( _config->requestExpirationPeriod() ) != future_status::ready )
+    lock_guard<mutex> lock(_stateMutex);
+    return _lastUsed;
+}
+
+bool PeerLink::IsHealthy() const
+{
+    lock_guard<mutex> lock(_stateMutex);
+    return ! _failed && _session->IsAlive();
+}
+
+void PeerLink::Touch()
+{
+    lock_guard<mutex> lock(_stateMutex);
+    _lastUsed = chrono::steady_clock::now();
+}
+
+
+void PeerLink::Call( function<void(INodeMethods&)> operation )
+{
+    // NOTE no need to serialize calls, they only wait for their own response
+    Touch();
+    try { operation(*_proxy); }
+    catch (...)
     {
-        LOG(WARNING) << "Session " << _session->id() << " received no response, timed out";
-        throw LocationNetworkError( ErrorCode::ERROR_BAD_RESPONSE, "Timeout waiting for response of dispatched request" );
+        CallFinished( current_exception() );
+        throw;
     }
-    unique_ptr<iop::locnet::Response> result( futureResponse.get() );
-    if ( result && result->status() != iop::locnet::Status::STATUS_OK )
+    CallFinished( exception_ptr() );
+}
+
+
+bool PeerLink::IsLinkFailure(exception_ptr error)
+{
+    if (! error)
+        { return false; }
+    try { rethrow_exception(error); }
+    catch (LocationNetworkError &ex)
+        { return ex.code() == ErrorCode::ERROR_CONNECTION || ex.code() == ErrorCode::ERROR_TIMEOUT; }
+    catch (...)
+        { return true; } // E.g. socket errors
+}
+
+
+void PeerLink::CallFinished(exception_ptr error)
+{
+    if ( IsLinkFailure(error) )
     {
-        LOG(WARNING) << "Session " << _session->id() << " received response code " << result->status()
-                     << ", error details: " << result->details();
-        throw LocationNetworkError( ErrorCode::ERROR_BAD_RESPONSE, result->details() );
+        LOG_DEBUG(Network) << "Call failed through link to " << _endpoint << ", dropping link";
+        if (_failureCache)
+            { _failureCache->RecordFailure(_endpoint); }
+        lock_guard<mutex> lock(_stateMutex);
+        _failed = true;
+        return;
+    }
+    if (_failureCache)
+        { _failureCache->RecordSuccess(_endpoint); }
+    Touch();
+}
+
+
+
+PeerLinkNodeProxy::PeerLinkNodeProxy(shared_ptr<PeerLink> link) : _link(link)
+{
+    if (_link == nullptr) {
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No peer link instantiated");
     }
+}
+
+NodeInfo PeerLinkNodeProxy::GetNodeInfo() const
+{
+    shared_ptr<NodeInfo> result;
+    _link->Call( [&result] (INodeMethods &node) { result.reset( new NodeInfo( node.GetNodeInfo() ) ); } );
+    return *result;
+}
+
+size_t PeerLinkNodeProxy::GetNodeCount() const
+{
+    size_t result = 0;
+    _link->Call( [&result] (INodeMethods &node) { result = node.GetNodeCount(); } );
     return result;
 }
 
+vector<NodeInfo> PeerLinkNodeProxy::GetRandomNodes(size_t maxNodeCount, Neighbours filter) const
+{
+    vector<NodeInfo> result;
+    _link->Call( [&result, maxNodeCount, filter] (INodeMethods &node)
+        { result = node.GetRandomNodes(maxNodeCount, filter); } );
+    return result;
+}
 
+vector<NodeInfo> PeerLinkNodeProxy::GetClosestNodesByDistance(const GpsLocation &location,
+    Distance radiusKm, size_t maxNodeCount, Neighbours filter) const
+{
+    vector<NodeInfo> result;
+    _link->Call( [&result, &location, radiusKm, maxNodeCount, filter] (INodeMethods &node)
+        { result = node.GetClosestNodesByDistance(location, radiusKm, maxNodeCount, filter); } );
+    return result;
+}
 
-TcpNodeConnectionFactory::TcpNodeConnectionFactory(shared_ptr<Config> config) :
-    _config(config) {}
+shared_ptr<NodeInfo> PeerLinkNodeProxy::AcceptColleague(const NodeInfo &requestorNode)
+{
+    shared_ptr<NodeInfo> result;
+    _link->Call( [&result, &requestorNode] (INodeMethods &node)
+        { result = node.AcceptColleague(requestorNode); } );
+    return result;
+}
 
-void TcpNodeConnectionFactory::detectedIpCallback(function<void(const Address&)> detectedIpCallback)
+shared_ptr<NodeInfo> PeerLinkNodeProxy::RenewColleague(const NodeInfo &requestorNode)
 {
-    _detectedIpCallback = detectedIpCallback;
-    LOG(DEBUG) << "Callback for detecting external IP address is set " << static_cast<bool>(_detectedIpCallback); 
+    shared_ptr<NodeInfo> result;
+    _link->Call( [&result, &requestorNode] (INodeMethods &node)
+        { result = node.RenewColleague(requestorNode); } );
+    return result;
 }
 
+shared_ptr<NodeInfo> PeerLinkNodeProxy::AcceptNeighbour(const NodeInfo &requestorNode)
+{
+    shared_ptr<NodeInfo> result;
+    _link->Call( [&result, &requestorNode] (INodeMethods &node)
+        { result = node.AcceptNeighbour(requestorNode); } );
+    return result;
+}
 
-shared_ptr<INodeMethods> TcpNodeConnectionFactory::ConnectTo(const NetworkEndpoint& endpoint)
+shared_ptr<NodeInfo> PeerLinkNodeProxy::RenewNeighbour(const NodeInfo &requestorNode)
 {
-    LOG(DEBUG) << "Connecting to " << endpoint;
-    shared_ptr<IProtoBufChannel> connection( new AsyncProtoBufTcpChannel(endpoint) );
-    shared_ptr<ProtoBufClientSession> session( ProtoBufClientSession::Create(connection) );
-    shared_ptr<IBlockingRequestDispatcher> dispatcher( new NetworkDispatcher(_config, session) );
-    shared_ptr<INodeMethods> result( new NodeMethodsProtoBufClient(dispatcher, _detectedIpCallback) );
-    session->StartMessageLoop();
+    shared_ptr<NodeInfo> result;
+    _link->Call( [&result, &requestorNode] (INodeMethods &node)
+        { result = node.RenewNeighbour(requestorNode); } );
     return result;
 }
 
 
 
+PeerLinkManager::PeerLinkManager( shared_ptr<TcpNodeConnectionFactory> connectionFactory,
+                                  shared_ptr<PeerFailureCache> failureCache,
+                                  size_t maxLinkCount, chrono::steady_clock::duration idleTimeout ) :
+    _connectionFactory(connectionFactory), _failureCache(failureCache),
+    _maxLinkCount(maxLinkCount), _idleTimeout(idleTimeout)
+{
+    if (_connectionFactory == nullptr) {
+        throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "No connection factory instantiated");
+    }
+    if (_maxLinkCount == 0) {
+        throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Peer link limit must be positive");
+    }
+}
+
+
+shared_ptr<PeerLink> PeerLinkManager::FindLink(const NetworkEndpoint &endpoint)
+{
+    lock_guard<mutex> lock(_mutex);
+    auto linkIt = _links.find( PeerFailureCache::KeyOf(endpoint) );
+    if ( linkIt == _links.end() )
+        { return shared_ptr<PeerLink>(); }
+    // NOTE idle links not evicted yet are not reused either, the remote node may be closing them already
+    bool idle = linkIt->second->lastUsed() <= chrono::steady_clock::now() - _idleTimeout;
+    if ( ! idle && linkIt->second->IsHealthy() )
+    {
+        LOG_TRACE(Network) << "Reusing open link to " << endpoint;
+        linkIt->second->Touch();
+        return linkIt->second;
+    }
+    LOG_DEBUG(Network) << "Link to " << endpoint << " is idle or broken, reconnecting";
+    _links.erase(linkIt);
+    return shared_ptr<PeerLink>();
+}
+
+
+void PeerLinkManager::CheckBackoff(const NetworkEndpoint &endpoint)
+{
+    if ( _failureCache && ! _failureCache->TryAttempt(endpoint) )
+    {
+        LOG_TRACE(Network) << "Peer " << endpoint << " failed recently, refusing to connect";
+        throw LocationNetworkError( ErrorCode::ERROR_CONNECTION, "Peer " +
+            PeerFailureCache::KeyOf(endpoint) + " failed recently, backing off" );
+    }
+}
+
+
+shared_ptr<PeerLink> PeerLinkManager::AddLink( const NetworkEndpoint &endpoint,
+    shared_ptr<ProtoBufClientSession> session )
+{
+    string linkKey = PeerFailureCache::KeyOf(endpoint);
+    shared_ptr<PeerLink> link( new PeerLink( endpoint, session,
+        _connectionFactory->CreateProxy(session), _failureCache ) );
+    
+    lock_guard<mutex> lock(_mutex);
+    auto linkIt = _links.find(linkKey);
+    if ( linkIt != _links.end() && linkIt->second->IsHealthy() )
+        { link = linkIt->second; } // Another thread was faster, use its link and drop ours
+    else
+    {
+        _links.erase(linkKey);
+        if ( _links.size() >= _maxLinkCount )
+            { EvictLeastRecentlyUsed(); }
+        _links[linkKey] = link;
+    }
+    return link;
+}
+
+
+shared_ptr<PeerLink> PeerLinkManager::OpenLink(const NetworkEndpoint &endpoint)
+{
+    shared_ptr<PeerLink> link = FindLink(endpoint);
+    if (link)
+        { return link; }
+    CheckBackoff(endpoint);
+    
+    // NOTE connecting is blocking, must not hold the lock meanwhile
+    shared_ptr<ProtoBufClientSession> session;
+    try { session = _connectionFactory->OpenSession(endpoint); }
+    catch (LocationNetworkError &ex)
+    {
+        // Refusing to block on a reactor thread says nothing about the peer
+        if ( _failureCache && ex.code() == ErrorCode::ERROR_CONNECTION )
+            { _failureCache->RecordFailure(endpoint); }
+        throw;
+    }
+    return AddLink(endpoint, session);
+}
+
+
+shared_ptr<IDelayedRequestDispatcher> PeerLinkManager::CreateLinkDispatcher(shared_ptr<PeerLink> link)
+{
+    weak_ptr<PeerLink> linkWeakRef(link);
+    return _connectionFactory->CreateAsyncDispatcher( link->session(), [linkWeakRef] (exception_ptr error)
+    {
+        shared_ptr<PeerLink> link = linkWeakRef.lock();
+        if (link)
+            { link->CallFinished(error); }
+    } );
+}
+
+
+shared_ptr<INodeMethods> PeerLinkManager::ConnectTo(const NetworkEndpoint &endpoint)
+    { return shared_ptr<INodeMethods>( new PeerLinkNodeProxy( OpenLink(endpoint) ) ); }
+
+
+shared_ptr<IAsyncNodeMethods> PeerLinkManager::ConnectToAsync(const NetworkEndpoint &endpoint)
+{
+    shared_ptr<PeerLink> link = FindLink(endpoint);
+    if (link)
+        { return _connectionFactory->CreateAsyncProxy( CreateLinkDispatcher(link) ); }
+    CheckBackoff(endpoint);
+    
+    // Connect in the background, requests of the proxy are queued meanwhile
+    shared_ptr<PendingSessionRequestDispatcher> dispatcher( new PendingSessionRequestDispatcher() );
+    weak_ptr<PeerLinkManager> managerWeakRef( shared_from_this() );
+    shared_ptr<PeerFailureCache> failureCache = _failureCache;
+    _connectionFactory->OpenSessionAsync( endpoint, [dispatcher, managerWeakRef, failureCache, endpoint]
+        (shared_ptr<ProtoBufClientSession> session, exception_ptr error)
+    {
+        if (error)
+        {
+            if (failureCache)
+                { failureCache->RecordFailure(endpoint); }
+            dispatcher->Failed(error);
+            return;
+        }
+        shared_ptr<PeerLinkManager> manager = managerWeakRef.lock();
+        if (! manager)
+        {
+            dispatcher->Failed( make_exception_ptr( LocationNetworkError(
+                ErrorCode::ERROR_BAD_STATE, "Peer link manager was destroyed while connecting" ) ) );
+            return;
+        }
+        dispatcher->Opened( manager->CreateLinkDispatcher( manager->AddLink(endpoint, session) ) );
+    } );
+    return _connectionFactory->CreateAsyncProxy(dispatcher);
+}
+
+
+void PeerLinkManager::EvictLeastRecentlyUsed()
+{
+    // NOTE proxies still in use keep the session of an evicted link open until they are released
+    auto oldestIt = min_element( _links.begin(), _links.end(),
+        [] (const pair<const string, shared_ptr<PeerLink>> &one, const pair<const string, shared_ptr<PeerLink>> &other)
+            { return one.second->lastUsed() < other.second->lastUsed(); } );
+    if ( oldestIt != _links.end() )
+    {
+        LOG_DEBUG(Network) << "Peer link limit " << _maxLinkCount << " reached, closing link to " << oldestIt->second->endpoint();
+        _links.erase(oldestIt);
+    }
+}
+
+
+size_t PeerLinkManager::EvictIdleLinks()
+{
+    auto idleSince = chrono::steady_clock::now() - _idleTimeout;
+    size_t evictedCount = 0;
+    
+    lock_guard<mutex> lock(_mutex);
+    for (auto linkIt = _links.begin(); linkIt != _links.end(); )
+    {
+        if ( linkIt->second->lastUsed() <= idleSince || ! linkIt->second->IsHealthy() )
+        {
+            LOG_DEBUG(Network) << "Closing idle or broken link to " << linkIt->second->endpoint();
+            linkIt = _links.erase(linkIt);
+            ++evictedCount;
+        }
+        else { ++linkIt; }
+    }
+    return evictedCount;
+}
+
+
+size_t PeerLinkManager::linkCount() const
+{
+    lock_guard<mutex> lock(_mutex);
+    return _links.size();
+}
+
+
+
 LocalServiceRequestDispatcherFactory::LocalServiceRequestDispatcherFactory(
     shared_ptr<ILocalServiceMethods> iLocal) : _iLocal(iLocal) {}
 
@@ -644,18 +2105,21 @@ NeighbourChangeProtoBufNotifier::NeighbourChangeProtoBufNotifier(
         // shared_ptr<IProtoBufRequestDispatcher> dispatcher ) :
     _sessionId(), _localService(localService), _session(session) //, _dispatcher(dispatcher)
 {
-    //session->KeepAlive();
 }
 
 
 NeighbourChangeProtoBufNotifier::~NeighbourChangeProtoBufNotifier()
 {
     Deregister();
-    LOG(DEBUG) << "ChangeListener for session " << _sessionId << " destroyed";
+    LOG_DEBUG(Network) << "ChangeListener for session " << _sessionId << " destroyed";
 }
 
 void NeighbourChangeProtoBufNotifier::OnRegistered()
-    { _sessionId = _session->id(); }
+{
+    _sessionId = _session->id();
+    // Notifications are sent until the client disconnects, even if it has nothing more to say
+    _session->KeepAlive();
+}
 
 
 void NeighbourChangeProtoBufNotifier::Deregister()
@@ -664,7 +2128,7 @@ void NeighbourChangeProtoBufNotifier::Deregister()
     // from deregistering another instance after failed (e.g. repeated) addlistener request for same session
     if ( ! _sessionId.empty() )
     {
-        LOG(DEBUG) << "ChangeListener deregistering for session " << _sessionId;
+        LOG_DEBUG(Network) << "ChangeListener deregistering for session " << _sessionId;
         _localService->RemoveListener(_sessionId);
         _sessionId.clear();
     }
@@ -734,7 +2198,7 @@ void NeighbourChangeProtoBufNotifier::RemovedNode(const NodeDbEntry& node)
             unique_ptr<iop::locnet::Request> req( new iop::locnet::Request() );
             iop::locnet::NeighbourhoodChange *change =
                 req->mutable_local_service()->mutable_neighbourhood_changed()->add_changes();
-            change->set_removed_node_id( node.id() );
+            change->set_removed_node_id( node.id().ToHex() );
         
             unique_ptr<iop::locnet::Message> msgToSend( RequestToMessage( move(req) ) );
             _session->SendRequest( move(msgToSend) );
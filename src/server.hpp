@@ -2,6 +2,12 @@
 #define __LOCNET_SERVER_H__
 
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <random>
+#include <thread>
+
 #include "network.hpp"
 #include "messaging.hpp"
 
@@ -24,12 +30,222 @@ public:
     
     virtual const SessionId& id() const = 0;
     virtual const Address& remoteAddress() const = 0;
+    // Address of the connected peer as seen by this node, unspecified while not connected
+    virtual const IpAddress& remoteIpAddress() const = 0;
     
     virtual void ReceiveMessage( std::function<ReceivedMessageCallback> callback ) = 0;
     virtual std::future< std::unique_ptr<iop::locnet::Message> > ReceiveMessage(asio::use_future_t<>) = 0;
     
     virtual void SendMessage( std::unique_ptr<iop::locnet::Message> &&message, std::function<SentMessageCallback> callback ) = 0;
     virtual std::future<void> SendMessage(std::unique_ptr<iop::locnet::Message> &&message, asio::use_future_t<>) = 0;
+    // Message is serialized before returning, it may be e.g. allocated on an arena of the caller.
+    // Spliced fields are appended to the response of the message, see SplicedResponseFields.
+    virtual void SendMessage( const iop::locnet::Message &message, const SplicedResponseFields &splicedFields,
+                              std::function<SentMessageCallback> callback ) = 0;
+    
+    // Backpressure of outgoing messages: the callback is run when not too many messages wait to be sent
+    virtual size_t sendQueueDepth() const = 0;
+    virtual void WhenSendQueueReady( std::function<void()> callback ) = 0;
+    
+    // Exempt the connection from idle expiry, e.g. to keep sending notifications
+    virtual void KeepAlive() = 0;
+};
+
+
+
+// Receiving side of a message channel with a persistent buffer. Reads take as many bytes as available
+// and all complete frames are extracted before reading again, thus messages pipelined by the peer
+// are parsed after a single wake-up. Everything is executed on the strand of the channel.
+// NOTE pending reads keep only this object alive, the channel may still close the socket when released.
+class AsyncMessageReader : public std::enable_shared_from_this<AsyncMessageReader>
+{
+    std::weak_ptr<asio::ip::tcp::socket>        _socket;
+    std::shared_ptr<asio::io_service::strand>   _strand;
+    SessionId                                   _channelId;
+    std::unique_ptr<std::string>                _buffer;
+    size_t                                      _dataBegin;
+    size_t                                      _dataEnd;
+    size_t                                      _pendingFrameEnd; // Size of the partially received frame
+    bool                                        _failed;
+    std::deque< std::unique_ptr<iop::locnet::Message> > _receivedMessages;
+    std::chrono::steady_clock::time_point       _lastActivity;
+    std::chrono::steady_clock::time_point       _partialFrameSince; // Epoch if no partial frame is buffered
+
+    AsyncMessageReader( std::weak_ptr<asio::ip::tcp::socket> socket,
+                        std::shared_ptr<asio::io_service::strand> strand,
+                        const SessionId &channelId );
+
+    bool ExtractFrames();
+    void ReserveReadSpace();
+    void NextMessage( std::function<IProtoBufChannel::ReceivedMessageCallback> callback );
+
+public:
+
+    static const size_t InitialBufferSize = 4096;
+
+    static std::shared_ptr<AsyncMessageReader> Create( std::weak_ptr<asio::ip::tcp::socket> socket,
+        std::shared_ptr<asio::io_service::strand> strand, const SessionId &channelId );
+    ~AsyncMessageReader();
+
+    // NOTE these must be called on the strand
+    std::chrono::steady_clock::time_point lastActivity() const;
+    std::chrono::steady_clock::time_point partialFrameSince() const;
+
+    // NOTE a single receive may be pending at a time, just like with plain socket reads
+    void ReceiveMessage( std::function<IProtoBufChannel::ReceivedMessageCallback> callback );
+};
+
+
+
+// Statistics collected about the send queues of all connections, mostly for logging and monitoring.
+struct SendQueueStats
+{
+    size_t queuedFrames      = 0;   // Messages currently waiting to be written on all connections
+    size_t maxQueueDepth     = 0;   // Most messages ever waiting on a single connection
+    size_t congestedCount    = 0;   // Times a queue reached its high-water mark
+    size_t writeCount        = 0;
+    size_t writtenFrameCount = 0;   // More than writeCount if writes were coalesced
+};
+
+
+// Sending side of a message channel. Asio does not allow concurrent writes on a socket, so frames
+// are queued and a single write is in flight at a time, all frames queued meanwhile are flushed
+// together with a single gather write. Everything is executed on the strand of the channel.
+class AsyncMessageWriter : public std::enable_shared_from_this<AsyncMessageWriter>
+{
+    struct QueuedFrame
+    {
+        std::unique_ptr<std::string>                            frame;
+        std::function<IProtoBufChannel::SentMessageCallback>    callback;
+    };
+    
+    static std::atomic<size_t> _totalQueuedFrames;
+    static std::atomic<size_t> _maxQueueDepth;
+    static std::atomic<size_t> _congestedCount;
+    static std::atomic<size_t> _writeCount;
+    static std::atomic<size_t> _writtenFrameCount;
+    
+    std::weak_ptr<asio::ip::tcp::socket>        _socket;
+    std::shared_ptr<asio::io_service::strand>   _strand;
+    SessionId                                   _channelId;
+    size_t                                      _highWaterMark;
+    
+    std::deque<QueuedFrame>                     _queuedFrames;
+    std::vector<QueuedFrame>                    _writtenFrames; // Frames of the write in flight
+    size_t                                      _queuedBytes;   // Including the write in flight
+    std::atomic<size_t>                         _queueDepth;
+    std::vector< std::function<void()> >        _readyCallbacks;
+    bool                                        _failed;
+    std::chrono::steady_clock::time_point       _lastActivity;
+    
+    AsyncMessageWriter( std::weak_ptr<asio::ip::tcp::socket> socket,
+                        std::shared_ptr<asio::io_service::strand> strand,
+                        const SessionId &channelId, size_t highWaterMark );
+    
+    bool IsCongested() const;
+    void StartWrite();
+    void WriteCompleted(const asio::error_code &error);
+    
+public:
+    
+    static const size_t DefaultHighWaterMark = 256 * 1024;
+    static const size_t MaxGatherFrameCount  = 64;
+    
+    static SendQueueStats stats();
+    
+    static std::shared_ptr<AsyncMessageWriter> Create( std::weak_ptr<asio::ip::tcp::socket> socket,
+        std::shared_ptr<asio::io_service::strand> strand, const SessionId &channelId,
+        size_t highWaterMark = DefaultHighWaterMark );
+    ~AsyncMessageWriter();
+    
+    size_t queueDepth() const;
+    std::chrono::steady_clock::time_point lastActivity() const; // NOTE must be called on the strand
+    
+    void SendFrame( std::unique_ptr<std::string> &&frame,
+                    std::function<IProtoBufChannel::SentMessageCallback> callback );
+    void WhenReady( std::function<void()> callback );
+};
+
+
+
+// Connection limits and expiration timeouts for connections accepted by a listener.
+// Zero values disable the given limit or timeout.
+struct ConnectionPolicy
+{
+    std::chrono::steady_clock::duration idleTimeout = std::chrono::steady_clock::duration::zero();
+    std::chrono::steady_clock::duration readTimeout = std::chrono::steady_clock::duration::zero(); // To receive a whole message once started
+    size_t maxConnections           = 0;
+    size_t maxConnectionsPerAddress = 0;
+};
+
+
+// Statistics collected about connections of a listener, mostly for logging and monitoring.
+struct ConnectionStats
+{
+    size_t openCount               = 0;
+    size_t rejectedCount           = 0;    // Refused at accept time over the limits
+    size_t idleEvictedCount        = 0;
+    size_t readTimeoutEvictedCount = 0;
+};
+
+
+// Enforces the connection policy of a listener. Open connections are counted in total and
+// per remote address to refuse new ones over the limits, accepted ones are expired by their channels.
+class ConnectionManager
+{
+    ConnectionPolicy                            _policy;
+    mutable std::mutex                          _mutex;
+    std::unordered_map<Address, size_t>         _addressConnectionCounts;
+    ConnectionStats                             _stats;
+    
+public:
+    
+    ConnectionManager(const ConnectionPolicy &policy);
+    
+    const ConnectionPolicy& policy() const;
+    ConnectionStats stats() const;
+    
+    // Returns false and counts a rejection if the connection is over the limits
+    bool TryOpen(const Address &remoteAddress);
+    void Closed(const Address &remoteAddress);
+    void Evicted(bool idle);
+};
+
+
+// Closes the socket of a channel when it was idle for too long or a message was not received
+// in time once started. Deadlines are checked on the strand of the channel without rescheduling
+// the timer for every message: when it fires early, it is simply set again for the remaining time.
+class ConnectionExpiryTimer : public std::enable_shared_from_this<ConnectionExpiryTimer>
+{
+    std::weak_ptr<asio::ip::tcp::socket>        _socket;
+    std::shared_ptr<asio::io_service::strand>   _strand;
+    std::weak_ptr<AsyncMessageReader>           _reader;
+    std::weak_ptr<AsyncMessageWriter>           _writer;
+    std::shared_ptr<ConnectionManager>          _manager;
+    SessionId                                   _channelId;
+    asio::steady_timer                          _timer;
+    std::atomic<bool>                           _keepAlive;
+    
+    ConnectionExpiryTimer( std::weak_ptr<asio::ip::tcp::socket> socket,
+                           std::shared_ptr<asio::io_service::strand> strand,
+                           std::weak_ptr<AsyncMessageReader> reader,
+                           std::weak_ptr<AsyncMessageWriter> writer,
+                           std::shared_ptr<ConnectionManager> manager,
+                           const SessionId &channelId );
+    
+    void Schedule(std::chrono::steady_clock::duration delay);
+    void CheckDeadlines();
+    
+public:
+    
+    static std::shared_ptr<ConnectionExpiryTimer> Create( std::weak_ptr<asio::ip::tcp::socket> socket,
+        std::shared_ptr<asio::io_service::strand> strand, std::weak_ptr<AsyncMessageReader> reader,
+        std::weak_ptr<AsyncMessageWriter> writer, std::shared_ptr<ConnectionManager> manager,
+        const SessionId &channelId );
+    
+    void Start();
+    void Cancel();
+    void KeepAlive();
 };
 
 
@@ -37,45 +253,87 @@ public:
 // ProtoBuf message channel that sends messages through an async TCP network connection.
 class AsyncProtoBufTcpChannel : public IProtoBufChannel
 {
-    std::shared_ptr<asio::ip::tcp::socket>  _socket;
-    SessionId                               _id;
-    Address                                 _remoteAddress;
-    uint32_t                                _nextRequestId;
+    std::shared_ptr<asio::ip::tcp::socket>      _socket;
+    std::shared_ptr<asio::io_service::strand>   _strand; // Serializes I/O on the socket with multiple reactor threads
+    std::shared_ptr<AsyncMessageReader>         _reader;
+    std::shared_ptr<AsyncMessageWriter>         _writer;
+    std::shared_ptr<ConnectionManager>          _manager;
+    std::shared_ptr<ConnectionExpiryTimer>      _expiryTimer;
+    SessionId                                   _id;
+    Address                                     _remoteAddress;
+    IpAddress                                   _remoteIpAddress;
+    std::atomic<uint32_t>                       _nextRequestId;
     
     //std::mutex                              _socketWriteMutex;
     //std::mutex                              _socketReadMutex;
 
 public:
 
+    typedef void ConnectedCallback( std::shared_ptr<AsyncProtoBufTcpChannel> channel, const asio::error_code &error );
+    
     // Server connection to client with accepted socket
     AsyncProtoBufTcpChannel(std::shared_ptr<asio::ip::tcp::socket> socket);
-    // Client connection to server, endpoint resolution to be done
+    // Client connection to server, endpoint resolution to be done.
+    // NOTE this blocks the calling thread until connected, use Connect() instead on reactor threads.
     AsyncProtoBufTcpChannel(const NetworkEndpoint &endpoint);
     ~AsyncProtoBufTcpChannel();
+    
+    // Client connection to server, resolving and connecting asynchronously within the given timeout
+    static void Connect( const NetworkEndpoint &endpoint, std::chrono::steady_clock::duration timeout,
+                         std::function<ConnectedCallback> callback );
+    static std::future< std::shared_ptr<AsyncProtoBufTcpChannel> > Connect( const NetworkEndpoint &endpoint,
+        std::chrono::steady_clock::duration timeout, asio::use_future_t<> );
 
     const SessionId& id() const override;
     const Address& remoteAddress() const override;
+    const IpAddress& remoteIpAddress() const override;
     
     void ReceiveMessage( std::function<ReceivedMessageCallback> callback ) override;
     std::future< std::unique_ptr<iop::locnet::Message> > ReceiveMessage(asio::use_future_t<>) override;
     void SendMessage( std::unique_ptr<iop::locnet::Message> &&message, std::function<SentMessageCallback> callback ) override;
     std::future<void> SendMessage(std::unique_ptr<iop::locnet::Message> &&message, asio::use_future_t<>) override;
+    void SendMessage( const iop::locnet::Message &message, const SplicedResponseFields &splicedFields,
+                      std::function<SentMessageCallback> callback ) override;
+    
+    size_t sendQueueDepth() const override;
+    void WhenSendQueueReady( std::function<void()> callback ) override;
+    
+    // Accepted connection counted by the manager and expired according to its policy
+    void Manage(std::shared_ptr<ConnectionManager> manager);
+    void KeepAlive() override;
 };
 
 
 
+// Request/response session over a message channel. Responses are matched to pending requests
+// by message id, each outgoing request has a deadline enforced by a timer on the reactor,
+// so no thread has to wait for a remote node that might never answer.
 class ProtoBufClientSession : public std::enable_shared_from_this<ProtoBufClientSession>
 {
 public:
     
+    typedef std::chrono::steady_clock::duration Duration;
+    typedef uint32_t RequestId;
     typedef void IncomingRequestHandler( std::unique_ptr<iop::locnet::Message> &&incomingRequest );
+    // Called exactly once, either with the response or with an error if the request failed,
+    // expired or was cancelled
+    typedef void ResponseHandler( std::unique_ptr<iop::locnet::Response> &&response, std::exception_ptr error );
+    
+    static const Duration DefaultRequestTimeout;
     
 private:
     
+    struct PendingRequest
+    {
+        std::function<ResponseHandler>      handler;
+        std::shared_ptr<asio::steady_timer> deadline;
+    };
+    
     std::shared_ptr<IProtoBufChannel> _messageChannel;
+    std::atomic<bool>                 _messageLoopFailed;
     
-    uint32_t _nextMessageId;
-    std::unordered_map< uint32_t, std::promise< std::unique_ptr<iop::locnet::Response> > > _pendingRequests;
+    RequestId _nextMessageId;
+    std::unordered_map<RequestId, PendingRequest> _pendingRequests;
     std::mutex _pendingRequestsMutex;
 
     static void AsyncMessageLoopHandler( std::weak_ptr<ProtoBufClientSession> sessionWeakRef,
@@ -84,6 +342,11 @@ private:
     
     ProtoBufClientSession(std::shared_ptr<IProtoBufChannel> connection);
     
+    // Remove the request from the pending ones and notify its sender, returns false if not pending
+    bool CompleteRequest( RequestId requestId, std::unique_ptr<iop::locnet::Response> &&response,
+                          std::exception_ptr error );
+    void FailPendingRequests(const std::string &reason);
+    
 public:
     
     static std::shared_ptr<ProtoBufClientSession> Create(std::shared_ptr<IProtoBufChannel> connection);
@@ -92,10 +355,22 @@ public:
     
     virtual const SessionId& id() const;
     virtual std::shared_ptr<IProtoBufChannel> messageChannel();
+    virtual bool IsAlive() const;
+    virtual void KeepAlive();
+    virtual size_t pendingRequestCount();
     
     virtual void StartMessageLoop( std::function<IncomingRequestHandler> requestHandler = std::function<IncomingRequestHandler>() );
+    
+    // Zero timeout means no deadline, the request is pending until answered or cancelled.
+    // Requests that timed out fail with ERROR_TIMEOUT. If sending throws, the request
+    // is forgotten and the handler is not called.
+    virtual RequestId SendRequest( std::unique_ptr<iop::locnet::Message> &&requestMessage,
+        Duration timeout, std::function<ResponseHandler> responseHandler );
     virtual std::future< std::unique_ptr<iop::locnet::Response> > SendRequest(
-        std::unique_ptr<iop::locnet::Message> &&requestMessage);
+        std::unique_ptr<iop::locnet::Message> &&requestMessage, Duration timeout = DefaultRequestTimeout );
+    // Returns false if the request is not pending anymore, otherwise its handler gets an error
+    virtual bool CancelRequest(RequestId requestId);
+    
     virtual void ResponseArrived( std::unique_ptr<iop::locnet::Message> &&responseMessage);
 };
 
@@ -115,17 +390,104 @@ public:
 
 
 
+// Statistics collected about the queue of a dispatch worker pool, mostly for logging and monitoring.
+struct DispatchQueueStats
+{
+    size_t queueDepth    = 0;   // Requests currently waiting for a worker
+    size_t maxQueueDepth = 0;
+    size_t executedCount = 0;
+    size_t rejectedCount = 0;   // Requests refused because the queue was full
+    
+    std::chrono::steady_clock::duration maxWaitTime   = std::chrono::steady_clock::duration::zero();
+    std::chrono::steady_clock::duration totalWaitTime = std::chrono::steady_clock::duration::zero();
+};
+
+
+// Bounded pool of worker threads to run blocking request handlers (database writes, calls to
+// remote nodes) taken off the reactor threads, so they never stall network I/O.
+class DispatchWorkerPool
+{
+public:
+    
+    typedef std::function<void()> Task;
+    
+private:
+    
+    struct QueuedTask
+    {
+        Task                                    task;
+        std::chrono::steady_clock::time_point   enqueuedAt;
+    };
+    
+    std::string                 _name;
+    size_t                      _maxQueueDepth;
+    
+    mutable std::mutex          _mutex;
+    std::condition_variable     _taskAvailable;
+    std::deque<QueuedTask>      _queue;
+    bool                        _shutdown = false;
+    DispatchQueueStats          _stats;
+    std::vector<std::thread>    _workers;
+    
+    void WorkerLoop();
+    
+public:
+    
+    DispatchWorkerPool(const std::string &name, size_t threadCount, size_t maxQueueDepth);
+    ~DispatchWorkerPool();
+    
+    const std::string& name() const;
+    DispatchQueueStats stats() const;
+    
+    // Returns false without queueing the task if the queue is full or the pool is shut down
+    bool TryPost(Task task);
+    // Refuse new tasks, workers exit after executing the ones already queued
+    void Shutdown();
+};
+
+
+
+// Limits the number of requests read ahead and served concurrently on a single connection.
+// Reading is paused while the limit is reached and resumed when a request was served.
+class RequestPipeline
+{
+    mutable std::mutex  _mutex;
+    size_t              _maxInFlightCount;
+    size_t              _inFlightCount = 0;
+    bool                _readPaused    = false;
+    bool                _failed        = false;
+    
+public:
+    
+    RequestPipeline(size_t maxInFlightCount);
+    
+    size_t inFlightCount() const;
+    bool IsFailed() const;
+    
+    // Returns true if the next request may be read right away
+    bool RequestStarted();
+    // Returns true if reading was paused and has to be resumed by the caller
+    bool RequestFinished(bool successful);
+};
+
+
+
 // Tcp server implementation that serves protobuf requests for accepted clients.
 class DispatchingTcpServer : public TcpServer
 {
 protected:
     
     std::shared_ptr<IBlockingRequestDispatcherFactory> _dispatcherFactory;
+    std::shared_ptr<DispatchWorkerPool>                _workerPool;
+    size_t                                             _pipelinedRequestCount = 1;
+    std::shared_ptr<ConnectionManager>                 _connectionManager;
     
     DispatchingTcpServer( TcpPort portNumber,
         std::shared_ptr<IBlockingRequestDispatcherFactory> dispatcherFactory );
     DispatchingTcpServer( const std::string &interfaceName, TcpPort portNumber,
         std::shared_ptr<IBlockingRequestDispatcherFactory> dispatcherFactory );
+    DispatchingTcpServer( asio::io_service &ioService, TcpPort portNumber,
+        std::shared_ptr<IBlockingRequestDispatcherFactory> dispatcherFactory );
 
 public:
     
@@ -133,10 +495,30 @@ public:
         std::shared_ptr<IBlockingRequestDispatcherFactory> dispatcherFactory );
     static std::shared_ptr<DispatchingTcpServer> Create( const std::string &interfaceName, TcpPort portNumber,
         std::shared_ptr<IBlockingRequestDispatcherFactory> dispatcherFactory );
+    // Server for a single core in thread-per-core mode, accepted connections are served by the given service
+    static std::shared_ptr<DispatchingTcpServer> Create( asio::io_service &ioService, TcpPort portNumber,
+        std::shared_ptr<IBlockingRequestDispatcherFactory> dispatcherFactory );
     
+    // Serves a single message, returns if the message loop of the session should be continued
+    static bool ServeMessage( std::unique_ptr<iop::locnet::Message> &&receivedMessage,
+                              std::shared_ptr<ProtoBufClientSession> session,
+                              std::shared_ptr<IBlockingRequestDispatcher> dispatcher );
     static void AsyncServeMessageHandler( std::unique_ptr<iop::locnet::Message> &&receivedMessage,
                                           std::shared_ptr<ProtoBufClientSession> session,
-                                          std::shared_ptr<IBlockingRequestDispatcher> dispatcher );
+                                          std::shared_ptr<IBlockingRequestDispatcher> dispatcher,
+                                          std::weak_ptr<DispatchWorkerPool> workerPool,
+                                          std::shared_ptr<RequestPipeline> pipeline );
+    
+    // Requests are dispatched on the reactor thread unless a worker pool is set
+    void workerPool(std::shared_ptr<DispatchWorkerPool> workerPool);
+    // With a worker pool, this many requests of a connection may be served concurrently
+    void pipelinedRequestCount(size_t requestCount);
+    // Connections are neither limited nor expired unless a policy is set
+    void connectionPolicy(const ConnectionPolicy &policy);
+    // Listeners sharing a manager enforce common limits, e.g. acceptors of the same port on several cores
+    void connectionManager(std::shared_ptr<ConnectionManager> manager);
+    std::shared_ptr<ConnectionManager> connectionManager() const;
+    ConnectionStats connectionStats() const;
     void StartListening() override;
     void AsyncAcceptHandler( std::shared_ptr<asio::ip::tcp::socket> socket,
                              const asio::error_code &ec ) override;
@@ -201,24 +583,242 @@ public:
     NetworkDispatcher(std::shared_ptr<Config> config, std::shared_ptr<ProtoBufClientSession> session);
     virtual ~NetworkDispatcher() {}
     
-    std::chrono::duration<uint32_t> RequestExpirationPeriod();
     std::unique_ptr<iop::locnet::Response> Dispatch(std::unique_ptr<iop::locnet::Request> &&request) override;
 };
 
 
 
+// A protobuf request dispatcher that sends requests through a network session without blocking,
+// the session completes each request with its response or an error after the deadline.
+class SessionRequestDispatcher : public IDelayedRequestDispatcher
+{
+public:
+    
+    // Error is empty if the request succeeded
+    typedef void OutcomeCallback(std::exception_ptr error);
+    
+private:
+    
+    std::shared_ptr<ProtoBufClientSession>  _session;
+    ProtoBufClientSession::Duration         _timeout;
+    std::function<OutcomeCallback>          _outcomeCallback;
+    
+public:
+    
+    SessionRequestDispatcher( std::shared_ptr<ProtoBufClientSession> session,
+        ProtoBufClientSession::Duration timeout,
+        std::function<OutcomeCallback> outcomeCallback = std::function<OutcomeCallback>() );
+    
+    void Dispatch( std::unique_ptr<iop::locnet::Request> &&request,
+                   std::function<ResponseHandler> responseHandler ) override;
+};
+
+
+
+// A request dispatcher for a session that is still being opened. Requests are queued without
+// blocking until the session is ready, then sent through it, or failed with the connection error.
+class PendingSessionRequestDispatcher : public IDelayedRequestDispatcher
+{
+    struct QueuedRequest
+    {
+        std::unique_ptr<iop::locnet::Request>   request;
+        std::function<ResponseHandler>          responseHandler;
+    };
+    
+    std::mutex                                  _mutex;
+    std::shared_ptr<IDelayedRequestDispatcher>  _dispatcher;
+    std::exception_ptr                          _error;
+    std::vector<QueuedRequest>                  _queuedRequests;
+    
+public:
+    
+    // Send queued and later requests through the dispatcher of the opened session
+    void Opened(std::shared_ptr<IDelayedRequestDispatcher> dispatcher);
+    // Fail queued and later requests with the error of opening the session
+    void Failed(std::exception_ptr error);
+    
+    void Dispatch( std::unique_ptr<iop::locnet::Request> &&request,
+                   std::function<ResponseHandler> responseHandler ) override;
+};
+
+
+
 // Connection factory that creates proxies that transparently communicate with a remote node.
 class TcpNodeConnectionFactory : public INodeProxyFactory
 {
     std::shared_ptr<Config>             _config;
-    std::function<void(const Address&)> _detectedIpCallback;
+    std::function<void(const IpAddress&)> _detectedIpCallback;
     
 public:
     
+    typedef void SessionOpenedCallback( std::shared_ptr<ProtoBufClientSession> session, std::exception_ptr error );
+    
     TcpNodeConnectionFactory(std::shared_ptr<Config> config);
+    // Blocks until connected, throws without waiting if called on a reactor thread
     std::shared_ptr<INodeMethods> ConnectTo(const NetworkEndpoint &address) override;
+    // Never blocks, requests of the proxy are queued until connected
+    std::shared_ptr<IAsyncNodeMethods> ConnectToAsync(const NetworkEndpoint &address) override;
+    
+    // Never blocks, the callback is called exactly once on a reactor thread
+    void OpenSessionAsync( const NetworkEndpoint &endpoint, std::function<SessionOpenedCallback> callback );
+    std::shared_ptr<ProtoBufClientSession> OpenSession(const NetworkEndpoint &endpoint);
+    std::shared_ptr<INodeMethods> CreateProxy(std::shared_ptr<ProtoBufClientSession> session);
+    std::shared_ptr<IDelayedRequestDispatcher> CreateAsyncDispatcher( std::shared_ptr<ProtoBufClientSession> session,
+        std::function<SessionRequestDispatcher::OutcomeCallback> outcomeCallback =
+            std::function<SessionRequestDispatcher::OutcomeCallback>() );
+    std::shared_ptr<IAsyncNodeMethods> CreateAsyncProxy(std::shared_ptr<IDelayedRequestDispatcher> dispatcher);
+    
+    void detectedIpCallback(std::function<void(const IpAddress&)> detectedIpCallback);
+};
+
+
+
+// Remembers recent connection or response failures of remote nodes to fail fast instead of
+// repeatedly waiting for unreachable peers. Works like a circuit breaker: after a failure the peer
+// is blocked for an exponentially growing, randomized backoff period, then a single trial attempt
+// is let through. Success clears the failure record, failing again doubles the backoff.
+class PeerFailureCache
+{
+public:
+    
+    typedef std::chrono::steady_clock::duration    Duration;
+    typedef std::chrono::steady_clock::time_point  TimePoint;
+    typedef std::function<TimePoint()>             ClockFunc;
+    
+private:
+    
+    struct FailureRecord
+    {
+        size_t      failureCount = 0;
+        Duration    backoff      = Duration::zero();
+        TimePoint   retryAfter;
+    };
+    
+    Duration        _initialBackoff;
+    Duration        _maxBackoff;
+    ClockFunc       _clock;
+    
+    mutable std::mutex                              _mutex;
+    std::mt19937                                    _randomGenerator;
+    std::unordered_map<std::string, FailureRecord>  _failures;
+    
+    Duration Randomize(Duration backoff);
+    
+public:
+    
+    PeerFailureCache( Duration initialBackoff, Duration maxBackoff,
+        ClockFunc clock = [] { return std::chrono::steady_clock::now(); } );
+    
+    static std::string KeyOf(const NetworkEndpoint &endpoint);
+    
+    bool TryAttempt(const NetworkEndpoint &endpoint);
+    void RecordFailure(const NetworkEndpoint &endpoint);
+    void RecordSuccess(const NetworkEndpoint &endpoint);
+    
+    size_t failureCount(const NetworkEndpoint &endpoint) const;
+};
+
+
+
+// An open session to a remote node that can be shared by several proxies.
+// Calls through the link run concurrently, the session matches responses to requests by message id.
+class PeerLink
+{
+    NetworkEndpoint                         _endpoint;
+    std::shared_ptr<ProtoBufClientSession>  _session;
+    std::shared_ptr<INodeMethods>           _proxy;
+    
+    mutable std::mutex                      _stateMutex;
+    std::chrono::steady_clock::time_point   _lastUsed;
+    bool                                    _failed;
+    std::shared_ptr<PeerFailureCache>       _failureCache;
+    
+public:
+    
+    PeerLink( const NetworkEndpoint &endpoint, std::shared_ptr<ProtoBufClientSession> session,
+              std::shared_ptr<INodeMethods> proxy, std::shared_ptr<PeerFailureCache> failureCache );
+    
+    const NetworkEndpoint& endpoint() const;
+    std::shared_ptr<ProtoBufClientSession> session() const;
+    std::chrono::steady_clock::time_point lastUsed() const;
+    bool IsHealthy() const;
+    
+    // Only connection failures and expired deadlines break the link. Errors decoded from a valid
+    // response, e.g. an error status or unexpected content, are passed on but leave the link healthy.
+    static bool IsLinkFailure(std::exception_ptr error);
+    
+    void Touch();
+    void Call( std::function<void(INodeMethods&)> operation );
+    // Bookkeeping of a call completed through the session directly, e.g. asynchronously
+    void CallFinished(std::exception_ptr error);
+};
+
+
+
+// Proxy that forwards calls to a shared peer link. Calls failing on the connection mark
+// the link unhealthy, so it will not be handed out again.
+class PeerLinkNodeProxy : public INodeMethods
+{
+    std::shared_ptr<PeerLink> _link;
+    
+public:
+    
+    PeerLinkNodeProxy(std::shared_ptr<PeerLink> link);
+    
+    NodeInfo GetNodeInfo() const override;
+    size_t GetNodeCount() const override;
+    std::vector<NodeInfo> GetRandomNodes(
+        size_t maxNodeCount, Neighbours filter) const override;
+    
+    std::vector<NodeInfo> GetClosestNodesByDistance(const GpsLocation &location,
+        Distance radiusKm, size_t maxNodeCount, Neighbours filter) const override;
+    
+    std::shared_ptr<NodeInfo> AcceptColleague(const NodeInfo &node) override;
+    std::shared_ptr<NodeInfo> RenewColleague (const NodeInfo &node) override;
+    std::shared_ptr<NodeInfo> AcceptNeighbour(const NodeInfo &node) override;
+    std::shared_ptr<NodeInfo> RenewNeighbour (const NodeInfo &node) override;
+};
+
+
+
+// Node proxy factory that keeps sessions to remote nodes open and reuses them for later proxies
+// instead of connecting again for each proxy. Links are keyed by endpoint, broken links are
+// reconnected on demand, idle links are evicted and the number of open links is limited.
+// Peers that failed recently are refused immediately until their backoff period elapses.
+// Asynchronous connections keep only a weak reference, so the manager must be owned by a shared_ptr.
+// NOTE there is no keep-alive ping, the protocol has no request for it. Links idle for the idle timeout
+//      are not reused anymore, thus it must be shorter than the idle timeout of the remote side.
+//      Links broken by the remote side are detected by their failed message loop and reconnected.
+class PeerLinkManager : public INodeProxyFactory, public std::enable_shared_from_this<PeerLinkManager>
+{
+    std::shared_ptr<TcpNodeConnectionFactory>   _connectionFactory;
+    std::shared_ptr<PeerFailureCache>           _failureCache;
+    size_t                                      _maxLinkCount;
+    std::chrono::steady_clock::duration         _idleTimeout;
+    
+    mutable std::mutex                                          _mutex;
+    std::unordered_map<std::string, std::shared_ptr<PeerLink>>  _links;
+    
+    void EvictLeastRecentlyUsed();
+    std::shared_ptr<PeerLink> FindLink(const NetworkEndpoint &endpoint);
+    void CheckBackoff(const NetworkEndpoint &endpoint);
+    std::shared_ptr<PeerLink> AddLink(const NetworkEndpoint &endpoint, std::shared_ptr<ProtoBufClientSession> session);
+    std::shared_ptr<PeerLink> OpenLink(const NetworkEndpoint &endpoint);
+    std::shared_ptr<IDelayedRequestDispatcher> CreateLinkDispatcher(std::shared_ptr<PeerLink> link);
+    
+public:
+    
+    PeerLinkManager( std::shared_ptr<TcpNodeConnectionFactory> connectionFactory,
+                     std::shared_ptr<PeerFailureCache> failureCache,
+                     size_t maxLinkCount, std::chrono::steady_clock::duration idleTimeout );
+    
+    std::shared_ptr<INodeMethods> ConnectTo(const NetworkEndpoint &endpoint) override;
+    // Asynchronous calls are not serialized, they are sent through the shared session concurrently.
+    // Never blocks: without an open link, requests are queued while a new link is connected.
+    std::shared_ptr<IAsyncNodeMethods> ConnectToAsync(const NetworkEndpoint &endpoint) override;
     
-    void detectedIpCallback(std::function<void(const Address&)> detectedIpCallback);
+    size_t EvictIdleLinks();
+    size_t linkCount() const;
 };
 
 
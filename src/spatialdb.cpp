@@ -29,11 +29,11 @@ const vector<string> DatabaseInitCommands = {
     ");"
     
     "INSERT OR IGNORE INTO metainfo (key, value) "
-    "  VALUES ('version', '1');"
+    "  VALUES ('version', '2');"
     
     "CREATE TABLE IF NOT EXISTS nodes ( "
-    "  id           TEXT PRIMARY KEY, "
-    "  ipAddress    TEXT NOT NULL, "
+    "  id           BLOB PRIMARY KEY, "
+    "  ipAddress    BLOB NOT NULL, " // Binary address in network order
     "  nodePort     INT NOT NULL, "
     "  clientPort   INT NOT NULL, "
     "  relationType INT NOT NULL, "
@@ -43,7 +43,7 @@ const vector<string> DatabaseInitCommands = {
     ");"
     
     "CREATE TABLE IF NOT EXISTS services ( "
-    "  nodeId       TEXT NOT NULL, "
+    "  nodeId       BLOB NOT NULL, "
     "  serviceType  TEXT NOT NULL, "
     "  port         INT NOT NULL, "
     "  data         BLOB, "
@@ -60,12 +60,9 @@ NodeDbEntry NodeDbEntry::FromSelfInfo(const NodeInfo &thisNodeInfo)
     { return NodeDbEntry(thisNodeInfo, NodeRelationType::Self, NodeContactRoleType::Self); }
 
 
-NodeDbEntry::NodeDbEntry(const NodeDbEntry& other) :
-    NodeInfo(other), _relationType(other._relationType), _roleType(other._roleType) {}
-
-NodeDbEntry::NodeDbEntry( const NodeInfo& info,
+NodeDbEntry::NodeDbEntry( NodeInfo info,
                           NodeRelationType relationType, NodeContactRoleType roleType) :
-    NodeInfo(info), _relationType(relationType), _roleType(roleType) {}
+    NodeInfo( move(info) ), _relationType(relationType), _roleType(roleType) {}
 
 
 NodeRelationType NodeDbEntry::relationType() const { return _relationType; }
@@ -83,6 +80,13 @@ bool NodeDbEntry::operator!=(const NodeDbEntry &other) const
     { return ! operator==(other); }
 
 
+NodeInfo WithNewEncoding(NodeInfo node)
+{
+    node.encoding( shared_ptr<NodeInfoEncoding>( new NodeInfoEncoding() ) );
+    return node;
+}
+
+
 
 void ThreadSafeChangeListenerRegistry::AddListener(shared_ptr<IChangeListener> listener)
 {
@@ -92,13 +96,13 @@ void ThreadSafeChangeListenerRegistry::AddListener(shared_ptr<IChangeListener> l
     
     if ( _listeners.find( listener->sessionId() ) != _listeners.end() )
     {
-        LOG(DEBUG) << "Session already have a registered listener, ignore request to add new one";
+        LOG_DEBUG(Database) << "Session already have a registered listener, ignore request to add new one";
         return;
     }
     
     _listeners[ listener->sessionId() ] = listener;
     listener->OnRegistered();
-    LOG(DEBUG) << "Registered ChangeListener for session " << listener->sessionId();
+    LOG_DEBUG(Database) << "Registered ChangeListener for session " << listener->sessionId();
 }
 
 
@@ -106,7 +110,7 @@ void ThreadSafeChangeListenerRegistry::RemoveListener(const SessionId& sessionId
 {
     lock_guard<mutex> lock(_mutex);
     _listeners.erase(sessionId);
-    LOG(DEBUG) << "Deregistered ChangeListener for session " << sessionId;
+    LOG_DEBUG(Database) << "Deregistered ChangeListener for session " << sessionId;
 }
 
 
@@ -116,12 +120,67 @@ vector<shared_ptr<IChangeListener>> ThreadSafeChangeListenerRegistry::listeners(
     vector<shared_ptr<IChangeListener>> result;
     for (const auto &listenerEntry : _listeners)
         { result.push_back(listenerEntry.second); }
-    //LOG(DEBUG) << "Listener count " << result.size();
+    //LOG_DEBUG(Database) << "Listener count " << result.size();
     return result;
 }
 
 
 
+EncodedNodeCache::EncodedNodeCache() :
+    _changeCount(0), _changesInProgress(0) {}
+
+
+uint64_t EncodedNodeCache::changeCount() const
+{
+    lock_guard<mutex> lock(_mutex);
+    return _changeCount;
+}
+
+
+void EncodedNodeCache::AttachUnlocked(NodeInfo &node)
+{
+    shared_ptr<NodeInfoEncoding> &encoding = _encodings[ node.id() ];
+    if (! encoding)
+        { encoding.reset( new NodeInfoEncoding() ); }
+    node.encoding(encoding);
+}
+
+
+void EncodedNodeCache::Attach(NodeInfo &node, uint64_t queriedAtChange)
+{
+    lock_guard<mutex> lock(_mutex);
+    if ( _changesInProgress == 0 && _changeCount == queriedAtChange )
+        { AttachUnlocked(node); }
+}
+
+
+void EncodedNodeCache::Attach(vector<NodeDbEntry> &nodes, uint64_t queriedAtChange)
+{
+    lock_guard<mutex> lock(_mutex);
+    if ( _changesInProgress != 0 || _changeCount != queriedAtChange )
+        { return; }
+    for (auto &node : nodes)
+        { AttachUnlocked(node); }
+}
+
+
+void EncodedNodeCache::ChangeStarted()
+{
+    lock_guard<mutex> lock(_mutex);
+    ++_changesInProgress;
+}
+
+
+void EncodedNodeCache::ChangeFinished(const NodeId &nodeId)
+{
+    lock_guard<mutex> lock(_mutex);
+    --_changesInProgress;
+    ++_changeCount;
+    _encodings.erase(nodeId);
+}
+
+
+
 
 // NOTE SQLite works fine without this as sqlite3_open also calls init()
 // struct StaticDatabaseInitializer {
@@ -186,6 +245,98 @@ string LocationPointSql(const GpsLocation &location)
 
 
 
+IpAddress LoadIpAddress(sqlite3_stmt *statement, int column)
+{
+    const void *bytes = sqlite3_column_blob(statement, column);
+    return IpAddress::FromBytes( bytes, sqlite3_column_bytes(statement, column) );
+}
+
+
+NodeId LoadNodeId(sqlite3_stmt *statement, int column)
+{
+    const void *bytes = sqlite3_column_blob(statement, column);
+    return NodeId::FromBytes( bytes, sqlite3_column_bytes(statement, column) );
+}
+
+
+
+// Databases of version 1 stored node ids and addresses as text. Convert them in place
+// the same way as ids and addresses given in text form are adapted when starting the node,
+// so the stored neighbourhood and its services survive the upgrade.
+void MigrateTextNodeIds(sqlite3 *dbHandle)
+{
+    vector< pair<string, string> > textRows;
+    {
+        sqlite3_stmt *statement;
+        const char *queryStr = "SELECT id, ipAddress FROM nodes WHERE typeof(id) = 'text';";
+        if ( sqlite3_prepare_v2( dbHandle, queryStr, -1, &statement, nullptr ) != SQLITE_OK )
+        {
+            LOG(ERROR) << "Failed to prepare statement: " << queryStr;
+            throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Failed to prepare statement for listing old node entries");
+        }
+        scope_exit finalizeStmt( [&statement] { sqlite3_finalize(statement); } );
+        
+        while ( sqlite3_step(statement) == SQLITE_ROW )
+        {
+            textRows.emplace_back(
+                string( reinterpret_cast<const char*>( sqlite3_column_text(statement, 0) ), sqlite3_column_bytes(statement, 0) ),
+                string( reinterpret_cast<const char*>( sqlite3_column_text(statement, 1) ), sqlite3_column_bytes(statement, 1) ) );
+        }
+    }
+    if ( textRows.empty() )
+        { return; }
+    
+    ExecuteSql(dbHandle, "BEGIN TRANSACTION;");
+    scope_error rollback( [dbHandle] { sqlite3_exec(dbHandle, "ROLLBACK;", nullptr, nullptr, nullptr); } );
+    
+    sqlite3_stmt *nodeStatement;
+    sqlite3_stmt *serviceStatement;
+    const char *nodeUpdateStr    = "UPDATE OR REPLACE nodes SET id = ?, ipAddress = ? WHERE id = ?;";
+    const char *serviceUpdateStr = "UPDATE OR REPLACE services SET nodeId = ? WHERE nodeId = ?;";
+    if ( sqlite3_prepare_v2( dbHandle, nodeUpdateStr, -1, &nodeStatement, nullptr ) != SQLITE_OK )
+        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Failed to prepare statement for converting node entries"); }
+    scope_exit finalizeNodeStmt( [&nodeStatement] { sqlite3_finalize(nodeStatement); } );
+    if ( sqlite3_prepare_v2( dbHandle, serviceUpdateStr, -1, &serviceStatement, nullptr ) != SQLITE_OK )
+        { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Failed to prepare statement for converting service entries"); }
+    scope_exit finalizeServiceStmt( [&serviceStatement] { sqlite3_finalize(serviceStatement); } );
+    
+    size_t droppedCount = 0;
+    for (auto const &row : textRows)
+    {
+        const string &textId = row.first;
+        NodeId nodeId(textId);
+        IpAddress address;
+        try { address = IpAddress::FromString(row.second); }
+        catch (exception &ex)
+        {
+            LOG(WARNING) << "Dropping node " << textId << " with invalid address " << row.second << ": " << ex.what();
+            ++droppedCount;
+            continue;
+        }
+        
+        sqlite3_reset(nodeStatement);
+        sqlite3_reset(serviceStatement);
+        if ( sqlite3_bind_blob( nodeStatement, 1, nodeId.data(), nodeId.size(), SQLITE_STATIC )         != SQLITE_OK ||
+             sqlite3_bind_blob( nodeStatement, 2, address.data(), address.size(), SQLITE_STATIC )       != SQLITE_OK ||
+             sqlite3_bind_text( nodeStatement, 3, textId.data(), textId.size(), SQLITE_STATIC )         != SQLITE_OK ||
+             sqlite3_bind_blob( serviceStatement, 1, nodeId.data(), nodeId.size(), SQLITE_STATIC )      != SQLITE_OK ||
+             sqlite3_bind_text( serviceStatement, 2, textId.data(), textId.size(), SQLITE_STATIC )      != SQLITE_OK )
+            { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Failed to bind node conversion statement params"); }
+        
+        if ( sqlite3_step(nodeStatement) != SQLITE_DONE || sqlite3_step(serviceStatement) != SQLITE_DONE )
+            { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Failed to convert node entry " + textId); }
+    }
+    
+    // Only the nodes dropped above are left with text ids
+    ExecuteSql( dbHandle, "DELETE FROM services WHERE typeof(nodeId) = 'text';" );
+    ExecuteSql( dbHandle, "DELETE FROM nodes WHERE typeof(id) = 'text';" );
+    ExecuteSql( dbHandle, "INSERT OR REPLACE INTO metainfo (key, value) VALUES ('version', '2');" );
+    ExecuteSql( dbHandle, "END TRANSACTION;" );
+    LOG(INFO) << "Converted " << textRows.size() - droppedCount << " nodes stored in an old format, dropped " << droppedCount;
+}
+
+
+
 vector<NodeDbEntry> SpatiaLiteDatabase::QueryEntries(const GpsLocation &fromLocation,
     const string &whereCondition, const string orderBy, const string &limit) const
 {
@@ -199,7 +350,7 @@ vector<NodeDbEntry> SpatiaLiteDatabase::QueryEntries(const GpsLocation &fromLoca
         orderBy + " " +
         limit;
     
-    //LOG(DEBUG) << "Running query: " << queryStr;
+    //LOG_DEBUG(Database) << "Running query: " << queryStr;
     
     int prepResult = sqlite3_prepare_v2( _dbHandle, queryStr.c_str(), -1, &statement, nullptr );
     if (prepResult != SQLITE_OK)
@@ -210,11 +361,10 @@ vector<NodeDbEntry> SpatiaLiteDatabase::QueryEntries(const GpsLocation &fromLoca
 
     scope_exit finalizeStmt( [&statement] { sqlite3_finalize(statement); } );
     
+    uint64_t queriedAtChange = _encodedNodes.changeCount();
     vector<NodeDbEntry> result;
     while ( sqlite3_step(statement) == SQLITE_ROW )
     {
-        const uint8_t *idPtr        = sqlite3_column_text  (statement, 0);
-        const uint8_t *ipAddrPtr    = sqlite3_column_text  (statement, 1);
         int            nodePort     = sqlite3_column_int   (statement, 2);
         int            clientPort   = sqlite3_column_int   (statement, 3);
         double         longitude    = sqlite3_column_double(statement, 4);
@@ -223,17 +373,16 @@ vector<NodeDbEntry> SpatiaLiteDatabase::QueryEntries(const GpsLocation &fromLoca
         int            roleType     = sqlite3_column_int   (statement, 7);
         //int            expiresAt    = sqlite3_column_int   (statement, 8);
         
-        NodeContact contact( reinterpret_cast<const char*>(ipAddrPtr),
+        NodeContact contact( LoadIpAddress(statement, 1),
                              static_cast<TcpPort>(nodePort), static_cast<TcpPort>(clientPort) );
-        string nodeId( reinterpret_cast<const char*>(idPtr) );
-        NodeInfo::Services services = LoadServices(nodeId);
-        NodeInfo info( nodeId, GpsLocation(latitude, longitude), contact, services );
-        result.emplace_back( info,
+        NodeId nodeId( LoadNodeId(statement, 0) );
+        result.emplace_back( NodeInfo( nodeId, GpsLocation(latitude, longitude), contact, LoadServices(nodeId) ),
             // TODO use some kind of checked conversion function from int to enums
             static_cast<NodeRelationType>(relationType),
             static_cast<NodeContactRoleType>(roleType) );
     }
     
+    _encodedNodes.Attach(result, queriedAtChange);
     return result;
 }
 
@@ -242,7 +391,7 @@ vector<NodeDbEntry> SpatiaLiteDatabase::QueryEntries(const GpsLocation &fromLoca
 // https://groups.google.com/forum/#!msg/spatialite-users/83SOajOJ2JU/sgi5fuYAVVkJ
 SpatiaLiteDatabase::SpatiaLiteDatabase( const NodeInfo& myNodeInfo, const string &dbPath,
                                         chrono::duration<uint32_t> entryExpirationPeriod ) :
-    _myNodeInfo(myNodeInfo), _dbHandle(nullptr), _entryExpirationPeriod(entryExpirationPeriod)
+    _myNodeInfo( WithNewEncoding(myNodeInfo) ), _dbHandle(nullptr), _entryExpirationPeriod(entryExpirationPeriod)
 {
     _spatialiteConnection = spatialite_alloc_connection();
     
@@ -267,8 +416,8 @@ SpatiaLiteDatabase::SpatiaLiteDatabase( const NodeInfo& myNodeInfo, const string
     sqlite3_load_extension(_dbHandle, "mod_spatialite", nullptr, nullptr);
 #endif
 
-    LOG(TRACE) << "SQLite version: " << sqlite3_libversion();
-    LOG(TRACE) << "SpatiaLite version: " << spatialite_version();
+    LOG_TRACE(Database) << "SQLite version: " << sqlite3_libversion();
+    LOG_TRACE(Database) << "SpatiaLite version: " << spatialite_version();
     
     if (creatingDb)
     {
@@ -277,19 +426,21 @@ SpatiaLiteDatabase::SpatiaLiteDatabase( const NodeInfo& myNodeInfo, const string
             { ExecuteSql(_dbHandle, command); }
         LOG(INFO) << "Database initialized";
     }
+    else
+        { MigrateTextNodeIds(_dbHandle); }
     
-    LOG(DEBUG) << "Updating node information in database";
-    vector<NodeDbEntry> selfEntries = QueryEntries( _myNodeInfo.location(),
+    LOG_DEBUG(Database) << "Updating node information in database";
+    vector<NodeDbEntry> selfEntries = QueryEntries( _myNodeInfo.Load()->location(),
         "WHERE relationType = " + to_string( static_cast<uint32_t>(NodeRelationType::Self) ) );
     if ( selfEntries.size() > 1 )
         { throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Multiple self instances found, database may have been tampered with."); }
-    if ( ! selfEntries.empty() && selfEntries.front().id() != _myNodeInfo.id() )
+    if ( ! selfEntries.empty() && selfEntries.front().id() != _myNodeInfo.Load()->id() )
         { throw LocationNetworkError(ErrorCode::ERROR_BAD_STATE, "Node id changed, database is invalidated. Delete database file " +
             dbPath + " to force signing up to the network with the new node id."); }
     
-    if ( selfEntries.empty() )  { Store ( NodeDbEntry::FromSelfInfo(_myNodeInfo), false ); }
-    else                        { Update( NodeDbEntry::FromSelfInfo(_myNodeInfo), false ); }
-    LOG(DEBUG) << "Database ready with node count: " << GetNodeCount();
+    if ( selfEntries.empty() )  { Store ( NodeDbEntry::FromSelfInfo( *_myNodeInfo.Load() ), false ); }
+    else                        { Update( NodeDbEntry::FromSelfInfo( *_myNodeInfo.Load() ), false ); }
+    LOG_DEBUG(Database) << "Database ready with node count: " << GetNodeCount();
 }
 
 
@@ -361,7 +512,7 @@ NodeInfo::Services SpatiaLiteDatabase::LoadServices(const NodeId& nodeId) const
     
     scope_exit finalizeStmt( [&statement] { sqlite3_finalize(statement); } );
     
-    if ( sqlite3_bind_text( statement, 1, nodeId.c_str(), -1, SQLITE_STATIC ) != SQLITE_OK )
+    if ( sqlite3_bind_blob( statement, 1, nodeId.data(), nodeId.size(), SQLITE_STATIC ) != SQLITE_OK )
     {
         LOG(ERROR) << "Failed to bind LoadServices query node id param";
         throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Failed to bind LoadServices query node id param");
@@ -383,8 +534,7 @@ NodeInfo::Services SpatiaLiteDatabase::LoadServices(const NodeId& nodeId) const
                 { data = string( reinterpret_cast<const char*>(dataBytes), dataBytesCnt ); }
         }
         
-        ServiceInfo service( serviceType, port, data );
-        services[ service.type() ] = service;
+        services[serviceType] = ServiceInfo( serviceType, port, move(data) );
     }
     
     return services;
@@ -416,7 +566,7 @@ void SpatiaLiteDatabase::StoreServices(const NodeId& nodeId, const NodeInfo::Ser
         const ServiceInfo &service = servicePair.second;
         const char *blobData = service.customData().empty() ? nullptr : service.customData().data();
         int blobSize = service.customData().size();
-        if ( sqlite3_bind_text( statement, 1, nodeId.c_str(), -1, SQLITE_STATIC )  != SQLITE_OK ||
+        if ( sqlite3_bind_blob( statement, 1, nodeId.data(), nodeId.size(), SQLITE_STATIC )  != SQLITE_OK ||
              sqlite3_bind_text( statement, 2, service.type().c_str(), -1, SQLITE_STATIC ) != SQLITE_OK ||
              sqlite3_bind_int(  statement, 3, service.port() )                     != SQLITE_OK ||
              sqlite3_bind_blob( statement, 4, blobData, blobSize, SQLITE_STATIC )  != SQLITE_OK )
@@ -457,7 +607,7 @@ void SpatiaLiteDatabase::RemoveServices(const NodeId& nodeId)
     
     scope_exit finalizeStmt( [&statement] { sqlite3_finalize(statement); } );
     
-    if ( sqlite3_bind_text( statement, 1, nodeId.c_str(), -1, SQLITE_STATIC ) != SQLITE_OK )
+    if ( sqlite3_bind_blob( statement, 1, nodeId.data(), nodeId.size(), SQLITE_STATIC ) != SQLITE_OK )
     {
         LOG(ERROR) << "Failed to bind RemoveService query node id param";
         throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Failed to bind remove service query node id param");
@@ -484,7 +634,7 @@ shared_ptr<NodeDbEntry> SpatiaLiteDatabase::Load(const NodeId& nodeId) const
         "FROM nodes "
         "WHERE id=?";
     
-    //LOG(DEBUG) << "Running query: " << queryStr;
+    //LOG_DEBUG(Database) << "Running query: " << queryStr;
     
     int prepResult = sqlite3_prepare_v2( _dbHandle, queryStr.c_str(), -1, &statement, nullptr );
     if (prepResult != SQLITE_OK)
@@ -495,17 +645,16 @@ shared_ptr<NodeDbEntry> SpatiaLiteDatabase::Load(const NodeId& nodeId) const
 
     scope_exit finalizeStmt( [&statement] { sqlite3_finalize(statement); } );
     
-    if ( sqlite3_bind_text( statement, 1, nodeId.c_str(), -1, SQLITE_STATIC ) != SQLITE_OK )
+    if ( sqlite3_bind_blob( statement, 1, nodeId.data(), nodeId.size(), SQLITE_STATIC ) != SQLITE_OK )
     {
         LOG(ERROR) << "Failed to bind load query node id param";
         throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Failed to bind load query node id param");
     }
 
+    uint64_t queriedAtChange = _encodedNodes.changeCount();
     shared_ptr<NodeDbEntry> result;
     if ( sqlite3_step(statement) == SQLITE_ROW )
     {
-        const uint8_t *idPtr        = sqlite3_column_text  (statement, 0);
-        const uint8_t *ipAddrPtr    = sqlite3_column_text  (statement, 1);
         int            nodePort     = sqlite3_column_int   (statement, 2);
         int            clientPort   = sqlite3_column_int   (statement, 3);
         double         longitude    = sqlite3_column_double(statement, 4);
@@ -514,13 +663,13 @@ shared_ptr<NodeDbEntry> SpatiaLiteDatabase::Load(const NodeId& nodeId) const
         int            roleType     = sqlite3_column_int   (statement, 7);
         
         // TODO create enums through checked "enum constructor" method
-        NodeContact contact( reinterpret_cast<const char*>(ipAddrPtr),
+        NodeContact contact( LoadIpAddress(statement, 1),
                              static_cast<TcpPort>(nodePort), static_cast<TcpPort>(clientPort) );
         
-        NodeInfo::Services services = LoadServices(nodeId);
         result.reset( new NodeDbEntry(
-            NodeInfo( reinterpret_cast<const char*>(idPtr), GpsLocation(latitude, longitude), contact, services ),
+            NodeInfo( nodeId, GpsLocation(latitude, longitude), contact, LoadServices(nodeId) ),
             static_cast<NodeRelationType>(relationType), static_cast<NodeContactRoleType>(roleType) ) );
+        _encodedNodes.Attach(*result, queriedAtChange);
     }
     
     return result;
@@ -531,6 +680,9 @@ shared_ptr<NodeDbEntry> SpatiaLiteDatabase::Load(const NodeId& nodeId) const
 // TODO reduce SpatiaLite boilerplate in general as much as possible. Currently it's very repetitive.
 void SpatiaLiteDatabase::Store(const NodeDbEntry &node, bool expires)
 {
+    _encodedNodes.ChangeStarted();
+    scope_exit changeFinished( [this, &node] { _encodedNodes.ChangeFinished(node.id()); } );
+    
     sqlite3_stmt *statement;
     string insertStr(
         "INSERT INTO nodes "
@@ -550,8 +702,8 @@ void SpatiaLiteDatabase::Store(const NodeDbEntry &node, bool expires)
         numeric_limits<time_t>::max();
     const NodeContact &contact = node.contact();
     // TODO abstract long bind checks away, probably with functions, or maybe macros
-    if ( sqlite3_bind_text( statement, 1, node.id().c_str(), -1, SQLITE_STATIC )        != SQLITE_OK ||
-         sqlite3_bind_text( statement, 2, contact.address().c_str(), -1, SQLITE_STATIC )!= SQLITE_OK ||
+    if ( sqlite3_bind_blob( statement, 1, node.id().data(), node.id().size(), SQLITE_STATIC ) != SQLITE_OK ||
+         sqlite3_bind_blob( statement, 2, contact.address().data(), contact.address().size(), SQLITE_STATIC ) != SQLITE_OK ||
          sqlite3_bind_int(  statement, 3, contact.nodePort() )                          != SQLITE_OK ||
          sqlite3_bind_int(  statement, 4, contact.clientPort() )                        != SQLITE_OK ||
          sqlite3_bind_int(  statement, 5, static_cast<int>( node.relationType() ) )     != SQLITE_OK ||
@@ -582,6 +734,9 @@ void SpatiaLiteDatabase::Store(const NodeDbEntry &node, bool expires)
 
 void SpatiaLiteDatabase::Update(const NodeDbEntry& node, bool expires)
 {
+    _encodedNodes.ChangeStarted();
+    scope_exit changeFinished( [this, &node] { _encodedNodes.ChangeFinished(node.id()); } );
+    
     sqlite3_stmt *statement;
     string insertStr(
         "UPDATE nodes SET "
@@ -601,13 +756,13 @@ void SpatiaLiteDatabase::Update(const NodeDbEntry& node, bool expires)
         chrono::system_clock::to_time_t( chrono::system_clock::now() + _entryExpirationPeriod ) :
         numeric_limits<time_t>::max();
     const NodeContact &contact = node.contact();
-    if ( sqlite3_bind_text( statement, 1, contact.address().c_str(), -1, SQLITE_STATIC )!= SQLITE_OK ||
+    if ( sqlite3_bind_blob( statement, 1, contact.address().data(), contact.address().size(), SQLITE_STATIC ) != SQLITE_OK ||
          sqlite3_bind_int(  statement, 2, contact.nodePort() )                          != SQLITE_OK ||
          sqlite3_bind_int(  statement, 3, contact.clientPort() )                        != SQLITE_OK ||
          sqlite3_bind_int(  statement, 4, static_cast<int>( node.relationType() ) )     != SQLITE_OK ||
          sqlite3_bind_int(  statement, 5, static_cast<int>( node.roleType() ) )         != SQLITE_OK ||
          sqlite3_bind_int(  statement, 6, expiresAt )                                   != SQLITE_OK ||
-         sqlite3_bind_text( statement, 7, node.id().c_str(), -1, SQLITE_STATIC )        != SQLITE_OK )
+         sqlite3_bind_blob( statement, 7, node.id().data(), node.id().size(), SQLITE_STATIC ) != SQLITE_OK )
     {
         LOG(ERROR) << "Failed to bind node store statement params";
         throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Failed to bind node store statement params");
@@ -629,9 +784,9 @@ void SpatiaLiteDatabase::Update(const NodeDbEntry& node, bool expires)
     
     StoreServices( node.id(), node.services() );
     
-    // update cached self node info
+    // update cached self node info, copies handed out before keep the encoding of the old info
     if ( node.relationType() == NodeRelationType::Self )
-        { _myNodeInfo = node; }
+        { _myNodeInfo.Store( WithNewEncoding(node) ); }
     
     for ( auto listenerEntry : _listenerRegistry.listeners() )
     {
@@ -646,10 +801,13 @@ void SpatiaLiteDatabase::Remove(const NodeId &nodeId)
 {
     shared_ptr<NodeDbEntry> storedNode = Load(nodeId);
     if (storedNode == nullptr)
-        { throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Node to be removed is not present: " + nodeId); }
+        { throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Node to be removed is not present: " + nodeId.ToHex()); }
     if ( storedNode->relationType() == NodeRelationType::Self )
         { throw LocationNetworkError(ErrorCode::ERROR_INVALID_VALUE, "Attempt to delete self entry"); }
     
+    _encodedNodes.ChangeStarted();
+    scope_exit changeFinished( [this, &nodeId] { _encodedNodes.ChangeFinished(nodeId); } );
+    
     RemoveServices(nodeId);
     
     sqlite3_stmt *statement;
@@ -665,7 +823,7 @@ void SpatiaLiteDatabase::Remove(const NodeId &nodeId)
 
     scope_exit finalizeStmt( [&statement] { sqlite3_finalize(statement); } );
     
-    if ( sqlite3_bind_text( statement, 1, nodeId.c_str(), -1, SQLITE_STATIC ) != SQLITE_OK )
+    if ( sqlite3_bind_blob( statement, 1, nodeId.data(), nodeId.size(), SQLITE_STATIC ) != SQLITE_OK )
     {
         LOG(ERROR) << "Failed to bind node delete statement id param";
         throw LocationNetworkError(ErrorCode::ERROR_INTERNAL, "Failed to bind node delete statement id param");
@@ -702,7 +860,7 @@ void SpatiaLiteDatabase::ExpireOldNodes()
         "WHERE expiresAt <= " + to_string(now) + " AND " +
             "relationType != " + to_string( static_cast<uint32_t>(NodeRelationType::Self) ) );
     
-    vector<NodeDbEntry> expiredEntries = QueryEntries( _myNodeInfo.location(), expiredCondition );
+    vector<NodeDbEntry> expiredEntries = QueryEntries( _myNodeInfo.Load()->location(), expiredCondition );
     
     for (const auto &entry : expiredEntries)
     {
@@ -716,7 +874,7 @@ void SpatiaLiteDatabase::ExpireOldNodes()
 
 vector<NodeDbEntry> SpatiaLiteDatabase::GetNodes(NodeContactRoleType roleType)
 {
-    return QueryEntries( _myNodeInfo.location(),
+    return QueryEntries( _myNodeInfo.Load()->location(),
         "WHERE roleType = " + to_string( static_cast<int>(roleType) ) );
 }
 
@@ -725,7 +883,7 @@ vector<NodeDbEntry> SpatiaLiteDatabase::GetNodes(NodeContactRoleType roleType)
 size_t SpatiaLiteDatabase::GetNodeCount() const
 {
     // NOTE this would be better done by SELECT COUNT(*) but that would need a lot more boilerplate code again
-    vector<NodeDbEntry> nodes( QueryEntries( _myNodeInfo.location() ) );
+    vector<NodeDbEntry> nodes( QueryEntries( _myNodeInfo.Load()->location() ) );
     return nodes.size();
 }
 
@@ -733,7 +891,7 @@ size_t SpatiaLiteDatabase::GetNodeCount() const
 size_t SpatiaLiteDatabase::GetNodeCount(NodeRelationType filter) const
 {
     // NOTE this would be better done by SELECT COUNT(*) but that would need a lot more boilerplate code again
-    vector<NodeDbEntry> nodes( QueryEntries( _myNodeInfo.location(),
+    vector<NodeDbEntry> nodes( QueryEntries( _myNodeInfo.Load()->location(),
         "WHERE relationType = " + to_string( static_cast<int>(filter) ) ) );
     return nodes.size();
 }
@@ -742,7 +900,7 @@ size_t SpatiaLiteDatabase::GetNodeCount(NodeRelationType filter) const
 
 vector<NodeDbEntry> SpatiaLiteDatabase::GetNeighbourNodesByDistance() const
 {
-    return QueryEntries( _myNodeInfo.location(),
+    return QueryEntries( _myNodeInfo.Load()->location(),
         "WHERE relationType = " + to_string( static_cast<int>(NodeRelationType::Neighbour) ),
         "ORDER BY dist_km" );
 }
@@ -753,7 +911,7 @@ vector<NodeDbEntry> SpatiaLiteDatabase::GetRandomNodes(size_t maxNodeCount, Neig
 {
     string whereCondition = filter == Neighbours::Included ? "" :
         "WHERE relationType = " + to_string( static_cast<int>(NodeRelationType::Colleague) );
-    return QueryEntries( _myNodeInfo.location(), whereCondition,
+    return QueryEntries( _myNodeInfo.Load()->location(), whereCondition,
         "ORDER BY RANDOM()", "LIMIT " + to_string(maxNodeCount) );
 }
 
@@ -779,7 +937,7 @@ vector<NodeDbEntry> SpatiaLiteDatabase::GetClosestNodesByDistance(
 
 NodeDbEntry SpatiaLiteDatabase::ThisNode() const
 {
-    return NodeDbEntry::FromSelfInfo(_myNodeInfo);
+    return NodeDbEntry::FromSelfInfo( *_myNodeInfo.Load() );
 //     string whereCondition = "WHERE relationType = " + to_string( static_cast<int>(NodeRelationType::Colleague) );
 //     vector<NodeDbEntry> result = QueryEntries( _myNodeInfo.location(), whereCondition );
 //     if ( result.empty() )
@@ -5,6 +5,7 @@
 #include <memory>
 #include <mutex>
 #include <sqlite3.h>
+#include <unordered_map>
 #include <vector>
 
 #include "basic.hpp"
@@ -51,8 +52,12 @@ public:
     
     static NodeDbEntry FromSelfInfo(const NodeInfo &thisNodeInfo);
     
-    NodeDbEntry(const NodeDbEntry& other);
-    NodeDbEntry( const NodeInfo& info,
+    NodeDbEntry(const NodeDbEntry &other) = default;
+    NodeDbEntry(NodeDbEntry &&other) = default;
+    NodeDbEntry& operator=(const NodeDbEntry &other) = default;
+    NodeDbEntry& operator=(NodeDbEntry &&other) = default;
+    // Info is taken by value to be moved in from temporaries
+    NodeDbEntry( NodeInfo info,
                  NodeRelationType relationType, NodeContactRoleType roleType );
     
     NodeRelationType relationType() const;
@@ -63,6 +68,11 @@ public:
 };
 
 
+// Copy of a node info to be stored with a new encoding attached,
+// not shared with the copies of its previous value handed out before.
+NodeInfo WithNewEncoding(NodeInfo node);
+
+
 
 // Interface to listen for any changes in the node map.
 class IChangeListener
@@ -144,16 +154,45 @@ public:
 
 
 
+// Encodings of stored entries by node id, attached to all copies of an entry handed out
+// by queries until the entry changes, so nodes listed by many responses are encoded only once.
+// Changes are counted: results of a query that overlapped a change may be read from the previous
+// version of an entry, they are handed out without attaching anything to avoid caching them.
+class EncodedNodeCache
+{
+    mutable std::mutex  _mutex;
+    std::unordered_map< NodeId, std::shared_ptr<NodeInfoEncoding> > _encodings;
+    uint64_t            _changeCount;
+    size_t              _changesInProgress;
+    
+    void AttachUnlocked(NodeInfo &node);
+    
+public:
+    
+    EncodedNodeCache();
+    
+    // To be taken before querying entries and passed to Attach()
+    uint64_t changeCount() const;
+    void Attach(NodeInfo &node, uint64_t queriedAtChange);
+    void Attach(std::vector<NodeDbEntry> &nodes, uint64_t queriedAtChange);
+    
+    void ChangeStarted();
+    void ChangeFinished(const NodeId &nodeId);
+};
+
+
+
 // A spatial database implementation that uses the SpatiaLite embedded SQL engine.
 class SpatiaLiteDatabase : public ISpatialDatabase
 {
-    NodeInfo     _myNodeInfo;
+    SharedSnapshot<NodeInfo> _myNodeInfo; // Read by all request handlers, updated rarely
     sqlite3     *_dbHandle;
     void        *_spatialiteConnection;
     
     std::chrono::duration<uint32_t> _entryExpirationPeriod;
     
     ThreadSafeChangeListenerRegistry _listenerRegistry;
+    mutable EncodedNodeCache         _encodedNodes;
     
     std::vector<NodeDbEntry> QueryEntries(const GpsLocation &fromLocation,
         const std::string &whereCondition = "", const std::string orderBy = "",
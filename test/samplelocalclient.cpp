@@ -86,6 +86,7 @@ int main(int argc, const char* argv[])
          
         thread reactorThread( []
         {
+            Reactor::MarkReactorThread();
             while (! ShutdownRequested)
             {
                 Reactor::Instance().AsioService().run_one();
@@ -99,8 +100,8 @@ int main(int argc, const char* argv[])
             shared_ptr<IBlockingRequestDispatcher> dispatcher( new NetworkDispatcher(config, session) );
             LOG(INFO) << "Sending registerservice request";
             unique_ptr<iop::locnet::Request> registerRequest( new iop::locnet::Request() );
-            registerRequest->mutable_local_service()->mutable_register_service()->set_allocated_service(
-                Converter::ToProtoBuf( ServiceInfo("ServiceType::Profile", 16999, "ProfileServerId") ) );
+            Converter::FillProtoBuf( registerRequest->mutable_local_service()->mutable_register_service()->mutable_service(),
+                ServiceInfo("ServiceType::Profile", 16999, "ProfileServerId") );
             unique_ptr<iop::locnet::Response> registerResponse = dispatcher->Dispatch( move(registerRequest) );
             
             uint32_t requestsSent = 0;
@@ -49,6 +49,7 @@ int main(int argc, const char* argv[])
 
         thread reactorThread( []
         {
+            Reactor::MarkReactorThread();
             while (! ShutdownRequested)
             {
                 Reactor::Instance().AsioService().run_one();
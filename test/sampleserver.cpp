@@ -103,6 +103,7 @@ int main(int argc, const char *argv[])
         std::signal(SIGINT,  signalHandler);
         std::signal(SIGTERM, signalHandler);
         
+        Reactor::MarkReactorThread();
         while ( ! Reactor::Instance().IsShutdown() )
             { Reactor::Instance().AsioService().run_one(); }
         
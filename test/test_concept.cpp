@@ -105,6 +105,15 @@ ostream& operator<<(ostream &out, const TestCase testCase)
     { return out << "test case (maxNodes: " << testCase._maxNodeCount << ", seeds: " << testCase._seedCount << ", neighbours: " << testCase._maxNeighbourCount << ")"; }
 
 
+// Simulated nodes are told apart by address only, give each of them a unique private IPv4 address
+IpAddress simulatedNodeAddress(size_t nodeIndex)
+{
+    uint8_t bytes[] = { 10, static_cast<uint8_t>(nodeIndex >> 16),
+        static_cast<uint8_t>(nodeIndex >> 8), static_cast<uint8_t>(nodeIndex) };
+    return IpAddress::FromBytes( bytes, sizeof(bytes) );
+}
+
+
 vector< shared_ptr<TestConfig> > createOneConfigByCity(
     const vector<Settlement> &settlements, const TestCase &testCase)
 {
@@ -113,8 +122,8 @@ vector< shared_ptr<TestConfig> > createOneConfigByCity(
     {
         //cout << settlement.name << "\t" << settlement.location << "\t" << settlement.population << endl;
         
-        NodeInfo nodeInfo( settlement.name, settlement.location,
-            NodeContact(settlement.name, 8888, 9999), NodeInfo::Services() );
+        NodeInfo nodeInfo( NodeId(settlement.name), settlement.location,
+            NodeContact( simulatedNodeAddress( nodeConfigs.size() ), 8888, 9999 ), NodeInfo::Services() );
         shared_ptr<TestConfig> config( new TestConfig(nodeInfo) );
         nodeConfigs.push_back(config);
         
@@ -139,8 +148,8 @@ vector< shared_ptr<TestConfig> > createConfigsByPopulation(
             //cout << settlement.name << "\t" << settlement.location << "\t" << settlement.population << endl;
             
             ++nodeUniqueIndex;
-            NodeInfo nodeInfo( city.name + "-" + to_string(nodeUniqueIndex), city.location,
-                NodeContact(city.name + "-" + to_string(nodeUniqueIndex), 8888, 9999), NodeInfo::Services() );
+            NodeInfo nodeInfo( NodeId( city.name + "-" + to_string(nodeUniqueIndex) ), city.location,
+                NodeContact( simulatedNodeAddress( nodeConfigs.size() ), 8888, 9999 ), NodeInfo::Services() );
             shared_ptr<TestConfig> config( new TestConfig(nodeInfo) );
             nodeConfigs.push_back(config);
             
@@ -270,6 +279,22 @@ void testNodes( const vector< shared_ptr<TestConfig> > &nodeConfigs,
         { entry.second->MergeSplits(); }
     for ( auto &entry : proxyFactory->nodes() )
         { REQUIRE( entry.second->GetNodeCount() > 1 ); } // Connected to at least another node
+    
+    // Measure how much of the map is rediscovered by periodic exploration
+    size_t knownNodesBefore = 0;
+    for ( auto &entry : proxyFactory->nodes() )
+        { knownNodesBefore += entry.second->GetNodeCount(); }
+    for (size_t round = 0; round < 3; ++round)
+    {
+        for ( auto &entry : proxyFactory->nodes() )
+            { entry.second->DiscoverUnknownAreas(); }
+    }
+    size_t knownNodesAfter = 0;
+    for ( auto &entry : proxyFactory->nodes() )
+        { knownNodesAfter += entry.second->GetNodeCount(); }
+    REQUIRE( knownNodesAfter >= knownNodesBefore );
+    cout << "  average map size after merge " << knownNodesBefore / networkSize
+         << ", after discovery " << knownNodesAfter / networkSize << endl;
 }
     
 
@@ -58,16 +58,70 @@ SCENARIO("Construction and behaviour of data holder types", "[basic][logic]")
         }
     }
     
+    GIVEN("IP addresses in text form") {
+        THEN("they are stored in binary form") {
+            IpAddress v4 = IpAddress::FromString("1.2.3.4");
+            REQUIRE( v4.size() == 4 );
+            REQUIRE( v4.data()[3] == 4 );
+            REQUIRE( IpAddress::FromBytes( v4.data(), v4.size() ) == v4 );
+            
+            IpAddress v6 = IpAddress::FromString("::1");
+            REQUIRE( v6.family() == IpAddress::Family::V6 );
+            REQUIRE( v6.size() == IpAddress::MaxSize );
+            REQUIRE( v6.ToString() == "::1" );
+            REQUIRE( v6 != v4 );
+            
+            REQUIRE( IpAddress::FromString("").empty() );
+            REQUIRE_THROWS( IpAddress::FromString("not.an.address") );
+            REQUIRE_THROWS( IpAddress::FromBytes( v4.data(), 3 ) );
+        }
+    }
+    
+    GIVEN("Node ids in different forms") {
+        THEN("they are all adapted to fixed size binary ids") {
+            NodeId readableId("NodeId");
+            REQUIRE( readableId.size() == NodeId::Size );
+            REQUIRE( readableId == NodeId("NodeId") );
+            REQUIRE( readableId != NodeId("OtherNodeId") );
+            REQUIRE( NodeId::FromBytes( readableId.data(), readableId.size() ) == readableId );
+            
+            string hexId = readableId.ToHex();
+            REQUIRE( hexId.size() == 2 * NodeId::Size );
+            REQUIRE( NodeId(hexId) == readableId );
+            REQUIRE( hash<NodeId>()( NodeId(hexId) ) == hash<NodeId>()(readableId) );
+        }
+        
+        THEN("ids are received from other nodes as hex text") {
+            NodeId nodeId("NodeId");
+            string hexId = nodeId.ToHex();
+            REQUIRE( NodeId::FromHex(hexId) == nodeId );
+            
+            REQUIRE_THROWS( NodeId::FromHex("NodeId") );
+            REQUIRE_THROWS( NodeId::FromHex("") );
+            REQUIRE_THROWS( NodeId::FromHex( string( reinterpret_cast<const char*>( nodeId.data() ), nodeId.size() ) ) );
+            hexId[0] = 'x';
+            REQUIRE_THROWS( NodeId::FromHex(hexId) );
+        }
+        
+        THEN("ids are loaded from the database as raw bytes") {
+            NodeId nodeId("NodeId");
+            string hexId = nodeId.ToHex();
+            REQUIRE_THROWS( NodeId::FromBytes( hexId.data(), hexId.size() ) );
+            REQUIRE_THROWS( NodeId::FromBytes( hexId.data(), 0 ) );
+        }
+    }
+    
     GIVEN("A node info object") {
         NodeInfo::Services services{
             { "ServiceType::Profile", ServiceInfo("ServiceType::Profile", 1111) } };
-        NodeInfo node( "NodeId", loc, NodeContact("127.0.0.1", 6666, 7777), services );
+        NodeInfo node( NodeId("NodeId"), loc, NodeContact("127.0.0.1", 6666, 7777), services );
         THEN("its fields are properly filled in") {
-            REQUIRE( node.id() == "NodeId" );
+            REQUIRE( node.id() == NodeId("NodeId") );
             REQUIRE( node.location() == loc );
             
             NodeContact &contact = node.contact();
-            REQUIRE( contact.address() == "127.0.0.1" );
+            REQUIRE( contact.address().ToString() == "127.0.0.1" );
+            REQUIRE( contact.address().family() == IpAddress::Family::V4 );
             REQUIRE( contact.nodeEndpoint().isLoopback() );
             REQUIRE( contact.nodePort() == 6666 );
             REQUIRE( contact.clientPort() == 7777 );
@@ -79,9 +133,9 @@ SCENARIO("Construction and behaviour of data holder types", "[basic][logic]")
             REQUIRE( service.type() == "ServiceType::Profile" );
             REQUIRE( service.port() == 1111 );
             
-            contact.address( Address("1.2.3.4") );
+            contact.address( IpAddress::FromString("1.2.3.4") );
             
-            REQUIRE( contact.address() == "1.2.3.4" );
+            REQUIRE( contact.address().ToString() == "1.2.3.4" );
             REQUIRE( ! contact.nodeEndpoint().isLoopback() );
         }
     }
@@ -98,7 +152,7 @@ SCENARIO("Spatial database", "[spatialdb][logic]")
         THEN("its initially empty") {
             REQUIRE( geodb.GetNodeCount() == 1 ); // contains only self
             REQUIRE( geodb.GetNeighbourNodesByDistance().empty() );
-            REQUIRE_THROWS( geodb.Remove("NonExistingNodeId") );
+            REQUIRE_THROWS( geodb.Remove( NodeId("NonExistingNodeId") ) );
             
             shared_ptr<NodeDbEntry> self = geodb.Load(TestData::NodeBudapest.id() );
             REQUIRE( self );
@@ -125,10 +179,10 @@ SCENARIO("Spatial database", "[spatialdb][logic]")
                 { "ServiceType::Token", ServiceInfo("ServiceType::Token", 2222) } };
             NodeInfo::Services services2{
                 { "ServiceType::Relay", ServiceInfo("ServiceType::Relay", 3333) } };
-            NodeDbEntry entry1( NodeInfo( "ColleagueNodeId1", GpsLocation(1.0, 1.0),
+            NodeDbEntry entry1( NodeInfo( NodeId("ColleagueNodeId1"), GpsLocation(1.0, 1.0),
                 NodeContact("127.0.0.1", 6666, 7777), services1 ),
                     NodeRelationType::Colleague, NodeContactRoleType::Initiator );
-            NodeDbEntry entry2( NodeInfo( "NeighbourNodeId2", GpsLocation(2.0, 2.0),
+            NodeDbEntry entry2( NodeInfo( NodeId("NeighbourNodeId2"), GpsLocation(2.0, 2.0),
                 NodeContact("127.0.0.1", 8888, 9999), services2 ),
                     NodeRelationType::Neighbour, NodeContactRoleType::Acceptor );
             
@@ -138,17 +192,17 @@ SCENARIO("Spatial database", "[spatialdb][logic]")
             THEN("they can be queried and removed") {
                 REQUIRE( geodb.GetNodeCount() == 3 );
                 REQUIRE( geodb.GetNeighbourNodesByDistance().size() == 1 );
-                REQUIRE_THROWS( geodb.Remove("NonExistingNodeId") );
+                REQUIRE_THROWS( geodb.Remove( NodeId("NonExistingNodeId") ) );
                 
-                shared_ptr<NodeDbEntry> loaded1 = geodb.Load("ColleagueNodeId1");
-                shared_ptr<NodeDbEntry> loaded2 = geodb.Load("NeighbourNodeId2");
+                shared_ptr<NodeDbEntry> loaded1 = geodb.Load( NodeId("ColleagueNodeId1") );
+                shared_ptr<NodeDbEntry> loaded2 = geodb.Load( NodeId("NeighbourNodeId2") );
                  
                 
                 REQUIRE( loaded1 != nullptr );
                 REQUIRE( loaded1->services() == services1 );
                 REQUIRE( loaded1->services().at("ServiceType::Profile").customData() == "ProfileServerId" );
                 
-                geodb.Remove("ColleagueNodeId1");
+                geodb.Remove( NodeId("ColleagueNodeId1") );
                 REQUIRE( geodb.GetNodeCount() == 2 );
                 REQUIRE( geodb.GetNeighbourNodesByDistance().size() == 1 );
                 
@@ -156,9 +210,9 @@ SCENARIO("Spatial database", "[spatialdb][logic]")
                 REQUIRE( loaded2->services() == services2 );
                 
                 
-                geodb.Remove("NeighbourNodeId2");
+                geodb.Remove( NodeId("NeighbourNodeId2") );
                 
-                REQUIRE_THROWS( geodb.Remove("NonExistingNodeId") );
+                REQUIRE_THROWS( geodb.Remove( NodeId("NonExistingNodeId") ) );
                 REQUIRE( geodb.GetNodeCount() == 1 );
                 REQUIRE( geodb.GetNeighbourNodesByDistance().empty() );
             }
@@ -235,6 +289,25 @@ SCENARIO("Spatial database", "[spatialdb][logic]")
                 REQUIRE( neighboursByDistance[0] == TestData::EntryKecskemet );
                 REQUIRE( neighboursByDistance[1] == TestData::EntryWien );
             }
+            THEN("Entries share their encoding until they are changed") {
+                shared_ptr<NodeInfoEncoding> londonEncoding = geodb.Load( TestData::NodeLondon.id() )->encoding();
+                REQUIRE( londonEncoding );
+                REQUIRE( geodb.Load( TestData::NodeLondon.id() )->encoding() == londonEncoding );
+                vector<NodeDbEntry> closestNodes = geodb.GetClosestNodesByDistance(
+                    TestData::London, 1, 1, Neighbours::Included );
+                REQUIRE( closestNodes.size() == 1 );
+                REQUIRE( closestNodes[0].encoding() == londonEncoding );
+
+                geodb.Update( NodeDbEntry(TestData::NodeLondon, NodeRelationType::Neighbour, NodeContactRoleType::Initiator) );
+                shared_ptr<NodeDbEntry> updatedLondonEntry = geodb.Load( TestData::NodeLondon.id() );
+                REQUIRE( updatedLondonEntry->encoding() );
+                REQUIRE( updatedLondonEntry->encoding() != londonEncoding );
+                REQUIRE( closestNodes[0].encoding() == londonEncoding );
+
+                geodb.Remove( TestData::NodeLondon.id() );
+                geodb.Store(TestData::EntryLondon);
+                REQUIRE( geodb.Load( TestData::NodeLondon.id() )->encoding() != updatedLondonEntry->encoding() );
+            }
             THEN("Data is properly updated and deleted") {
                 REQUIRE( geodb.GetNodeCount() == 6 );
                 REQUIRE( geodb.GetNeighbourNodesByDistance().size() == 2 );
@@ -272,6 +345,43 @@ SCENARIO("Spatial database", "[spatialdb][logic]")
             }
         }
     }
+    
+    GIVEN("A database stored by an older version with text node ids") {
+        const string dbPath = "test-textids.sqlite";
+        remove( dbPath.c_str() );
+        scope_exit removeDb( [dbPath] { remove( dbPath.c_str() ); } );
+        
+        NodeInfo::Services services{
+            { "ServiceType::Profile", ServiceInfo("ServiceType::Profile", 1111, "ProfileServerId") } };
+        NodeDbEntry neighbour( NodeInfo( NodeId("NeighbourNodeId"), TestData::Kecskemet,
+            NodeContact("127.0.0.1", 6666, 7777), services ),
+                NodeRelationType::Neighbour, NodeContactRoleType::Acceptor );
+        {
+            SpatiaLiteDatabase geodb( TestData::NodeBudapest, dbPath, chrono::hours(1) );
+            geodb.Store(neighbour);
+        }
+        
+        // Rewrite rows the way version 1 stored them
+        sqlite3 *dbHandle;
+        REQUIRE( sqlite3_open( dbPath.c_str(), &dbHandle ) == SQLITE_OK );
+        REQUIRE( sqlite3_exec( dbHandle,
+            "UPDATE services SET nodeId = 'NeighbourNodeId';"
+            "UPDATE nodes SET id = 'NeighbourNodeId', ipAddress = '127.0.0.1' WHERE relationType = 2;"
+            "UPDATE nodes SET id = 'BudapestId', ipAddress = '127.0.0.1' WHERE relationType = 3;"
+            "UPDATE metainfo SET value = '1' WHERE key = 'version';",
+            nullptr, nullptr, nullptr ) == SQLITE_OK );
+        sqlite3_close(dbHandle);
+        
+        THEN("its nodes and services are converted instead of being dropped") {
+            SpatiaLiteDatabase geodb( TestData::NodeBudapest, dbPath, chrono::hours(1) );
+            REQUIRE( geodb.GetNodeCount() == 2 );
+            
+            shared_ptr<NodeDbEntry> loaded = geodb.Load( neighbour.id() );
+            REQUIRE( loaded != nullptr );
+            REQUIRE( *loaded == neighbour );
+            REQUIRE( geodb.GetNeighbourNodesByDistance().size() == 1 );
+        }
+    }
 }
 
 
@@ -280,7 +390,7 @@ SCENARIO("Server registration", "[localservice][logic]")
 {
     GIVEN("The location based network") {
         GpsLocation loc(1.0, 2.0);
-        NodeInfo nodeInfo( NodeInfo("NodeId", loc, NodeContact("127.0.0.1", 6666, 7777), {} ) );
+        NodeInfo nodeInfo( NodeInfo(NodeId("NodeId"), loc, NodeContact("127.0.0.1", 6666, 7777), {} ) );
         shared_ptr<ISpatialDatabase> geodb( new SpatiaLiteDatabase(nodeInfo,
             SpatiaLiteDatabase::IN_MEMORY_DB, chrono::hours(1) ) );
         
@@ -333,3 +443,48 @@ SCENARIO("Server registration", "[localservice][logic]")
         }
     }
 }
+
+
+
+SCENARIO("Coverage guided discovery", "[locnet][logic]")
+{
+    GIVEN("A coverage grid of the map")
+    {
+        CoverageGrid grid;
+        mt19937 generator(42);
+        
+        THEN("probe locations are selected all over the map")
+        {
+            for (size_t i = 0; i < 100; ++i)
+                { REQUIRE_NOTHROW( grid.SelectProbeLocation(generator) ); }
+            REQUIRE( CoverageGrid::CellIndex( GpsLocation(-89.9, -179.9) ) == 0 );
+            REQUIRE( CoverageGrid::CellIndex( GpsLocation(90, 180) ) ==
+                CoverageGrid::LatitudeCellCount * CoverageGrid::LongitudeCellCount - 1 );
+        }
+        
+        THEN("populated areas with few known nodes are preferred")
+        {
+            // Probes everywhere found only nodes in Budapest, cells of London and New York have known nodes
+            for (size_t lat = 0; lat < CoverageGrid::LatitudeCellCount; ++lat)
+            {
+                for (size_t lon = 0; lon < CoverageGrid::LongitudeCellCount; ++lon)
+                {
+                    GpsLocation cellLocation( lat * CoverageGrid::CellSizeDegrees - 85.,
+                                              lon * CoverageGrid::CellSizeDegrees - 175. );
+                    for (size_t probe = 0; probe < 10; ++probe)
+                        { grid.RecordProbe(cellLocation, TestData::Budapest); }
+                }
+            }
+            grid.UpdateKnownNodes( { TestData::EntryLondon, TestData::EntryNewYork } );
+            
+            size_t budapestProbes = 0;
+            for (size_t i = 0; i < 1000; ++i)
+            {
+                GpsLocation probe = grid.SelectProbeLocation(generator);
+                if ( CoverageGrid::CellIndex(probe) == CoverageGrid::CellIndex(TestData::Budapest) )
+                    { ++budapestProbes; }
+            }
+            REQUIRE( budapestProbes > 500 );
+        }
+    }
+}
@@ -2,6 +2,8 @@
 //#define CATCH_CONFIG_MAIN
 #include <catch.hpp>
 
+#include <cstdlib>
+#include <new>
 #include <easylogging++.h>
 
 #include "config.hpp"
@@ -14,6 +16,34 @@ INITIALIZE_EASYLOGGINGPP
 
 
 
+// NOTE the replaced allocation functions live in this file to affect the test executable only,
+//      sample programs sharing the test implementations keep the standard ones.
+// Plain integer, needs no dynamic initialization when first touched by a thread
+static thread_local size_t ThreadAllocationCount = 0;
+
+void* operator new(size_t size)
+{
+    ++ThreadAllocationCount;
+    void *memory = malloc(size == 0 ? 1 : size);
+    if (memory == nullptr)
+        { throw bad_alloc(); }
+    return memory;
+}
+
+void operator delete(void *memory) noexcept
+    { free(memory); }
+
+
+namespace LocNet
+{
+    AllocationCounter::AllocationCounter() : _startCount(ThreadAllocationCount) {}
+
+    size_t AllocationCounter::count() const
+        { return ThreadAllocationCount - _startCount; }
+}
+
+
+
 int main( int argc, char* argv[] )
 {
     // Disable logging to prevent flooding the console
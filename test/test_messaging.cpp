@@ -1,6 +1,7 @@
 #include <catch.hpp>
 #include <easylogging++.h>
 
+#include "logging.hpp"
 #include "messaging.hpp"
 #include "testdata.hpp"
 #include "testimpls.hpp"
@@ -26,6 +27,66 @@ SCENARIO("ProtoBuf messaging", "[messaging]")
         }
     }
     
+    GIVEN("A node info") {
+        THEN("Its id is sent as hex text and decoded back to the binary id") {
+            iop::locnet::NodeInfo protoBufNode;
+            Converter::FillProtoBuf(&protoBufNode, TestData::NodeBudapest);
+            REQUIRE( protoBufNode.node_id() == TestData::NodeBudapest.id().ToHex() );
+            REQUIRE( Converter::FromProtoBuf(protoBufNode) == TestData::NodeBudapest );
+            
+            protoBufNode.set_node_id( "BudapestId" );
+            REQUIRE_THROWS( Converter::FromProtoBuf(protoBufNode) );
+        }
+    }
+    
+    GIVEN("A message to be sent") {
+        iop::locnet::Message message;
+        message.set_id(42);
+        message.mutable_request()->set_version({1,0,0});
+        message.mutable_request()->mutable_remote_node()->mutable_get_node_count();
+        
+        THEN("Its frame is the same as the serialized wrapper message") {
+            string frame;
+            MessageFraming::Serialize(message, frame);
+            
+            iop::locnet::MessageWithHeader wrapper;
+            wrapper.mutable_body()->CopyFrom(message);
+            wrapper.set_header(1);
+            wrapper.set_header( wrapper.ByteSizeLong() - MessageFraming::HeaderSize );
+            REQUIRE( frame == wrapper.SerializeAsString() );
+            REQUIRE( MessageFraming::ReadFrameSize( frame.data() ) == frame.size() - MessageFraming::HeaderSize );
+            
+            iop::locnet::Message parsed;
+            REQUIRE( MessageFraming::Parse( frame.data() + MessageFraming::HeaderSize,
+                frame.size() - MessageFraming::HeaderSize, parsed ) );
+            REQUIRE( parsed.SerializeAsString() == message.SerializeAsString() );
+        }
+        
+        THEN("Malformed frames are refused") {
+            string frame;
+            MessageFraming::Serialize(message, frame);
+            
+            iop::locnet::Message parsed;
+            REQUIRE_FALSE( MessageFraming::Parse( frame.data() + MessageFraming::HeaderSize,
+                frame.size() - MessageFraming::HeaderSize - 1, parsed ) );
+            frame[0] = 0;
+            REQUIRE_THROWS( MessageFraming::ReadFrameSize( frame.data() ) );
+        }
+        
+        THEN("Frame sizes with the highest bits set are decoded") {
+            const char header[] = { static_cast<char>(MessageFraming::HeaderFieldTag),
+                '\x01', '\x82', '\x03', '\xF4' };
+            REQUIRE( MessageFraming::ReadFrameSize(header) == 0xF4038201u );
+        }
+        
+        THEN("Messages over the frame size limit are refused") {
+            iop::locnet::Message oversized;
+            oversized.mutable_response()->set_details( string(MessageFraming::MaxFrameSize, 'x') );
+            string frame;
+            REQUIRE_THROWS_AS( MessageFraming::Serialize(oversized, frame), LocationNetworkError );
+        }
+    }
+    
     GIVEN("A message dispatcher") {
         shared_ptr<TestConfig> config( new TestConfig(TestData::NodeBudapest) );
         shared_ptr<ISpatialDatabase> geodb( new SpatiaLiteDatabase( config->myNodeInfo(),
@@ -59,7 +120,406 @@ SCENARIO("ProtoBuf messaging", "[messaging]")
             NodeInfo secondNeighbour( Converter::FromProtoBuf( getNeighboursResp.nodes(1) ) );
             REQUIRE( secondNeighbour == TestData::NodeWien );
         }
+        
+        THEN("Responses can be filled on a reusable arena") {
+            iop::locnet::Request request;
+            request.set_version({1,0,0});
+            request.mutable_client()->mutable_get_closest_nodes()->set_max_node_count(10);
+            request.mutable_client()->mutable_get_closest_nodes()->set_max_radius_km(20000);
+            Converter::FillProtoBuf( request.mutable_client()->mutable_get_closest_nodes()->mutable_location(),
+                TestData::Budapest );
+            unique_ptr<iop::locnet::Response> heapResponse = dispatcher.Dispatch(
+                unique_ptr<iop::locnet::Request>( new iop::locnet::Request(request) ) );
+            
+            MessageArena arena;
+            for (size_t round = 0; round < 3; ++round)
+            {
+                iop::locnet::Response *response = arena.Create<iop::locnet::Response>();
+                dispatcher.DispatchInto(request, *response);
+                REQUIRE( response->client().get_closest_nodes().nodes_size() > 0 );
+                REQUIRE( response->SerializeAsString() == heapResponse->SerializeAsString() );
+                arena.Reset();
+            }
+        }
+        
+        THEN("Requests are routed through the installed hooks") {
+            shared_ptr<RequestRouteMetrics> metrics( new RequestRouteMetrics() );
+            IRequestRouteHooks::Install(metrics);
+            scope_exit uninstallHooks( [] { IRequestRouteHooks::Install( shared_ptr<IRequestRouteHooks>() ); } );
+            
+            iop::locnet::Request request;
+            request.set_version({1,0,0});
+            request.mutable_client()->mutable_get_node_info();
+            for (size_t round = 0; round < 3; ++round)
+                { dispatcher.Dispatch( unique_ptr<iop::locnet::Request>( new iop::locnet::Request(request) ) ); }
+            request.mutable_local_service()->mutable_neighbourhood_changed();
+            REQUIRE_THROWS( dispatcher.Dispatch( unique_ptr<iop::locnet::Request>( new iop::locnet::Request(request) ) ) );
+            
+            map<string, RequestRouteStats> stats = metrics->stats();
+            REQUIRE( stats["Client.GetNodeInfo"].servedCount == 3 );
+            REQUIRE( stats["LocalService.NeighbourhoodChanged"].failedCount == 1 );
+            
+            request.clear_version();
+            REQUIRE_THROWS( dispatcher.Dispatch( unique_ptr<iop::locnet::Request>( new iop::locnet::Request(request) ) ) );
+            request.set_version({1,0,0});
+            request.mutable_local_service()->clear_neighbourhood_changed();
+            REQUIRE_THROWS( dispatcher.Dispatch( unique_ptr<iop::locnet::Request>( new iop::locnet::Request(request) ) ) );
+            REQUIRE( metrics->stats().size() == 2 );
+        }
+        
+        THEN("Admission hooks may refuse requests") {
+            struct RefuseClientHooks : public IRequestRouteHooks
+            {
+                bool Admit(const char *route) override
+                    { return string(route).find("Client.") != 0; }
+                void Served(const char*, Duration, bool) override {}
+            };
+            IRequestRouteHooks::Install( make_shared<RefuseClientHooks>() );
+            scope_exit uninstallHooks( [] { IRequestRouteHooks::Install( shared_ptr<IRequestRouteHooks>() ); } );
+            
+            iop::locnet::Request request;
+            request.set_version({1,0,0});
+            request.mutable_client()->mutable_get_node_info();
+            ErrorCode refusalError = ErrorCode::ERROR_INTERNAL;
+            try { dispatcher.Dispatch( unique_ptr<iop::locnet::Request>( new iop::locnet::Request(request) ) ); }
+            catch (LocationNetworkError &ex) { refusalError = ex.code(); }
+            REQUIRE( refusalError == ErrorCode::ERROR_BAD_STATE );
+            request.mutable_remote_node()->mutable_get_node_count();
+            REQUIRE( dispatcher.Dispatch( unique_ptr<iop::locnet::Request>( new iop::locnet::Request(request) ) )
+                ->remote_node().get_node_count().node_count() > 0 );
+        }
+        
+        THEN("The cached encoding of the node info is spliced into served responses until it is updated") {
+            shared_ptr<NodeInfoEncoding> selfEncoding = geodb->ThisNode().encoding();
+            REQUIRE( selfEncoding );
+            REQUIRE( geodb->ThisNode().encoding() == selfEncoding );
+            
+            iop::locnet::Request request;
+            request.set_version({1,0,0});
+            request.mutable_remote_node()->mutable_get_node_info();
+            auto serveSpliced = [&dispatcher, &request] ()
+            {
+                SplicedResponseFields &splicedFields = SplicedResponseFields::ThreadInstance();
+                splicedFields.Activate();
+                scope_exit resetSplicedFields( [&splicedFields] { splicedFields.Reset(); } );
+                
+                iop::locnet::Message message;
+                message.mutable_response()->set_status(iop::locnet::Status::STATUS_OK);
+                dispatcher.DispatchInto( request, *message.mutable_response() );
+                REQUIRE_FALSE( message.response().remote_node().get_node_info().has_node_info() );
+                
+                string frame;
+                MessageFraming::Serialize(message, splicedFields, frame);
+                iop::locnet::Message parsed;
+                REQUIRE( MessageFraming::Parse( frame.data() + MessageFraming::HeaderSize,
+                    frame.size() - MessageFraming::HeaderSize, parsed ) );
+                REQUIRE( parsed.response().status() == iop::locnet::Status::STATUS_OK );
+                return Converter::FromProtoBuf( parsed.response().remote_node().get_node_info().node_info() );
+            };
+            
+            REQUIRE( serveSpliced() == TestData::NodeBudapest );
+            REQUIRE( selfEncoding->bytes() );
+            REQUIRE( serveSpliced() == TestData::NodeBudapest );
+            
+            NodeDbEntry updatedSelf = geodb->ThisNode();
+            updatedSelf.contact() = NodeContact( updatedSelf.contact().address(), 1234, updatedSelf.contact().clientPort() );
+            geodb->Update(updatedSelf, false);
+            REQUIRE( geodb->ThisNode().encoding() != selfEncoding );
+            REQUIRE( serveSpliced().contact().nodePort() == 1234 );
+            
+            REQUIRE( dispatcher.Dispatch( unique_ptr<iop::locnet::Request>( new iop::locnet::Request(request) ) )
+                ->remote_node().get_node_info().node_info().contact().node_port() == 1234 );
+        }
     }
     
 }
 
+
+
+
+SCENARIO("Diagnostic logging switches", "[messaging]")
+{
+    GIVEN("Subsystems with default diagnostic levels")
+    {
+        scope_exit restoreLevels( [] { Diagnostics::Configure("all:debug"); } );
+        size_t formatCount = 0;
+        auto formatMessage = [&formatCount] { ++formatCount; return string("formatted"); };
+        
+        THEN("formatting of disabled levels is never evaluated")
+        {
+            REQUIRE( Diagnostics::level(LogSubsystem::Network) == Diagnostics::DefaultLevel );
+            LOG_TRACE(Network) << formatMessage();
+            REQUIRE( formatCount == 0 );
+            LOG_DEBUG(Network) << formatMessage();
+            REQUIRE( formatCount == 1 );
+            
+            Diagnostics::Configure("network:trace,messaging:off");
+            LOG_TRACE(Network) << formatMessage();
+            LOG_DEBUG(Messaging) << formatMessage();
+            LOG_TRACE(Node) << formatMessage();
+            REQUIRE( formatCount == 2 );
+        }
+        
+        THEN("invalid settings are refused without changing any levels")
+        {
+            REQUIRE_THROWS_AS( Diagnostics::Configure("node:trace,network:loud"), LocationNetworkError );
+            REQUIRE_THROWS_AS( Diagnostics::Configure("kernel:trace"), LocationNetworkError );
+            REQUIRE( Diagnostics::level(LogSubsystem::Node) == Diagnostics::DefaultLevel );
+            
+            Diagnostics::Configure("all:off");
+            REQUIRE( Diagnostics::level(LogSubsystem::Database) == DiagnosticLevel::Off );
+        }
+    }
+}
+
+
+
+SCENARIO("Asynchronous log backend", "[messaging]")
+{
+    GIVEN("A log backend with small rings that is not started yet")
+    {
+        const string logPath = "test-asynclog.log";
+        remove( logPath.c_str() );
+        scope_exit removeLog( [logPath] { remove( logPath.c_str() ); } );
+        AsyncLogBackend backend(4);
+        
+        THEN("records over the ring capacity are dropped instead of blocking")
+        {
+            size_t appendedCount = 0;
+            for (size_t idx = 0; idx < 10; ++idx)
+            {
+                if ( backend.Append(el::Level::Info, "src/test.cpp", idx, "Record " + to_string(idx)) )
+                    { ++appendedCount; }
+            }
+            REQUIRE( appendedCount == 4 );
+            REQUIRE( backend.droppedCount() == 6 );
+            
+            THEN("queued records are written to the log file until shut down")
+            {
+                backend.Start(logPath);
+                backend.Shutdown();
+                REQUIRE( backend.writtenCount() == 4 );
+                
+                ifstream logFile(logPath);
+                vector<string> lines;
+                string line;
+                while ( getline(logFile, line) )
+                    { lines.push_back(line); }
+                REQUIRE( lines.size() == 5 );
+                REQUIRE( lines[0].find("INFO Record 0 (test.cpp:0)") != string::npos );
+                REQUIRE( lines[3].find("INFO Record 3 (test.cpp:3)") != string::npos );
+                REQUIRE( lines[4].find("WARNING 6 log records were dropped") != string::npos );
+                
+                THEN("records appended after shutdown are written directly")
+                {
+                    REQUIRE( backend.Append(el::Level::Info, "src/test.cpp", 42, "Late record") );
+                    REQUIRE( backend.writtenCount() == 5 );
+                    logFile.clear();
+                    REQUIRE( getline(logFile, line) );
+                    REQUIRE( line.find("INFO Late record (test.cpp:42)") != string::npos );
+                }
+            }
+        }
+    }
+}
+
+
+
+SCENARIO("Allocations of node queries", "[.][load]")
+{
+    GIVEN("A node with a few stored entries advertising services and a message dispatcher")
+    {
+        shared_ptr<TestConfig> config( new TestConfig(TestData::NodeBudapest) );
+        shared_ptr<ISpatialDatabase> geodb( new SpatiaLiteDatabase( config->myNodeInfo(),
+            SpatiaLiteDatabase::IN_MEMORY_DB, chrono::hours(1) ) );
+        for ( NodeDbEntry entry : { TestData::EntryKecskemet, TestData::EntryLondon,
+                TestData::EntryNewYork, TestData::EntryWien, TestData::EntryCapeTown } )
+        {
+            entry.services()["Profile"] = ServiceInfo( "Profile", 16001, string(40, 'p') );
+            entry.services()["Relay"]   = ServiceInfo( "Relay", 16002, string(40, 'r') );
+            geodb->Store(entry);
+        }
+        
+        shared_ptr<INodeProxyFactory> connectionFactory( new DummyNodeConnectionFactory() );
+        shared_ptr<IChangeListenerFactory> listenerFactory( new DummyChangeListenerFactory() );
+        shared_ptr<Node> node = Node::Create(config, geodb, connectionFactory);
+        IncomingRequestDispatcher dispatcher(node, listenerFactory);
+        
+        iop::locnet::Request request;
+        request.set_version({1,0,0});
+        request.mutable_client()->mutable_get_closest_nodes()->set_max_node_count(10);
+        request.mutable_client()->mutable_get_closest_nodes()->set_max_radius_km(20000);
+        Converter::FillProtoBuf( request.mutable_client()->mutable_get_closest_nodes()->mutable_location(),
+            TestData::Budapest );
+        
+        // NOTE counts include allocations of the database queries, they are only reported here
+        THEN("the heap allocations per request of the main query methods are measured")
+        {
+            const size_t iterationCount = 100;
+            map< string, function<size_t()> > queries{
+                { "GetClosestNodesByDistance", [&node] { return node->GetClosestNodesByDistance(
+                    TestData::Budapest, 20000, 10, Neighbours::Included ).size(); } },
+                { "GetRandomNodes", [&node] { return node->GetRandomNodes(10, Neighbours::Included).size(); } },
+                { "GetNeighbourNodesByDistance", [&node] { return node->GetNeighbourNodesByDistance().size(); } },
+                { "Dispatch GetClosestNodes", [&dispatcher, &request] {
+                    MessageArena &arena = MessageArena::ThreadInstance();
+                    iop::locnet::Response *response = arena.Create<iop::locnet::Response>();
+                    dispatcher.DispatchInto(request, *response);
+                    size_t nodeCount = response->client().get_closest_nodes().nodes_size();
+                    arena.Reset();
+                    return nodeCount; } },
+            };
+            
+            for (auto const &query : queries)
+            {
+                // Warm up thread local caches and the prepared statements of the database
+                REQUIRE( query.second() > 0 );
+                
+                AllocationCounter allocations;
+                for (size_t idx = 0; idx < iterationCount; ++idx)
+                    { query.second(); }
+                cout << query.first << ": " << static_cast<double>( allocations.count() ) / iterationCount
+                     << " allocations per request" << endl;
+            }
+        }
+    }
+}
+
+
+
+SCENARIO("Cost of encoding listed nodes", "[.][load]")
+{
+    GIVEN("A node with stored entries advertising services and a message dispatcher")
+    {
+        shared_ptr<TestConfig> config( new TestConfig(TestData::NodeBudapest) );
+        shared_ptr<ISpatialDatabase> geodb( new SpatiaLiteDatabase( config->myNodeInfo(),
+            SpatiaLiteDatabase::IN_MEMORY_DB, chrono::hours(1) ) );
+        for ( NodeDbEntry entry : { TestData::EntryKecskemet, TestData::EntryLondon,
+                TestData::EntryNewYork, TestData::EntryWien, TestData::EntryCapeTown } )
+        {
+            entry.services()["Profile"] = ServiceInfo( "Profile", 16001, string(40, 'p') );
+            entry.services()["Relay"]   = ServiceInfo( "Relay", 16002, string(40, 'r') );
+            geodb->Store(entry);
+        }
+        
+        shared_ptr<INodeProxyFactory> connectionFactory( new DummyNodeConnectionFactory() );
+        shared_ptr<IChangeListenerFactory> listenerFactory( new DummyChangeListenerFactory() );
+        shared_ptr<Node> node = Node::Create(config, geodb, connectionFactory);
+        IncomingRequestDispatcher dispatcher(node, listenerFactory);
+        
+        iop::locnet::Request request;
+        request.set_version({1,0,0});
+        request.mutable_client()->mutable_get_closest_nodes()->set_max_node_count(10);
+        request.mutable_client()->mutable_get_closest_nodes()->set_max_radius_km(20000);
+        Converter::FillProtoBuf( request.mutable_client()->mutable_get_closest_nodes()->mutable_location(),
+            TestData::Budapest );
+        
+        // NOTE times include the database query and serving the request, only the encoding differs
+        THEN("responses spliced from the cached encodings of the nodes are cheaper than converting them")
+        {
+            const size_t iterationCount = 1000;
+            auto serve = [&dispatcher, &request] (bool splicing, string &frame)
+            {
+                MessageArena &arena = MessageArena::ThreadInstance();
+                scope_exit resetArena( [&arena] { arena.Reset(); } );
+                SplicedResponseFields &splicedFields = SplicedResponseFields::ThreadInstance();
+                scope_exit resetSplicedFields( [&splicedFields] { splicedFields.Reset(); } );
+                if (splicing)
+                    { splicedFields.Activate(); }
+                
+                iop::locnet::Message *message = arena.Create<iop::locnet::Message>();
+                dispatcher.DispatchInto( request, *message->mutable_response() );
+                MessageFraming::Serialize(*message, splicedFields, frame);
+            };
+            
+            string plainFrame;
+            string splicedFrame;
+            serve(false, plainFrame);
+            serve(true, splicedFrame);
+            iop::locnet::Message plainMessage;
+            iop::locnet::Message splicedMessage;
+            REQUIRE( MessageFraming::Parse( plainFrame.data() + MessageFraming::HeaderSize,
+                plainFrame.size() - MessageFraming::HeaderSize, plainMessage ) );
+            REQUIRE( MessageFraming::Parse( splicedFrame.data() + MessageFraming::HeaderSize,
+                splicedFrame.size() - MessageFraming::HeaderSize, splicedMessage ) );
+            REQUIRE( splicedMessage.SerializeAsString() == plainMessage.SerializeAsString() );
+            size_t nodeCount = plainMessage.response().client().get_closest_nodes().nodes_size();
+            REQUIRE( nodeCount > 0 );
+            
+            for (bool splicing : { false, true })
+            {
+                string frame;
+                auto startTime = chrono::steady_clock::now();
+                for (size_t idx = 0; idx < iterationCount; ++idx)
+                    { serve(splicing, frame); }
+                chrono::duration<double, nano> serveTime = chrono::steady_clock::now() - startTime;
+                cout << ( splicing ? "Serving with spliced cached encodings: " : "Serving with converted nodes: " )
+                     << serveTime.count() / iterationCount / nodeCount << " ns per node" << endl;
+            }
+            
+            vector<NodeInfo> nodes = node->GetClosestNodesByDistance(
+                TestData::Budapest, 20000, 10, Neighbours::Included );
+            size_t encodedSize = 0;
+            auto startTime = chrono::steady_clock::now();
+            for (size_t idx = 0; idx < iterationCount; ++idx)
+            {
+                for (auto const &listedNode : nodes)
+                {
+                    iop::locnet::NodeInfo message;
+                    Converter::FillProtoBuf(&message, listedNode);
+                    encodedSize += message.SerializeAsString().size();
+                }
+            }
+            chrono::duration<double, nano> convertTime = chrono::steady_clock::now() - startTime;
+            
+            startTime = chrono::steady_clock::now();
+            for (size_t idx = 0; idx < iterationCount; ++idx)
+            {
+                for (auto const &listedNode : nodes)
+                    { encodedSize -= Converter::Serialized(listedNode)->size(); }
+            }
+            chrono::duration<double, nano> cachedTime = chrono::steady_clock::now() - startTime;
+            
+            cout << "Encoding a node: " << convertTime.count() / iterationCount / nodes.size() << " ns, "
+                 << "taking its cached encoding: " << cachedTime.count() / iterationCount / nodes.size() << " ns" << endl;
+            REQUIRE( encodedSize == 0 );
+        }
+    }
+}
+
+
+
+SCENARIO("Cost of disabled diagnostic logging", "[.][load]")
+{
+    GIVEN("A message with a list of nodes to be logged")
+    {
+        unique_ptr<iop::locnet::Message> message( new iop::locnet::Message() );
+        iop::locnet::GetRandomNodesResponse *nodesResp =
+            message->mutable_response()->mutable_remote_node()->mutable_get_random_nodes();
+        for (size_t idx = 0; idx < 50; ++idx)
+            { Converter::FillProtoBuf( nodesResp->add_nodes(), TestData::NodeBudapest ); }
+        
+        THEN("skipped trace statements are orders of magnitude cheaper than formatting the message")
+        {
+            const size_t iterationCount = 1000;
+            scope_exit restoreLevels( [] { Diagnostics::Configure("all:debug"); } );
+            Diagnostics::Configure("network:debug");
+            
+            size_t formattedSize = 0;
+            auto startTime = chrono::steady_clock::now();
+            for (size_t idx = 0; idx < iterationCount; ++idx)
+                { formattedSize += message->ShortDebugString().size(); }
+            chrono::duration<double, nano> formatTime = chrono::steady_clock::now() - startTime;
+            
+            startTime = chrono::steady_clock::now();
+            for (size_t idx = 0; idx < iterationCount; ++idx)
+                { LOG_TRACE(Network) << "Sending message " << message->ShortDebugString(); }
+            chrono::duration<double, nano> disabledTime = chrono::steady_clock::now() - startTime;
+            
+            cout << "Formatting message: " << formatTime.count() / iterationCount << " ns, "
+                 << "disabled trace statement: " << disabledTime.count() / iterationCount << " ns" << endl;
+            REQUIRE( formattedSize > 0 );
+            REQUIRE( disabledTime.count() * 100 < formatTime.count() );
+        }
+    }
+}
@@ -1,3 +1,5 @@
+#include <atomic>
+#include <future>
 #include <thread>
 
 #include <asio.hpp>
@@ -18,17 +20,20 @@ using namespace asio::ip;
 void reactorLoop(const string &threadName)
 {
     LOG(DEBUG) << "Thread " << threadName << " started";
-    try
+    Reactor::MarkReactorThread();
+    asio::io_service &reactor = Reactor::Instance().AsioService();
+    while ( ! reactor.stopped() )
     {
-        asio::io_service &reactor = Reactor::Instance().AsioService();
-        reactor.run();
-        reactor.reset();            
-        LOG(DEBUG) << "Thread " << threadName << " succesfully executed a single task";
-    }
-    catch (exception &ex)
-    {
-        LOG(ERROR) << "Async operation failed: " << ex.what();
-        LOG(DEBUG) << "Thread " << threadName << " failed at a single task";
+        try
+        {
+            reactor.run();
+            LOG(DEBUG) << "Thread " << threadName << " succesfully executed all tasks";
+        }
+        catch (exception &ex)
+        {
+            LOG(ERROR) << "Async operation failed: " << ex.what();
+            LOG(DEBUG) << "Thread " << threadName << " failed at a single task";
+        }
     }
     LOG(DEBUG) << "Thread " << threadName << " shut down";
 }
@@ -60,7 +65,13 @@ SCENARIO("Client-Server requests and responses with TCP networking", "[network]"
         tcpServer->StartListening();
         
         thread reactorMainThread( [] { reactorLoop("ReactorMain"); } );
-        reactorMainThread.detach();
+        // NOTE reset only after the thread has finished, otherwise a late stop may leave the reactor stopped for the next test
+        scope_exit stopReactor( [&reactorMainThread]
+        {
+            Reactor::Instance().Shutdown();
+            reactorMainThread.join();
+            Reactor::Instance().AsioService().reset();
+        } );
 
         THEN("It serves clients via sync TCP")
         {
@@ -94,6 +105,65 @@ SCENARIO("Client-Server requests and responses with TCP networking", "[network]"
             }
         }
 
+        THEN("It serves requests pipelined in a single write")
+        {
+            string frames;
+            for (uint32_t messageId = 1; messageId <= 3; ++messageId)
+            {
+                iop::locnet::Message requestMsg;
+                requestMsg.set_id(messageId);
+                requestMsg.mutable_request()->mutable_remote_node()->mutable_get_node_count();
+                requestMsg.mutable_request()->set_version({1,0,0});
+                string frame;
+                MessageFraming::Serialize(requestMsg, frame);
+                frames += frame;
+            }
+
+            shared_ptr<tcp::socket> socket( new tcp::socket( Reactor::Instance().AsioService() ) );
+            socket->connect( tcp::endpoint( address::from_string("127.0.0.1"), nodeContact.nodePort() ) );
+            asio::write( *socket, asio::buffer(frames) );
+
+            shared_ptr<IProtoBufChannel> clientChannel( new AsyncProtoBufTcpChannel(socket) );
+            for (uint32_t messageId = 1; messageId <= 3; ++messageId)
+            {
+                unique_ptr<iop::locnet::Message> msgReceived( clientChannel->ReceiveMessage(asio::use_future).get() );
+                REQUIRE( msgReceived );
+                REQUIRE( msgReceived->id() == messageId );
+                REQUIRE( msgReceived->response().remote_node().get_node_count().node_count() == 6 );
+            }
+        }
+
+        THEN("Messages sent in a burst are queued and written in order")
+        {
+            SendQueueStats statsBefore = AsyncMessageWriter::stats();
+            shared_ptr<IProtoBufChannel> clientChannel( new AsyncProtoBufTcpChannel(
+                        nodeContact.nodeEndpoint() ) );
+
+            const uint32_t requestCount = 20;
+            shared_ptr< atomic<uint32_t> > sentCount( new atomic<uint32_t>(0) );
+            for (uint32_t messageId = 1; messageId <= requestCount; ++messageId)
+            {
+                unique_ptr<iop::locnet::Message> requestMsg( new iop::locnet::Message() );
+                requestMsg->set_id(messageId);
+                requestMsg->mutable_request()->mutable_remote_node()->mutable_get_node_count();
+                requestMsg->mutable_request()->set_version({1,0,0});
+                clientChannel->SendMessage( move(requestMsg), [sentCount] { ++*sentCount; } );
+            }
+
+            for (uint32_t messageId = 1; messageId <= requestCount; ++messageId)
+            {
+                unique_ptr<iop::locnet::Message> msgReceived( clientChannel->ReceiveMessage(asio::use_future).get() );
+                REQUIRE( msgReceived );
+                REQUIRE( msgReceived->id() == messageId );
+            }
+            REQUIRE( *sentCount == requestCount );
+            REQUIRE( clientChannel->sendQueueDepth() == 0 );
+
+            SendQueueStats statsAfter = AsyncMessageWriter::stats();
+            REQUIRE( statsAfter.writtenFrameCount - statsBefore.writtenFrameCount >= 2 * requestCount );
+            REQUIRE( statsAfter.writeCount - statsBefore.writeCount <= statsAfter.writtenFrameCount - statsBefore.writtenFrameCount );
+        }
+
         THEN("It serves transparent clients using ProtoBuf/TCP protocol")
         {
             shared_ptr<IProtoBufChannel> clientChannel( new AsyncProtoBufTcpChannel(
@@ -107,8 +177,88 @@ SCENARIO("Client-Server requests and responses with TCP networking", "[network]"
             size_t nodeCount = client.GetNodeCount();
             REQUIRE( nodeCount == 6 );
         }
-
-        Reactor::Instance().Shutdown();
+        
+        THEN("It serves requests on a worker pool")
+        {
+            shared_ptr<DispatchWorkerPool> workerPool( new DispatchWorkerPool("NodeRequests", 2, 16) );
+            tcpServer->workerPool(workerPool);
+            
+            shared_ptr<IProtoBufChannel> clientChannel( new AsyncProtoBufTcpChannel(
+                        nodeContact.nodeEndpoint() ) );
+            shared_ptr<ProtoBufClientSession> clientSession( ProtoBufClientSession::Create(clientChannel) );
+            clientSession->StartMessageLoop();
+            
+            shared_ptr<IBlockingRequestDispatcher> netDispatcher( new NetworkDispatcher(config, clientSession) );
+            NodeMethodsProtoBufClient client(netDispatcher, {});
+            REQUIRE( client.GetNodeCount() == 6 );
+            REQUIRE( client.GetNodeInfo() == TestData::NodeBudapest );
+            REQUIRE( workerPool->stats().executedCount == 2 );
+        }
+        
+        THEN("Channels are connected asynchronously")
+        {
+            // NOTE localhost may also resolve to an IPv6 address that is not served, must fall back to IPv4
+            shared_ptr<IProtoBufChannel> clientChannel( AsyncProtoBufTcpChannel::Connect(
+                NetworkEndpoint( "localhost", nodeContact.nodePort() ), chrono::seconds(5), asio::use_future ).get() );
+            shared_ptr<ProtoBufClientSession> clientSession( ProtoBufClientSession::Create(clientChannel) );
+            clientSession->StartMessageLoop();
+            
+            shared_ptr<IBlockingRequestDispatcher> netDispatcher( new NetworkDispatcher(config, clientSession) );
+            NodeMethodsProtoBufClient client(netDispatcher, {});
+            REQUIRE( client.GetNodeCount() == 6 );
+            
+            // Nobody listens on the port of the client interface here
+            auto refused = AsyncProtoBufTcpChannel::Connect(
+                nodeContact.clientEndpoint(), chrono::seconds(5), asio::use_future );
+            REQUIRE_THROWS_AS( refused.get(), LocationNetworkError );
+        }
+        
+        THEN("Remote calls are kept in flight asynchronously")
+        {
+            shared_ptr<TcpNodeConnectionFactory> connectionFactory( new TcpNodeConnectionFactory(config) );
+            shared_ptr<PeerLinkManager> peerLinks( new PeerLinkManager(
+                connectionFactory, shared_ptr<PeerFailureCache>(), 1, chrono::minutes(10) ) );
+            
+            shared_ptr<IAsyncNodeMethods> proxy = peerLinks->ConnectToAsync( nodeContact.nodeEndpoint() );
+            vector< future<size_t> > nodeCounts;
+            for (size_t i = 0; i < 5; ++i)
+                { nodeCounts.push_back( proxy->GetNodeCount() ); }
+            future<NodeInfo> nodeInfo = proxy->GetNodeInfo();
+            
+            for (auto &nodeCount : nodeCounts)
+                { REQUIRE( nodeCount.get() == 6 ); }
+            REQUIRE( nodeInfo.get() == TestData::NodeBudapest );
+            REQUIRE( peerLinks->linkCount() == 1 );
+            
+            // Blocking and asynchronous proxies share the same link
+            REQUIRE( peerLinks->ConnectTo( nodeContact.nodeEndpoint() )->GetNodeCount() == 6 );
+            REQUIRE( peerLinks->linkCount() == 1 );
+        }
+        
+        THEN("Peer links are reused by node proxies")
+        {
+            shared_ptr<TcpNodeConnectionFactory> connectionFactory( new TcpNodeConnectionFactory(config) );
+            PeerLinkManager peerLinks( connectionFactory, shared_ptr<PeerFailureCache>(), 1, chrono::minutes(10) );
+            
+            shared_ptr<INodeMethods> proxy1 = peerLinks.ConnectTo( nodeContact.nodeEndpoint() );
+            shared_ptr<INodeMethods> proxy2 = peerLinks.ConnectTo( nodeContact.nodeEndpoint() );
+            REQUIRE( peerLinks.linkCount() == 1 );
+            REQUIRE( proxy1->GetNodeCount() == 6 );
+            REQUIRE( proxy2->GetNodeInfo() == TestData::NodeBudapest );
+            
+            // Link count is limited, another endpoint of the same node replaces the old link
+            shared_ptr<INodeMethods> proxy3 = peerLinks.ConnectTo(
+                NetworkEndpoint( "localhost", nodeContact.nodePort() ) );
+            REQUIRE( peerLinks.linkCount() == 1 );
+            REQUIRE( proxy3->GetNodeCount() == 6 );
+            REQUIRE( proxy1->GetNodeCount() == 6 );
+            
+            PeerLinkManager expiringPeerLinks( connectionFactory, shared_ptr<PeerFailureCache>(), 10, chrono::seconds(0) );
+            shared_ptr<INodeMethods> proxy4 = expiringPeerLinks.ConnectTo( nodeContact.nodeEndpoint() );
+            REQUIRE( expiringPeerLinks.linkCount() == 1 );
+            REQUIRE( expiringPeerLinks.EvictIdleLinks() == 1 );
+            REQUIRE( expiringPeerLinks.linkCount() == 0 );
+        }
     }
 }
 
@@ -134,7 +284,13 @@ SCENARIO("Neighbourhood notifications for local services", "[network]")
         tcpServer->StartListening();
 
         thread reactorMainThread( [] { reactorLoop("ReactorMain"); } );
-        reactorMainThread.detach();
+        // NOTE reset only after the thread has finished, otherwise a late stop may leave the reactor stopped for the next test
+        scope_exit stopReactor( [&reactorMainThread]
+        {
+            Reactor::Instance().Shutdown();
+            reactorMainThread.join();
+            Reactor::Instance().AsioService().reset();
+        } );
         
         THEN("It properly notifies local services on changes")
         {
@@ -167,8 +323,8 @@ SCENARIO("Neighbourhood notifications for local services", "[network]")
             shared_ptr<IBlockingRequestDispatcher> requestDispatcher( new NetworkDispatcher(config, session) );
             LOG(INFO) << "Sending registerservice request";
             unique_ptr<iop::locnet::Request> registerRequest( new iop::locnet::Request() );
-            registerRequest->mutable_local_service()->mutable_register_service()->set_allocated_service(
-                Converter::ToProtoBuf( ServiceInfo("ServiceType::Profile", 16999, "ProfileServerId") ) );
+            Converter::FillProtoBuf( registerRequest->mutable_local_service()->mutable_register_service()->mutable_service(),
+                ServiceInfo("ServiceType::Profile", 16999, "ProfileServerId") );
             requestDispatcher->Dispatch( move(registerRequest) );
             
             for (size_t requestsSent = 0; requestsSent < 3; ++requestsSent)
@@ -199,3 +355,848 @@ SCENARIO("Neighbourhood notifications for local services", "[network]")
     }
 }
 
+
+
+
+SCENARIO("Periodic job scheduling", "[network]")
+{
+    GIVEN("A scheduler driven by a virtual clock")
+    {
+        PeriodicScheduler::TimePoint virtualNow = chrono::steady_clock::now();
+        vector<PeriodicScheduler::Task> pendingTasks;
+        shared_ptr<PeriodicScheduler> scheduler = PeriodicScheduler::Create(
+            [&virtualNow] { return virtualNow; },
+            [&pendingTasks] (const PeriodicScheduler::Task &task) { pendingTasks.push_back(task); } );
+        
+        size_t maintenanceRuns = 0;
+        size_t discoveryRuns = 0;
+        scheduler->AddJob( "Maintenance", chrono::hours(7), chrono::minutes(10),
+            [&maintenanceRuns] { ++maintenanceRuns; } );
+        scheduler->AddJob( "Discovery", chrono::minutes(5), chrono::seconds(0),
+            [&discoveryRuns] { ++discoveryRuns; throw runtime_error("Discovery failed"); } );
+        
+        THEN("jobs are run only when due")
+        {
+            REQUIRE( scheduler->RunDueJobs() == 0 );
+            REQUIRE( scheduler->NextDueTime() == virtualNow + chrono::minutes(5) );
+            
+            virtualNow += chrono::minutes(5);
+            REQUIRE( scheduler->RunDueJobs() == 1 );
+            REQUIRE( pendingTasks.size() == 1 );
+            pendingTasks.back()();
+            pendingTasks.clear();
+            REQUIRE( discoveryRuns == 1 );
+            REQUIRE( scheduler->GetStats("Discovery").runCount == 1 );
+            REQUIRE( scheduler->GetStats("Discovery").failureCount == 1 );
+            
+            virtualNow += chrono::hours(7) + chrono::minutes(10);
+            REQUIRE( scheduler->RunDueJobs() == 2 );
+            for (auto &task : pendingTasks)
+                { task(); }
+            REQUIRE( maintenanceRuns == 1 );
+            REQUIRE( discoveryRuns == 2 );
+            REQUIRE( scheduler->GetStats("Maintenance").runCount == 1 );
+            REQUIRE( scheduler->GetStats("Maintenance").failureCount == 0 );
+            REQUIRE_THROWS( scheduler->GetStats("NonExistingJob") );
+        }
+        
+        THEN("overlapping runs of the same job are skipped")
+        {
+            virtualNow += chrono::minutes(5);
+            REQUIRE( scheduler->RunDueJobs() == 1 );
+            virtualNow += chrono::minutes(5);
+            REQUIRE( scheduler->RunDueJobs() == 0 );
+            REQUIRE( scheduler->GetStats("Discovery").skippedCount == 1 );
+            
+            pendingTasks.back()();
+            pendingTasks.clear();
+            virtualNow += chrono::minutes(5);
+            REQUIRE( scheduler->RunDueJobs() == 1 );
+            REQUIRE( scheduler->GetStats("Discovery").runCount == 1 );
+        }
+        
+        THEN("no jobs are run after shutdown")
+        {
+            scheduler->Shutdown();
+            virtualNow += chrono::hours(8);
+            REQUIRE( scheduler->RunDueJobs() == 0 );
+        }
+        
+        THEN("triggered jobs run once after triggers settle down")
+        {
+            size_t updateRuns = 0;
+            scheduler->AddTriggeredJob( "Update", chrono::seconds(3), [&updateRuns] { ++updateRuns; } );
+            REQUIRE_THROWS( scheduler->Trigger("Discovery") );
+            
+            scheduler->Trigger("Update");
+            virtualNow += chrono::seconds(2);
+            scheduler->Trigger("Update");
+            virtualNow += chrono::seconds(2);
+            REQUIRE( scheduler->RunDueJobs() == 0 );
+            virtualNow += chrono::seconds(1);
+            REQUIRE( scheduler->RunDueJobs() == 1 );
+            
+            // Triggers during the run result in a single follow-up run
+            scheduler->Trigger("Update");
+            scheduler->Trigger("Update");
+            virtualNow += chrono::seconds(3);
+            REQUIRE( scheduler->RunDueJobs() == 0 );
+            pendingTasks.back()();
+            pendingTasks.clear();
+            REQUIRE( updateRuns == 1 );
+            REQUIRE( scheduler->RunDueJobs() == 0 );
+            virtualNow += chrono::seconds(3);
+            REQUIRE( scheduler->RunDueJobs() == 1 );
+            pendingTasks.back()();
+            REQUIRE( updateRuns == 2 );
+            
+            // Not run again without triggers, only the periodic job is due
+            virtualNow += chrono::hours(1);
+            REQUIRE( scheduler->RunDueJobs() == 1 );
+            REQUIRE( scheduler->GetStats("Update").runCount == 2 );
+        }
+    }
+    
+    GIVEN("A node reporting self info changes to a triggered job")
+    {
+        shared_ptr<TestConfig> config( new TestConfig(TestData::NodeBudapest) );
+        shared_ptr<ISpatialDatabase> geodb( new SpatiaLiteDatabase( config->myNodeInfo(),
+            SpatiaLiteDatabase::IN_MEMORY_DB, chrono::hours(1) ) );
+        shared_ptr<INodeProxyFactory> connectionFactory( new DummyNodeConnectionFactory() );
+        shared_ptr<Node> node = Node::Create(config, geodb, connectionFactory);
+        
+        PeriodicScheduler::TimePoint virtualNow = chrono::steady_clock::now();
+        shared_ptr<PeriodicScheduler> scheduler = PeriodicScheduler::Create(
+            [&virtualNow] { return virtualNow; },
+            [] (const PeriodicScheduler::Task &task) { task(); } );
+        size_t neighbourhoodUpdates = 0;
+        scheduler->AddTriggeredJob( "SelfInfoUpdate", chrono::seconds(3), [node, &neighbourhoodUpdates]
+        {
+            ++neighbourhoodUpdates;
+            node->RenewNeighbours();
+        } );
+        node->selfInfoChangedCallback( [scheduler] { scheduler->Trigger("SelfInfoUpdate"); } );
+        
+        THEN("several changes within the quiet period result in a single neighbourhood update")
+        {
+            node->RegisterService( ServiceInfo("Profile", 16999, "ProfileServerId") );
+            virtualNow += chrono::seconds(1);
+            node->RegisterService( ServiceInfo("Relay", 16998, "RelayServerId") );
+            virtualNow += chrono::seconds(1);
+            node->DeregisterService("Relay");
+            virtualNow += chrono::seconds(1);
+            node->DetectedExternalAddress( IpAddress::FromString("10.1.2.3") );
+            REQUIRE( scheduler->RunDueJobs() == 0 );
+            
+            virtualNow += chrono::seconds(3);
+            REQUIRE( scheduler->RunDueJobs() == 1 );
+            REQUIRE( neighbourhoodUpdates == 1 );
+            virtualNow += chrono::minutes(1);
+            REQUIRE( scheduler->RunDueJobs() == 0 );
+            REQUIRE( neighbourhoodUpdates == 1 );
+        }
+        
+        node->selfInfoChangedCallback( function<void()>() );
+    }
+    
+    GIVEN("A scheduler running jobs on its own threads")
+    {
+        PeriodicScheduler::TimePoint virtualNow = chrono::steady_clock::now();
+        shared_ptr<PeriodicScheduler> scheduler = PeriodicScheduler::Create(
+            [&virtualNow] { return virtualNow; } );
+        
+        promise<void> jobStarted;
+        promise<void> release;
+        shared_future<void> released( release.get_future() );
+        atomic<bool> jobFinished(false);
+        scheduler->AddJob( "Slow", chrono::minutes(5), chrono::seconds(0),
+            [&jobStarted, released, &jobFinished]
+        {
+            jobStarted.set_value();
+            released.wait();
+            jobFinished = true;
+        } );
+        
+        THEN("shutdown waits for the job in progress")
+        {
+            virtualNow += chrono::minutes(5);
+            REQUIRE( scheduler->RunDueJobs() == 1 );
+            jobStarted.get_future().wait();
+            
+            future<void> shutdownDone = async( launch::async, [scheduler] { scheduler->Shutdown(); } );
+            REQUIRE( shutdownDone.wait_for( chrono::milliseconds(100) ) == future_status::timeout );
+            
+            release.set_value();
+            shutdownDone.get();
+            REQUIRE( jobFinished );
+            REQUIRE( scheduler->GetStats("Slow").runCount == 1 );
+            
+            virtualNow += chrono::minutes(5);
+            REQUIRE( scheduler->RunDueJobs() == 0 );
+        }
+    }
+}
+
+
+
+SCENARIO("Dispatch worker pool", "[network]")
+{
+    GIVEN("A worker pool with a single thread and a short queue")
+    {
+        DispatchWorkerPool workerPool("Test", 1, 1);
+        
+        THEN("tasks over the queue limit are refused")
+        {
+            promise<void> release;
+            shared_future<void> released( release.get_future() );
+            promise<void> firstStarted;
+            promise<void> secondFinished;
+            
+            REQUIRE( workerPool.TryPost( [&firstStarted, released]
+                { firstStarted.set_value(); released.wait(); } ) );
+            firstStarted.get_future().wait();
+            
+            REQUIRE( workerPool.TryPost( [&secondFinished] { secondFinished.set_value(); } ) );
+            REQUIRE( workerPool.stats().queueDepth == 1 );
+            REQUIRE( ! workerPool.TryPost( [] {} ) );
+            
+            release.set_value();
+            secondFinished.get_future().wait();
+            
+            DispatchQueueStats stats = workerPool.stats();
+            REQUIRE( stats.queueDepth == 0 );
+            REQUIRE( stats.maxQueueDepth == 1 );
+            REQUIRE( stats.executedCount == 2 );
+            REQUIRE( stats.rejectedCount == 1 );
+            REQUIRE( stats.maxWaitTime > chrono::steady_clock::duration::zero() );
+        }
+        
+        THEN("queued tasks are still executed after shutdown")
+        {
+            promise<void> release;
+            shared_future<void> released( release.get_future() );
+            promise<void> firstStarted;
+            promise<void> queuedFinished;
+            
+            REQUIRE( workerPool.TryPost( [&firstStarted, released]
+                { firstStarted.set_value(); released.wait(); } ) );
+            firstStarted.get_future().wait();
+            REQUIRE( workerPool.TryPost( [&queuedFinished] { queuedFinished.set_value(); } ) );
+            
+            workerPool.Shutdown();
+            REQUIRE( ! workerPool.TryPost( [] {} ) );
+            
+            release.set_value();
+            REQUIRE( queuedFinished.get_future().wait_for( chrono::seconds(5) ) == future_status::ready );
+            REQUIRE( workerPool.stats().executedCount == 2 );
+        }
+    }
+}
+
+
+
+// Serves node count requests slowly and everything else immediately
+class SlowNodeCountFastRestDispatcher : public IBlockingRequestDispatcher
+{
+public:
+    
+    unique_ptr<iop::locnet::Response> Dispatch(unique_ptr<iop::locnet::Request> &&request) override
+    {
+        unique_ptr<iop::locnet::Response> response( new iop::locnet::Response() );
+        if ( request->remote_node().has_get_node_count() )
+        {
+            this_thread::sleep_for( chrono::milliseconds(300) );
+            response->mutable_remote_node()->mutable_get_node_count()->set_node_count(42);
+        }
+        else { response->mutable_remote_node()->mutable_get_node_info(); }
+        return response;
+    }
+};
+
+
+SCENARIO("Pipelined request processing", "[network]")
+{
+    GIVEN("A request pipeline allowing two requests in flight")
+    {
+        RequestPipeline pipeline(2);
+        
+        THEN("reading is paused at the limit and resumed when a request finishes")
+        {
+            REQUIRE( pipeline.RequestStarted() );
+            REQUIRE( ! pipeline.RequestStarted() );
+            REQUIRE( pipeline.inFlightCount() == 2 );
+            REQUIRE( pipeline.RequestFinished(true) );
+            REQUIRE( ! pipeline.RequestFinished(true) );
+            REQUIRE( pipeline.inFlightCount() == 0 );
+            
+            REQUIRE( pipeline.RequestStarted() );
+            REQUIRE( ! pipeline.RequestStarted() );
+            REQUIRE( ! pipeline.RequestFinished(false) );
+            REQUIRE( pipeline.IsFailed() );
+        }
+    }
+    
+    GIVEN("A server reading ahead requests of a connection")
+    {
+        shared_ptr<IBlockingRequestDispatcherFactory> dispatcherFactory(
+            new StaticBlockingDispatcherFactory( shared_ptr<IBlockingRequestDispatcher>(
+                new SlowNodeCountFastRestDispatcher() ) ) );
+        const TcpPort port = 16995;
+        shared_ptr<DispatchingTcpServer> tcpServer = DispatchingTcpServer::Create(port, dispatcherFactory);
+        shared_ptr<DispatchWorkerPool> workerPool( new DispatchWorkerPool("NodeRequests", 2, 16) );
+        tcpServer->workerPool(workerPool);
+        tcpServer->pipelinedRequestCount(4);
+        tcpServer->StartListening();
+        
+        thread reactorMainThread( [] { reactorLoop("ReactorMain"); } );
+        scope_exit stopReactor( [&reactorMainThread, workerPool]
+        {
+            Reactor::Instance().Shutdown();
+            reactorMainThread.join();
+            Reactor::Instance().AsioService().reset();
+            workerPool->Shutdown();
+        } );
+        
+        THEN("responses are sent as soon as they are ready")
+        {
+            shared_ptr<IProtoBufChannel> clientChannel( new AsyncProtoBufTcpChannel(
+                NetworkEndpoint("127.0.0.1", port) ) );
+            
+            unique_ptr<iop::locnet::Message> slowRequest( new iop::locnet::Message() );
+            slowRequest->set_id(1);
+            slowRequest->mutable_request()->mutable_remote_node()->mutable_get_node_count();
+            slowRequest->mutable_request()->set_version({1,0,0});
+            clientChannel->SendMessage( move(slowRequest), [] {} );
+            
+            unique_ptr<iop::locnet::Message> fastRequest( new iop::locnet::Message() );
+            fastRequest->set_id(2);
+            fastRequest->mutable_request()->mutable_remote_node()->mutable_get_node_info();
+            fastRequest->mutable_request()->set_version({1,0,0});
+            clientChannel->SendMessage( move(fastRequest), [] {} );
+            
+            unique_ptr<iop::locnet::Message> firstResponse( clientChannel->ReceiveMessage(asio::use_future).get() );
+            unique_ptr<iop::locnet::Message> secondResponse( clientChannel->ReceiveMessage(asio::use_future).get() );
+            REQUIRE( firstResponse );
+            REQUIRE( firstResponse->id() == 2 );
+            REQUIRE( secondResponse );
+            REQUIRE( secondResponse->id() == 1 );
+            REQUIRE( secondResponse->response().remote_node().get_node_count().node_count() == 42 );
+        }
+        
+        THEN("blocking calls sharing a peer link do not wait for each other")
+        {
+            shared_ptr<TestConfig> config( new TestConfig(TestData::NodeBudapest) );
+            shared_ptr<TcpNodeConnectionFactory> connectionFactory( new TcpNodeConnectionFactory(config) );
+            shared_ptr<PeerLinkManager> peerLinks( new PeerLinkManager(
+                connectionFactory, shared_ptr<PeerFailureCache>(), 1, chrono::minutes(10) ) );
+            shared_ptr<INodeMethods> proxy = peerLinks->ConnectTo( NetworkEndpoint("127.0.0.1", port) );
+            
+            auto startTime = chrono::steady_clock::now();
+            future<size_t> firstCount  = async( launch::async, [proxy] { return proxy->GetNodeCount(); } );
+            future<size_t> secondCount = async( launch::async, [proxy] { return proxy->GetNodeCount(); } );
+            REQUIRE( firstCount.get() == 42 );
+            REQUIRE( secondCount.get() == 42 );
+            // Each request takes 300ms on the server, served by two workers in parallel
+            REQUIRE( chrono::steady_clock::now() - startTime < chrono::milliseconds(550) );
+            REQUIRE( peerLinks->linkCount() == 1 );
+        }
+    }
+}
+
+
+
+SCENARIO("Connection limits and expiry", "[network]")
+{
+    GIVEN("A server with strict connection policy")
+    {
+        shared_ptr<TestConfig> config( new TestConfig(TestData::NodeBudapest) );
+        shared_ptr<IBlockingRequestDispatcherFactory> dispatcherFactory(
+            new StaticBlockingDispatcherFactory( shared_ptr<IBlockingRequestDispatcher>(
+                new SlowNodeCountFastRestDispatcher() ) ) );
+        const TcpPort port = 16996;
+        ConnectionPolicy policy;
+        policy.idleTimeout = chrono::milliseconds(300);
+        policy.readTimeout = chrono::milliseconds(200);
+        policy.maxConnectionsPerAddress = 1;
+        shared_ptr<DispatchingTcpServer> tcpServer = DispatchingTcpServer::Create(port, dispatcherFactory);
+        tcpServer->connectionPolicy(policy);
+        tcpServer->StartListening();
+        
+        thread reactorMainThread( [] { reactorLoop("ReactorMain"); } );
+        scope_exit stopReactor( [&reactorMainThread]
+        {
+            Reactor::Instance().Shutdown();
+            reactorMainThread.join();
+            Reactor::Instance().AsioService().reset();
+        } );
+        
+        THEN("idle connections are closed and the limit per address is enforced")
+        {
+            shared_ptr<IProtoBufChannel> firstChannel( new AsyncProtoBufTcpChannel(
+                NetworkEndpoint("127.0.0.1", port) ) );
+            unique_ptr<iop::locnet::Message> request( new iop::locnet::Message() );
+            request->mutable_request()->mutable_remote_node()->mutable_get_node_info();
+            request->mutable_request()->set_version({1,0,0});
+            firstChannel->SendMessage( move(request), asio::use_future ).get();
+            REQUIRE( firstChannel->ReceiveMessage(asio::use_future).get() );
+            
+            shared_ptr<IProtoBufChannel> secondChannel( new AsyncProtoBufTcpChannel(
+                NetworkEndpoint("127.0.0.1", port) ) );
+            REQUIRE( ! secondChannel->ReceiveMessage(asio::use_future).get() );
+            
+            // Server closes the first connection after being idle
+            REQUIRE( ! firstChannel->ReceiveMessage(asio::use_future).get() );
+            
+            ConnectionStats stats = tcpServer->connectionStats();
+            REQUIRE( stats.rejectedCount == 1 );
+            REQUIRE( stats.idleEvictedCount == 1 );
+        }
+        
+        THEN("connections sending partial messages are closed")
+        {
+            shared_ptr<tcp::socket> socket( new tcp::socket( Reactor::Instance().AsioService() ) );
+            socket->connect( tcp::endpoint( address::from_string("127.0.0.1"), port ) );
+            const char partialHeader[] = { MessageFraming::HeaderFieldTag, 100 };
+            asio::write( *socket, asio::buffer(partialHeader) );
+            
+            shared_ptr<IProtoBufChannel> channel( new AsyncProtoBufTcpChannel(socket) );
+            REQUIRE( ! channel->ReceiveMessage(asio::use_future).get() );
+            
+            ConnectionStats stats = tcpServer->connectionStats();
+            REQUIRE( stats.readTimeoutEvictedCount == 1 );
+            REQUIRE( stats.idleEvictedCount == 0 );
+        }
+    }
+}
+
+
+
+// Channel that is unable to send anything
+class FailingSendChannel : public IProtoBufChannel
+{
+    SessionId _id = "FailingSendChannel";
+    Address   _address;
+    IpAddress _ipAddress;
+    
+public:
+    
+    const SessionId& id() const override { return _id; }
+    const Address& remoteAddress() const override { return _address; }
+    const IpAddress& remoteIpAddress() const override { return _ipAddress; }
+    
+    void ReceiveMessage( function<ReceivedMessageCallback> ) override {}
+    future< unique_ptr<iop::locnet::Message> > ReceiveMessage(asio::use_future_t<>) override
+        { return promise< unique_ptr<iop::locnet::Message> >().get_future(); }
+    
+    void SendMessage( unique_ptr<iop::locnet::Message> &&, function<SentMessageCallback> ) override
+        { throw LocationNetworkError(ErrorCode::ERROR_CONNECTION, "Channel is broken"); }
+    future<void> SendMessage(unique_ptr<iop::locnet::Message> &&, asio::use_future_t<>) override
+        { throw LocationNetworkError(ErrorCode::ERROR_CONNECTION, "Channel is broken"); }
+    void SendMessage( const iop::locnet::Message &, const SplicedResponseFields &, function<SentMessageCallback> ) override
+        { throw LocationNetworkError(ErrorCode::ERROR_CONNECTION, "Channel is broken"); }
+    
+    size_t sendQueueDepth() const override { return 0; }
+    void WhenSendQueueReady( function<void()> callback ) override { callback(); }
+    void KeepAlive() override {}
+};
+
+
+
+SCENARIO("Request deadlines", "[network]")
+{
+    GIVEN("A session to a server that is slow to answer some requests")
+    {
+        shared_ptr<IBlockingRequestDispatcherFactory> dispatcherFactory(
+            new StaticBlockingDispatcherFactory( shared_ptr<IBlockingRequestDispatcher>(
+                new SlowNodeCountFastRestDispatcher() ) ) );
+        const TcpPort port = 16997;
+        shared_ptr<DispatchingTcpServer> tcpServer = DispatchingTcpServer::Create(port, dispatcherFactory);
+        shared_ptr<DispatchWorkerPool> workerPool( new DispatchWorkerPool("NodeRequests", 2, 16) );
+        tcpServer->workerPool(workerPool);
+        tcpServer->StartListening();
+        
+        thread reactorMainThread( [] { reactorLoop("ReactorMain"); } );
+        scope_exit stopReactor( [&reactorMainThread, workerPool]
+        {
+            Reactor::Instance().Shutdown();
+            reactorMainThread.join();
+            workerPool->Shutdown();
+            Reactor::Instance().AsioService().reset();
+        } );
+        
+        shared_ptr<IProtoBufChannel> channel( new AsyncProtoBufTcpChannel(
+            NetworkEndpoint("127.0.0.1", port) ) );
+        shared_ptr<ProtoBufClientSession> session( ProtoBufClientSession::Create(channel) );
+        session->StartMessageLoop();
+        
+        auto createRequest = [] (bool slow)
+        {
+            unique_ptr<iop::locnet::Message> request( new iop::locnet::Message() );
+            request->mutable_request()->set_version({1,0,0});
+            if (slow)
+                { request->mutable_request()->mutable_remote_node()->mutable_get_node_count(); }
+            else { request->mutable_request()->mutable_remote_node()->mutable_get_node_info(); }
+            return request;
+        };
+        
+        THEN("expired requests fail without waiting and late responses are dropped")
+        {
+            auto expiring = session->SendRequest( createRequest(true), chrono::milliseconds(50) );
+            ErrorCode expiryError = ErrorCode::ERROR_INTERNAL;
+            try { expiring.get(); }
+            catch (LocationNetworkError &ex) { expiryError = ex.code(); }
+            REQUIRE( expiryError == ErrorCode::ERROR_TIMEOUT );
+            REQUIRE( session->pendingRequestCount() == 0 );
+            
+            // Late response of the expired request arrives first, must not break the session
+            auto response = session->SendRequest( createRequest(false), chrono::seconds(5) ).get();
+            REQUIRE( response );
+            REQUIRE( response->remote_node().has_get_node_info() );
+            REQUIRE( session->IsAlive() );
+        }
+        
+        THEN("pending requests can be cancelled")
+        {
+            bool failed = false;
+            ProtoBufClientSession::RequestId requestId = session->SendRequest( createRequest(true),
+                ProtoBufClientSession::Duration::zero(),
+                [&failed] (unique_ptr<iop::locnet::Response> &&response, exception_ptr error)
+                    { failed = ! response && error; } );
+            REQUIRE( session->CancelRequest(requestId) );
+            REQUIRE( failed );
+            REQUIRE( session->pendingRequestCount() == 0 );
+            REQUIRE( ! session->CancelRequest(requestId) );
+        }
+        
+        THEN("requests that cannot be sent are not left pending")
+        {
+            shared_ptr<ProtoBufClientSession> brokenSession( ProtoBufClientSession::Create(
+                shared_ptr<IProtoBufChannel>( new FailingSendChannel() ) ) );
+            bool handlerCalled = false;
+            REQUIRE_THROWS( brokenSession->SendRequest( createRequest(false), chrono::seconds(5),
+                [&handlerCalled] (unique_ptr<iop::locnet::Response> &&, exception_ptr)
+                    { handlerCalled = true; } ) );
+            REQUIRE( brokenSession->pendingRequestCount() == 0 );
+            REQUIRE( ! handlerCalled );
+        }
+    }
+}
+
+
+
+SCENARIO("Opening sessions with a single reactor thread", "[network]")
+{
+    GIVEN("A server and a connection factory sharing the only reactor thread")
+    {
+        shared_ptr<IBlockingRequestDispatcherFactory> dispatcherFactory(
+            new StaticBlockingDispatcherFactory( shared_ptr<IBlockingRequestDispatcher>(
+                new SlowNodeCountFastRestDispatcher() ) ) );
+        const TcpPort port = 16998;
+        shared_ptr<DispatchingTcpServer> tcpServer = DispatchingTcpServer::Create(port, dispatcherFactory);
+        shared_ptr<DispatchWorkerPool> workerPool( new DispatchWorkerPool("NodeRequests", 2, 16) );
+        tcpServer->workerPool(workerPool);
+        tcpServer->StartListening();
+        
+        thread reactorMainThread( [] { reactorLoop("ReactorMain"); } );
+        scope_exit stopReactor( [&reactorMainThread, workerPool]
+        {
+            Reactor::Instance().Shutdown();
+            reactorMainThread.join();
+            workerPool->Shutdown();
+            Reactor::Instance().AsioService().reset();
+        } );
+        
+        shared_ptr<TcpNodeConnectionFactory> connectionFactory(
+            new TcpNodeConnectionFactory( shared_ptr<TestConfig>( new TestConfig() ) ) );
+        NetworkEndpoint endpoint("127.0.0.1", port);
+        
+        THEN("connecting from the reactor thread never blocks it")
+        {
+            promise<bool> blockingRefused;
+            promise< shared_ptr<IAsyncNodeMethods> > asyncProxy;
+            promise< future<size_t> > nodeCount;
+            Reactor::Instance().AsioService().post( [&]
+            {
+                try
+                {
+                    connectionFactory->ConnectTo(endpoint);
+                    blockingRefused.set_value(false);
+                }
+                catch (LocationNetworkError &ex)
+                    { blockingRefused.set_value( ex.code() == ErrorCode::ERROR_BAD_STATE ); }
+                
+                // The session is still being opened by this very thread, request is queued until then
+                shared_ptr<IAsyncNodeMethods> proxy = connectionFactory->ConnectToAsync(endpoint);
+                nodeCount.set_value( proxy->GetNodeCount() );
+                asyncProxy.set_value(proxy);
+            } );
+            
+            future<bool> refused = blockingRefused.get_future();
+            REQUIRE( refused.wait_for( chrono::seconds(1) ) == future_status::ready );
+            REQUIRE( refused.get() );
+            
+            future<size_t> count = nodeCount.get_future().get();
+            REQUIRE( count.wait_for( chrono::seconds(5) ) == future_status::ready );
+            REQUIRE( count.get() == 42 );
+            asyncProxy.get_future().get();
+        }
+    }
+}
+
+
+
+SCENARIO("Backing off from unreachable peers", "[network]")
+{
+    GIVEN("A peer failure cache driven by a virtual clock")
+    {
+        PeerFailureCache::TimePoint virtualNow = chrono::steady_clock::now();
+        PeerFailureCache failureCache( chrono::seconds(10), chrono::seconds(60),
+            [&virtualNow] { return virtualNow; } );
+        NetworkEndpoint deadPeer("127.0.0.1", 6666);
+        NetworkEndpoint livePeer("127.0.0.1", 7777);
+        
+        THEN("unknown peers are always tried")
+        {
+            REQUIRE( failureCache.TryAttempt(livePeer) );
+            REQUIRE( failureCache.TryAttempt(livePeer) );
+            REQUIRE( failureCache.failureCount(livePeer) == 0 );
+        }
+        
+        THEN("failed peers are refused until a single trial is let through after the backoff")
+        {
+            failureCache.RecordFailure(deadPeer);
+            REQUIRE( failureCache.failureCount(deadPeer) == 1 );
+            REQUIRE( ! failureCache.TryAttempt(deadPeer) );
+            REQUIRE( failureCache.TryAttempt(livePeer) );
+            
+            virtualNow += chrono::seconds(16);
+            REQUIRE( failureCache.TryAttempt(deadPeer) );
+            REQUIRE( ! failureCache.TryAttempt(deadPeer) );
+            
+            // Failing trial doubles the backoff
+            failureCache.RecordFailure(deadPeer);
+            REQUIRE( failureCache.failureCount(deadPeer) == 2 );
+            virtualNow += chrono::seconds(16);
+            REQUIRE( ! failureCache.TryAttempt(deadPeer) );
+            virtualNow += chrono::seconds(16);
+            REQUIRE( failureCache.TryAttempt(deadPeer) );
+            
+            // Successful trial resets the peer
+            failureCache.RecordSuccess(deadPeer);
+            REQUIRE( failureCache.failureCount(deadPeer) == 0 );
+            REQUIRE( failureCache.TryAttempt(deadPeer) );
+        }
+        
+        THEN("backoff is limited")
+        {
+            for (size_t i = 0; i < 10; ++i)
+                { failureCache.RecordFailure(deadPeer); }
+            virtualNow += chrono::seconds(91);
+            REQUIRE( failureCache.TryAttempt(deadPeer) );
+        }
+    }
+    
+    GIVEN("A peer link to a remote node")
+    {
+        shared_ptr<PeerFailureCache> failureCache( new PeerFailureCache( chrono::seconds(10), chrono::seconds(60) ) );
+        NetworkEndpoint peer("127.0.0.1", 6666);
+        shared_ptr<ProtoBufClientSession> session( ProtoBufClientSession::Create(
+            shared_ptr<IProtoBufChannel>( new FailingSendChannel() ) ) );
+        TcpNodeConnectionFactory connectionFactory( shared_ptr<TestConfig>( new TestConfig() ) );
+        PeerLink link( peer, session, connectionFactory.CreateProxy(session), failureCache );
+        
+        auto failCall = [&link] (ErrorCode code)
+        {
+            try { link.Call( [code] (INodeMethods&) { throw LocationNetworkError(code, "Call failed"); } ); }
+            catch (LocationNetworkError &) { return true; }
+            return false;
+        };
+        
+        THEN("errors decoded from responses are passed on without penalty")
+        {
+            REQUIRE( failCall(ErrorCode::ERROR_BAD_RESPONSE) );
+            REQUIRE( failCall(ErrorCode::ERROR_INVALID_VALUE) );
+            REQUIRE( link.IsHealthy() );
+            REQUIRE( failureCache->failureCount(peer) == 0 );
+        }
+        
+        THEN("expired deadlines break the link")
+        {
+            REQUIRE( failCall(ErrorCode::ERROR_TIMEOUT) );
+            REQUIRE( ! link.IsHealthy() );
+            REQUIRE( failureCache->failureCount(peer) == 1 );
+        }
+        
+        THEN("connection failures break the link")
+        {
+            REQUIRE( failCall(ErrorCode::ERROR_CONNECTION) );
+            REQUIRE( ! link.IsHealthy() );
+            REQUIRE( failureCache->failureCount(peer) == 1 );
+        }
+    }
+}
+
+
+
+// Simulates a request handler that blocks on the database or network for a while
+class SlowNodeCountDispatcher : public IBlockingRequestDispatcher
+{
+public:
+    
+    unique_ptr<iop::locnet::Response> Dispatch(unique_ptr<iop::locnet::Request> &&) override
+    {
+        this_thread::sleep_for( chrono::milliseconds(2) );
+        unique_ptr<iop::locnet::Response> response( new iop::locnet::Response() );
+        response->mutable_remote_node()->mutable_get_node_count()->set_node_count(42);
+        return response;
+    }
+};
+
+
+SCENARIO("Request throughput with multiple reactor threads", "[.][load]")
+{
+    GIVEN("A server with a blocking request handler and several concurrent clients")
+    {
+        shared_ptr<TestConfig> config( new TestConfig(TestData::NodeBudapest) );
+        shared_ptr<IBlockingRequestDispatcherFactory> dispatcherFactory(
+            new StaticBlockingDispatcherFactory( shared_ptr<IBlockingRequestDispatcher>(
+                new SlowNodeCountDispatcher() ) ) );
+        
+        const size_t clientCount = 8;
+        const size_t requestsPerClient = 100;
+        TcpPort port = 16980;
+        
+        THEN("requests per second scale with the number of reactor threads")
+        {
+            double singleThreadRate = 0;
+            for (size_t threadCount : { 1, 2, 4 })
+            {
+                Reactor::Instance().AsioService().reset();
+                shared_ptr<DispatchingTcpServer> tcpServer = DispatchingTcpServer::Create(++port, dispatcherFactory);
+                tcpServer->StartListening();
+                
+                vector<thread> reactorThreads;
+                for (size_t threadIdx = 0; threadIdx < threadCount; ++threadIdx)
+                    { reactorThreads.emplace_back( [] { Reactor::Instance().AsioService().run(); } ); }
+                
+                auto startTime = chrono::steady_clock::now();
+                vector<thread> clientThreads;
+                for (size_t clientIdx = 0; clientIdx < clientCount; ++clientIdx)
+                {
+                    clientThreads.emplace_back( [config, port, requestsPerClient]
+                    {
+                        shared_ptr<IProtoBufChannel> clientChannel( new AsyncProtoBufTcpChannel(
+                            NetworkEndpoint("127.0.0.1", port) ) );
+                        shared_ptr<ProtoBufClientSession> clientSession( ProtoBufClientSession::Create(clientChannel) );
+                        clientSession->StartMessageLoop();
+                        
+                        shared_ptr<IBlockingRequestDispatcher> netDispatcher( new NetworkDispatcher(config, clientSession) );
+                        NodeMethodsProtoBufClient client(netDispatcher, {});
+                        for (size_t requestIdx = 0; requestIdx < requestsPerClient; ++requestIdx)
+                            { client.GetNodeCount(); }
+                    } );
+                }
+                for (auto &clientThread : clientThreads)
+                    { clientThread.join(); }
+                chrono::duration<double> elapsed = chrono::steady_clock::now() - startTime;
+                
+                Reactor::Instance().Shutdown();
+                for (auto &reactorThread : reactorThreads)
+                    { reactorThread.join(); }
+                
+                double requestsPerSecond = clientCount * requestsPerClient / elapsed.count();
+                cout << threadCount << " reactor thread(s): " << requestsPerSecond << " requests/sec" << endl;
+                if (threadCount == 1)
+                    { singleThreadRate = requestsPerSecond; }
+                else { REQUIRE( requestsPerSecond > singleThreadRate ); }
+            }
+            Reactor::Instance().AsioService().reset();
+        }
+    }
+}
+
+
+
+SCENARIO("Thread-per-core reactor mode", "[network]")
+{
+    GIVEN("A reactor pool with acceptors sharing the same port on every core")
+    {
+        shared_ptr<TestConfig> config( new TestConfig(TestData::NodeBudapest) );
+        shared_ptr<IBlockingRequestDispatcherFactory> dispatcherFactory(
+            new StaticBlockingDispatcherFactory( shared_ptr<IBlockingRequestDispatcher>(
+                new SlowNodeCountDispatcher() ) ) );
+        
+        const TcpPort port = 16990;
+        ReactorPool corePool(2);
+        ConnectionPolicy policy;
+        policy.maxConnections = 100;
+        shared_ptr<ConnectionManager> connectionManager( new ConnectionManager(policy) );
+        vector< shared_ptr<DispatchingTcpServer> > servers;
+        for (size_t coreIndex = 0; coreIndex < corePool.coreCount(); ++coreIndex)
+        {
+            servers.push_back( DispatchingTcpServer::Create(
+                corePool.AsioService(coreIndex), port, dispatcherFactory ) );
+            servers.back()->connectionManager(connectionManager);
+            servers.back()->StartListening();
+        }
+        corePool.Start();
+        
+        THEN("tasks posted to a core are run by its own thread")
+        {
+            vector< promise<thread::id> > threadIds(2);
+            for (size_t coreIndex = 0; coreIndex < corePool.coreCount(); ++coreIndex)
+            {
+                corePool.Post( coreIndex, [&threadIds, coreIndex]
+                    { threadIds[coreIndex].set_value( this_thread::get_id() ); } );
+            }
+            thread::id firstCoreThread  = threadIds[0].get_future().get();
+            thread::id secondCoreThread = threadIds[1].get_future().get();
+            REQUIRE( firstCoreThread != secondCoreThread );
+            REQUIRE( firstCoreThread != this_thread::get_id() );
+        }
+        
+        THEN("core threads are known to be reactor threads")
+        {
+            promise<bool> onReactorThread;
+            corePool.Post( 0, [&onReactorThread]
+                { onReactorThread.set_value( Reactor::IsReactorThread() ); } );
+            REQUIRE( onReactorThread.get_future().get() );
+            REQUIRE( ! Reactor::IsReactorThread() );
+        }
+        
+        THEN("clients are served on the shared port")
+        {
+            Reactor::Instance().AsioService().reset();
+            asio::io_service::work keepRunning( Reactor::Instance().AsioService() );
+            thread clientReactorThread( [] { Reactor::Instance().AsioService().run(); } );
+            
+            vector< shared_ptr<ProtoBufClientSession> > clientSessions;
+            for (size_t clientIdx = 0; clientIdx < 4; ++clientIdx)
+            {
+                shared_ptr<IProtoBufChannel> clientChannel( new AsyncProtoBufTcpChannel(
+                    NetworkEndpoint("127.0.0.1", port) ) );
+                shared_ptr<ProtoBufClientSession> clientSession( ProtoBufClientSession::Create(clientChannel) );
+                clientSession->StartMessageLoop();
+                clientSessions.push_back(clientSession);
+                
+                shared_ptr<IBlockingRequestDispatcher> netDispatcher( new NetworkDispatcher(config, clientSession) );
+                NodeMethodsProtoBufClient client(netDispatcher, {});
+                REQUIRE( client.GetNodeCount() == 42 );
+            }
+            // Connections accepted by any core are counted against the same limits
+            REQUIRE( connectionManager->stats().openCount == 4 );
+            
+            clientSessions.clear();
+            for (size_t waitCount = 0; connectionManager->stats().openCount > 0 && waitCount < 50; ++waitCount)
+                { this_thread::sleep_for( chrono::milliseconds(100) ); }
+            REQUIRE( connectionManager->stats().openCount == 0 );
+            
+            Reactor::Instance().Shutdown();
+            clientReactorThread.join();
+            Reactor::Instance().AsioService().reset();
+        }
+        
+        corePool.Shutdown();
+        corePool.Join();
+    }
+}
@@ -13,17 +13,17 @@ GpsLocation TestData::NewYork(40.741895,-73.989308);
 GpsLocation TestData::CapeTown(-33.9248685,18.4240553);
 
 
-NodeInfo TestData::NodeBudapest( "BudapestId", Budapest,
+NodeInfo TestData::NodeBudapest( NodeId("BudapestId"), Budapest,
     NodeContact( "127.0.0.1", 6371, 16371), {} );
-NodeInfo TestData::NodeKecskemet( "KecskemetId", Kecskemet,
+NodeInfo TestData::NodeKecskemet( NodeId("KecskemetId"), Kecskemet,
     NodeContact( "127.0.0.1", 6372, 16372), {} );
-NodeInfo TestData::NodeWien( "WienId", Wien,
+NodeInfo TestData::NodeWien( NodeId("WienId"), Wien,
     NodeContact( "127.0.0.1", 6373, 16373), {} );
-NodeInfo TestData::NodeLondon( "LondonId", London,
+NodeInfo TestData::NodeLondon( NodeId("LondonId"), London,
     NodeContact( "127.0.0.1", 6374, 16374), {} );
-NodeInfo TestData::NodeNewYork( "NewYorkId", NewYork,
+NodeInfo TestData::NodeNewYork( NodeId("NewYorkId"), NewYork,
     NodeContact( "127.0.0.1", 6375, 16375), {} );
-NodeInfo TestData::NodeCapeTown( "CapeTownId", CapeTown,
+NodeInfo TestData::NodeCapeTown( NodeId("CapeTownId"), CapeTown,
     NodeContact( "127.0.0.1", 6376, 16376), {} );
 
 NodeDbEntry TestData::EntryBudapest( NodeBudapest,
@@ -67,7 +67,7 @@ random_device InMemorySpatialDatabase::_randomDevice;
 
 InMemorySpatialDatabase::InMemorySpatialDatabase(const NodeInfo& myNodeInfo,
         shared_ptr<TestClock> testClock, chrono::duration<int64_t> entryExpirationPeriod) :
-    _myNodeInfo(myNodeInfo), _testClock(testClock), _entryExpirationPeriod(entryExpirationPeriod)
+    _myNodeInfo( WithNewEncoding(myNodeInfo) ), _testClock(testClock), _entryExpirationPeriod(entryExpirationPeriod)
 {
     Store( NodeDbEntry(myNodeInfo, NodeRelationType::Self, NodeContactRoleType::Acceptor), false );
 }
@@ -88,11 +88,13 @@ void InMemorySpatialDatabase::Store(const NodeDbEntry &node, bool expires)
     
     chrono::system_clock::time_point expiresAt = expires ?
          _testClock->now() + _entryExpirationPeriod : chrono::system_clock::time_point::max();
-    _nodes.emplace( node.id(), InMemDbEntry(node, expiresAt) );
+    // Copies handed out share the encoding of the entry until it is updated like in the real database
+    NodeDbEntry encodedNode( WithNewEncoding(node), node.relationType(), node.roleType() );
+    _nodes.emplace( node.id(), InMemDbEntry(encodedNode, expiresAt) );
 }
 
 
-shared_ptr<NodeDbEntry> InMemorySpatialDatabase::Load(const string &nodeId) const
+shared_ptr<NodeDbEntry> InMemorySpatialDatabase::Load(const NodeId &nodeId) const
 {
     auto it = _nodes.find(nodeId);
     if ( it == _nodes.end() ) {
@@ -113,11 +115,15 @@ void InMemorySpatialDatabase::Update(const NodeDbEntry &node, bool expires)
     
     chrono::system_clock::time_point expiresAt = expires ?
         _testClock->now() + _entryExpirationPeriod : chrono::system_clock::time_point::max();
-    it->second = InMemDbEntry(node, expiresAt);
+    NodeDbEntry encodedNode( WithNewEncoding(node), node.relationType(), node.roleType() );
+    it->second = InMemDbEntry(encodedNode, expiresAt);
+    
+    if ( node.relationType() == NodeRelationType::Self )
+        { _myNodeInfo = WithNewEncoding(node); }
 }
 
 
-void InMemorySpatialDatabase::Remove(const string &nodeId)
+void InMemorySpatialDatabase::Remove(const NodeId &nodeId)
 {
     auto it = _nodes.find(nodeId);
     if ( it == _nodes.end() ) {
@@ -313,15 +319,20 @@ chrono::duration<uint32_t> TestConfig::DbExpirationPeriod( chrono::hours(24) );
 
 TestConfig::TestConfig(const NodeInfo &aNodeInfo) : _nodeInfo(aNodeInfo) {}
 TestConfig::TestConfig() :
-    _nodeInfo("TestNodeId", GpsLocation(0,0), NodeContact("Im.a.client", 0, 0), {} ) {}
+    _nodeInfo(NodeId("TestNodeId"), GpsLocation(0,0), NodeContact(IpAddress(), 0, 0), {} ) {}
 
 bool TestConfig::isTestMode() const             { return true; }
 const NodeInfo& TestConfig::myNodeInfo() const  { return _nodeInfo; }
 const NetworkEndpoint& TestConfig::localServiceEndpoint() const { return _localEndpoint; }
 const std::string& TestConfig::logPath() const  { return _logPath; }
+const std::string& TestConfig::diagnostics() const  { return _diagnostics; }
 const std::string& TestConfig::dbPath() const   { return _dbPath; }
 
 size_t TestConfig::neighbourhoodTargetSize() const  { return _neighbourhoodTargetSize; }
+size_t TestConfig::reactorThreadCount() const       { return _reactorThreadCount; }
+size_t TestConfig::reactorCoreCount() const         { return _reactorCoreCount; }
+size_t TestConfig::dispatchWorkerCount() const      { return _dispatchWorkerCount; }
+size_t TestConfig::pipelinedRequestCount() const    { return _pipelinedRequestCount; }
 const std::vector<NetworkEndpoint>& TestConfig::seedNodes() const           { return _seedNodes; }
 std::chrono::duration<uint32_t> TestConfig::requestExpirationPeriod() const { return chrono::seconds(60); }
 std::chrono::duration<uint32_t> TestConfig::dbMaintenancePeriod() const     { return chrono::hours(7); }
@@ -142,8 +142,13 @@ struct TestConfig : public Config
     NodeInfo        _nodeInfo;
     NetworkEndpoint _localEndpoint = NetworkEndpoint("",0);
     std::string     _logPath;
+    std::string     _diagnostics;
     std::string     _dbPath;
     size_t          _neighbourhoodTargetSize = 5;
+    size_t          _reactorThreadCount = 1;
+    size_t          _reactorCoreCount = 0;
+    size_t          _dispatchWorkerCount = 2;
+    size_t          _pipelinedRequestCount = 1;
     std::vector<NetworkEndpoint> _seedNodes;
         
     
@@ -154,11 +159,16 @@ struct TestConfig : public Config
     const NetworkEndpoint& localServiceEndpoint() const override;
     
     const std::string& logPath() const override;
+    const std::string& diagnostics() const override;
     const std::string& dbPath() const override;
     
     bool isTestMode() const override;
     const std::vector<NetworkEndpoint>& seedNodes() const override;
     size_t neighbourhoodTargetSize() const override;
+    size_t reactorThreadCount() const override;
+    size_t reactorCoreCount() const override;
+    size_t dispatchWorkerCount() const override;
+    size_t pipelinedRequestCount() const override;
     
     std::chrono::duration<uint32_t> requestExpirationPeriod() const override;
     std::chrono::duration<uint32_t> dbMaintenancePeriod() const override;
@@ -167,6 +177,20 @@ struct TestConfig : public Config
 };
 
 
+// Counts heap allocations made by the current thread while an instance is alive.
+// Works with the replaced global operator new of the test executable, defined in test_main.cpp.
+class AllocationCounter
+{
+    size_t _startCount;
+    
+public:
+    
+    AllocationCounter();
+    
+    size_t count() const;
+};
+
+
 } // namespace LocNet
 
 #endif // __LOCNET_TEST_IMPLEMENTATIONS_H__